@@ -0,0 +1,151 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "AVSyncClock.h"
+#include "MUD/threading/ScopeLock.h"
+
+#include <stdlib.h>
+
+#undef LOG_TAG
+#define LOG_TAG "AVSyncClock"
+#include "log.h"
+
+AVSyncClock::AVSyncClock() :
+    mEnabled(getenv("XSTX_AV_SYNC") != NULL),
+    mToleranceUs(DEFAULT_TOLERANCE_MS * 1000),
+    mHaveAudio(false),
+    mAudioDelayUs(0),
+    mLastPlayoutUs(0),
+    mConsecutiveDrops(0),
+    mHeld(0),
+    mDropped(0)
+{
+    const char *tolerance = getenv("XSTX_AV_SYNC_TOLERANCE_MS");
+    if (tolerance != NULL && atoi(tolerance) > 0)
+    {
+        mToleranceUs = (int64_t)atoi(tolerance) * 1000;
+    }
+}
+
+void AVSyncClock::setEnabled(bool enabled)
+{
+    mud::ScopeLock scope(mLock);
+    mEnabled = enabled;
+}
+
+void AVSyncClock::reset()
+{
+    mud::ScopeLock scope(mLock);
+    mHaveAudio = false;
+    mConsecutiveDrops = 0;
+}
+
+void AVSyncClock::audioScheduled(uint64_t timestampUs, uint64_t playoutUs)
+{
+    mud::ScopeLock scope(mLock);
+
+    double delay = (double)(int64_t)(playoutUs - timestampUs);
+    if (!mHaveAudio ||
+        delay - mAudioDelayUs > MAX_DELAY_JUMP_US ||
+        mAudioDelayUs - delay > MAX_DELAY_JUMP_US)
+    {
+        if (mHaveAudio)
+        {
+            LOGV("Audio delay jumped from %.1f to %.1f ms; resynchronizing",
+                 mAudioDelayUs / 1000.0, delay / 1000.0);
+        }
+        mAudioDelayUs = delay;
+        mHaveAudio = true;
+    }
+    else
+    {
+        mAudioDelayUs += (delay - mAudioDelayUs) / 8.0;
+    }
+    mLastPlayoutUs = playoutUs;
+}
+
+bool AVSyncClock::haveAudioLocked(uint64_t nowUs) const
+{
+    return mHaveAudio && nowUs < mLastPlayoutUs + AUDIO_TIMEOUT_US;
+}
+
+AVSyncClock::EDecision AVSyncClock::schedule(uint64_t timestampUs,
+                                             uint64_t nowUs,
+                                             uint64_t &presentAtUs)
+{
+    mud::ScopeLock scope(mLock);
+
+    presentAtUs = nowUs;
+    if (!mEnabled || !haveAudioLocked(nowUs))
+    {
+        return NO_CLOCK;
+    }
+
+    // How long until the audio of this frame is heard
+    int64_t early = (int64_t)timestampUs + (int64_t)mAudioDelayUs -
+                    (int64_t)nowUs;
+
+    if (early < -mToleranceUs && mConsecutiveDrops < MAX_CONSECUTIVE_DROPS)
+    {
+        mConsecutiveDrops++;
+        mDropped++;
+        return DROP;
+    }
+    mConsecutiveDrops = 0;
+
+    if (early > mToleranceUs && early <= MAX_HOLD_US)
+    {
+        presentAtUs = nowUs + (uint64_t)early;
+        mHeld++;
+    }
+    return PRESENT;
+}
+
+void AVSyncClock::framePresented(uint64_t timestampUs, uint64_t nowUs)
+{
+    mud::ScopeLock scope(mLock);
+
+    if (!haveAudioLocked(nowUs))
+    {
+        return;
+    }
+    // Positive when the picture comes after its sound
+    mOffsets.add((double)((int64_t)nowUs - (int64_t)timestampUs) -
+                 mAudioDelayUs);
+}
+
+void AVSyncClock::getStats(Stats &stats, bool reset)
+{
+    mud::ScopeLock scope(mLock);
+
+    stats.mMeasured = mOffsets.count();
+    stats.mOffsetMeanMs = mOffsets.mean() / 1000.0;
+    stats.mOffsetMinMs = mOffsets.minimum() / 1000.0;
+    stats.mOffsetMaxMs = mOffsets.maximum() / 1000.0;
+    stats.mOffsetStddevMs = mOffsets.stddev() / 1000.0;
+    stats.mAudioDelayMs = mHaveAudio ? mAudioDelayUs / 1000.0 : 0.0;
+    stats.mHeld = mHeld;
+    stats.mDropped = mDropped;
+
+    if (reset)
+    {
+        mOffsets.reset();
+        mHeld = 0;
+        mDropped = 0;
+    }
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _included_AVSyncClock_h
+#define _included_AVSyncClock_h
+
+#include <stdint.h>
+#include "MUD/threading/SimpleLock.h"
+
+#include "RunningStats.h"
+
+/**
+ * Keeps video in step with audio by treating the audio playout position
+ * as the master clock.
+ *
+ * The audio renderer reports, for every frame it queues, the local
+ * monotonic time at which the frame's first sample will reach the
+ * speaker. The difference between that time and the frame's stream
+ * timestamp is the audio delay; it is smoothed over frames, so the
+ * coarse buffer levels the renderers see average out. Any stream
+ * timestamp then maps to the local time its audio plays at.
+ *
+ * The video path asks schedule() for each frame before showing it, and
+ * reports framePresented() once it is on screen. The A/V offset is
+ * measured on every presented frame whenever audio is playing, and
+ * collected by getStats(). Holding frames that are early and dropping
+ * frames that are late only happens when the XSTX_AV_SYNC environment
+ * variable is set; XSTX_AV_SYNC_TOLERANCE_MS sets how far video may be
+ * off before that (default 30). Late frames are never dropped two in a
+ * row: dropping only catches up with a passing stall, and video that lags
+ * for good shows up as a steady positive offset instead, which calls for
+ * more audio delay (XSTX_AUDIO_MIN_DELAY_MS).
+ *
+ * All methods are thread safe.
+ */
+class AVSyncClock
+{
+public:
+    /**
+     * What to do with a video frame.
+     */
+    enum EDecision
+    {
+        PRESENT,    ///< Show the frame at the returned time.
+        DROP,       ///< The frame is too far behind the audio.
+        NO_CLOCK    ///< No audio is playing; schedule the frame otherwise.
+    };
+
+    /**
+     * Snapshot of the synchronization statistics.
+     */
+    struct Stats
+    {
+        uint64_t mMeasured;         ///< Presented frames the offset was measured on.
+        double mOffsetMeanMs;       ///< Mean A/V offset; positive if video lags.
+        double mOffsetMinMs;        ///< Most video led the audio by (negative).
+        double mOffsetMaxMs;        ///< Most video lagged the audio by.
+        double mOffsetStddevMs;     ///< Spread of the A/V offset.
+        double mAudioDelayMs;       ///< Current stream-to-speaker audio delay.
+        uint64_t mHeld;             ///< Frames held back for the audio.
+        uint64_t mDropped;          ///< Frames dropped for being late.
+    };
+
+    /**
+     * Constructor.
+     */
+    AVSyncClock();
+
+    /**
+     * @return True if video is held and dropped to follow the audio.
+     */
+    bool isEnabled() const { return mEnabled; }
+
+    /**
+     * Enable or disable holding and dropping video frames. The offset is
+     * measured either way.
+     *
+     * @param[in] enabled True to enable.
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * Forget the audio clock, e.g. after a reconnect. Statistics are
+     * kept.
+     */
+    void reset();
+
+    /**
+     * Record when a frame of audio will be heard. Called by the audio
+     * renderer as it queues each frame.
+     *
+     * @param[in] timestampUs stream timestamp of the frame
+     * @param[in] playoutUs local monotonic time its first sample plays
+     */
+    void audioScheduled(uint64_t timestampUs, uint64_t playoutUs);
+
+    /**
+     * Decide when a video frame should be shown.
+     *
+     * @param[in] timestampUs stream timestamp of the frame
+     * @param[in] nowUs local monotonic time
+     * @param[out] presentAtUs local monotonic time the frame should be
+     *     shown at; never earlier than nowUs
+     *
+     * @return PRESENT, DROP, or NO_CLOCK if synchronization is disabled
+     *     or no audio is playing.
+     */
+    EDecision schedule(uint64_t timestampUs, uint64_t nowUs,
+                       uint64_t &presentAtUs);
+
+    /**
+     * Record that a video frame has been shown and measure the A/V offset.
+     *
+     * @param[in] timestampUs stream timestamp of the frame
+     * @param[in] nowUs local monotonic time
+     */
+    void framePresented(uint64_t timestampUs, uint64_t nowUs);
+
+    /**
+     * Get the statistics gathered since the last call with reset set.
+     *
+     * @param[out] stats the statistics
+     * @param[in] reset true to start a new measurement period
+     */
+    void getStats(Stats &stats, bool reset);
+
+private:
+    /** The audio clock is stale once this long past the last frame queued. */
+    static const uint64_t AUDIO_TIMEOUT_US = 200000;
+
+    /** A change in audio delay bigger than this restarts the mapping. */
+    static const int64_t MAX_DELAY_JUMP_US = 1000000;
+
+    /** Frames further ahead than this are not held; the clocks disagree. */
+    static const int64_t MAX_HOLD_US = 500000;
+
+    /** Late frames dropped in a row before one is shown anyway. */
+    static const uint32_t MAX_CONSECUTIVE_DROPS = 1;
+
+    /** Default XSTX_AV_SYNC_TOLERANCE_MS. */
+    static const uint32_t DEFAULT_TOLERANCE_MS = 30;
+
+    /**
+     * @return true if audio is playing and mAudioDelayUs is usable
+     */
+    bool haveAudioLocked(uint64_t nowUs) const;
+
+    mud::SimpleLock mLock;
+
+    bool mEnabled;
+    int64_t mToleranceUs;
+
+    bool mHaveAudio;
+    double mAudioDelayUs;       ///< Smoothed playout time - timestamp.
+    uint64_t mLastPlayoutUs;    ///< When the last queued audio frame plays.
+
+    uint32_t mConsecutiveDrops;
+    uint64_t mHeld;
+    uint64_t mDropped;
+    RunningStats mOffsets;      ///< A/V offset of shown frames, in us.
+};
+
+#endif //_included_AVSyncClock_h
@@ -30,6 +30,8 @@
 #include <MUD/threading/ScopeLock.h>
 
 AppStreamWrapper::AppStreamWrapper() :
+    mRecorder(NULL),
+    mCaptureSink(NULL),
     mVideoRenderer(NULL),
     mClientHandle(NULL),
     mClientLibraryHandle(NULL),
@@ -58,6 +60,10 @@ AppStreamWrapper::~AppStreamWrapper()
 {
     recycle();
     delete mVideoRenderer;
+
+    // the callbacks are gone, so everything recorded can be flushed
+    delete mRecorder;
+    delete mCaptureSink;
 }
 
 // Forward declarations of callbacks.
@@ -96,7 +102,20 @@ XStxResult AppStreamWrapper::init()
         return createResult;
     }
 
+    mCaptureSink = CaptureSink::createFromEnvironment();
+
     mVideoRenderer = newVideoRenderer();
+    if (mVideoRenderer != NULL)
+    {
+        mVideoRenderer->setSyncClock(&mSyncClock);
+        mVideoRenderer->setCaptureSink(mCaptureSink);
+    }
+    mAudioModule.setSyncClock(&mSyncClock);
+    mAudioModule.setCaptureSink(mCaptureSink);
+
+    mRecorder = StreamRecorder::createFromEnvironment();
+    mVideoModule.setRecorder(mRecorder);
+    mAudioModule.setRecorder(mRecorder);
 
     return XSTX_RESULT_OK;
 }
@@ -240,6 +259,38 @@ void AppStreamWrapper::step()
                                       mLastTotalCount / mTimePassedInSeconds ) ;// FPS
             }
             LOGV("[metrics]=%s", metricsText);
+
+            if (mVideoRenderer->getPresentationScheduler().isEnabled())
+            {
+                PresentationScheduler::Stats stats;
+                mVideoRenderer->getPresentationScheduler().getStats(stats, true);
+                LOGV("[presentation]={ \"Presented\":%llu, \"Dropped\":%llu, \"Repeated\":%llu, "
+                     "\"IntervalMeanMs\":%.2f, \"IntervalVarianceMs2\":%.2f, \"IntervalMaxMs\":%.2f, "
+                     "\"JitterMs\":%.2f, \"TargetDelayMs\":%.2f }",
+                     (unsigned long long)stats.mPresented,
+                     (unsigned long long)stats.mDropped,
+                     (unsigned long long)stats.mRepeated,
+                     stats.mIntervalMeanMs, stats.mIntervalVarianceMs2,
+                     stats.mIntervalMaxMs, stats.mJitterMs,
+                     stats.mTargetDelayMs);
+            }
+
+            AVSyncClock::Stats syncStats;
+            mSyncClock.getStats(syncStats, true);
+            if (syncStats.mMeasured > 0)
+            {
+                LOGV("[avsync]={ \"Measured\":%llu, \"OffsetMeanMs\":%.2f, "
+                     "\"OffsetMinMs\":%.2f, \"OffsetMaxMs\":%.2f, "
+                     "\"OffsetStddevMs\":%.2f, \"AudioDelayMs\":%.2f, "
+                     "\"Held\":%llu, \"Dropped\":%llu, \"Enabled\":%d }",
+                     (unsigned long long)syncStats.mMeasured,
+                     syncStats.mOffsetMeanMs, syncStats.mOffsetMinMs,
+                     syncStats.mOffsetMaxMs, syncStats.mOffsetStddevMs,
+                     syncStats.mAudioDelayMs,
+                     (unsigned long long)syncStats.mHeld,
+                     (unsigned long long)syncStats.mDropped,
+                     mSyncClock.isEnabled() ? 1 : 0);
+            }
 #else
             // render frame-per-second
             char fpsText[6];
@@ -301,6 +352,16 @@ XStxResult AppStreamWrapper::clientReconnected()
 
     mReconnecting = false;
 
+    // The decoder may still hold packets and references from before
+    mVideoModule.flush();
+
+    // Timestamps restart with the new connection
+    if (mVideoRenderer)
+    {
+        mVideoRenderer->getPresentationScheduler().reset();
+    }
+    mSyncClock.reset();
+
     pausePlayback(mPaused || mReconnecting);
 
     platformOnReconnected();
@@ -366,6 +427,10 @@ XStxResult AppStreamWrapper::receivedClientConfiguration(const XStxClientConfigu
 
     LOGI("Received client configuration");
     mVideoModule.receivedClientConfiguration(config);
+    if (mCaptureSink != NULL)
+    {
+        mCaptureSink->setChromaSampling(config->mChromaSampling);
+    }
 
     return XSTX_RESULT_OK;
 }
@@ -28,6 +28,9 @@
 #include "VideoRenderer.h"
 #include "VideoModule.h"
 #include "AudioModule.h"
+#include "StreamRecorder.h"
+#include "CaptureSink.h"
+#include "AVSyncClock.h"
 
 #include "platformBindings.h"
 
@@ -354,6 +357,23 @@ protected :
      */
     AudioModule mAudioModule;
 
+    /**
+     * Records the encoded streams when XSTX_RECORD_STREAM is set; NULL
+     * otherwise.
+     */
+    StreamRecorder *mRecorder;
+
+    /**
+     * Captures the rendered frames when XSTX_CAPTURE_VIDEO or
+     * XSTX_CAPTURE_AUDIO is set; NULL otherwise.
+     */
+    CaptureSink *mCaptureSink;
+
+    /**
+     * Audio playout clock that video is synchronized to.
+     */
+    AVSyncClock mSyncClock;
+
     /**
      * The associated video renderer (which we own instead of the VideoModule
      * so that we can create it early and query it for capabilities).
@@ -37,6 +37,7 @@
 
 
 #include <MUD/base/SmartPointers.h>
+#include <MUD/base/TimeVal.h>
 
 int AudioModule::mMaxSize = 0;
 
@@ -69,6 +70,14 @@ XStxResult decoderDecodeFrame(void *context, XStxEncodedAudioFrame *enc,
         LOGD("Client Audio Timestamp: %llu", enc->mTimestampUs);
     }
     AudioModule *am = (AudioModule *)context;
+    if (am->getRecorder())
+    {
+        am->getRecorder()->recordAudioFrame(enc);
+    }
+    // A lost packet comes through with no data for the decoder to conceal
+    am->getJitterBuffer().packetArrived(
+        enc->mTimestampUs, mud::TimeVal::mono().toMicroSeconds(),
+        enc->mData == NULL && enc->mDataSize == 0);
     return am->getDecoder()->decodeFrame(enc, dec);
 }
 
@@ -134,7 +143,14 @@ XStxResult AudioModule::initAllocator(uint32_t maxSize)
 
     // instantiate allocator
     shared_ptr<RawAudioFrameAllocator>
-        allocator(new RawAudioFrameAllocator(maxSize));
+        allocator(new RawAudioFrameAllocator(maxSize * FRAMES_PER_BUFFER,
+                                             NUM_FRAMES_IN_POOL));
+    const mud::SlabArena &arena = allocator->getArena();
+    LOGV("Audio frame arena: %u slots of %u bytes, %u bytes%s%s",
+         arena.getSlotCount(), (unsigned)arena.getSlotSize(),
+         (unsigned)arena.getBlockSize(),
+         arena.isLocked() ? ", locked" : "",
+         arena.usesHugePages() ? ", huge pages" : "");
 
     // allocate fixed size pool for audio frames
     if (mFramePool.allocate(allocator, NUM_FRAMES_IN_POOL) != SIMPLE_RESULT_OK)
@@ -243,6 +259,12 @@ bool AudioModule::initialize(XStxClientHandle clientHandle)
 
     // initialize renderer
     mRenderer = newAudioRenderer(mFramePool, clientHandle);
+    if (mRenderer != NULL)
+    {
+        mRenderer->setJitterBuffer(&mJitterBuffer);
+        mRenderer->setSyncClock(mSyncClock);
+        mRenderer->setCaptureSink(mCaptureSink);
+    }
 
     // Set XStx callbacks and contexts on for the XStxIAudioRenderer struct
     mStxRenderer.mStartFcn = &audioRenderStart;
@@ -23,8 +23,13 @@
 #include <XStx/client/XStxClientAPI.h>
 #include <MUD/memory/FixedSizePool.h>
 
+#include "StreamRecorder.h"
+#include "AudioJitterBuffer.h"
+
 class AudioRenderer;  // renderer
 class AudioDecoder;   // decoder
+class AVSyncClock;    // audio master clock
+class CaptureSink;    // capture of rendered frames
 
 /**
  * AudioModule provides audio frames and holds a reference to the decoder
@@ -44,7 +49,10 @@ public:
      */
     AudioModule() :
         mDecoder(NULL),
-        mRenderer(NULL)
+        mRenderer(NULL),
+        mRecorder(NULL),
+        mSyncClock(NULL),
+        mCaptureSink(NULL)
     {
         memset(&mStxDecoder, 0, sizeof(mStxDecoder));
         memset(&mStxRenderer, 0, sizeof(mStxRenderer));
@@ -102,6 +110,53 @@ public:
      * @return A pointer to the audio decoder.
      */
     AudioDecoder* getDecoder() { return mDecoder; }
+
+    /**
+     * Record every encoded frame before it is decoded.
+     *
+     * @param[in] recorder the recorder, or NULL to stop recording; owned by
+     *     the caller
+     */
+    void setRecorder(StreamRecorder *recorder) { mRecorder = recorder; }
+
+    /**
+     * Get the stream recorder.
+     *
+     * @return A pointer to the recorder, or NULL if not recording.
+     */
+    StreamRecorder* getRecorder() { return mRecorder; }
+
+    /**
+     * Set the clock the renderer reports audio playout to, for A/V sync.
+     * Must be called before initialize().
+     *
+     * @param[in] syncClock the clock, or NULL; owned by the caller
+     */
+    void setSyncClock(AVSyncClock *syncClock) { mSyncClock = syncClock; }
+
+    /**
+     * Set where the renderer captures the frames it plays. Must be called
+     * before initialize().
+     *
+     * @param[in] captureSink the sink, or NULL; owned by the caller
+     */
+    void setCaptureSink(CaptureSink *captureSink) { mCaptureSink = captureSink; }
+
+    /**
+     * Get the jitter buffer, which the decoder callback reports packet
+     * arrivals to and the renderer plays out through.
+     *
+     * @return The jitter buffer.
+     */
+    AudioJitterBuffer& getJitterBuffer() { return mJitterBuffer; }
+
+    /**
+     * Get the pool decoded frames are allocated from, for a renderer
+     * created outside the module.
+     *
+     * @return The frame pool.
+     */
+    mud::FixedSizePool<XStxRawAudioFrame>& getFramePool() { return mFramePool; }
 private:
     /**
      *  decoder
@@ -113,6 +168,26 @@ private:
      */
     AudioRenderer *mRenderer;
 
+    /**
+     *  recorder for the encoded stream
+     */
+    StreamRecorder *mRecorder;
+
+    /**
+     *  audio master clock for A/V sync
+     */
+    AVSyncClock *mSyncClock;
+
+    /**
+     *  capture of rendered frames
+     */
+    CaptureSink *mCaptureSink;
+
+    /**
+     *  adaptive playout delay
+     */
+    AudioJitterBuffer mJitterBuffer;
+
     /**
      *  pool for audio frames
      */
@@ -123,6 +198,13 @@ private:
      */
     static const int NUM_FRAMES_IN_POOL = 50;
 
+    /**
+     *  frames of the largest size each buffer in the pool can hold. After
+     *  a loss, the decoder returns the frames it rebuilt or concealed
+     *  together with the next one.
+     */
+    static const int FRAMES_PER_BUFFER = 4;
+
     /**
      * The largest size a frame can be.
      */
@@ -21,6 +21,7 @@
  */
 
 #include "AudioRenderer.h"
+#include "CaptureSink.h"
 #include "MUD/base/TimeVal.h"
 
 #undef LOG_TAG
@@ -32,7 +33,10 @@ AudioRenderer::AudioRenderer(
     XStxClientHandle clientHandle)
     :
       mFramePool(framePool),
-      mClientHandle(clientHandle)
+      mClientHandle(clientHandle),
+      mJitterBuffer(NULL),
+      mSyncClock(NULL),
+      mCaptureSink(NULL)
 {
 
 }
@@ -45,3 +49,16 @@ void AudioRenderer::recycleFrame(XStxRawAudioFrame *frame)
 {
     mFramePool.recycleElement(frame);
 }
+
+XStxResult AudioRenderer::getNextFrame(XStxRawAudioFrame **frame, int delay,
+                                       int msBuffer)
+{
+    *frame = NULL;
+    XStxResult result = XStxGetNextAudioFrame(mClientHandle, frame, delay,
+                                              msBuffer);
+    if (result == XSTX_RESULT_OK && *frame != NULL && mCaptureSink != NULL)
+    {
+        mCaptureSink->captureAudioFrame(*frame);
+    }
+    return result;
+}
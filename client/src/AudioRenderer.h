@@ -25,6 +25,10 @@
 
 #include <MUD/memory/FixedSizePool.h>
 
+class AudioJitterBuffer;
+class AVSyncClock;
+class CaptureSink;
+
 /**
  * The abstract base class of an audio renderer.
  */
@@ -75,12 +79,68 @@ public:
      */
     virtual void stop()=0;
 
+    /**
+     * Set the jitter buffer that decides how much audio to buffer. A
+     * renderer that keeps its own playout buffer passes its frames through
+     * it; others ignore it.
+     *
+     * @param[in] jitterBuffer the jitter buffer, owned by the caller
+     */
+    void setJitterBuffer(AudioJitterBuffer *jitterBuffer)
+    {
+        mJitterBuffer = jitterBuffer;
+    }
+
+    /**
+     * Set the clock video is synchronized to. The renderer reports when
+     * each frame it queues will be heard.
+     *
+     * @param[in] syncClock the clock, owned by the caller
+     */
+    void setSyncClock(AVSyncClock *syncClock)
+    {
+        mSyncClock = syncClock;
+    }
+
+    /**
+     * Set where rendered frames are captured to. Every frame the renderer
+     * takes with getNextFrame() is handed to it, before any playout
+     * adjustment.
+     *
+     * @param[in] captureSink the sink, or NULL; owned by the caller
+     */
+    void setCaptureSink(CaptureSink *captureSink)
+    {
+        mCaptureSink = captureSink;
+    }
+
 protected:
+    /**
+     * Take the next decoded frame from the client library, and pass it
+     * to the capture sink. Renderers get their frames through this rather
+     * than calling XStxGetNextAudioFrame() themselves.
+     *
+     * @param[out] frame the frame, or NULL
+     * @param[in] delay as for XStxGetNextAudioFrame()
+     * @param[in] msBuffer as for XStxGetNextAudioFrame()
+     * @return the result of XStxGetNextAudioFrame()
+     */
+    XStxResult getNextFrame(XStxRawAudioFrame **frame, int delay, int msBuffer);
+
     // Pool for audio frames
     mud::FixedSizePool<XStxRawAudioFrame> &mFramePool;
 
     // The client handle
     XStxClientHandle mClientHandle;
+
+    // Adaptive playout delay, or NULL
+    AudioJitterBuffer *mJitterBuffer;
+
+    // Audio master clock for A/V sync, or NULL
+    AVSyncClock *mSyncClock;
+
+    // Capture of rendered frames, or NULL
+    CaptureSink *mCaptureSink;
 };
 
 #endif //_included_AudioRenderer_h
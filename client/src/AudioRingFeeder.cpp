@@ -0,0 +1,258 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "AudioRingFeeder.h"
+#include "AudioJitterBuffer.h"
+#include "AudioRenderer.h"
+#include "AVSyncClock.h"
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <new>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "AudioRenderer"
+#include "log.h"
+
+AudioRingFeeder::AudioRingFeeder(AudioRenderer &renderer)
+    : mRenderer(renderer)
+    , mJitterBuffer(NULL)
+    , mSyncClock(NULL)
+    , mUnderruns(0)
+    , mUnderrunSamples(0)
+    , mFramesFed(0)
+    , mDroppedSamples(0)
+    , mMinFillSamples(0xFFFFFFFF)
+    , mLastUnderruns(0)
+    , mRingLimitMs(RING_TARGET_MS)
+    , mOutputLatencyUs(0)
+    , mDeviceRate(SAMPLING_RATE)
+    , mDeviceChannels(NUM_CHANNELS)
+    , mConverted(NULL)
+    , mConvertedSamples(0)
+{
+}
+
+AudioRingFeeder::~AudioRingFeeder()
+{
+    delete[] mConverted;
+}
+
+bool AudioRingFeeder::init(uint32_t deviceRate, uint32_t deviceChannels,
+                           AudioResampler::EQuality quality)
+{
+    mDeviceRate = deviceRate;
+    mDeviceChannels = deviceChannels;
+    mRingLimitMs = mJitterBuffer != NULL ?
+        mJitterBuffer->getMaxDelayMs() : RING_TARGET_MS;
+
+    if (!mConverter.init(SAMPLING_RATE, NUM_CHANNELS, mDeviceRate,
+                         mDeviceChannels, quality))
+    {
+        return false;
+    }
+
+    delete[] mConverted;
+    mConverted = NULL;
+    mConvertedSamples = 0;
+    if (!mConverter.isPassthrough())
+    {
+        mConvertedSamples = mConverter.getMaxOutputSamples(CONVERT_CHUNK_SAMPLES);
+        mConverted = new(std::nothrow) int16_t[mConvertedSamples * mDeviceChannels];
+        if (mConverted == NULL)
+        {
+            return false;
+        }
+        LOGV("Converting audio to %u Hz, %u channels for the device "
+             "(%u resampler taps)", mDeviceRate, mDeviceChannels,
+             mConverter.getResamplerTaps());
+    }
+
+    uint64_t ringSamples = (uint64_t)(mRingLimitMs + RING_HEADROOM_MS) *
+                           mDeviceRate / 1000 * mDeviceChannels;
+    return mRing.allocate((uint32_t)ringSamples) == SIMPLE_RESULT_OK;
+}
+
+void AudioRingFeeder::reset()
+{
+    mRing.reset();
+    mConverter.reset();
+    if (mJitterBuffer != NULL)
+    {
+        mJitterBuffer->reset();
+    }
+}
+
+void AudioRingFeeder::feed()
+{
+    uint32_t buffered = mRing.readAvailable();
+    if (buffered < mMinFillSamples)
+    {
+        mMinFillSamples = buffered;
+    }
+
+    uint32_t bufferedMs = (uint32_t)(ringSamplesToUs(buffered) / 1000);
+    if (bufferedMs >= mRingLimitMs)
+    {
+        mud::ThreadUtil::sleep(FEED_POLL_MS);
+        return;
+    }
+
+    // The ring runs dry in bufferedMs. Once it is nearly empty the
+    // callback is already writing zeros, so give the SDK a frame's time
+    // to deliver real audio rather than spinning on concealment.
+    uint32_t deadlineMs = bufferedMs > NUM_MS_PER_FRAME ?
+        bufferedMs : NUM_MS_PER_FRAME;
+    uint32_t timeout = 0;
+    if (deadlineMs > TIMEOUT_MARGIN_MS)
+    {
+        timeout = deadlineMs - TIMEOUT_MARGIN_MS;
+    }
+
+    XStxRawAudioFrame *frame = mRenderer.popFrame(deadlineMs, timeout);
+    if (frame == NULL)
+    {
+        mud::ThreadUtil::sleep(1);
+        return;
+    }
+
+    queueFrame(frame);
+
+    if (++mFramesFed % STATS_INTERVAL_FRAMES == 0)
+    {
+        logStats();
+    }
+}
+
+void AudioRingFeeder::queueFrame(XStxRawAudioFrame *frame)
+{
+    const int16_t *samples = reinterpret_cast<const int16_t*>(frame->mData);
+    uint32_t numSamples = frame->mDataSize / BYTES_PER_SAMPLE;
+
+    if (mSyncClock != NULL && numSamples > 0)
+    {
+        // The frame plays after what is in the ring and what the jitter
+        // buffer is holding back, once it has made it through the device
+        uint64_t aheadUs = ringSamplesToUs(mRing.readAvailable()) +
+                           mOutputLatencyUs;
+        if (mJitterBuffer != NULL)
+        {
+            aheadUs += (uint64_t)mJitterBuffer->getHeldSamples() * 1000000 /
+                       SAMPLING_RATE;
+        }
+        mSyncClock->audioScheduled(frame->mTimestampUs,
+            mud::TimeVal::mono().toMicroSeconds() + aheadUs);
+    }
+
+    if (mJitterBuffer == NULL)
+    {
+        writeToRing(samples, numSamples / NUM_CHANNELS);
+        numSamples = 0;
+    }
+
+    while (numSamples >= NUM_CHANNELS)
+    {
+        uint32_t numSamplesPerChannel = numSamples / NUM_CHANNELS;
+        if (numSamplesPerChannel > AudioJitterBuffer::MAX_FRAME_SAMPLES)
+        {
+            numSamplesPerChannel = AudioJitterBuffer::MAX_FRAME_SAMPLES;
+        }
+
+        uint64_t bufferedUs = ringSamplesToUs(mRing.readAvailable());
+        uint32_t numOutSamplesPerChannel = 0;
+        const int16_t *out = mJitterBuffer->process(
+            samples, numSamplesPerChannel, bufferedUs, numOutSamplesPerChannel);
+
+        writeToRing(out, numOutSamplesPerChannel);
+
+        samples += numSamplesPerChannel * NUM_CHANNELS;
+        numSamples -= numSamplesPerChannel * NUM_CHANNELS;
+    }
+
+    mRenderer.recycleFrame(frame);
+}
+
+void AudioRingFeeder::writeToRing(const int16_t *samples,
+                                  uint32_t numSamplesPerChannel)
+{
+    // Only more audio than the room left above the limit can overflow
+    if (mConverted == NULL)
+    {
+        uint32_t numSamples = numSamplesPerChannel * NUM_CHANNELS;
+        mDroppedSamples += numSamples - mRing.write(samples, numSamples);
+        return;
+    }
+
+    while (numSamplesPerChannel > 0)
+    {
+        uint32_t chunk = numSamplesPerChannel < CONVERT_CHUNK_SAMPLES ?
+                         numSamplesPerChannel : CONVERT_CHUNK_SAMPLES;
+        uint32_t numOutSamples =
+            mConverter.process(samples, chunk, mConverted) * mDeviceChannels;
+        mDroppedSamples += numOutSamples - mRing.write(mConverted, numOutSamples);
+
+        samples += chunk * NUM_CHANNELS;
+        numSamplesPerChannel -= chunk;
+    }
+}
+
+uint32_t AudioRingFeeder::fill(int16_t *buffer, uint32_t numSamplesPerChannel)
+{
+    uint32_t numSamplesRequested = numSamplesPerChannel * mDeviceChannels;
+    uint32_t numSamplesRead = mRing.read(buffer, numSamplesRequested);
+
+    if (numSamplesRead < numSamplesRequested)
+    {
+        uint32_t numZeros = numSamplesRequested - numSamplesRead;
+        memset(buffer + numSamplesRead, 0, numZeros * BYTES_PER_SAMPLE);
+        mUnderruns = mUnderruns + 1;
+        mUnderrunSamples = mUnderrunSamples + numZeros;
+    }
+
+    return numSamplesRead / mDeviceChannels;
+}
+
+uint64_t AudioRingFeeder::ringSamplesToUs(uint32_t numSamples) const
+{
+    return (uint64_t)numSamples * 1000000 / (mDeviceRate * mDeviceChannels);
+}
+
+void AudioRingFeeder::logStats()
+{
+    uint32_t underruns = mUnderruns;
+    uint32_t fillSamples = mRing.readAvailable();
+
+    LOGV("[portaudio]={ \"Underruns\":%u, \"IntervalUnderruns\":%u, "
+         "\"UnderrunSamples\":%u, \"FillMs\":%.1f, \"MinFillMs\":%.1f, "
+         "\"LimitMs\":%u, \"DroppedSamples\":%u, \"Frames\":%u, "
+         "\"DeviceRate\":%u, \"DeviceChannels\":%u }",
+         underruns, underruns - mLastUnderruns, (uint32_t)mUnderrunSamples,
+         ringSamplesToUs(fillSamples) / 1000.0,
+         ringSamplesToUs(mMinFillSamples) / 1000.0,
+         mRingLimitMs, mDroppedSamples, mFramesFed,
+         mDeviceRate, mDeviceChannels);
+
+    mLastUnderruns = underruns;
+    mMinFillSamples = 0xFFFFFFFF;
+
+    if (mJitterBuffer != NULL)
+    {
+        mJitterBuffer->logStats();
+    }
+}
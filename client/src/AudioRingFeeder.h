@@ -0,0 +1,238 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_AudioRingFeeder_h
+#define _included_AudioRingFeeder_h
+
+#include <stdint.h>
+
+#include <XStx/common/XStxAPI.h>
+#include <XStx/client/XStxClientAPI.h>
+
+#include "MUD/memory/SpscRingBuffer.h"
+
+#include "AudioFormatConverter.h"
+
+class AudioJitterBuffer;
+class AudioRenderer;
+class AVSyncClock;
+
+/**
+ * Moves decoded audio from a renderer's frames into a wait-free ring that
+ * an audio device callback drains.
+ *
+ * A feeder thread calls feed() in a loop. Each call pulls the next frame
+ * with the renderer's popFrame(), passes it through the jitter buffer if
+ * there is one, converts it to the device format and writes it into the
+ * ring. The device callback calls fill(), which only copies samples out
+ * of the ring: it takes no locks, allocates nothing and makes no SDK
+ * calls, so a slow frame can't make it miss its deadline.
+ *
+ * With a jitter buffer, frames are pulled as soon as the SDK has them, up
+ * to the jitter buffer's maximum delay, and the jitter buffer stretches
+ * them to hold the ring at its target delay. Without one, the ring is
+ * kept at RING_TARGET_MS.
+ */
+class AudioRingFeeder
+{
+public:
+
+    /** Format of the decoded audio, as defined in XStxClientAPI.h */
+    static const uint32_t NUM_CHANNELS = 2;
+    static const uint32_t SAMPLING_RATE = 48000;
+    static const uint32_t NUM_MS_PER_FRAME = 10;
+
+    /**
+     * Constructor.
+     *
+     * @param[in] renderer where frames are pulled from and recycled to
+     */
+    explicit AudioRingFeeder(AudioRenderer &renderer);
+
+    /** Destructor */
+    ~AudioRingFeeder();
+
+    /**
+     * Set the jitter buffer frames pass through. Takes effect at the next
+     * init().
+     *
+     * @param[in] jitterBuffer the jitter buffer, or NULL; owned by the caller
+     */
+    void setJitterBuffer(AudioJitterBuffer *jitterBuffer)
+    {
+        mJitterBuffer = jitterBuffer;
+    }
+
+    /**
+     * Set the clock told when each queued frame will be heard.
+     *
+     * @param[in] syncClock the clock, or NULL; owned by the caller
+     */
+    void setSyncClock(AVSyncClock *syncClock)
+    {
+        mSyncClock = syncClock;
+    }
+
+    /**
+     * Set the latency of the device past the ring.
+     *
+     * @param[in] latencyUs latency in microseconds
+     */
+    void setOutputLatencyUs(uint64_t latencyUs)
+    {
+        mOutputLatencyUs = latencyUs;
+    }
+
+    /**
+     * Set up the converter and the ring for the device format.
+     *
+     * @param[in] deviceRate sample rate the device plays at, in Hz
+     * @param[in] deviceChannels channels the device plays
+     * @param[in] quality resampler quality
+     * @return false if memory ran out or the conversion is not supported.
+     */
+    bool init(uint32_t deviceRate, uint32_t deviceChannels,
+              AudioResampler::EQuality quality);
+
+    /**
+     * Empty the ring, the converter and the jitter buffer. Neither feed()
+     * nor fill() may be running.
+     */
+    void reset();
+
+    /**
+     * One pass of the feeder loop: pull and queue a frame if the ring is
+     * below its limit, else sleep briefly. Logs the statistics every
+     * STATS_INTERVAL_FRAMES frames.
+     */
+    void feed();
+
+    /**
+     * Copy one frame into the ring, through the jitter buffer if there is
+     * one, and recycle it. Reports when the frame will be heard to the
+     * sync clock.
+     *
+     * @param[in] frame the frame
+     */
+    void queueFrame(XStxRawAudioFrame *frame);
+
+    /**
+     * Copy samples from the ring to a device buffer of deviceChannels
+     * interleaved channels. If the ring holds fewer samples than asked
+     * for, the rest of the buffer is filled with zeros and an underrun is
+     * counted. Called from the real-time audio thread; never blocks.
+     *
+     * @param[out] buffer the device buffer
+     * @param[in] numSamplesPerChannel samples per channel to fill
+     * @return the samples per channel that came from the ring
+     */
+    uint32_t fill(int16_t *buffer, uint32_t numSamplesPerChannel);
+
+    /**
+     * Log the underrun count and ring fill level, then reset the interval
+     * statistics.
+     */
+    void logStats();
+
+    /**
+     * @return how much audio the given number of ring samples holds, in
+     *     microseconds
+     */
+    uint64_t ringSamplesToUs(uint32_t numSamples) const;
+
+    /** @return how much audio the ring holds, in microseconds */
+    uint64_t getBufferedUs() const
+    {
+        return ringSamplesToUs(mRing.readAvailable());
+    }
+
+    uint32_t getDeviceRate() const { return mDeviceRate; }
+    uint32_t getDeviceChannels() const { return mDeviceChannels; }
+    uint32_t getUnderruns() const { return mUnderruns; }
+    uint32_t getDroppedSamples() const { return mDroppedSamples; }
+
+private:
+
+    /**
+     * Convert decoded samples to the device format and copy them into the
+     * ring.
+     */
+    void writeToRing(const int16_t *samples, uint32_t numSamplesPerChannel);
+
+    static const int BYTES_PER_SAMPLE = 2; // 16 bit samples
+
+    // The feeder asks the SDK for the next frame with a deadline of when
+    // the ring will run dry, less this margin. On the one hand we'd like to
+    // set the margin as low as possible to give rtp packets time to arrive
+    // before the SDK inserts concealment. On the other, the feeder needs
+    // time to copy the frame into the ring once it is returned. The margin
+    // doesn't have to cover the callback writing to the driver, since the
+    // callback doesn't wait for frames.
+    static const uint32_t TIMEOUT_MARGIN_MS = 2;
+
+    // Without a jitter buffer the feeder stops pulling frames once the ring
+    // holds this much audio. This is latency on top of the device's own, so
+    // keep it to a few frames.
+    static const uint32_t RING_TARGET_MS = 3 * NUM_MS_PER_FRAME;
+
+    // Ring room beyond the most audio the feeder lets it hold, for the
+    // frame on its way in and for stretching.
+    static const uint32_t RING_HEADROOM_MS = 4 * NUM_MS_PER_FRAME;
+
+    // Samples per channel converted to the device format at a time.
+    static const uint32_t CONVERT_CHUNK_SAMPLES = 2 * SAMPLING_RATE * NUM_MS_PER_FRAME / 1000;
+
+    // How long the feeder sleeps when the ring is at its limit.
+    static const uint32_t FEED_POLL_MS = 2;
+
+    // How often (in frames fed) the ring statistics are logged.
+    static const uint32_t STATS_INTERVAL_FRAMES = 500;
+
+    AudioRenderer &mRenderer;
+    AudioJitterBuffer *mJitterBuffer;
+    AVSyncClock *mSyncClock;
+
+    /** Samples on their way from the feeder to the callback */
+    mud::SpscRingBuffer<int16_t> mRing;
+
+    /** Written by the callback only */
+    volatile uint32_t mUnderruns;
+    volatile uint32_t mUnderrunSamples;
+
+    /** Feeder statistics */
+    uint32_t mFramesFed;
+    uint32_t mDroppedSamples;
+    uint32_t mMinFillSamples;
+    uint32_t mLastUnderruns;
+
+    /** Most audio the feeder lets the ring hold, in ms */
+    uint32_t mRingLimitMs;
+
+    /** Latency of the device past the ring */
+    uint64_t mOutputLatencyUs;
+
+    /** Format the device plays; the ring holds samples in it */
+    uint32_t mDeviceRate;
+    uint32_t mDeviceChannels;
+
+    /** Conversion from the decoded format to the device format */
+    AudioFormatConverter mConverter;
+    int16_t *mConverted;
+    uint32_t mConvertedSamples;
+};
+
+#endif //_included_AudioRingFeeder_h
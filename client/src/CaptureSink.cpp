@@ -0,0 +1,480 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "CaptureSink.h"
+
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "CaptureSink"
+#include "log.h"
+
+/** Video queue depth when XSTX_CAPTURE_QUEUE isn't set */
+static const uint32_t DEFAULT_VIDEO_QUEUE_DEPTH = 8;
+
+/** Audio frames that may wait for the writer; a few seconds of audio */
+static const uint32_t AUDIO_QUEUE_DEPTH = 256;
+
+/** How long the writer sleeps when nothing wakes it */
+static const uint64_t WRITER_WAIT_MS = 100;
+
+static const uint32_t WAV_HEADER_SIZE = 44;
+
+/** Nominal frame rate written to the Y4M header */
+static const uint32_t Y4M_FRAME_RATE = 30;
+
+static void putLE16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void putLE32(uint8_t *out, uint32_t value)
+{
+    putLE16(out, (uint16_t)value);
+    putLE16(out + 2, (uint16_t)(value >> 16));
+}
+
+/**
+ * Copy the visible part of a plane, dropping the stride padding.
+ */
+static uint8_t *copyPlane(uint8_t *out, const uint8_t *plane, uint32_t stride,
+                          uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        memcpy(out, plane + (size_t)y * stride, width);
+        out += width;
+    }
+    return out;
+}
+
+CaptureSink *CaptureSink::createFromEnvironment()
+{
+    const char *videoPath = getenv("XSTX_CAPTURE_VIDEO");
+    const char *audioPath = getenv("XSTX_CAPTURE_AUDIO");
+    if (videoPath != NULL && videoPath[0] == '\0')
+    {
+        videoPath = NULL;
+    }
+    if (audioPath != NULL && audioPath[0] == '\0')
+    {
+        audioPath = NULL;
+    }
+    if (videoPath == NULL && audioPath == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t queueDepth = DEFAULT_VIDEO_QUEUE_DEPTH;
+    const char *value = getenv("XSTX_CAPTURE_QUEUE");
+    if (value != NULL && atoi(value) > 0)
+    {
+        queueDepth = (uint32_t)atoi(value);
+    }
+
+    std::vector<uint64_t> timesMs;
+    value = getenv("XSTX_CAPTURE_TIMESTAMPS");
+    while (value != NULL && *value != '\0')
+    {
+        char *end = NULL;
+        unsigned long timeMs = strtoul(value, &end, 10);
+        if (end == value)
+        {
+            LOGW("Ignoring XSTX_CAPTURE_TIMESTAMPS from \"%s\"", value);
+            break;
+        }
+        timesMs.push_back(timeMs);
+        value = (*end == ',') ? end + 1 : end;
+    }
+
+    CaptureSink *sink = new(std::nothrow) CaptureSink();
+    if (sink == NULL)
+    {
+        return NULL;
+    }
+    sink->setCaptureTimes(timesMs);
+    if (!sink->open(videoPath, audioPath, queueDepth))
+    {
+        delete sink;
+        return NULL;
+    }
+    return sink;
+}
+
+CaptureSink::CaptureSink()
+    : mVideoFile(NULL)
+    , mAudioFile(NULL)
+    , mWriterThread(NULL)
+    , mStopping(false)
+    , mChromaSampling(XSTX_CHROMA_SAMPLING_YUV420)
+    , mNextCaptureTime(0)
+    , mHaveFirstTimestamp(false)
+    , mFirstTimestampUs(0)
+    , mVideoHeaderWritten(false)
+    , mVideoWidth(0)
+    , mVideoHeight(0)
+    , mVideo444(false)
+    , mMismatchedFrames(0)
+    , mAudioDataSize(0)
+{
+    mVideoQueue.mReadPosition = 0;
+    mVideoQueue.mWritePosition = 0;
+    mVideoQueue.mCapturedFrames = 0;
+    mVideoQueue.mDroppedFrames = 0;
+    mAudioQueue = mVideoQueue;
+}
+
+CaptureSink::~CaptureSink()
+{
+    close();
+}
+
+bool CaptureSink::open(const char *videoPath, const char *audioPath,
+                       uint32_t videoQueueDepth)
+{
+    if (mWriterThread != NULL || (videoPath == NULL && audioPath == NULL))
+    {
+        return false;
+    }
+
+    if (videoPath != NULL)
+    {
+        mVideoFile = fopen(videoPath, "wb");
+        if (mVideoFile == NULL)
+        {
+            LOGE("Failed to create video capture %s", videoPath);
+            return false;
+        }
+        mVideoQueue.mSlots.resize(videoQueueDepth);
+    }
+
+    if (audioPath != NULL)
+    {
+        mAudioFile = fopen(audioPath, "wb");
+        if (mAudioFile == NULL)
+        {
+            LOGE("Failed to create audio capture %s", audioPath);
+            close();
+            return false;
+        }
+        // The sizes are filled in by close()
+        writeWavHeader(0);
+        mAudioQueue.mSlots.resize(AUDIO_QUEUE_DEPTH);
+    }
+
+    mStopping = false;
+    mWriterThread = new(std::nothrow) WriterThread("CaptureSink", *this);
+    if (mWriterThread == NULL || mWriterThread->start() != SIMPLE_RESULT_OK)
+    {
+        LOGE("Failed to start capture writer");
+        delete mWriterThread;
+        mWriterThread = NULL;
+        close();
+        return false;
+    }
+
+    if (videoPath != NULL)
+    {
+        LOGI("Capturing video to %s (%u frame queue%s)", videoPath,
+             videoQueueDepth,
+             mCaptureTimesMs.empty() ? "" : ", selected timestamps only");
+    }
+    if (audioPath != NULL)
+    {
+        LOGI("Capturing audio to %s", audioPath);
+    }
+    return true;
+}
+
+void CaptureSink::setCaptureTimes(const std::vector<uint64_t> &timesMs)
+{
+    mCaptureTimesMs = timesMs;
+    mNextCaptureTime = 0;
+}
+
+void CaptureSink::setChromaSampling(XStxChromaSampling chromaSampling)
+{
+    mChromaSampling = chromaSampling;
+}
+
+void CaptureSink::close()
+{
+    if (mWriterThread != NULL)
+    {
+        // the writer drains the queues before it exits
+        mStopping = true;
+        mLock.lock();
+        mLock.signal();
+        mLock.unlock();
+        mWriterThread->join();
+        delete mWriterThread;
+        mWriterThread = NULL;
+
+        LOGI("[capture]={ \"VideoFrames\":%u, \"VideoDropped\":%u, "
+             "\"VideoMismatched\":%u, \"AudioFrames\":%u, \"AudioDropped\":%u }",
+             mVideoQueue.mCapturedFrames, mVideoQueue.mDroppedFrames,
+             mMismatchedFrames, mAudioQueue.mCapturedFrames,
+             mAudioQueue.mDroppedFrames);
+    }
+
+    if (mVideoFile != NULL)
+    {
+        fclose(mVideoFile);
+        mVideoFile = NULL;
+    }
+    if (mAudioFile != NULL)
+    {
+        // WAV sizes are 32 bits; a longer capture keeps all the samples but
+        // readers stop at the size in the header
+        uint32_t dataSize = mAudioDataSize > 0xffffffffULL - WAV_HEADER_SIZE ?
+            (uint32_t)(0xffffffffULL - WAV_HEADER_SIZE) : (uint32_t)mAudioDataSize;
+        if (fseek(mAudioFile, 0, SEEK_SET) == 0)
+        {
+            writeWavHeader(dataSize);
+        }
+        fclose(mAudioFile);
+        mAudioFile = NULL;
+    }
+}
+
+void CaptureSink::captureVideoFrame(const XStxRawVideoFrame *frame)
+{
+    // Frames that weren't decoded carry no pictures
+    if (mVideoFile == NULL || frame == NULL || frame->mPlanes[0] == NULL ||
+        frame->mWidth == 0 || frame->mHeight == 0 ||
+        !isWantedTime(frame->mTimestampUs))
+    {
+        return;
+    }
+
+    Slot *slot = reserve(mVideoQueue, "video");
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    bool is444 = mChromaSampling == XSTX_CHROMA_SAMPLING_YUV444;
+    uint32_t width = frame->mWidth;
+    uint32_t height = frame->mHeight;
+    uint32_t chromaWidth = is444 ? width : (width + 1) / 2;
+    uint32_t chromaHeight = is444 ? height : (height + 1) / 2;
+    size_t size = (size_t)width * height +
+                  2 * (size_t)chromaWidth * chromaHeight;
+
+    // The slot keeps its buffer, so this only allocates when the size grows
+    slot->mData.resize(size);
+    uint8_t *out = &slot->mData[0];
+    out = copyPlane(out, frame->mPlanes[0], frame->mStrides[0], width, height);
+    out = copyPlane(out, frame->mPlanes[1], frame->mStrides[1],
+                    chromaWidth, chromaHeight);
+    copyPlane(out, frame->mPlanes[2], frame->mStrides[2],
+              chromaWidth, chromaHeight);
+
+    slot->mTimestampUs = frame->mTimestampUs;
+    slot->mWidth = width;
+    slot->mHeight = height;
+    slot->m444 = is444;
+    publish(mVideoQueue);
+}
+
+void CaptureSink::captureAudioFrame(const XStxRawAudioFrame *frame)
+{
+    if (mAudioFile == NULL || frame == NULL || frame->mDataSize == 0)
+    {
+        return;
+    }
+
+    Slot *slot = reserve(mAudioQueue, "audio");
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    slot->mData.resize(frame->mDataSize);
+    memcpy(&slot->mData[0], frame->mData, frame->mDataSize);
+    slot->mTimestampUs = frame->mTimestampUs;
+    publish(mAudioQueue);
+}
+
+CaptureSink::Slot *CaptureSink::reserve(SlotQueue &queue, const char *what)
+{
+    Slot *slot = NULL;
+    mLock.lock();
+    if (mWriterThread != NULL && !mStopping &&
+        queue.mWritePosition - queue.mReadPosition < queue.mSlots.size())
+    {
+        slot = &queue.mSlots[(size_t)(queue.mWritePosition % queue.mSlots.size())];
+    }
+    else if (mWriterThread != NULL && queue.mDroppedFrames++ == 0)
+    {
+        LOGW("Capture can't keep up; dropping %s frames", what);
+    }
+    mLock.unlock();
+    return slot;
+}
+
+void CaptureSink::publish(SlotQueue &queue)
+{
+    mLock.lock();
+    queue.mWritePosition++;
+    queue.mCapturedFrames++;
+    mLock.signal();
+    mLock.unlock();
+}
+
+bool CaptureSink::isWantedTime(uint64_t timestampUs)
+{
+    if (!mHaveFirstTimestamp)
+    {
+        mHaveFirstTimestamp = true;
+        mFirstTimestampUs = timestampUs;
+    }
+    if (mCaptureTimesMs.empty())
+    {
+        return true;
+    }
+
+    uint64_t timeMs = timestampUs >= mFirstTimestampUs ?
+                      (timestampUs - mFirstTimestampUs) / 1000 : 0;
+    if (mNextCaptureTime >= mCaptureTimesMs.size() ||
+        timeMs < mCaptureTimesMs[mNextCaptureTime])
+    {
+        return false;
+    }
+
+    // One frame covers every listed time it has reached
+    while (mNextCaptureTime < mCaptureTimesMs.size() &&
+           mCaptureTimesMs[mNextCaptureTime] <= timeMs)
+    {
+        mNextCaptureTime++;
+    }
+    return true;
+}
+
+void CaptureSink::writerLoop()
+{
+    for (;;)
+    {
+        mLock.waitForSignalAndLock(WRITER_WAIT_MS);
+        bool stopping = mStopping;
+        mLock.unlock();
+
+        drain(mVideoQueue, true);
+        drain(mAudioQueue, false);
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+}
+
+void CaptureSink::drain(SlotQueue &queue, bool video)
+{
+    for (;;)
+    {
+        mLock.lock();
+        uint64_t readPosition = queue.mReadPosition;
+        uint64_t writePosition = queue.mWritePosition;
+        mLock.unlock();
+
+        if (readPosition == writePosition)
+        {
+            return;
+        }
+
+        // The renderers never touch a published slot, so the write can
+        // happen outside the lock
+        const Slot &slot = queue.mSlots[(size_t)(readPosition % queue.mSlots.size())];
+        if (video)
+        {
+            writeVideoFrame(slot);
+        }
+        else if (fwrite(&slot.mData[0], 1, slot.mData.size(), mAudioFile) ==
+                 slot.mData.size())
+        {
+            mAudioDataSize += slot.mData.size();
+        }
+        else
+        {
+            LOGE("Failed to write audio capture");
+        }
+
+        mLock.lock();
+        queue.mReadPosition++;
+        mLock.unlock();
+    }
+}
+
+void CaptureSink::writeVideoFrame(const Slot &slot)
+{
+    if (!mVideoHeaderWritten)
+    {
+        mVideoWidth = slot.mWidth;
+        mVideoHeight = slot.mHeight;
+        mVideo444 = slot.m444;
+        fprintf(mVideoFile, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 %s\n",
+                mVideoWidth, mVideoHeight, Y4M_FRAME_RATE,
+                mVideo444 ? "C444" : "C420jpeg");
+        mVideoHeaderWritten = true;
+    }
+    else if (slot.mWidth != mVideoWidth || slot.mHeight != mVideoHeight ||
+             slot.m444 != mVideo444)
+    {
+        if (mMismatchedFrames++ == 0)
+        {
+            LOGW("Video changed to %ux%u%s; Y4M can't follow, dropping frames",
+                 slot.mWidth, slot.mHeight, slot.m444 ? " 4:4:4" : "");
+        }
+        return;
+    }
+
+    fprintf(mVideoFile, "FRAME XTS=%llu\n", (unsigned long long)slot.mTimestampUs);
+    if (fwrite(&slot.mData[0], 1, slot.mData.size(), mVideoFile) !=
+        slot.mData.size())
+    {
+        LOGE("Failed to write video capture");
+    }
+}
+
+void CaptureSink::writeWavHeader(uint32_t dataSize)
+{
+    uint8_t header[WAV_HEADER_SIZE];
+    uint32_t blockAlign = AUDIO_CHANNELS * AUDIO_BYTES_PER_SAMPLE;
+    memcpy(header, "RIFF", 4);
+    putLE32(header + 4, WAV_HEADER_SIZE - 8 + dataSize);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    putLE32(header + 16, 16);
+    putLE16(header + 20, 1); // PCM
+    putLE16(header + 22, (uint16_t)AUDIO_CHANNELS);
+    putLE32(header + 24, AUDIO_SAMPLING_RATE);
+    putLE32(header + 28, AUDIO_SAMPLING_RATE * blockAlign);
+    putLE16(header + 32, (uint16_t)blockAlign);
+    putLE16(header + 34, (uint16_t)(AUDIO_BYTES_PER_SAMPLE * 8));
+    memcpy(header + 36, "data", 4);
+    putLE32(header + 40, dataSize);
+    if (fwrite(header, 1, sizeof(header), mAudioFile) != sizeof(header))
+    {
+        LOGE("Failed to write audio capture header");
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_CaptureSink_h
+#define _included_CaptureSink_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "XStx/common/XStxAPI.h"
+
+#include "MUD/threading/Thread.h"
+#include "MUD/threading/WaitableLock.h"
+
+/**
+ * Writes what a client decoded to files so headless runs can be checked
+ * offline: video to a Y4M file and audio to a WAV file. Attached to the
+ * video renderer, which hands it every frame it renders, and to the audio
+ * renderer, which hands it every frame it takes from the client library.
+ * Configured from the environment:
+ *  - XSTX_CAPTURE_VIDEO: path of the Y4M file to write.
+ *  - XSTX_CAPTURE_AUDIO: path of the WAV file to write (48 kHz, 16-bit
+ *    stereo, as the audio decoder produces it).
+ *  - XSTX_CAPTURE_QUEUE: video frames that may wait for the writer (8 by
+ *    default).
+ *  - XSTX_CAPTURE_TIMESTAMPS: comma separated list of times in
+ *    milliseconds, relative to the first rendered video frame. Only the
+ *    first frame at or after each of them is captured. Audio is always
+ *    captured in full.
+ *
+ * The renderers only copy the visible part of the frame into a queue
+ * slot; a writer thread does the file I/O. If the writer can't keep up
+ * the frame is dropped from the capture rather than delaying rendering.
+ *
+ * Every Y4M frame header carries the stream timestamp of the frame in
+ * microseconds as an XTS parameter ("FRAME XTS=1234567"), since the frame
+ * rate in the stream header is only nominal. The video size and chroma
+ * sampling are fixed by the first captured frame; frames that don't match
+ * are dropped.
+ */
+class CaptureSink
+{
+public:
+
+    /** Format of captured audio */
+    static const uint32_t AUDIO_SAMPLING_RATE = 48000;
+    static const uint32_t AUDIO_CHANNELS = 2;
+    static const uint32_t AUDIO_BYTES_PER_SAMPLE = 2;
+
+    /**
+     * Create a sink if XSTX_CAPTURE_VIDEO or XSTX_CAPTURE_AUDIO is set.
+     *
+     * @return an open sink, or NULL if capture is not requested or the
+     *     files can't be created.
+     */
+    static CaptureSink *createFromEnvironment();
+
+    /** Constructor */
+    CaptureSink();
+
+    /** Destructor; closes the files */
+    ~CaptureSink();
+
+    /**
+     * Create the capture files and start the writer thread.
+     *
+     * @param[in] videoPath Y4M file to write, or NULL for no video
+     * @param[in] audioPath WAV file to write, or NULL for no audio
+     * @param[in] videoQueueDepth video frames that may wait for the writer
+     * @return true on success
+     */
+    bool open(const char *videoPath, const char *audioPath,
+              uint32_t videoQueueDepth);
+
+    /**
+     * Only capture the first video frame at or after each of the given
+     * times. Must be called before the first frame is captured.
+     *
+     * @param[in] timesMs times in milliseconds relative to the first
+     *     rendered frame; capture everything if empty
+     */
+    void setCaptureTimes(const std::vector<uint64_t> &timesMs);
+
+    /**
+     * Set the chroma sampling of the frames that will be captured.
+     * 4:2:0 is assumed until this is called.
+     */
+    void setChromaSampling(XStxChromaSampling chromaSampling);
+
+    /**
+     * Flush everything queued, finish the files and close them.
+     */
+    void close();
+
+    /**
+     * Capture a rendered video frame. Never blocks; safe to call from the
+     * render path. Only the video renderer's thread may call it.
+     */
+    void captureVideoFrame(const XStxRawVideoFrame *frame);
+
+    /**
+     * Capture a rendered audio frame. Never blocks; safe to call from the
+     * render path. Only the audio renderer's thread may call it.
+     */
+    void captureAudioFrame(const XStxRawAudioFrame *frame);
+
+private:
+
+    /** A frame waiting for the writer */
+    struct Slot
+    {
+        uint64_t mTimestampUs;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        bool m444;
+        std::vector<uint8_t> mData;
+    };
+
+    /**
+     * Fixed-size queue of slots between one renderer and the writer.
+     * Positions only grow; the slot is position % size. Positions are
+     * guarded by mLock; a slot is only touched by the side that owns it
+     * at the time.
+     */
+    struct SlotQueue
+    {
+        std::vector<Slot> mSlots;
+        uint64_t mReadPosition;
+        uint64_t mWritePosition;
+        uint32_t mCapturedFrames;
+        uint32_t mDroppedFrames;
+    };
+
+    /**
+     * Get the slot for the next frame, or NULL if the queue is full.
+     */
+    Slot *reserve(SlotQueue &queue, const char *what);
+
+    /**
+     * Hand the reserved slot to the writer.
+     */
+    void publish(SlotQueue &queue);
+
+    /**
+     * Decide whether a video frame is wanted by the capture times.
+     */
+    bool isWantedTime(uint64_t timestampUs);
+
+    /**
+     * Writer thread body.
+     */
+    void writerLoop();
+
+    /**
+     * Write everything queued so far.
+     */
+    void drain(SlotQueue &queue, bool video);
+
+    /**
+     * Write a video frame, and the stream header before the first one.
+     */
+    void writeVideoFrame(const Slot &slot);
+
+    /**
+     * Write the WAV header for the given amount of sample data.
+     */
+    void writeWavHeader(uint32_t dataSize);
+
+    DEFINE_METHOD_THREAD(WriterThread, CaptureSink, writerLoop);
+
+    FILE *mVideoFile;
+    FILE *mAudioFile;
+    WriterThread *mWriterThread;
+    volatile bool mStopping;
+    mud::WaitableLock mLock;
+
+    SlotQueue mVideoQueue;
+    SlotQueue mAudioQueue;
+
+    /** Video renderer thread only */
+    XStxChromaSampling mChromaSampling;
+    std::vector<uint64_t> mCaptureTimesMs;
+    size_t mNextCaptureTime;
+    bool mHaveFirstTimestamp;
+    uint64_t mFirstTimestampUs;
+
+    /** Writer thread only */
+    bool mVideoHeaderWritten;
+    uint32_t mVideoWidth;
+    uint32_t mVideoHeight;
+    bool mVideo444;
+    uint32_t mMismatchedFrames;
+    uint64_t mAudioDataSize;
+};
+
+#endif // _included_CaptureSink_h
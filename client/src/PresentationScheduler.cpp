@@ -0,0 +1,197 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "PresentationScheduler.h"
+#include "MUD/threading/ScopeLock.h"
+
+#include <stdlib.h>
+
+#undef LOG_TAG
+#define LOG_TAG "PresentationScheduler"
+#include "log.h"
+
+PresentationScheduler::PresentationScheduler() :
+    mEnabled(getenv("XSTX_PRESENTATION_SCHEDULER") != NULL),
+    mPresented(0),
+    mDropped(0),
+    mRepeated(0)
+{
+    resetLocked();
+    mJitterUs = 0;
+    mTargetDelayUs = MIN_TARGET_DELAY_US;
+    mFrameIntervalUs = DEFAULT_FRAME_INTERVAL_US;
+}
+
+void PresentationScheduler::setEnabled(bool enabled)
+{
+    mud::ScopeLock scope(mLock);
+    mEnabled = enabled;
+    resetLocked();
+}
+
+void PresentationScheduler::reset()
+{
+    mud::ScopeLock scope(mLock);
+    resetLocked();
+}
+
+void PresentationScheduler::resetLocked()
+{
+    mHaveLast = false;
+    mLastTimestampUs = 0;
+    mLastArrivalUs = 0;
+    mLastDropped = false;
+    mTransitCount = 0;
+    mTransitNext = 0;
+    mLastPresentUs = 0;
+    mNextDueUs = 0;
+}
+
+PresentationScheduler::EDecision PresentationScheduler::schedule(
+    uint64_t timestampUs, uint64_t arrivalUs, uint64_t &presentAtUs)
+{
+    mud::ScopeLock scope(mLock);
+
+    presentAtUs = arrivalUs;
+
+    // A stream without usable timestamps (or one that just jumped) can't
+    // be scheduled; show the frame now and start a new mapping.
+    if (mHaveLast &&
+        (timestampUs <= mLastTimestampUs ||
+         timestampUs - mLastTimestampUs > MAX_TIMESTAMP_GAP_US))
+    {
+        LOGV("Timestamp discontinuity %llu -> %llu; resynchronizing",
+             (unsigned long long)mLastTimestampUs,
+             (unsigned long long)timestampUs);
+        resetLocked();
+    }
+
+    int64_t transit = (int64_t)(arrivalUs - timestampUs);
+
+    if (mHaveLast)
+    {
+        // RFC 3550 inter-arrival jitter: how much the spacing between
+        // arrivals differs from the spacing between timestamps.
+        int64_t timestampDelta = (int64_t)(timestampUs - mLastTimestampUs);
+        int64_t arrivalDelta = (int64_t)(arrivalUs - mLastArrivalUs);
+        int64_t d = arrivalDelta - timestampDelta;
+        mJitterUs += ((double)(d < 0 ? -d : d) - mJitterUs) / 16.0;
+        mFrameIntervalUs += ((double)timestampDelta - mFrameIntervalUs) / 16.0;
+    }
+    mHaveLast = true;
+    mLastTimestampUs = timestampUs;
+    mLastArrivalUs = arrivalUs;
+
+    mTransit[mTransitNext] = transit;
+    mTransitNext = (mTransitNext + 1) % TRANSIT_WINDOW;
+    if (mTransitCount < TRANSIT_WINDOW)
+    {
+        mTransitCount++;
+    }
+    int64_t baseTransit = transit;
+    for (uint32_t i = 0; i < mTransitCount; i++)
+    {
+        if (mTransit[i] < baseTransit)
+        {
+            baseTransit = mTransit[i];
+        }
+    }
+
+    // Grow the buffer as soon as jitter goes up, shrink it gently.
+    double desired = mJitterUs * JITTER_MULTIPLIER;
+    if (desired < MIN_TARGET_DELAY_US)
+    {
+        desired = MIN_TARGET_DELAY_US;
+    }
+    if (desired > MAX_TARGET_DELAY_US)
+    {
+        desired = MAX_TARGET_DELAY_US;
+    }
+    if (desired > mTargetDelayUs)
+    {
+        mTargetDelayUs = desired;
+    }
+    else
+    {
+        mTargetDelayUs += (desired - mTargetDelayUs) / 64.0;
+    }
+
+    int64_t presentAt = (int64_t)timestampUs + baseTransit +
+        (int64_t)mTargetDelayUs;
+    int64_t lateness = (int64_t)arrivalUs - presentAt;
+
+    if (lateness > (int64_t)mFrameIntervalUs && !mLastDropped)
+    {
+        mLastDropped = true;
+        mDropped++;
+        return DROP;
+    }
+    mLastDropped = false;
+
+    if (presentAt > (int64_t)arrivalUs)
+    {
+        presentAtUs = (uint64_t)presentAt;
+    }
+    return PRESENT;
+}
+
+void PresentationScheduler::framePresented(uint64_t nowUs)
+{
+    mud::ScopeLock scope(mLock);
+
+    if (mLastPresentUs != 0 && nowUs >= mLastPresentUs)
+    {
+        mIntervals.add((double)(nowUs - mLastPresentUs));
+    }
+    mPresented++;
+    mLastPresentUs = nowUs;
+    mNextDueUs = nowUs + (uint64_t)(mFrameIntervalUs * 1.5);
+}
+
+void PresentationScheduler::frameMissed(uint64_t nowUs)
+{
+    mud::ScopeLock scope(mLock);
+
+    if (mLastPresentUs != 0 && nowUs > mNextDueUs)
+    {
+        mRepeated++;
+        mNextDueUs += (uint64_t)mFrameIntervalUs;
+    }
+}
+
+void PresentationScheduler::getStats(Stats &stats, bool reset)
+{
+    mud::ScopeLock scope(mLock);
+
+    stats.mPresented = mPresented;
+    stats.mDropped = mDropped;
+    stats.mRepeated = mRepeated;
+    stats.mIntervalMeanMs = mIntervals.mean() / 1000.0;
+    stats.mIntervalVarianceMs2 = mIntervals.variance() / 1000000.0;
+    stats.mIntervalMaxMs = mIntervals.maximum() / 1000.0;
+    stats.mJitterMs = mJitterUs / 1000.0;
+    stats.mTargetDelayMs = mTargetDelayUs / 1000.0;
+
+    if (reset)
+    {
+        mPresented = 0;
+        mDropped = 0;
+        mRepeated = 0;
+        mIntervals.reset();
+    }
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _included_PresentationScheduler_h
+#define _included_PresentationScheduler_h
+
+#include <stdint.h>
+#include "MUD/threading/SimpleLock.h"
+
+#include "RunningStats.h"
+
+/**
+ * Decides when a decoded video frame should be shown, based on its
+ * stream timestamp rather than on when it happened to come out of the
+ * decoder.
+ *
+ * Stream time is mapped onto the local monotonic clock using the
+ * smallest transit time (arrival - timestamp) seen over a sliding
+ * window, plus a target delay. The target delay is the jitter buffer:
+ * it tracks a multiple of the measured inter-arrival jitter, growing
+ * quickly when the network gets worse and shrinking slowly when it
+ * recovers. Frames that arrive more than one frame interval after
+ * their presentation time are dropped (never two in a row); draws that
+ * find no new frame when one was due are counted as repeats.
+ *
+ * The scheduler is enabled by setting the XSTX_PRESENTATION_SCHEDULER
+ * environment variable. Without it, frames are shown as soon as they
+ * are decoded, as before.
+ */
+class PresentationScheduler
+{
+public:
+    /**
+     * What to do with an incoming frame.
+     */
+    enum EDecision
+    {
+        PRESENT,    ///< Show the frame at the returned time.
+        DROP        ///< The frame is too late; don't show it.
+    };
+
+    /**
+     * Snapshot of the presentation statistics.
+     */
+    struct Stats
+    {
+        uint64_t mPresented;        ///< Frames shown.
+        uint64_t mDropped;          ///< Frames dropped for being late.
+        uint64_t mRepeated;         ///< Draws that re-showed the last frame.
+        double mIntervalMeanMs;     ///< Mean time between shown frames.
+        double mIntervalVarianceMs2;///< Variance of the time between shown frames.
+        double mIntervalMaxMs;      ///< Longest time between shown frames.
+        double mJitterMs;           ///< Current inter-arrival jitter estimate.
+        double mTargetDelayMs;      ///< Current jitter buffer delay.
+    };
+
+    /**
+     * Constructor.
+     */
+    PresentationScheduler();
+
+    /**
+     * @return True if timestamp-driven presentation is enabled.
+     */
+    bool isEnabled() const { return mEnabled; }
+
+    /**
+     * Enable or disable the scheduler. Resets the clock mapping.
+     *
+     * @param[in] enabled True to enable.
+     */
+    void setEnabled(bool enabled);
+
+    /**
+     * Forget the clock mapping, e.g. after a reconnect. Statistics are
+     * kept.
+     */
+    void reset();
+
+    /**
+     * Schedule a decoded frame. Called on the thread that posts frames
+     * to the renderer.
+     *
+     * @param[in] timestampUs stream timestamp of the frame
+     * @param[in] arrivalUs local monotonic time the frame was posted
+     * @param[out] presentAtUs local monotonic time the frame should be
+     *     shown at; never earlier than arrivalUs
+     *
+     * @return PRESENT or DROP.
+     */
+    EDecision schedule(uint64_t timestampUs, uint64_t arrivalUs,
+                       uint64_t &presentAtUs);
+
+    /**
+     * Record that a frame has been shown. Called on the render thread.
+     *
+     * @param[in] nowUs local monotonic time
+     */
+    void framePresented(uint64_t nowUs);
+
+    /**
+     * Record a draw that had no new frame to show. Counts a repeat if
+     * a frame was due by now. Called on the render thread.
+     *
+     * @param[in] nowUs local monotonic time
+     */
+    void frameMissed(uint64_t nowUs);
+
+    /**
+     * Get the statistics gathered since the last call with reset set.
+     *
+     * @param[out] stats the statistics
+     * @param[in] reset true to start a new measurement period
+     */
+    void getStats(Stats &stats, bool reset);
+
+private:
+    /** Number of frames the transit-time minimum is taken over. */
+    static const uint32_t TRANSIT_WINDOW = 64;
+
+    /** Bounds of the jitter buffer delay. */
+    static const uint64_t MIN_TARGET_DELAY_US = 5000;
+    static const uint64_t MAX_TARGET_DELAY_US = 100000;
+
+    /** Target delay, in multiples of the jitter estimate. */
+    static const uint32_t JITTER_MULTIPLIER = 3;
+
+    /** Frame interval assumed until we have measured one. */
+    static const uint64_t DEFAULT_FRAME_INTERVAL_US = 33333;
+
+    /** A timestamp jump bigger than this restarts the clock mapping. */
+    static const uint64_t MAX_TIMESTAMP_GAP_US = 1000000;
+
+    void resetLocked();
+
+    mud::SimpleLock mLock;
+
+    bool mEnabled;
+
+    bool mHaveLast;             ///< mLastTimestampUs/mLastArrivalUs are valid.
+    uint64_t mLastTimestampUs;
+    uint64_t mLastArrivalUs;
+    bool mLastDropped;          ///< The previous frame was dropped.
+
+    int64_t mTransit[TRANSIT_WINDOW];   ///< Recent arrival - timestamp values.
+    uint32_t mTransitCount;
+    uint32_t mTransitNext;
+
+    double mJitterUs;           ///< RFC 3550 style inter-arrival jitter.
+    double mTargetDelayUs;      ///< Current jitter buffer delay.
+    double mFrameIntervalUs;    ///< Smoothed timestamp delta between frames.
+
+    uint64_t mLastPresentUs;    ///< When the last frame was shown, 0 if never.
+    uint64_t mNextDueUs;        ///< When a draw without a new frame is a repeat.
+
+    uint64_t mPresented;
+    uint64_t mDropped;
+    uint64_t mRepeated;
+    RunningStats mIntervals;    ///< Time between shown frames, in us.
+};
+
+#endif //_included_PresentationScheduler_h
@@ -19,8 +19,14 @@
 #ifndef _include_RawAudioFrameAllocator_h
 #define _include_RawAudioFrameAllocator_h
 
+#include "MUD/memory/SlabArena.h"
+
+#include <new>
+
 /**
  * Allocator Helper
+ * - when told how many frames the pool holds, carves them all from one
+ *   SlabArena instead of making a heap allocation per frame
  */
 class RawAudioFrameAllocator :
     public mud::FixedSizePool<XStxRawAudioFrame>::Allocator
@@ -31,10 +37,25 @@ public:
      * Constructor.
      *
      * @param maxSize The largest size of audio frame we need to accept.
+     * @param numFrames The number of frames the pool will hold; 0 to
+     *     allocate each frame on the heap.
      */
-    RawAudioFrameAllocator(uint32_t maxSize) :
+    RawAudioFrameAllocator(uint32_t maxSize, uint32_t numFrames = 0) :
         mMaxSize(maxSize)
     {
+        if (numFrames > 0)
+        {
+            mArena.init(mMaxSize + sizeof(XStxRawAudioFrame), numFrames,
+                        mud::SlabArena::flagsFromEnvironment());
+        }
+    }
+
+    /**
+     * The arena the frames are carved from, for reporting.
+     */
+    const mud::SlabArena &getArena() const
+    {
+        return mArena;
     }
 
     /**
@@ -44,8 +65,14 @@ public:
      */
     XStxRawAudioFrame* allocate()
     {
-        // allocate memory
-        uint8_t *buffer = new uint8_t[mMaxSize + sizeof(XStxRawAudioFrame)];
+        // take a slot from the arena, or fall back to the heap if it
+        // couldn't be set up or is used up
+        uint8_t *buffer = static_cast<uint8_t *>(mArena.allocate());
+        if (!buffer)
+        {
+            buffer = new(std::nothrow)
+                uint8_t[mMaxSize + sizeof(XStxRawAudioFrame)];
+        }
         if (!buffer)
         {
             return NULL;
@@ -71,13 +98,22 @@ public:
     void deallocate(XStxRawAudioFrame *frame)
     {
         uint8_t *buffer = (uint8_t *)frame;
-        delete[] buffer;
+        if (!mArena.deallocate(buffer))
+        {
+            delete[] buffer;
+        }
     }
 
     /**
      * The audio frame size.
      */
     uint32_t mMaxSize;
+
+private:
+    /**
+     * Backing store for the frames
+     */
+    mud::SlabArena mArena;
 };
 
 #endif // _include_RawAudioFrameAllocator_h
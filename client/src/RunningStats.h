@@ -0,0 +1,109 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _included_RunningStats_h
+#define _included_RunningStats_h
+
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * Accumulates count, mean, variance, minimum and maximum of a series
+ * of samples in constant space (Welford's method). Not thread safe;
+ * callers serialize access.
+ */
+class RunningStats
+{
+public:
+    /**
+     * Constructor.
+     */
+    RunningStats()
+    {
+        reset();
+    }
+
+    /**
+     * Forget all samples.
+     */
+    void reset()
+    {
+        mCount = 0;
+        mMean = 0;
+        mM2 = 0;
+        mMin = 0;
+        mMax = 0;
+    }
+
+    /**
+     * Add a sample.
+     *
+     * @param[in] value the sample
+     */
+    void add(double value)
+    {
+        mCount++;
+        if (mCount == 1)
+        {
+            mMin = value;
+            mMax = value;
+        }
+        else
+        {
+            if (value < mMin)
+            {
+                mMin = value;
+            }
+            if (value > mMax)
+            {
+                mMax = value;
+            }
+        }
+        double delta = value - mMean;
+        mMean += delta / (double)mCount;
+        mM2 += delta * (value - mMean);
+    }
+
+    uint64_t count() const { return mCount; }
+    double mean() const { return mMean; }
+    double minimum() const { return mMin; }
+    double maximum() const { return mMax; }
+
+    /**
+     * @return The population variance of the samples, 0 if fewer than
+     *     two samples were added.
+     */
+    double variance() const
+    {
+        return (mCount > 1) ? mM2 / (double)mCount : 0;
+    }
+
+    double stddev() const
+    {
+        return sqrt(variance());
+    }
+
+private:
+    uint64_t mCount;
+    double mMean;
+    double mM2;
+    double mMin;
+    double mMax;
+};
+
+#endif //_included_RunningStats_h
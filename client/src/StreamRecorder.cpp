@@ -0,0 +1,377 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "StreamRecorder.h"
+
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "StreamRecorder"
+#include "log.h"
+
+const char StreamRecorder::FILE_MAGIC[8] = { 'X', 'S', 'T', 'X', 'R', 'E', 'C', '\0' };
+const char StreamRecorder::INDEX_MAGIC[4] = { 'X', 'I', 'D', 'X' };
+
+/** Buffer size when XSTX_RECORD_BUFFER_KB isn't set */
+static const uint32_t DEFAULT_BUFFER_SIZE = 8 * 1024 * 1024;
+
+/** How long the writer sleeps when nothing wakes it */
+static const uint64_t WRITER_WAIT_MS = 100;
+
+static void putLE16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void putLE32(uint8_t *out, uint32_t value)
+{
+    putLE16(out, (uint16_t)value);
+    putLE16(out + 2, (uint16_t)(value >> 16));
+}
+
+static void putLE64(uint8_t *out, uint64_t value)
+{
+    putLE32(out, (uint32_t)value);
+    putLE32(out + 4, (uint32_t)(value >> 32));
+}
+
+StreamRecorder *StreamRecorder::createFromEnvironment()
+{
+    const char *path = getenv("XSTX_RECORD_STREAM");
+    if (path == NULL || path[0] == '\0')
+    {
+        return NULL;
+    }
+
+    uint32_t bufferSize = DEFAULT_BUFFER_SIZE;
+    const char *value = getenv("XSTX_RECORD_BUFFER_KB");
+    if (value != NULL && atoi(value) > 0)
+    {
+        bufferSize = (uint32_t)atoi(value) * 1024;
+    }
+
+    StreamRecorder *recorder = new(std::nothrow) StreamRecorder();
+    if (recorder == NULL)
+    {
+        return NULL;
+    }
+    if (!recorder->open(path, bufferSize))
+    {
+        delete recorder;
+        return NULL;
+    }
+    return recorder;
+}
+
+StreamRecorder::StreamRecorder()
+    : mFile(NULL)
+    , mWriterThread(NULL)
+    , mStopping(false)
+    , mReadPosition(0)
+    , mWritePosition(0)
+    , mFileOffset(0)
+    , mWriteFailed(false)
+    , mRecordedFrames(0)
+    , mDroppedFrames(0)
+{
+}
+
+StreamRecorder::~StreamRecorder()
+{
+    close();
+}
+
+bool StreamRecorder::open(const char *path, uint32_t bufferSize)
+{
+    if (mFile != NULL)
+    {
+        return false;
+    }
+
+    mFile = fopen(path, "wb");
+    if (mFile == NULL)
+    {
+        LOGE("Failed to create recording %s", path);
+        return false;
+    }
+
+    uint8_t header[FILE_HEADER_SIZE];
+    memcpy(header, FILE_MAGIC, sizeof(FILE_MAGIC));
+    putLE32(header + 8, FILE_VERSION);
+    putLE32(header + 12, FILE_HEADER_SIZE);
+    if (fwrite(header, 1, sizeof(header), mFile) != sizeof(header))
+    {
+        LOGE("Failed to write recording %s", path);
+        fclose(mFile);
+        mFile = NULL;
+        return false;
+    }
+
+    mBuffer.resize(bufferSize);
+    mReadPosition = 0;
+    mWritePosition = 0;
+    mFileOffset = FILE_HEADER_SIZE;
+    mIndex.clear();
+    mIndex.reserve(1024);
+    mWriteFailed = false;
+    mRecordedFrames = 0;
+    mDroppedFrames = 0;
+
+    mStopping = false;
+    mWriterThread = new(std::nothrow) WriterThread("StreamRecorder", *this);
+    if (mWriterThread == NULL || mWriterThread->start() != SIMPLE_RESULT_OK)
+    {
+        LOGE("Failed to start recording writer");
+        delete mWriterThread;
+        mWriterThread = NULL;
+        fclose(mFile);
+        mFile = NULL;
+        return false;
+    }
+
+    LOGI("Recording stream to %s (%u KB buffer)", path, bufferSize / 1024);
+    return true;
+}
+
+void StreamRecorder::close()
+{
+    if (mWriterThread == NULL)
+    {
+        return;
+    }
+
+    // the writer drains the buffer before it exits
+    mStopping = true;
+    mLock.lock();
+    mLock.signal();
+    mLock.unlock();
+    mWriterThread->join();
+    delete mWriterThread;
+    mWriterThread = NULL;
+
+    if (mWriteFailed)
+    {
+        // Without an index the reader stops at the last complete record
+        fclose(mFile);
+        mFile = NULL;
+        LOGE("Recording closed after a write error: %u frames, %u dropped; "
+             "no index written", mRecordedFrames, mDroppedFrames);
+        return;
+    }
+
+    // index and trailer
+    uint64_t indexOffset = mFileOffset;
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    for (size_t i = 0; i < mIndex.size(); i++)
+    {
+        putLE64(entry, mIndex[i].mOffset);
+        putLE64(entry + 8, mIndex[i].mTimestampUs);
+        fwrite(entry, 1, sizeof(entry), mFile);
+    }
+
+    uint8_t trailer[TRAILER_SIZE];
+    putLE64(trailer, indexOffset);
+    putLE32(trailer + 8, (uint32_t)mIndex.size());
+    memcpy(trailer + 12, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    fwrite(trailer, 1, sizeof(trailer), mFile);
+
+    fclose(mFile);
+    mFile = NULL;
+
+    LOGI("Recording closed: %u frames, %u dropped, %u keyframes, %llu bytes",
+         mRecordedFrames, mDroppedFrames, (uint32_t)mIndex.size(),
+         (unsigned long long)mFileOffset);
+}
+
+void StreamRecorder::recordVideoFrame(const XStxEncodedVideoFrame *frame)
+{
+    if (frame->mData == NULL || frame->mDataSize == 0)
+    {
+        record(STREAM_VIDEO, FLAG_EMPTY, frame->mTimestampUs, NULL, 0);
+        return;
+    }
+    record(STREAM_VIDEO, getVideoFrameFlags(frame->mData, frame->mDataSize),
+           frame->mTimestampUs, frame->mData, frame->mDataSize);
+}
+
+void StreamRecorder::recordAudioFrame(const XStxEncodedAudioFrame *frame)
+{
+    if (frame->mData == NULL || frame->mDataSize == 0)
+    {
+        record(STREAM_AUDIO, FLAG_EMPTY, frame->mTimestampUs, NULL, 0);
+        return;
+    }
+    record(STREAM_AUDIO, 0, frame->mTimestampUs, frame->mData,
+           frame->mDataSize);
+}
+
+uint8_t StreamRecorder::getVideoFrameFlags(const uint8_t *data, uint32_t size)
+{
+    uint8_t flags = 0;
+    for (uint32_t i = 0; i + 3 < size; i++)
+    {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        {
+            continue;
+        }
+
+        uint8_t nalType = data[i + 3] & 0x1f;
+        if (nalType == 7 || nalType == 8)
+        {
+            flags |= FLAG_PARAMETER_SETS;
+        }
+        else if (nalType == 5)
+        {
+            // the first slice decides the picture type
+            return flags | FLAG_KEYFRAME;
+        }
+        else if (nalType == 1)
+        {
+            return flags;
+        }
+        i += 3;
+    }
+    return flags;
+}
+
+void StreamRecorder::record(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+                            const uint8_t *data, uint32_t size)
+{
+    uint8_t header[RECORD_HEADER_SIZE];
+    header[0] = stream;
+    header[1] = flags;
+    putLE16(header + 2, 0);
+    putLE32(header + 4, size);
+    putLE64(header + 8, timestampUs);
+
+    uint64_t needed = RECORD_HEADER_SIZE + (uint64_t)size;
+
+    mLock.lock();
+    if (mWriteFailed)
+    {
+        mLock.unlock();
+        return;
+    }
+    if (mWriterThread == NULL || mStopping ||
+        mWritePosition - mReadPosition + needed > mBuffer.size())
+    {
+        if (mWriterThread != NULL && mDroppedFrames++ == 0)
+        {
+            LOGW("Recording can't keep up; dropping frames");
+        }
+        mLock.unlock();
+        return;
+    }
+
+    copyIn(mWritePosition, header, RECORD_HEADER_SIZE);
+    copyIn(mWritePosition + RECORD_HEADER_SIZE, data, size);
+    mWritePosition += needed;
+
+    if (stream == STREAM_VIDEO && (flags & FLAG_KEYFRAME) != 0)
+    {
+        IndexEntry entry;
+        entry.mOffset = mFileOffset;
+        entry.mTimestampUs = timestampUs;
+        mIndex.push_back(entry);
+    }
+    mFileOffset += needed;
+    mRecordedFrames++;
+
+    mLock.signal();
+    mLock.unlock();
+}
+
+void StreamRecorder::copyIn(uint64_t position, const uint8_t *data, uint32_t size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+
+    size_t offset = (size_t)(position % mBuffer.size());
+    size_t first = mBuffer.size() - offset;
+    if (first > size)
+    {
+        first = size;
+    }
+    memcpy(&mBuffer[offset], data, first);
+    if (first < size)
+    {
+        memcpy(&mBuffer[0], data + first, size - first);
+    }
+}
+
+void StreamRecorder::writerLoop()
+{
+    for (;;)
+    {
+        mLock.waitForSignalAndLock(WRITER_WAIT_MS);
+        bool stopping = mStopping;
+        mLock.unlock();
+
+        drain();
+
+        if (stopping)
+        {
+            break;
+        }
+    }
+}
+
+void StreamRecorder::drain()
+{
+    for (;;)
+    {
+        mLock.lock();
+        uint64_t readPosition = mReadPosition;
+        uint64_t writePosition = mWritePosition;
+        mLock.unlock();
+
+        if (readPosition == writePosition)
+        {
+            return;
+        }
+
+        // The callbacks never touch unread bytes, so the write can happen
+        // outside the lock. Stop at the end of the ring; the rest is
+        // written on the next pass.
+        size_t offset = (size_t)(readPosition % mBuffer.size());
+        size_t length = (size_t)(writePosition - readPosition);
+        if (length > mBuffer.size() - offset)
+        {
+            length = mBuffer.size() - offset;
+        }
+        if (fwrite(&mBuffer[offset], 1, length, mFile) != length)
+        {
+            LOGE("Failed to write recording; recording stopped");
+            mLock.lock();
+            mWriteFailed = true;
+            mReadPosition = mWritePosition;
+            mLock.unlock();
+            return;
+        }
+
+        mLock.lock();
+        mReadPosition += length;
+        mLock.unlock();
+    }
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_StreamRecorder_h
+#define _included_StreamRecorder_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "XStx/common/XStxAPI.h"
+
+#include "MUD/threading/Thread.h"
+#include "MUD/threading/WaitableLock.h"
+
+/**
+ * Tees the encoded frames a session receives into a capture file so
+ * client-side problems can be reproduced offline. Enabled by setting
+ * XSTX_RECORD_STREAM to the path of the file to write;
+ * XSTX_RECORD_BUFFER_KB sizes the buffer (8 MB by default).
+ *
+ * The decoder callbacks only copy the frame into a bounded buffer; a
+ * writer thread does the file I/O. If the writer can't keep up the frame
+ * is dropped from the recording rather than delaying the callback.
+ *
+ * File layout; all integers are little endian:
+ *
+ *   header  "XSTXREC\0", u32 version, u32 header size
+ *   record  u8 stream, u8 flags, u16 reserved, u32 size, u64 timestamp
+ *           (microseconds), followed by size bytes of payload: Annex-B
+ *           H.264 for video, one Opus packet for audio
+ *   index   u64 file offset, u64 timestamp of each video record that
+ *           starts with an IDR picture
+ *   trailer u64 index offset, u32 index entries, "XIDX"
+ *
+ * Records are in arrival order with audio and video interleaved, so
+ * playback from an index entry reads forward from its offset. A file
+ * without a trailer (e.g. the client crashed) can still be read
+ * sequentially.
+ */
+class StreamRecorder
+{
+public:
+
+    /** Values of the record stream field */
+    enum EStream
+    {
+        STREAM_VIDEO = 0,
+        STREAM_AUDIO = 1
+    };
+
+    /** Bits of the record flags field */
+    enum EFlags
+    {
+        /** The picture is an IDR picture */
+        FLAG_KEYFRAME = 0x01,
+        /** The frame carries SPS/PPS */
+        FLAG_PARAMETER_SETS = 0x02,
+        /** No payload (e.g. an audio frame to be concealed) */
+        FLAG_EMPTY = 0x04
+    };
+
+    static const char FILE_MAGIC[8];
+    static const char INDEX_MAGIC[4];
+    static const uint32_t FILE_VERSION = 1;
+    static const uint32_t FILE_HEADER_SIZE = 16;
+    static const uint32_t RECORD_HEADER_SIZE = 16;
+    static const uint32_t INDEX_ENTRY_SIZE = 16;
+    static const uint32_t TRAILER_SIZE = 16;
+
+    /**
+     * Create a recorder if XSTX_RECORD_STREAM is set.
+     *
+     * @return an open recorder, or NULL if recording is not requested or
+     *     the file can't be created.
+     */
+    static StreamRecorder *createFromEnvironment();
+
+    /** Constructor */
+    StreamRecorder();
+
+    /** Destructor; closes the file */
+    ~StreamRecorder();
+
+    /**
+     * Create the capture file and start the writer thread.
+     *
+     * @param[in] path file to write
+     * @param[in] bufferSize bytes that may wait for the writer
+     * @return true on success
+     */
+    bool open(const char *path, uint32_t bufferSize);
+
+    /**
+     * Flush everything buffered, write the index and close the file. If
+     * a write failed, the index is left out, so readers only trust the
+     * records that made it to disk.
+     */
+    void close();
+
+    /**
+     * Record a video frame. Safe to call from the decoder callback.
+     */
+    void recordVideoFrame(const XStxEncodedVideoFrame *frame);
+
+    /**
+     * Record an audio frame. Safe to call from the decoder callback.
+     */
+    void recordAudioFrame(const XStxEncodedAudioFrame *frame);
+
+    /**
+     * Classify an Annex-B access unit.
+     *
+     * @return a combination of FLAG_KEYFRAME and FLAG_PARAMETER_SETS
+     */
+    static uint8_t getVideoFrameFlags(const uint8_t *data, uint32_t size);
+
+private:
+
+    /**
+     * Copy a record into the buffer, or count it as dropped if the
+     * buffer is full.
+     */
+    void record(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+                const uint8_t *data, uint32_t size);
+
+    /**
+     * Copy bytes into the ring at the given (unwrapped) position.
+     */
+    void copyIn(uint64_t position, const uint8_t *data, uint32_t size);
+
+    /**
+     * Writer thread body.
+     */
+    void writerLoop();
+
+    /**
+     * Write everything buffered so far. After a failed write, stops
+     * recording and throws the buffer away.
+     */
+    void drain();
+
+    DEFINE_METHOD_THREAD(WriterThread, StreamRecorder, writerLoop);
+
+    struct IndexEntry
+    {
+        uint64_t mOffset;
+        uint64_t mTimestampUs;
+    };
+
+    FILE *mFile;
+    WriterThread *mWriterThread;
+    volatile bool mStopping;
+
+    /**
+     * Ring buffer between the callbacks and the writer. Positions only
+     * grow; the ring offset is position % size. Guarded by mLock, which
+     * also wakes the writer.
+     */
+    std::vector<uint8_t> mBuffer;
+    uint64_t mReadPosition;
+    uint64_t mWritePosition;
+    mud::WaitableLock mLock;
+
+    /** File offset of the next record; guarded by mLock */
+    uint64_t mFileOffset;
+    std::vector<IndexEntry> mIndex;
+
+    /**
+     * Set when a write fails; mFileOffset and mIndex no longer match the
+     * file after that. Guarded by mLock.
+     */
+    bool mWriteFailed;
+
+    /** Statistics; guarded by mLock */
+    uint32_t mRecordedFrames;
+    uint32_t mDroppedFrames;
+};
+
+#endif // _included_StreamRecorder_h
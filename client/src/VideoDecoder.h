@@ -23,6 +23,54 @@
 
 #include "XStx/common/XStxAPI.h"
 
+/**
+ * The frames VideoModule hands out. The decoder may hang its own state
+ * for the picture (e.g. a reference to the decoder's buffer) on
+ * mDecoderData; it is released through VideoDecoder::releaseFrame() when
+ * the frame is recycled.
+ */
+struct DecodedVideoFrame : public XStxRawVideoFrame
+{
+    void *mDecoderData;
+};
+
+/**
+ * Receives the pictures of a decoder that decodes on its own thread
+ * instead of returning them from VideoDecoder::decodeFrame().
+ */
+class DecodedFrameSink
+{
+public:
+    /**
+     * Destructor.
+     */
+    virtual ~DecodedFrameSink() { };
+
+    /**
+     * Reserve a frame to describe a decoded picture.
+     *
+     * @param[out] frame the reserved frame
+     * @return XSTX_RESULT_OK on success; XSTX_RESULT_FRAME_NOT_AVAILABLE if
+     *     the picture should be dropped.
+     */
+    virtual XStxResult getDecodedFrame(DecodedVideoFrame **frame) = 0;
+
+    /**
+     * Render a frame reserved with getDecodedFrame(). Blocks until the
+     * renderer is done with the planes.
+     *
+     * @param[in] frame the frame to render
+     */
+    virtual XStxResult renderDecodedFrame(DecodedVideoFrame *frame) = 0;
+
+    /**
+     * Give back a frame reserved with getDecodedFrame().
+     *
+     * @param[in] frame the frame to recycle
+     */
+    virtual XStxResult recycleDecodedFrame(DecodedVideoFrame *frame) = 0;
+};
+
 /**
  * The abstract video decoder.
  */
@@ -105,6 +153,30 @@ public :
      */
     virtual void release() { }
 
+    /**
+     * The frame is being recycled; release whatever decodeFrame() attached
+     * to it.
+     *
+     * @param[in] frame the frame being recycled
+     */
+    virtual void releaseFrame(DecodedVideoFrame *frame) { }
+
+    /**
+     * Give the decoder somewhere to send pictures it decodes
+     * asynchronously. Decoders that always return the picture from
+     * decodeFrame() ignore this.
+     *
+     * @param[in] sink where decoded pictures go; owned by the caller
+     */
+    virtual void setFrameSink(DecodedFrameSink *sink) { }
+
+    /**
+     * Discard queued packets and any pictures still in flight, e.g. when
+     * the stream restarts after a reconnect. May be called from any
+     * thread.
+     */
+    virtual void flush() { }
+
     /**
      * Pass general configuration parameters to decoder
      * TODO: will be made pure virtual once each client platform implements this.
@@ -20,7 +20,9 @@
 #include "VideoPipeline.h"
 
 #include <MUD/base/TimeVal.h>
+#include <MUD/memory/SlabArena.h>
 #include <assert.h>
+#include <new>
 
 #undef LOG_TAG
 #define LOG_TAG "VideoModule"
@@ -58,7 +60,13 @@ XStxResult decodeFrame(void *context, XStxEncodedVideoFrame *enc,
         LOGD("Client Video Timestamp: %llu", enc->mTimestampUs);
     }
 
-    XStxResult result = ((VideoDecoder *)context)->decodeFrame(enc, dec);
+    VideoModule *vm = (VideoModule *)context;
+    if (vm->getRecorder())
+    {
+        vm->getRecorder()->recordVideoFrame(enc);
+    }
+
+    XStxResult result = vm->getDecoder()->decodeFrame(enc, dec);
 
     uint64_t finishTime = mud::TimeVal::mono().toMilliSeconds();
     uint32_t totalTime = (uint32_t)(finishTime - startTime);
@@ -146,10 +154,20 @@ class RawVideoFrameAllocator :
 {
 
 public:
-    RawVideoFrameAllocator(uint32_t maxWidth, uint32_t maxHeight) :
-        mMaxWidth(maxWidth),
-        mMaxHeight(maxHeight)
+    /**
+     * Constructor
+     * @param[in] maxWidth maximum width
+     * @param[in] maxHeight maximum height
+     * @param[in] numFrames number of frames the pool will hold; their
+     *     descriptors are carved from one SlabArena
+     */
+    RawVideoFrameAllocator(uint32_t maxWidth, uint32_t maxHeight,
+                           uint32_t numFrames) :
+        mMaxHeight(maxHeight),
+        mMaxWidth(maxWidth)
     {
+        mArena.init(sizeof(DecodedVideoFrame), numFrames,
+                    mud::SlabArena::flagsFromEnvironment());
     }
 
     /**
@@ -159,10 +177,16 @@ public:
     XStxRawVideoFrame* allocate()
     {
 
-        // allocate memory
-        XStxRawVideoFrame *frame = new XStxRawVideoFrame;
+        // allocate memory from the arena, or the heap once it is used up
+        void *slot = mArena.allocate();
+        DecodedVideoFrame *frame = slot != NULL ?
+            new(slot) DecodedVideoFrame : new(std::nothrow) DecodedVideoFrame;
+        if (frame == NULL)
+        {
+            return NULL;
+        }
 
-        memset(frame, 0, sizeof(XStxRawVideoFrame));
+        memset(frame, 0, sizeof(DecodedVideoFrame));
 
         // initialize newly allocated raw video frame
         frame->mWidth = mMaxWidth;
@@ -176,6 +200,8 @@ public:
         frame->mStrides[1] = 0;
         frame->mStrides[2] = 0;
 
+        frame->mDecoderData = NULL;
+
         return frame;
     }
 
@@ -185,13 +211,25 @@ public:
      */
     void deallocate(XStxRawVideoFrame *frame)
     {
-        delete frame;
+        DecodedVideoFrame *decoded = static_cast<DecodedVideoFrame *>(frame);
+        if (mArena.owns(decoded))
+        {
+            decoded->~DecodedVideoFrame();
+            mArena.deallocate(decoded);
+        }
+        else
+        {
+            delete decoded;
+        }
     }
 
     // currently not used since we don't need to allocate data
     // AVFrame does that for us
     uint32_t mMaxHeight;
     uint32_t mMaxWidth;
+
+private:
+    mud::SlabArena mArena;
 };
 
 
@@ -203,7 +241,7 @@ public:
  *  Constructor
  */
 VideoModule::VideoModule() :
-    mDecoder(NULL), mRenderer(NULL),
+    mDecoder(NULL), mRenderer(NULL), mRecorder(NULL),
     mPaused(false)
 {
     memset(&mStxDecoder, 0, sizeof(mStxDecoder));
@@ -230,7 +268,8 @@ XStxResult VideoModule::initAllocator(uint32_t maxWidth, uint32_t maxHeight)
 {
     // instantiate allocator
     shared_ptr<RawVideoFrameAllocator>
-        allocator(new RawVideoFrameAllocator(maxWidth, maxHeight));
+        allocator(new RawVideoFrameAllocator(maxWidth, maxHeight,
+                                             NUM_FRAMES_IN_POOL));
     if (mFramePool.allocate(allocator, NUM_FRAMES_IN_POOL) != SIMPLE_RESULT_OK)
     {
         // failed allocate memory
@@ -272,6 +311,19 @@ XStxResult VideoModule::getFrame(uint32_t width, uint32_t height,
  */
 XStxResult VideoModule::recycleFrame(XStxRawVideoFrame *frameToRecycle)
 {
+    if (!mFramePool.isInUse(frameToRecycle))
+    {
+        // doesn't belong to this pool
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+
+    // every frame in the pool is a DecodedVideoFrame; let the decoder drop
+    // its reference to the picture before the frame can be reused
+    if (mDecoder)
+    {
+        mDecoder->releaseFrame(static_cast<DecodedVideoFrame *>(frameToRecycle));
+    }
+
     // recycle it back to frame pool
     if (mFramePool.recycleElement(frameToRecycle) != SIMPLE_RESULT_OK)
     {
@@ -283,6 +335,54 @@ XStxResult VideoModule::recycleFrame(XStxRawVideoFrame *frameToRecycle)
     return XSTX_RESULT_OK;
 }
 
+/**
+ * Reserve a frame for a picture decoded asynchronously.
+ * @param[out] frame to return pointer to video frame
+ */
+XStxResult VideoModule::getDecodedFrame(DecodedVideoFrame **frame)
+{
+    XStxRawVideoFrame *reservedFrame = NULL;
+    XStxResult result = getFrame(0, 0, &reservedFrame);
+    if (result == XSTX_RESULT_OK)
+    {
+        *frame = static_cast<DecodedVideoFrame *>(reservedFrame);
+    }
+    return result;
+}
+
+/**
+ * Render a picture decoded asynchronously.
+ * @param[in] frame frame reserved with getDecodedFrame()
+ */
+XStxResult VideoModule::renderDecodedFrame(DecodedVideoFrame *frame)
+{
+    if (frame == NULL)
+    {
+        assert(false);
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+
+    // postFrame() blocks until the renderer has picked the frame up
+    return mRenderer->postFrame(frame);
+}
+
+/**
+ * Recycle a frame reserved with getDecodedFrame().
+ * @param[in] frame frame reserved with getDecodedFrame()
+ */
+XStxResult VideoModule::recycleDecodedFrame(DecodedVideoFrame *frame)
+{
+    return recycleFrame(frame);
+}
+
+void VideoModule::flush()
+{
+    if (mDecoder)
+    {
+        mDecoder->flush();
+    }
+}
+
 /**
  * Initialize video module
  * @param[in] clientHandle handle to XStx client
@@ -330,11 +430,12 @@ bool VideoModule::initialize(XStxClientHandle mClientHandle, VideoRenderer &vr)
     }
 
     mRenderer->setDecodeType(mDecoder->getDecodeType());
+    mDecoder->setFrameSink(this);
 
     mStxDecoder.mStartFcn = &videoDecoderStart;
     mStxDecoder.mStartCtx = mDecoder;
     mStxDecoder.mDecodeVideoFrameFcn = &decodeFrame;
-    mStxDecoder.mDecodeVideoFrameCtx = mDecoder;
+    mStxDecoder.mDecodeVideoFrameCtx = this;
     mStxDecoder.mGetCapabilitiesCtx = this;
     mStxDecoder.mGetCapabilitiesFcn = &pipelineVideoDecoderGetCapabilities;
     mStxDecoder.mSize = sizeof(mStxDecoder);
@@ -26,6 +26,7 @@
 
 #include "VideoRenderer.h"
 #include "VideoDecoder.h"
+#include "StreamRecorder.h"
 
 /**
  * VideoModule provides video frames and holds a VideoRenderer and a
@@ -35,8 +36,11 @@
  * in a file (typically) called VideoPipeline.cpp. That file is defined
  * for each supported platform, and instantiates the appropriate video
  * decoder and renderer for its associated platform.
+ *
+ * VideoModule is also the DecodedFrameSink for decoders that decode on
+ * their own thread, so their pictures come out of the same frame pool.
  */
-class VideoModule
+class VideoModule : public DecodedFrameSink
 {
 public:
 
@@ -79,6 +83,30 @@ public:
      */
     XStxResult recycleFrame(XStxRawVideoFrame *frameToRecycle);
 
+    /**
+     * Reserve a frame for a picture decoded asynchronously.
+     * @param[out] frame to return pointer to video frame
+     */
+    XStxResult getDecodedFrame(DecodedVideoFrame **frame);
+
+    /**
+     * Render a picture decoded asynchronously.
+     * @param[in] frame frame reserved with getDecodedFrame()
+     */
+    XStxResult renderDecodedFrame(DecodedVideoFrame *frame);
+
+    /**
+     * Recycle a frame reserved with getDecodedFrame().
+     * @param[in] frame frame reserved with getDecodedFrame()
+     */
+    XStxResult recycleDecodedFrame(DecodedVideoFrame *frame);
+
+    /**
+     * The stream restarted (e.g. after a reconnect); drop whatever the
+     * decoder still holds from the old one.
+     */
+    void flush();
+
     /**
      * The app has gone to sleep; pause all processing.
      *
@@ -99,6 +127,29 @@ public:
      */
     VideoRenderer* getRenderer() { return mRenderer; }
 
+    /**
+     * Get the current video decoder.
+     *
+     * @return A pointer to the video decoder, or NULL if none has been created
+     *     yet.
+     */
+    VideoDecoder* getDecoder() { return mDecoder; }
+
+    /**
+     * Record every encoded frame before it is decoded.
+     *
+     * @param[in] recorder the recorder, or NULL to stop recording; owned by
+     *     the caller
+     */
+    void setRecorder(StreamRecorder *recorder) { mRecorder = recorder; }
+
+    /**
+     * Get the stream recorder.
+     *
+     * @return A pointer to the recorder, or NULL if not recording.
+     */
+    StreamRecorder* getRecorder() { return mRecorder; }
+
     /**
      * A call that lets us know what offset we should use for the surface when
      * the keyboard is present.
@@ -129,6 +180,11 @@ private:
      */
     VideoRenderer *mRenderer;
 
+    /**
+     *  recorder for the encoded stream
+     */
+    StreamRecorder *mRecorder;
+
     /**
      *  pool for video frames
      */
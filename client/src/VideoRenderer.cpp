@@ -17,12 +17,22 @@
 
 
 #include "VideoRenderer.h"
+#include "AVSyncClock.h"
+#include "CaptureSink.h"
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ThreadUtil.h"
 
 #undef LOG_TAG
 #define LOG_TAG "VideoRenderer"
 #include "log.h"
 #include <assert.h>
 #include <math.h>
+#include <new>
+#include <string.h>
+
+/** Longest the presentation thread waits before rechecking for stop() */
+static const uint64_t PRESENT_WAIT_MS = 10;
 
 VideoRenderer::~VideoRenderer()
 {
@@ -40,6 +50,57 @@ XStxResult VideoRenderer::postFrame(const XStxRawVideoFrame *frame)
     if(mExiting)
         return XSTX_RESULT_OK;
 
+    // Follow the audio if it is playing, else the stream timestamps
+    AVSyncClock::EDecision sync = AVSyncClock::NO_CLOCK;
+    uint64_t presentAtUs = 0;
+    if (mSyncClock != NULL)
+    {
+        sync = mSyncClock->schedule(frame->mTimestampUs,
+                                    mud::TimeVal::mono().toMicroSeconds(),
+                                    presentAtUs);
+        if (sync == AVSyncClock::DROP)
+        {
+            return XSTX_RESULT_OK;
+        }
+    }
+    if (sync == AVSyncClock::NO_CLOCK && mScheduler.isEnabled())
+    {
+        if (mScheduler.schedule(frame->mTimestampUs,
+                                mud::TimeVal::mono().toMicroSeconds(),
+                                presentAtUs) == PresentationScheduler::DROP)
+        {
+            // Too late to be worth showing; the frame goes back to the pool
+            return XSTX_RESULT_OK;
+        }
+        sync = AVSyncClock::PRESENT;
+    }
+
+    // Hold the frame until its presentation time. It waits in the
+    // presentation queue, so decoding keeps going ahead meanwhile; that
+    // is what absorbs the jitter.
+    bool hold = sync == AVSyncClock::PRESENT;
+
+    // A frame that needs no hold still goes behind any that are queued,
+    // so frames are never shown out of order
+    if ((hold || isPresentationPending()) && queueFrame(frame, presentAtUs))
+    {
+        return XSTX_RESULT_OK;
+    }
+    if (hold)
+    {
+        // Hardware surfaces can't be copied; hold them here instead
+        waitUntil(presentAtUs);
+
+        if (mExiting)
+            return XSTX_RESULT_OK;
+    }
+
+    presentFrame(frame);
+    return XSTX_RESULT_OK;
+}
+
+void VideoRenderer::presentFrame(const XStxRawVideoFrame *frame)
+{
     mFrame = frame;
 
     // If the new video frame is a different size than the previous frame,
@@ -53,17 +114,186 @@ XStxResult VideoRenderer::postFrame(const XStxRawVideoFrame *frame)
     // wait for rendering to pick up frame
     mSampleLock.waitForSignalAndLock();
     mSampleLock.unlock();
+}
 
-    return XSTX_RESULT_OK;
+void VideoRenderer::stop()
+{
+    mExiting = true;
+    mSampleLock.lock();
+    mFrame = NULL;
+    mSampleLock.signal();
+    mSampleLock.unlock();
+
+    mQueueLock.lock();
+    mQueueLock.signal();
+    mQueueLock.unlock();
+    mSlotLock.lock();
+    mSlotLock.signal();
+    mSlotLock.unlock();
+
+    if (mPresentThread != NULL)
+    {
+        mPresentThread->join();
+        delete mPresentThread;
+        mPresentThread = NULL;
+    }
+    mQueueHead = 0;
+    mQueueCount = 0;
+}
+
+bool VideoRenderer::getPlaneRows(const XStxRawVideoFrame *frame,
+                                 uint32_t rows[3]) const
+{
+    uint32_t chromaRows = (frame->mHeight + 1) / 2;
+    switch (mDecodeType)
+    {
+    case VideoDecoder::DECODE_PLANES:
+    case VideoDecoder::DECODE_INTERLEAVED:
+        break;
+    case VideoDecoder::DECODE_PLANES444:
+        chromaRows = frame->mHeight;
+        break;
+    default:
+        return false;
+    }
+    rows[0] = frame->mHeight;
+    rows[1] = chromaRows;
+    rows[2] = chromaRows;
+    return true;
+}
+
+bool VideoRenderer::isPresentationPending()
+{
+    mQueueLock.lock();
+    bool pending = mQueueCount > 0;
+    mQueueLock.unlock();
+    return pending;
+}
+
+bool VideoRenderer::queueFrame(const XStxRawVideoFrame *frame,
+                               uint64_t presentAtUs)
+{
+    uint32_t rows[3];
+    if (!getPlaneRows(frame, rows))
+    {
+        return false;
+    }
+
+    if (mPresentThread == NULL)
+    {
+        mPresentThread = new(std::nothrow) PresentThread("VideoPresent", *this);
+        if (mPresentThread == NULL || mPresentThread->start() != SIMPLE_RESULT_OK)
+        {
+            LOGE("Failed to start the presentation thread");
+            delete mPresentThread;
+            mPresentThread = NULL;
+            return false;
+        }
+    }
+
+    // Decoding runs at most PRESENT_QUEUE_DEPTH frames ahead
+    mQueueLock.lock();
+    while (mQueueCount == PRESENT_QUEUE_DEPTH && !mExiting)
+    {
+        mQueueLock.unlock();
+        mSlotLock.waitForSignalAndLock(PRESENT_WAIT_MS);
+        mSlotLock.unlock();
+        mQueueLock.lock();
+    }
+    if (mExiting)
+    {
+        mQueueLock.unlock();
+        return true;
+    }
+    // Only this thread fills slots, and the presentation thread doesn't
+    // touch this one until it is counted, so the copy needs no lock
+    QueuedFrame &queued = mQueue[(mQueueHead + mQueueCount) % PRESENT_QUEUE_DEPTH];
+    mQueueLock.unlock();
+
+    size_t sizes[3];
+    size_t total = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        sizes[i] = frame->mPlanes[i] != NULL ?
+            (size_t)frame->mStrides[i] * rows[i] : 0;
+        total += sizes[i];
+    }
+    if (queued.mBuffer.size() < total)
+    {
+        queued.mBuffer.resize(total);
+    }
+
+    queued.mFrame = *frame;
+    size_t offset = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (sizes[i] == 0)
+        {
+            queued.mFrame.mPlanes[i] = NULL;
+            continue;
+        }
+        queued.mFrame.mPlanes[i] = &queued.mBuffer[offset];
+        memcpy(queued.mFrame.mPlanes[i], frame->mPlanes[i], sizes[i]);
+        offset += sizes[i];
+    }
+    queued.mPresentAtUs = presentAtUs;
+
+    mQueueLock.lock();
+    mQueueCount++;
+    mQueueLock.signal();
+    mQueueLock.unlock();
+    return true;
+}
+
+void VideoRenderer::presentLoop()
+{
+    while (!mExiting)
+    {
+        mQueueLock.waitForSignalAndLock(PRESENT_WAIT_MS);
+        QueuedFrame *queued = mQueueCount > 0 ? &mQueue[mQueueHead] : NULL;
+        mQueueLock.unlock();
+
+        if (queued == NULL)
+        {
+            continue;
+        }
+
+        waitUntil(queued->mPresentAtUs);
+        if (mExiting)
+        {
+            break;
+        }
+        presentFrame(&queued->mFrame);
+
+        mQueueLock.lock();
+        mQueueHead = (mQueueHead + 1) % PRESENT_QUEUE_DEPTH;
+        mQueueCount--;
+        if (mQueueCount > 0)
+        {
+            // Don't wait for a signal that was already taken
+            mQueueLock.signal();
+        }
+        mQueueLock.unlock();
+
+        mSlotLock.lock();
+        mSlotLock.signal();
+        mSlotLock.unlock();
+    }
 }
 
 int VideoRenderer::checkQueue()
 {
     int frame = 0;
+    uint64_t timestampUs = 0;
     mSampleLock.lock();
     if (mFrame != NULL && !mExiting)
     {
+        timestampUs = mFrame->mTimestampUs;
         render();
+        if (mCaptureSink != NULL)
+        {
+            mCaptureSink->captureVideoFrame(mFrame);
+        }
         mFrame = NULL;
         frame = 1;
         mFrameValid = true;
@@ -71,9 +301,51 @@ int VideoRenderer::checkQueue()
     }
     mSampleLock.unlock();
 
+    if (frame && mSyncClock != NULL)
+    {
+        mSyncClock->framePresented(timestampUs,
+                                   mud::TimeVal::mono().toMicroSeconds());
+    }
+
+    if (mScheduler.isEnabled())
+    {
+        uint64_t now = mud::TimeVal::mono().toMicroSeconds();
+        if (frame)
+        {
+            mScheduler.framePresented(now);
+        }
+        else
+        {
+            mScheduler.frameMissed(now);
+        }
+    }
+
     return frame;
 }
 
+void VideoRenderer::waitUntil(uint64_t presentAtUs)
+{
+    for (;;)
+    {
+        uint64_t now = mud::TimeVal::mono().toMicroSeconds();
+        if (mExiting || now >= presentAtUs)
+        {
+            return;
+        }
+        // Sleep in short slices so that stop() is honored promptly, and
+        // spin out the last millisecond for accuracy.
+        uint64_t remainingMs = (presentAtUs - now) / 1000;
+        if (remainingMs > 1)
+        {
+            mud::ThreadUtil::sleep(remainingMs > 10 ? 10 : (unsigned long)(remainingMs - 1));
+        }
+        else
+        {
+            mud::ThreadUtil::yield();
+        }
+    }
+}
+
 void VideoRenderer::setSourceDimensions(uint32_t w, uint32_t h)
 {
     mSourceWidth = w;
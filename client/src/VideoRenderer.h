@@ -20,15 +20,26 @@
 #define _included_VideoRenderer_h
 
 #include <stdint.h>
+#include <vector>
 #include "XStx/client/XStxClientAPI.h"
+#include "MUD/threading/Thread.h"
 #include "MUD/threading/WaitableLock.h"
 
 #include "VideoDecoder.h"
+#include "PresentationScheduler.h"
+
+class AVSyncClock;
+class CaptureSink;
 
 /**
  * The base class of the video renderer. Handles queuing of frames
  * for the actual render, but the render itself happens (typically)
  * in another thread.
+ *
+ * Frames that have to wait for their presentation time are copied out
+ * of the XStx frame pool into a short queue, and handed to the render
+ * thread by a presentation thread once they are due, so the thread
+ * posting them goes straight back to decoding.
  */
 class VideoRenderer
 {
@@ -50,7 +61,12 @@ public:
         mScale(0),
         mExiting(false),
         mFrameValid(false),
-        mFrame(NULL)
+        mFrame(NULL),
+        mSyncClock(NULL),
+        mCaptureSink(NULL),
+        mQueueHead(0),
+        mQueueCount(0),
+        mPresentThread(NULL)
     { };
 
     /**
@@ -99,7 +115,9 @@ public:
     /**
      * Queue the given frame to render. Blocks until the frame
      * has been queued so that, on return from this function, the
-     * frame can be freed and reused.
+     * frame can be freed and reused. A frame that is held for its
+     * presentation time is copied, so this only blocks when the
+     * presentation queue is full.
      *
      * @param[in] frame to render
      */
@@ -241,17 +259,45 @@ public:
     virtual bool isChromaSamplingSupported(XStxChromaSampling chromaSampling) { return false; }
 
     /**
-     * Stop checking queue for new frames to render
+     * Get the scheduler that decides when posted frames are shown.
+     *
+     * @return The presentation scheduler.
+     */
+    PresentationScheduler& getPresentationScheduler()
+    {
+        return mScheduler;
+    }
+
+    /**
+     * Set the audio clock frames are synchronized to. When it is enabled
+     * and audio is playing, it decides when posted frames are shown in
+     * place of the presentation scheduler; the A/V offset of every shown
+     * frame is reported to it either way.
+     *
+     * @param[in] syncClock the clock, or NULL; owned by the caller
      */
-    void stop()
+    void setSyncClock(AVSyncClock *syncClock)
     {
-        mExiting = true;
-        mSampleLock.lock();
-        mFrame = NULL;
-        mSampleLock.signal();
-        mSampleLock.unlock();
+        mSyncClock = syncClock;
     }
 
+    /**
+     * Set where rendered frames are captured to. Every frame is handed
+     * to it just after render().
+     *
+     * @param[in] captureSink the sink, or NULL; owned by the caller
+     */
+    void setCaptureSink(CaptureSink *captureSink)
+    {
+        mCaptureSink = captureSink;
+    }
+
+    /**
+     * Stop checking queue for new frames to render. Frames waiting in
+     * the presentation queue are discarded.
+     */
+    void stop();
+
 protected:
     /**
      * Set the scale and offset values, calculated based on the relative
@@ -308,6 +354,108 @@ protected:
      * The current video frame.
      */
     const XStxRawVideoFrame *mFrame;
+
+    /**
+     * Timestamp-driven presentation and jitter buffering.
+     */
+    PresentationScheduler mScheduler;
+
+    /**
+     * Audio master clock, or NULL.
+     */
+    AVSyncClock *mSyncClock;
+
+    /**
+     * Capture of rendered frames, or NULL.
+     */
+    CaptureSink *mCaptureSink;
+
+private:
+    /**
+     * Frames that can wait in the presentation queue at once; enough to
+     * cover the audio delay video is held for when following the audio.
+     */
+    static const uint32_t PRESENT_QUEUE_DEPTH = 8;
+
+    /**
+     * A posted frame copied out of the XStx frame pool, waiting for its
+     * presentation time.
+     */
+    struct QueuedFrame
+    {
+        XStxRawVideoFrame mFrame;       ///< The copy; planes point into mBuffer.
+        std::vector<uint8_t> mBuffer;   ///< Plane data.
+        uint64_t mPresentAtUs;          ///< When to show it; 0 for right away.
+    };
+
+    /**
+     * Hand a frame to the render thread and wait until it has been
+     * rendered, or until the renderer is stopped.
+     *
+     * @param[in] frame to render
+     */
+    void presentFrame(const XStxRawVideoFrame *frame);
+
+    /**
+     * Copy a frame into the presentation queue, waiting for room if
+     * the queue is full. Starts the presentation thread on first use.
+     *
+     * @param[in] frame to queue
+     * @param[in] presentAtUs monotonic time to show it at, or 0
+     *
+     * @return false if the frame can't be copied (a hardware surface)
+     *     or the thread can't be started; it has to be shown directly.
+     */
+    bool queueFrame(const XStxRawVideoFrame *frame, uint64_t presentAtUs);
+
+    /**
+     * @return true if frames are waiting in, or being shown from, the
+     *     presentation queue
+     */
+    bool isPresentationPending();
+
+    /**
+     * Get how many rows of each plane a frame of the current decode type
+     * has.
+     *
+     * @param[in] frame the frame
+     * @param[out] rows rows of the Y, U and V planes
+     *
+     * @return false if the planes are not in memory the renderer can copy
+     */
+    bool getPlaneRows(const XStxRawVideoFrame *frame, uint32_t rows[3]) const;
+
+    /**
+     * Present queued frames as they fall due, until stop().
+     */
+    void presentLoop();
+
+    /**
+     * Block the calling thread until the given time, or until the
+     * renderer is stopped.
+     *
+     * @param[in] presentAtUs monotonic time in microseconds
+     */
+    void waitUntil(uint64_t presentAtUs);
+
+    DEFINE_METHOD_THREAD(PresentThread, VideoRenderer, presentLoop);
+
+    QueuedFrame mQueue[PRESENT_QUEUE_DEPTH];
+    uint32_t mQueueHead;            ///< Index of the oldest queued frame.
+    uint32_t mQueueCount;           ///< Frames queued, including the one being shown.
+
+    /**
+     * Guards mQueueHead and mQueueCount; signaled when a frame is
+     * queued or stop() is called.
+     */
+    mud::WaitableLock mQueueLock;
+
+    /**
+     * Signaled when the presentation thread frees a queue slot.
+     */
+    mud::WaitableLock mSlotLock;
+
+    PresentThread *mPresentThread;
 };
 
 #endif //_included_VideoRenderer_h
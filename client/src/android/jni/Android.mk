@@ -20,12 +20,24 @@ LOCAL_MODULE    := appstreamsample
 LOCAL_SRC_FILES := \
     $(CLIENT_PATH)/src/AudioModule.cpp \
     $(CLIENT_PATH)/src/AudioRenderer.cpp \
+    $(CLIENT_PATH)/src/audio_utility/AudioChannelMixer.cpp \
+    $(CLIENT_PATH)/src/audio_utility/AudioFormatConverter.cpp \
+    $(CLIENT_PATH)/src/audio_utility/AudioJitterBuffer.cpp \
+    $(CLIENT_PATH)/src/audio_utility/AudioResampler.cpp \
+    $(CLIENT_PATH)/src/audio_utility/WsolaStretcher.cpp \
     $(CLIENT_PATH)/src/ffmpeg_decoder/H264ToYuv.cpp \
     $(CLIENT_PATH)/src/ffmpeg_decoder/AVHelper.cpp \
     $(CLIENT_PATH)/src/VideoModule.cpp \
     $(CLIENT_PATH)/src/VideoRenderer.cpp \
+    $(CLIENT_PATH)/src/PresentationScheduler.cpp \
+    $(CLIENT_PATH)/src/AVSyncClock.cpp \
+    $(CLIENT_PATH)/src/StreamRecorder.cpp \
+    $(CLIENT_PATH)/src/CaptureSink.cpp \
     $(CLIENT_PATH)/src/AppStreamWrapper.cpp \
     $(CLIENT_PATH)/src/opus_decoder/OpusDecoder.cpp \
+    $(CLIENT_PATH)/src/h264_utility/NALUtils.cpp \
+    $(CLIENT_PATH)/src/h264_utility/BitStreamReader.cpp \
+    $(CLIENT_PATH)/src/h264_utility/ParameterSetStore.cpp \
     AudioPipeline.cpp \
     AndroidAudioRenderer.cpp \
     AndroidVideoDecoder.cpp \
@@ -48,7 +60,7 @@ LOCAL_ARM_MODE := arm
 LOCAL_CFLAGS += -D__STDINT_MACROS
 LOCAL_LDLIBS := -lz -llog -lGLESv2 -lOpenSLES
 
-LOCAL_C_INCLUDES := $(ROOT_PATH)/3rdparty $(ROOT_PATH)/example_src/common $(ROOT_PATH)/include $(FFMPEG)/include $(OPUS)/include $(CLIENT_PATH)/src
+LOCAL_C_INCLUDES := $(ROOT_PATH)/3rdparty $(ROOT_PATH)/example_src/common $(ROOT_PATH)/include $(FFMPEG)/include $(OPUS)/include $(CLIENT_PATH)/src $(CLIENT_PATH)/src/h264_utility $(CLIENT_PATH)/src/audio_utility
 
 LOCAL_STATIC_LIBRARIES := opus
 LOCAL_SHARED_LIBRARIES := XStxClientLibraryShared avutil avformat avcodec swresample
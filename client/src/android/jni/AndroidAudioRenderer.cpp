@@ -72,7 +72,7 @@ XStxRawAudioFrame* AndroidAudioRenderer::popFrame(int delay, int msBuffer)
      * give us a more exact value.
      */
 
-    XStxResult result = XStxGetNextAudioFrame(mClientHandle, &frame, delay, msBuffer);
+    XStxResult result = getNextFrame(&frame, delay, msBuffer);
     if (result != XSTX_RESULT_OK)
     {
         return NULL;
@@ -47,77 +47,24 @@ AndroidVideoDecoder::~AndroidVideoDecoder()
 
 
 /*
- findBlockStart() looks for the first NAL unit header in the
- given block.
-
- A NAL unit starts with 0,0,1 or 0,0,0,1 and then a "type" byte.
-
- The first call to findBlockStart() should find the very first
- block; subsequent calls (to find the end of the block/start of the next
- block) are offset exactly enough so that "start" points at the type byte.
-
- In this way findBlockStart() groups all of the "config"-style blocks
- together into one big block, which mimics how Android MediaCodec seems to
- expect it.
+ nextBlock() returns the index of the first NAL unit after the block that
+ starts at NAL unit "first". Each NAL unit is a block of its own, except that
+ the PPS and SEI units that follow an SPS are lumped together with it as one
+ big "config" block, which mimics how Android MediaCodec seems to expect it.
 */
-
-uint8_t* findBlockStart(uint8_t *start, uint8_t *end)
+static uint32_t nextBlock(const NALUnitIndex &index, uint32_t first)
 {
-    // we're lumping together all the "config" frames as one big frame
-    bool inConfig = (start[0] == 0x67 || (start[0] == 1 && start[1] == 0x67));
-
-    while (end > start)
+    uint32_t next = first + 1;
+    if (index.getUnit(first).type == NAL_TYPE_SPS)
     {
-        start = (uint8_t *)memchr(start, 0, end - start);
-
-        // no more zeros? or no more room for a header + data? None to find.
-        if (start == NULL || (end - start) <= 5)
-        {
-            return NULL;
-        }
-        else
+        while (next < index.getCount() &&
+               (index.getUnit(next).type == NAL_TYPE_PPS ||
+                index.getUnit(next).type == NAL_TYPE_SEI))
         {
-            if (start[1] != 0)
-            {
-                start++;
-                continue;
-            }
-
-            // 0 0 1 is valid
-            if (start[2] == 1)
-            {
-                if (inConfig && (start[3] == 0x68 || start[3] == 0x6))
-                {
-                    start++;
-                    continue;
-                }
-                return start;
-            }
-
-            if (start[2] != 0)
-            {
-                start++;
-                continue;
-            }
-
-            // 0 0 0 1 is valid
-            if (start[3] == 1)
-            {
-                if (inConfig && (start[4] == 0x68 || start[4] == 0x6))
-                {
-                    start++;
-                    continue;
-                }
-                return start;
-            }
-
-            start++;
+            next++;
         }
-
-        return start;
     }
-
-    return NULL;
+    return next;
 }
 
 /**
@@ -155,40 +102,35 @@ XStxResult AndroidVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawV
         }
 
         uint8_t *blockEnd = enc->mData + enc->mDataSize;
-        uint8_t *start = findBlockStart(enc->mData, blockEnd);
+        uint32_t nalCount = mNALIndex.build(enc->mData, enc->mDataSize);
 
-        if (!start)
+        if (nalCount == 0)
         {
             uint8_t *buffer = enc->mData;
             LOGE("Header not found: Actual buffer header %d,%d,%d,%d,0x%x (0x%x)", buffer[0], buffer[1], buffer[2], buffer[3], buffer[4], buffer[5]);
             return XSTX_RESULT_VIDEO_DECODING_ERROR;
         }
 
-        uint8_t *end = findBlockStart(start + 3, blockEnd); // skip over the first few bytes
-
-        if (!end)
+        uint32_t next;
+        for (uint32_t first = 0; first < nalCount; first = next)
         {
-            end = blockEnd;
-        }
+            // A block runs from its first start code to the start code of
+            // the next block
+            const nalUnit &unit = mNALIndex.getUnit(first);
+            next = nextBlock(mNALIndex, first);
+            uint8_t *start = enc->mData + unit.offset - unit.headerLength;
+            uint8_t *end = blockEnd;
+            if (next < nalCount)
+            {
+                const nalUnit &nextUnit = mNALIndex.getUnit(next);
+                end = enc->mData + nextUnit.offset - nextUnit.headerLength;
+            }
 
-        // The exit case is tested below.
-        while (true)
-        {
             if (!mFoundInitFrame)
             {
-                if (start[3] != 0x67 && start[4] != 0x67)
+                if (unit.type != NAL_TYPE_SPS)
                 {
-                    LOGV("Skipping non-init frame 0x%x/0x%x", start[3], start[4]); // set it to the next valid start
-                    start = end;
-                    if (start == blockEnd)
-                    {
-                        break;
-                    }
-                    end = findBlockStart(end + 4, blockEnd);
-                    if (!end)
-                    {
-                        end = blockEnd;
-                    }
+                    LOGV("Skipping non-init frame 0x%x", unit.type);
                     continue;
                 }
                 mFoundInitFrame = true;
@@ -198,7 +140,7 @@ XStxResult AndroidVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawV
             uint8_t *buffer = (uint8_t *)androidGetHWBuffer(&size);
             if (!buffer)
             {
-                if (start[3] == 0x67 || start[4] == 0x67)
+                if (unit.type == NAL_TYPE_SPS)
                 {
                     // cache our init frame!
                     mInitFrameLength = end - start;
@@ -216,7 +158,7 @@ XStxResult AndroidVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawV
             }
 
             int length = end - start;
-            if (start[2] == 1)
+            if (unit.headerLength == 3)
             {
                 buffer[0] = 0;
                 memcpy(buffer + 1, start, end - start);
@@ -237,14 +179,6 @@ XStxResult AndroidVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawV
             {
                 androidReleaseHWBuffer(length, 0);
             }
-
-            // set it to the next valid start
-            start = end;
-            end = findBlockStart(end + 4, blockEnd);
-            if (!end)
-            {
-                end = blockEnd;
-            }
         }
 
         static uint8_t dummy = 0;
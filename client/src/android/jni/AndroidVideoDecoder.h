@@ -16,6 +16,7 @@
 #define _included_AndroidVideoDecoder_h
 
 #include "VideoDecoder.h"
+#include "h264_utility/NALUtils.h"
 #include "jniBindings.h"
 
 class AndroidVideoDecoder : public VideoDecoder
@@ -83,6 +84,7 @@ private:
     VideoDecoder *mSWDelegate;
     uint8_t *mInitFrame;
     int mInitFrameLength;
+    NALUnitIndex mNALIndex;
 
     bool mFoundInitFrame;
     bool mClosing;
@@ -405,7 +405,7 @@ XStxRawAudioFrame* CoreAudioRenderer::popFrame(int delay, int msBuffer)
 {
     XStxRawAudioFrame * frame = NULL;
 
-    XStxResult result = XStxGetNextAudioFrame(mClientHandle, &frame, delay, msBuffer) ;
+    XStxResult result = getNextFrame(&frame, delay, msBuffer) ;
     if (result!=XSTX_RESULT_OK)
     {
         if (result==XSTX_RESULT_INVALID_STATE)
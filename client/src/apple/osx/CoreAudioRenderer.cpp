@@ -279,7 +279,7 @@ XStxRawAudioFrame* CoreAudioRenderer::popFrame(int delay, int msBuffer)
 {
     XStxRawAudioFrame * frame = NULL;
     
-    XStxResult result = XStxGetNextAudioFrame(mClientHandle, &frame, delay, msBuffer) ;
+    XStxResult result = getNextFrame(&frame, delay, msBuffer) ;
     if (result!=XSTX_RESULT_OK)
     {
 //        LOGV("%s Failed to get audio frame! %d",__PRETTY_FUNCTION__, result);
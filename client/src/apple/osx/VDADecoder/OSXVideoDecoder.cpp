@@ -85,19 +85,21 @@ XStxResult OSXVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawVideo
     OSType inSourceFormat='avc1';
     CFDataRef inAVCCData;
 
-    uint8_t *blockEnd = enc->mData+enc->mDataSize;
-    uint8_t *start = enc->mData;
+    //Find the frame's NALs once; everything below works from the index
+    mNALIndex.build(enc->mData, enc->mDataSize);
+    //Parameter sets are only parsed again when they change
+    mParameterSets.update(mNALIndex, enc->mData);
 
     if (!mFoundInitFrame) {
         //We don't have the initFrame yet
 
-        uint8 *spsStart = NULL;
+        uint8_t *spsStart = NULL;
         uint32_t spsLength = 0;
-        BOOL foundSPS = getNALUnit(NAL_TYPE_SPS, start, blockEnd, spsStart, spsLength);
+        bool foundSPS = getNALUnit(mNALIndex, NAL_TYPE_SPS, enc->mData, spsStart, spsLength);
 
-        uint8 *ppsStart = NULL;
+        uint8_t *ppsStart = NULL;
         uint32_t ppsLength = 0;
-        BOOL foundPPS = getNALUnit(NAL_TYPE_PPS, start, blockEnd, ppsStart, ppsLength);
+        bool foundPPS = getNALUnit(mNALIndex, NAL_TYPE_PPS, enc->mData, ppsStart, ppsLength);
 
         if (!foundSPS || !foundPPS) {
             LOGE("Did not find SPS or PPS");
@@ -114,13 +116,15 @@ XStxResult OSXVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawVideo
         //Turn it into a CFData
         inAVCCData = CFDataCreate(kCFAllocatorDefault, extraData, extraDataSize*sizeof(UInt8));
 
-        //Parse the SPS packet
-        sps theSPS = parseSPS(spsStart, spsLength);
-
         //Pull the Width & Height from the SPS
         videoWidth = 0;
         videoHeight = 0;
-        getVideoSizeFromSPS(theSPS, videoWidth, videoHeight);
+        const sps *theSPS = mParameterSets.getActiveSPS();
+        if (theSPS != NULL) {
+            getVideoSizeFromSPS(*theSPS, videoWidth, videoHeight);
+            LOGI("Stream is %ux%u, reorders up to %u frames", videoWidth, videoHeight,
+                 getMaxReorderFrames(*theSPS));
+        }
 
 
         //Create the VDADecoder
@@ -188,7 +192,7 @@ XStxResult OSXVideoDecoder::decodeFrame(XStxEncodedVideoFrame *enc, XStxRawVideo
     //We have initialized the decoder so try to decode the video frame
     if (mFoundInitFrame)
     {
-        CFDataRef frameData = convertFrameToData(enc->mData, enc->mDataSize);
+        CFDataRef frameData = convertFrameToData(enc->mData);
 
         if (frameData == NULL) {
             //No frame found
@@ -380,16 +384,16 @@ OSStatus OSXVideoDecoder::CreateDecoder(SInt32 inHeight, SInt32 inWidth,
  * Converts the frame to the format needed for VDADecoder (4-byte size values
  * instead of 00 00 01 NAL headers) and returns it as a CFData
  *
- * @param[in] pointer to the beginning of the frame data
- * @param[in] size of the frame data passed in
+ * @param[in] pointer to the beginning of the frame data, already indexed
+ * into mNALIndex
  */
-CFDataRef OSXVideoDecoder::convertFrameToData ( uint8_t *dataStart, uint32_t dataSize)
+CFDataRef OSXVideoDecoder::convertFrameToData ( uint8_t *dataStart)
 {
     uint8_t *newFrameData = NULL;
     uint32_t newFrameLength = 0;
 
     pthread_mutex_lock(&mFrameDecodeMutex);
-    bool convertedFrame = convertToSizeEncodedVideoFrame(dataStart, dataSize, newFrameData, newFrameLength);
+    bool convertedFrame = convertToSizeEncodedVideoFrame(mNALIndex, dataStart, mFrameBuffer, newFrameData, newFrameLength);
 
     if (!convertedFrame || newFrameLength <= 0) {
         LOGE("Could not convert frame");
@@ -24,6 +24,8 @@
 #include <map>
 
 #include "VideoDecoder.h"
+#include "NALUtils.h"
+#include "ParameterSetStore.h"
 
 class OSXVideoDecoder : public VideoDecoder
 {
@@ -95,10 +97,10 @@ class OSXVideoDecoder : public VideoDecoder
      * Converts the frame to the format needed for VDADecoder (4-byte size values
      * instead of 00 00 01 NAL headers) and returns it as a CFData
      *
-     * @param[in] pointer to the beginning of the frame data
-     * @param[in] size of the frame data passed in
+     * @param[in] pointer to the beginning of the frame data, already indexed
+     * into mNALIndex
      */
-    CFDataRef convertFrameToData ( uint8_t *dataStart, uint32_t dataSize);
+    CFDataRef convertFrameToData ( uint8_t *dataStart);
 
     VideoDecoder * mSWDelegate ;
     uint8_t * mInitFrame ;
@@ -106,6 +108,10 @@ class OSXVideoDecoder : public VideoDecoder
     
     bool mFoundInitFrame ;
     
+    NALUnitIndex mNALIndex;
+    SizeEncodedFrameBuffer mFrameBuffer;
+    ParameterSetStore mParameterSets;
+    
     VDADecoder mVDADecoder;
     
     VideoDecoder *ffmpegDecoder;
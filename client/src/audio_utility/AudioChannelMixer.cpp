@@ -0,0 +1,141 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "AudioChannelMixer.h"
+
+#include <string.h>
+
+namespace
+{
+
+const uint32_t CHANNEL_LFE = 3;
+
+/** -3 dB */
+const double FOLD_GAIN = 0.7071;
+
+inline int16_t saturate16(int32_t x)
+{
+    return (int16_t)(x < -32768 ? -32768 : (x > 32767 ? 32767 : x));
+}
+
+}
+
+AudioChannelMixer::AudioChannelMixer()
+    : mInputChannels(0)
+    , mOutputChannels(0)
+{
+    memset(mGains, 0, sizeof(mGains));
+}
+
+bool AudioChannelMixer::init(uint32_t inputChannels, uint32_t outputChannels)
+{
+    if (inputChannels == 0 || inputChannels > MAX_CHANNELS ||
+        outputChannels == 0 || outputChannels > MAX_CHANNELS)
+    {
+        return false;
+    }
+    mInputChannels = inputChannels;
+    mOutputChannels = outputChannels;
+
+    double gains[MAX_CHANNELS][MAX_CHANNELS];
+    memset(gains, 0, sizeof(gains));
+
+    if (inputChannels == 1)
+    {
+        gains[0][0] = 1.0;
+        if (outputChannels > 1)
+        {
+            gains[1][0] = 1.0;
+        }
+    }
+    else if (outputChannels == 1)
+    {
+        uint32_t mixed = 0;
+        for (uint32_t i = 0; i < inputChannels; i++)
+        {
+            mixed += i == CHANNEL_LFE ? 0 : 1;
+        }
+        for (uint32_t i = 0; i < inputChannels; i++)
+        {
+            gains[0][i] = i == CHANNEL_LFE ? 0.0 : 1.0 / mixed;
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < inputChannels; i++)
+        {
+            if (i < outputChannels)
+            {
+                gains[i][i] = 1.0;
+            }
+            else if (i == 2)
+            {
+                gains[0][i] = FOLD_GAIN;
+                gains[1][i] = FOLD_GAIN;
+            }
+            else if (i != CHANNEL_LFE)
+            {
+                // Surround pairs go to the side they are on
+                gains[i % 2][i] = FOLD_GAIN;
+            }
+        }
+    }
+
+    for (uint32_t o = 0; o < outputChannels; o++)
+    {
+        double sum = 0.0;
+        for (uint32_t i = 0; i < inputChannels; i++)
+        {
+            sum += gains[o][i];
+        }
+        double scale = sum > 1.0 ? 1.0 / sum : 1.0;
+        for (uint32_t i = 0; i < inputChannels; i++)
+        {
+            mGains[o][i] = (int32_t)(gains[o][i] * scale * (1 << GAIN_SHIFT)
+                                     + 0.5);
+        }
+    }
+    return true;
+}
+
+void AudioChannelMixer::process(const int16_t *in, uint32_t samplesPerChannel,
+                                int16_t *out) const
+{
+    if (isPassthrough())
+    {
+        memcpy(out, in, samplesPerChannel * mInputChannels * sizeof(int16_t));
+        return;
+    }
+
+    const int32_t round = 1 << (GAIN_SHIFT - 1);
+    for (uint32_t s = 0; s < samplesPerChannel; s++)
+    {
+        for (uint32_t o = 0; o < mOutputChannels; o++)
+        {
+            const int32_t *gains = mGains[o];
+            int32_t sum = round;
+            for (uint32_t i = 0; i < mInputChannels; i++)
+            {
+                sum += gains[i] * in[i];
+            }
+            out[o] = saturate16(sum >> GAIN_SHIFT);
+        }
+        in += mInputChannels;
+        out += mOutputChannels;
+    }
+}
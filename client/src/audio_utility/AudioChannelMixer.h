@@ -0,0 +1,87 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef __AppStreamSampleClient__AudioChannelMixer__
+#define __AppStreamSampleClient__AudioChannelMixer__
+
+#include <stdint.h>
+
+/**
+ * Mixes interleaved 16-bit PCM from one channel count to another, for
+ * devices that don't play stereo.
+ *
+ * Channels are taken to be in the usual WAVE order: front left, front
+ * right, centre, LFE, then the surround pairs.
+ *  - Mono goes to the front left and right; other outputs are silent.
+ *  - Down to mono, every input channel but the LFE is averaged.
+ *  - Down to two or more channels, the channels that exist on both sides
+ *    are copied; extra centre and surround channels are folded into front
+ *    left and right at -3 dB, and the LFE is dropped.
+ *  - Up from stereo or more, the extra output channels are silent.
+ * Rows of the matrix are scaled back to unity gain where folding would
+ * otherwise clip.
+ */
+class AudioChannelMixer
+{
+public:
+
+    static const uint32_t MAX_CHANNELS = 8;
+
+    /** Constructor */
+    AudioChannelMixer();
+
+    /**
+     * Build the mixing matrix.
+     *
+     * @param[in] inputChannels channels in the input, at most MAX_CHANNELS
+     * @param[in] outputChannels channels in the output, at most
+     *     MAX_CHANNELS
+     * @return true on success; false if a channel count is out of range.
+     */
+    bool init(uint32_t inputChannels, uint32_t outputChannels);
+
+    /**
+     * Mix a block of samples.
+     *
+     * @param[in] in interleaved input samples
+     * @param[in] samplesPerChannel number of samples per channel
+     * @param[out] out receives samplesPerChannel interleaved output
+     *     samples; must not overlap in
+     */
+    void process(const int16_t *in, uint32_t samplesPerChannel,
+                 int16_t *out) const;
+
+    uint32_t getInputChannels() const { return mInputChannels; }
+    uint32_t getOutputChannels() const { return mOutputChannels; }
+
+    /** @return true if the channel counts are equal */
+    bool isPassthrough() const { return mInputChannels == mOutputChannels; }
+
+private:
+
+    /** Gains are fixed point with this many fractional bits */
+    static const int GAIN_SHIFT = 14;
+
+    uint32_t mInputChannels;
+    uint32_t mOutputChannels;
+
+    /** Gain of each input channel in each output channel, row per output */
+    int32_t mGains[MAX_CHANNELS][MAX_CHANNELS];
+};
+
+#endif /* defined(__AppStreamSampleClient__AudioChannelMixer__) */
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "AudioFormatConverter.h"
+
+#include <new>
+#include <string.h>
+
+AudioFormatConverter::AudioFormatConverter()
+    : mMixFirst(false)
+    , mScratch(NULL)
+{
+}
+
+AudioFormatConverter::~AudioFormatConverter()
+{
+    delete[] mScratch;
+}
+
+bool AudioFormatConverter::init(uint32_t inputRate, uint32_t inputChannels,
+                                uint32_t outputRate, uint32_t outputChannels,
+                                AudioResampler::EQuality quality)
+{
+    delete[] mScratch;
+    mScratch = NULL;
+
+    mMixFirst = outputChannels < inputChannels;
+    uint32_t resampledChannels = mMixFirst ? outputChannels : inputChannels;
+    if (!mMixer.init(inputChannels, outputChannels) ||
+        !mResampler.init(inputRate, outputRate, resampledChannels, quality))
+    {
+        return false;
+    }
+
+    if (!mMixer.isPassthrough() && !mResampler.isPassthrough())
+    {
+        uint32_t size = mMixFirst ?
+            AudioResampler::MAX_INPUT_SAMPLES * resampledChannels :
+            mResampler.getMaxOutputSamples(AudioResampler::MAX_INPUT_SAMPLES) *
+                resampledChannels;
+        mScratch = new(std::nothrow) int16_t[size];
+        if (mScratch == NULL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AudioFormatConverter::reset()
+{
+    mResampler.reset();
+}
+
+uint32_t AudioFormatConverter::getMaxOutputSamples(uint32_t inputSamples) const
+{
+    uint32_t maxOut = 0;
+    while (inputSamples > 0)
+    {
+        uint32_t chunk = inputSamples < AudioResampler::MAX_INPUT_SAMPLES ?
+            inputSamples : AudioResampler::MAX_INPUT_SAMPLES;
+        maxOut += mResampler.getMaxOutputSamples(chunk);
+        inputSamples -= chunk;
+    }
+    return maxOut;
+}
+
+uint32_t AudioFormatConverter::process(const int16_t *in, uint32_t inputSamples,
+                                       int16_t *out)
+{
+    uint32_t inputChannels = mMixer.getInputChannels();
+    uint32_t outputChannels = mMixer.getOutputChannels();
+
+    if (mResampler.isPassthrough())
+    {
+        mMixer.process(in, inputSamples, out);
+        return inputSamples;
+    }
+
+    uint32_t numOut = 0;
+    while (inputSamples > 0)
+    {
+        uint32_t chunk = inputSamples < AudioResampler::MAX_INPUT_SAMPLES ?
+            inputSamples : AudioResampler::MAX_INPUT_SAMPLES;
+        uint32_t produced;
+
+        if (mMixer.isPassthrough())
+        {
+            produced = mResampler.process(in, chunk, out);
+        }
+        else if (mMixFirst)
+        {
+            mMixer.process(in, chunk, mScratch);
+            produced = mResampler.process(mScratch, chunk, out);
+        }
+        else
+        {
+            produced = mResampler.process(in, chunk, mScratch);
+            mMixer.process(mScratch, produced, out);
+        }
+
+        in += chunk * inputChannels;
+        inputSamples -= chunk;
+        out += produced * outputChannels;
+        numOut += produced;
+    }
+    return numOut;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef __AppStreamSampleClient__AudioFormatConverter__
+#define __AppStreamSampleClient__AudioFormatConverter__
+
+#include "AudioChannelMixer.h"
+#include "AudioResampler.h"
+
+#include <stdint.h>
+
+/**
+ * Converts the decoder's PCM to the rate and channel count a device plays,
+ * so a renderer can open the device in its native format rather than rely
+ * on the host API to convert.
+ *
+ * Channels are mixed down before resampling and up after it, so the
+ * resampler never filters more channels than it has to. With the same
+ * format on both sides samples are only copied.
+ */
+class AudioFormatConverter
+{
+public:
+
+    /** Constructor */
+    AudioFormatConverter();
+
+    /** Destructor */
+    ~AudioFormatConverter();
+
+    /**
+     * Set up a conversion.
+     *
+     * @param[in] inputRate sample rate of the input, in Hz
+     * @param[in] inputChannels channels in the input
+     * @param[in] outputRate sample rate of the output, in Hz
+     * @param[in] outputChannels channels in the output
+     * @param[in] quality resampler quality
+     * @return true on success; false if the conversion is not supported or
+     *     memory ran out.
+     */
+    bool init(uint32_t inputRate, uint32_t inputChannels,
+              uint32_t outputRate, uint32_t outputChannels,
+              AudioResampler::EQuality quality);
+
+    /**
+     * Forget the samples held in the resampler.
+     */
+    void reset();
+
+    /**
+     * @return the most samples per channel process() can return for the
+     *     given number of input samples per channel
+     */
+    uint32_t getMaxOutputSamples(uint32_t inputSamples) const;
+
+    /**
+     * Convert a block of samples.
+     *
+     * @param[in] in interleaved input samples
+     * @param[in] inputSamples number of samples per channel in in
+     * @param[out] out receives the interleaved output samples; must hold
+     *     getMaxOutputSamples(inputSamples) per channel
+     * @return the number of samples per channel written to out
+     */
+    uint32_t process(const int16_t *in, uint32_t inputSamples, int16_t *out);
+
+    /** @return true if the formats match and samples are only copied */
+    bool isPassthrough() const
+    {
+        return mMixer.isPassthrough() && mResampler.isPassthrough();
+    }
+
+    uint32_t getOutputChannels() const { return mMixer.getOutputChannels(); }
+
+    /** @return the resampler filter length per phase; 0 if not resampling */
+    uint32_t getResamplerTaps() const { return mResampler.getTaps(); }
+
+private:
+
+    AudioChannelMixer mMixer;
+    AudioResampler mResampler;
+
+    /** True if mixing down, so the mixer runs before the resampler */
+    bool mMixFirst;
+
+    /** Samples between the two stages */
+    int16_t *mScratch;
+};
+
+#endif /* defined(__AppStreamSampleClient__AudioFormatConverter__) */
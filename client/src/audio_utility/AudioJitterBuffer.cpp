@@ -0,0 +1,244 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "AudioJitterBuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "AudioJitterBuffer"
+#include "log.h"
+
+AudioJitterBuffer::AudioJitterBuffer()
+    : mStretch(true)
+    , mWindowCount(0)
+    , mWindowPos(0)
+    , mBaselineUs(0)
+    , mHaveBaseline(false)
+    , mJitterMs(0)
+    , mPackets(0)
+    , mConcealed(0)
+    , mFilteredDelayMs(0)
+    , mHaveDelay(false)
+    , mLastPackets(0)
+    , mLastConcealed(0)
+    , mLastAccelerated(0)
+    , mLastExpanded(0)
+    , mLastSamplesIn(0)
+    , mLastSamplesOut(0)
+{
+    mMinDelayMs = getEnvMs("XSTX_AUDIO_MIN_DELAY_MS", 20, 0, MAX_DELAY_LIMIT_MS);
+    mMaxDelayMs = getEnvMs("XSTX_AUDIO_MAX_DELAY_MS", 200, mMinDelayMs,
+                           MAX_DELAY_LIMIT_MS);
+    mTargetDelayMs = mMinDelayMs;
+
+    const char *value = getenv("XSTX_AUDIO_TIME_STRETCH");
+    if (value != NULL && strcmp(value, "0") == 0)
+    {
+        mStretch = false;
+    }
+
+    memset(mHistogram, 0, sizeof(mHistogram));
+}
+
+uint32_t AudioJitterBuffer::getEnvMs(const char *name, uint32_t fallback,
+                                     uint32_t low, uint32_t high)
+{
+    const char *value = getenv(name);
+    uint32_t ms = fallback;
+    if (value != NULL && atoi(value) >= 0)
+    {
+        ms = (uint32_t)atoi(value);
+    }
+    if (ms < low)
+    {
+        ms = low;
+    }
+    if (ms > high)
+    {
+        ms = high;
+    }
+    return ms;
+}
+
+void AudioJitterBuffer::packetArrived(uint64_t timestampUs, uint64_t arrivalUs,
+                                      bool concealed)
+{
+    mPackets = mPackets + 1;
+    if (concealed)
+    {
+        // A concealed packet never arrived; it says nothing about transit
+        mConcealed = mConcealed + 1;
+        return;
+    }
+
+    // The sender's clock has an unknown offset from ours, so only the
+    // transit time relative to the fastest recent packet means anything
+    int64_t transitUs = (int64_t)(arrivalUs - timestampUs);
+    if (mHaveBaseline)
+    {
+        mBaselineUs += BASELINE_RELAX_US;
+    }
+    if (!mHaveBaseline || transitUs < mBaselineUs ||
+        transitUs - mBaselineUs > 2000 * (int64_t)MAX_DELAY_LIMIT_MS)
+    {
+        // Faster than any packet so far, or a jump in the timestamps so
+        // large that the stream must have restarted
+        if (mHaveBaseline && transitUs > mBaselineUs)
+        {
+            memset(mHistogram, 0, sizeof(mHistogram));
+            mWindowCount = 0;
+            mWindowPos = 0;
+        }
+        mBaselineUs = transitUs;
+        mHaveBaseline = true;
+    }
+
+    uint64_t relativeMs = (uint64_t)(transitUs - mBaselineUs) / 1000;
+    if (relativeMs >= HISTOGRAM_BINS)
+    {
+        relativeMs = HISTOGRAM_BINS - 1;
+    }
+
+    if (mWindowCount == WINDOW_PACKETS)
+    {
+        mHistogram[mWindow[mWindowPos]]--;
+    }
+    else
+    {
+        mWindowCount++;
+    }
+    mWindow[mWindowPos] = (uint16_t)relativeMs;
+    mHistogram[relativeMs]++;
+    mWindowPos = (mWindowPos + 1) % WINDOW_PACKETS;
+
+    updateTarget();
+}
+
+void AudioJitterBuffer::updateTarget()
+{
+    uint32_t needed = (mWindowCount * TARGET_PERCENTILE + 99) / 100;
+    uint32_t seen = 0;
+    uint32_t jitterMs = 0;
+    for (uint32_t bin = 0; bin < HISTOGRAM_BINS; bin++)
+    {
+        seen += mHistogram[bin];
+        if (seen >= needed)
+        {
+            jitterMs = bin;
+            break;
+        }
+    }
+
+    uint32_t targetMs = jitterMs + FRAME_MS;
+    if (targetMs < mMinDelayMs)
+    {
+        targetMs = mMinDelayMs;
+    }
+    if (targetMs > mMaxDelayMs)
+    {
+        targetMs = mMaxDelayMs;
+    }
+    mJitterMs = jitterMs;
+    mTargetDelayMs = targetMs;
+}
+
+void AudioJitterBuffer::reset()
+{
+    mStretcher.reset();
+    mHaveDelay = false;
+}
+
+const int16_t *AudioJitterBuffer::process(const int16_t *in,
+                                          uint32_t samplesPerChannel,
+                                          uint64_t bufferedUs,
+                                          uint32_t &outSamplesPerChannel)
+{
+    uint32_t heldBefore = mStretcher.getHeldSamples();
+    double delayMs = (double)bufferedUs / 1000.0 +
+                     (double)heldBefore / SAMPLES_PER_MS;
+    if (!mHaveDelay)
+    {
+        mFilteredDelayMs = delayMs;
+        mHaveDelay = true;
+    }
+    else
+    {
+        mFilteredDelayMs += (delayMs - mFilteredDelayMs) * FILTER_WEIGHT / 16.0;
+    }
+
+    WsolaStretcher::EMode mode = WsolaStretcher::MODE_NORMAL;
+    if (mStretch)
+    {
+        double targetMs = mTargetDelayMs;
+        if (mFilteredDelayMs > targetMs + HIGH_MARGIN_MS)
+        {
+            mode = WsolaStretcher::MODE_ACCELERATE;
+        }
+        else if (mFilteredDelayMs * 4 < targetMs * 3)
+        {
+            mode = WsolaStretcher::MODE_EXPAND;
+        }
+    }
+
+    outSamplesPerChannel = mStretcher.process(in, samplesPerChannel, mode,
+                                              mOutput);
+
+    // Count what was removed or inserted straight away, so the next frames
+    // don't keep stretching while the filter catches up
+    int32_t change = (int32_t)(mStretcher.getHeldSamples() + outSamplesPerChannel)
+                   - (int32_t)(heldBefore + samplesPerChannel);
+    mFilteredDelayMs += (double)change / SAMPLES_PER_MS;
+
+    return mOutput;
+}
+
+void AudioJitterBuffer::logStats()
+{
+    uint32_t packets = mPackets;
+    uint32_t concealed = mConcealed;
+    uint32_t accelerated = mStretcher.getAccelerated();
+    uint32_t expanded = mStretcher.getExpanded();
+    uint64_t samplesIn = mStretcher.getSamplesIn();
+    uint64_t samplesOut = mStretcher.getSamplesOut();
+
+    uint32_t intervalPackets = packets - mLastPackets;
+    uint32_t intervalConcealed = concealed - mLastConcealed;
+    uint64_t intervalIn = samplesIn - mLastSamplesIn;
+    uint64_t intervalOut = samplesOut - mLastSamplesOut;
+
+    LOGV("[jitterbuffer]={ \"DelayMs\":%.1f, \"TargetMs\":%u, \"JitterMs\":%u, "
+         "\"MinDelayMs\":%u, \"MaxDelayMs\":%u, \"Stretch\":%d, "
+         "\"StretchRatio\":%.4f, \"Accelerated\":%u, \"Expanded\":%u, "
+         "\"ConcealmentRate\":%.4f, \"Concealed\":%u, \"Packets\":%u }",
+         mFilteredDelayMs, (uint32_t)mTargetDelayMs, (uint32_t)mJitterMs,
+         mMinDelayMs, mMaxDelayMs, mStretch ? 1 : 0,
+         intervalIn > 0 ? (double)intervalOut / (double)intervalIn : 1.0,
+         accelerated - mLastAccelerated, expanded - mLastExpanded,
+         intervalPackets > 0 ?
+             (double)intervalConcealed / (double)intervalPackets : 0.0,
+         intervalConcealed, intervalPackets);
+
+    mLastPackets = packets;
+    mLastConcealed = concealed;
+    mLastAccelerated = accelerated;
+    mLastExpanded = expanded;
+    mLastSamplesIn = samplesIn;
+    mLastSamplesOut = samplesOut;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef __AppStreamSampleClient__AudioJitterBuffer__
+#define __AppStreamSampleClient__AudioJitterBuffer__
+
+#include "WsolaStretcher.h"
+
+#include <stdint.h>
+
+/**
+ * Adapts the audio playout delay to the jitter measured on arriving
+ * packets.
+ *
+ * The decoder side reports each packet's timestamp and arrival time. The
+ * target delay is the 95th percentile of how much later than the fastest
+ * recent packet each packet arrived, over the last five seconds, plus a
+ * frame; so it grows as soon as the network gets worse and shrinks again
+ * once the late packets have left the window.
+ *
+ * The renderer side passes every decoded frame through process() along
+ * with the delay it has buffered. The buffered delay is smoothed and, when
+ * it drifts out of a band around the target, the frame is shortened or
+ * lengthened by a pitch period with WsolaStretcher instead of dropping
+ * audio or playing silence.
+ *
+ * Options are read from the environment when the buffer is constructed:
+ *  - XSTX_AUDIO_MIN_DELAY_MS: lowest target delay (default 20).
+ *  - XSTX_AUDIO_MAX_DELAY_MS: highest target delay (default 200, at most
+ *    500).
+ *  - XSTX_AUDIO_TIME_STRETCH: set to 0 to only measure; frames are then
+ *    never stretched.
+ *
+ * packetArrived() is called on the decoder thread, process() and
+ * logStats() on a single playout thread; getTargetDelayMs() on either.
+ */
+class AudioJitterBuffer
+{
+public:
+
+    static const uint32_t SAMPLING_RATE = 48000;
+    static const uint32_t NUM_CHANNELS = WsolaStretcher::NUM_CHANNELS;
+    static const uint32_t SAMPLES_PER_MS = SAMPLING_RATE / 1000;
+
+    /** Most samples per channel process() takes at once */
+    static const uint32_t MAX_FRAME_SAMPLES = WsolaStretcher::MAX_FRAME_SAMPLES;
+
+    /** Samples per channel process() can return at once */
+    static const uint32_t MAX_OUTPUT_SAMPLES = WsolaStretcher::MAX_OUTPUT_SAMPLES;
+
+    /** Highest XSTX_AUDIO_MAX_DELAY_MS accepted */
+    static const uint32_t MAX_DELAY_LIMIT_MS = 500;
+
+    /** Constructor */
+    AudioJitterBuffer();
+
+    /**
+     * Record the arrival of a packet. Called on the decoder thread.
+     *
+     * @param[in] timestampUs the timestamp the server gave the packet
+     * @param[in] arrivalUs the local monotonic time it arrived
+     * @param[in] concealed true if the packet was lost and the decoder
+     *     concealed it
+     */
+    void packetArrived(uint64_t timestampUs, uint64_t arrivalUs,
+                       bool concealed);
+
+    /**
+     * @return the delay playout should aim for, in milliseconds
+     */
+    uint32_t getTargetDelayMs() const { return mTargetDelayMs; }
+
+    /**
+     * @return the highest target delay, in milliseconds. A renderer needs
+     *     to be able to buffer this much.
+     */
+    uint32_t getMaxDelayMs() const { return mMaxDelayMs; }
+
+    /**
+     * Forget the playout state, when playback restarts.
+     */
+    void reset();
+
+    /**
+     * Pass a decoded frame through on its way to the output, shortened or
+     * lengthened to move the buffered delay towards the target.
+     *
+     * @param[in] in interleaved stereo samples
+     * @param[in] samplesPerChannel samples per channel in in; at most
+     *     MAX_FRAME_SAMPLES
+     * @param[in] bufferedUs how much audio is queued for output ahead of
+     *     this frame, in microseconds
+     * @param[out] outSamplesPerChannel set to the number of samples per
+     *     channel returned
+     * @return the samples to queue for output; valid until the next call
+     */
+    const int16_t *process(const int16_t *in, uint32_t samplesPerChannel,
+                           uint64_t bufferedUs,
+                           uint32_t &outSamplesPerChannel);
+
+    /**
+     * @return samples per channel held inside the buffer, which count
+     *     towards the delay
+     */
+    uint32_t getHeldSamples() const { return mStretcher.getHeldSamples(); }
+
+    /**
+     * Log the delay, stretching and concealment since the last call.
+     */
+    void logStats();
+
+private:
+
+    static const uint32_t FRAME_MS = 10;
+
+    /** Packets the jitter is measured over: five seconds of frames */
+    static const uint32_t WINDOW_PACKETS = 500;
+
+    /** Relative delays are binned by the millisecond up to this */
+    static const uint32_t HISTOGRAM_BINS = MAX_DELAY_LIMIT_MS + 1;
+
+    /** Percentile of the relative delay the target covers */
+    static const uint32_t TARGET_PERCENTILE = 95;
+
+    /**
+     * How fast the transit time baseline creeps up, so a sender clock
+     * running slow against ours doesn't read as growing jitter: 1 us per
+     * packet is 100 ppm.
+     */
+    static const uint64_t BASELINE_RELAX_US = 1;
+
+    /** Smoothing of the buffered delay, out of 16 per frame */
+    static const uint32_t FILTER_WEIGHT = 2;
+
+    /**
+     * Lengthen the audio while the smoothed delay is below 3/4 of the
+     * target and shorten it while it is above the target by HIGH_MARGIN_MS.
+     */
+    static const uint32_t HIGH_MARGIN_MS = FRAME_MS;
+
+    /**
+     * @return the value of an environment variable in [low, high], or
+     *     fallback if it is not set.
+     */
+    static uint32_t getEnvMs(const char *name, uint32_t fallback,
+                             uint32_t low, uint32_t high);
+
+    /** Recompute mTargetDelayMs from the histogram. */
+    void updateTarget();
+
+    /** Delay options */
+    uint32_t mMinDelayMs;
+    uint32_t mMaxDelayMs;
+    bool mStretch;
+
+    /** Decoder side: relative delays of the last WINDOW_PACKETS packets */
+    uint16_t mWindow[WINDOW_PACKETS];
+    uint32_t mWindowCount;
+    uint32_t mWindowPos;
+    uint32_t mHistogram[HISTOGRAM_BINS];
+    int64_t mBaselineUs;
+    bool mHaveBaseline;
+    volatile uint32_t mJitterMs;
+    volatile uint32_t mTargetDelayMs;
+    volatile uint32_t mPackets;
+    volatile uint32_t mConcealed;
+
+    /** Playout side */
+    WsolaStretcher mStretcher;
+    int16_t mOutput[MAX_OUTPUT_SAMPLES * NUM_CHANNELS];
+    double mFilteredDelayMs;
+    bool mHaveDelay;
+
+    /** Values at the last logStats() */
+    uint32_t mLastPackets;
+    uint32_t mLastConcealed;
+    uint32_t mLastAccelerated;
+    uint32_t mLastExpanded;
+    uint64_t mLastSamplesIn;
+    uint64_t mLastSamplesOut;
+};
+
+#endif /* defined(__AppStreamSampleClient__AudioJitterBuffer__) */
@@ -0,0 +1,358 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "AudioResampler.h"
+
+#include <math.h>
+#include <new>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RESAMPLER_USE_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RESAMPLER_USE_NEON 1
+#endif
+
+namespace
+{
+
+/** Filter length, Kaiser beta and cutoff relative to the Nyquist frequency */
+struct QualitySettings
+{
+    uint32_t mTaps;
+    double mBeta;
+    double mCutoff;
+};
+
+const QualitySettings QUALITY_SETTINGS[] =
+{
+    { 16, 5.0, 0.80 },
+    { 32, 7.0, 0.86 },
+    { 64, 9.0, 0.91 }
+};
+
+/** Longest filter per phase, reached when decimating by a large ratio */
+const uint32_t MAX_TAPS = 512;
+
+uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b != 0)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/** Zeroth order modified Bessel function of the first kind */
+double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++)
+    {
+        double half = x / (2.0 * k);
+        term *= half * half;
+        sum += term;
+        if (term < sum * 1e-12)
+        {
+            break;
+        }
+    }
+    return sum;
+}
+
+/** Dot product of n floats; n is a multiple of 8 */
+inline float dot(const float *a, const float *b, uint32_t n)
+{
+#if RESAMPLER_USE_SSE
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    for (uint32_t i = 0; i < n; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                           _mm_loadu_ps(b + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                           _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 sum = _mm_add_ps(sum0, sum1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif RESAMPLER_USE_NEON
+    float32x4_t sum0 = vdupq_n_f32(0.0f);
+    float32x4_t sum1 = vdupq_n_f32(0.0f);
+    for (uint32_t i = 0; i < n; i += 8)
+    {
+        sum0 = vmlaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float32x4_t sum = vaddq_f32(sum0, sum1);
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+#else
+    float sum0 = 0.0f;
+    float sum1 = 0.0f;
+    for (uint32_t i = 0; i < n; i += 2)
+    {
+        sum0 += a[i] * b[i];
+        sum1 += a[i + 1] * b[i + 1];
+    }
+    return sum0 + sum1;
+#endif
+}
+
+inline int16_t toSample(float x)
+{
+    if (x >= 32767.0f)
+    {
+        return 32767;
+    }
+    if (x <= -32768.0f)
+    {
+        return -32768;
+    }
+    return (int16_t)(x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+
+}
+
+AudioResampler::AudioResampler()
+    : mInterpolation(1)
+    , mDecimation(1)
+    , mNumChannels(0)
+    , mTaps(0)
+    , mFilter(NULL)
+    , mHistory(NULL)
+    , mHistoryStride(0)
+    , mHistorySamples(0)
+    , mPhase(0)
+{
+}
+
+AudioResampler::~AudioResampler()
+{
+    release();
+}
+
+void AudioResampler::release()
+{
+    delete[] mFilter;
+    mFilter = NULL;
+    delete[] mHistory;
+    mHistory = NULL;
+}
+
+bool AudioResampler::init(uint32_t inputRate, uint32_t outputRate,
+                          uint32_t numChannels, EQuality quality)
+{
+    release();
+    mInterpolation = 1;
+    mDecimation = 1;
+    mNumChannels = numChannels;
+    mTaps = 0;
+
+    if (inputRate == 0 || outputRate == 0 ||
+        numChannels == 0 || numChannels > MAX_CHANNELS)
+    {
+        return false;
+    }
+    if (inputRate == outputRate)
+    {
+        return true;
+    }
+
+    uint32_t divisor = gcd(inputRate, outputRate);
+    uint32_t interpolation = outputRate / divisor;
+    uint32_t decimation = inputRate / divisor;
+    if (interpolation > MAX_PHASES)
+    {
+        return false;
+    }
+
+    const QualitySettings &settings = QUALITY_SETTINGS[quality];
+    uint32_t taps = settings.mTaps;
+    double cutoff = settings.mCutoff;
+    if (decimation > interpolation)
+    {
+        // Keep the transition band as wide in output samples; rounded up
+        // to a multiple of 8 for the vector loop
+        taps = (uint32_t)(((uint64_t)taps * decimation + interpolation - 1) /
+                          interpolation);
+        taps = (taps + 7) & ~7u;
+        if (taps > MAX_TAPS)
+        {
+            return false;
+        }
+        cutoff *= (double)interpolation / decimation;
+    }
+
+    mFilter = new(std::nothrow) float[interpolation * taps];
+    mHistoryStride = taps - 1 + MAX_INPUT_SAMPLES;
+    mHistory = new(std::nothrow) float[mHistoryStride * numChannels];
+    if (mFilter == NULL || mHistory == NULL)
+    {
+        release();
+        return false;
+    }
+
+    mInterpolation = interpolation;
+    mDecimation = decimation;
+    mTaps = taps;
+    designFilter(cutoff, settings.mBeta);
+    reset();
+    return true;
+}
+
+void AudioResampler::designFilter(double cutoff, double beta)
+{
+    // The prototype runs at mInterpolation times the input rate; cutoff
+    // is relative to the input Nyquist frequency.
+    const double pi = 3.14159265358979323846;
+    uint32_t length = mInterpolation * mTaps;
+    double center = (length - 1) / 2.0;
+    double fc = cutoff / mInterpolation;
+    double i0Beta = besselI0(beta);
+
+    for (uint32_t phase = 0; phase < mInterpolation; phase++)
+    {
+        float *coefficients = mFilter + phase * mTaps;
+        double sum = 0.0;
+        for (uint32_t k = 0; k < mTaps; k++)
+        {
+            // Output phase r takes x[q - j] times h[j * L + r]; the
+            // history is oldest first, so tap k meets x[q - (taps - 1 - k)]
+            uint32_t n = (mTaps - 1 - k) * mInterpolation + phase;
+            double t = n - center;
+            double x = fc * t;
+            double sinc = x == 0.0 ? 1.0 : sin(pi * x) / (pi * x);
+            double r = 2.0 * t / (length - 1);
+            double window = besselI0(beta * sqrt(r * r < 1.0 ? 1.0 - r * r : 0.0))
+                            / i0Beta;
+            coefficients[k] = (float)(sinc * window);
+            sum += sinc * window;
+        }
+
+        // Unity gain at DC for every phase
+        for (uint32_t k = 0; k < mTaps; k++)
+        {
+            coefficients[k] = (float)(coefficients[k] / sum);
+        }
+    }
+}
+
+void AudioResampler::reset()
+{
+    if (mHistory == NULL)
+    {
+        return;
+    }
+    // Start with a filter's worth of silence so the first input sample
+    // produces output straight away
+    mHistorySamples = mTaps - 1;
+    memset(mHistory, 0, mHistoryStride * mNumChannels * sizeof(float));
+    mPhase = 0;
+}
+
+uint32_t AudioResampler::getMaxOutputSamples(uint32_t inputSamples) const
+{
+    if (isPassthrough())
+    {
+        return inputSamples;
+    }
+    return (uint32_t)((uint64_t)(inputSamples + mTaps) * mInterpolation /
+                      mDecimation) + 1;
+}
+
+uint32_t AudioResampler::process(const int16_t *in, uint32_t inputSamples,
+                                 int16_t *out)
+{
+    if (inputSamples > MAX_INPUT_SAMPLES)
+    {
+        inputSamples = MAX_INPUT_SAMPLES;
+    }
+    if (isPassthrough())
+    {
+        memcpy(out, in, inputSamples * mNumChannels * sizeof(int16_t));
+        return inputSamples;
+    }
+
+    for (uint32_t c = 0; c < mNumChannels; c++)
+    {
+        float *history = mHistory + c * mHistoryStride + mHistorySamples;
+        const int16_t *src = in + c;
+        for (uint32_t i = 0; i < inputSamples; i++)
+        {
+            history[i] = *src;
+            src += mNumChannels;
+        }
+    }
+    mHistorySamples += inputSamples;
+
+    uint32_t pos = 0;
+    uint32_t numOut = 0;
+    while (pos + mTaps <= mHistorySamples)
+    {
+        const float *coefficients = mFilter + mPhase * mTaps;
+        for (uint32_t c = 0; c < mNumChannels; c++)
+        {
+            out[c] = toSample(dot(mHistory + c * mHistoryStride + pos,
+                                  coefficients, mTaps));
+        }
+        out += mNumChannels;
+        numOut++;
+
+        mPhase += mDecimation;
+        pos += mPhase / mInterpolation;
+        mPhase %= mInterpolation;
+    }
+
+    // Keep what the next output still needs
+    mHistorySamples -= pos;
+    for (uint32_t c = 0; c < mNumChannels; c++)
+    {
+        float *history = mHistory + c * mHistoryStride;
+        memmove(history, history + pos, mHistorySamples * sizeof(float));
+    }
+    return numOut;
+}
+
+AudioResampler::EQuality AudioResampler::qualityFromString(const char *name,
+                                                           EQuality fallback)
+{
+    if (name == NULL)
+    {
+        return fallback;
+    }
+    if (strcmp(name, "low") == 0)
+    {
+        return QUALITY_LOW;
+    }
+    if (strcmp(name, "medium") == 0)
+    {
+        return QUALITY_MEDIUM;
+    }
+    if (strcmp(name, "high") == 0)
+    {
+        return QUALITY_HIGH;
+    }
+    return fallback;
+}
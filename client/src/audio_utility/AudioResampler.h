@@ -0,0 +1,160 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef __AppStreamSampleClient__AudioResampler__
+#define __AppStreamSampleClient__AudioResampler__
+
+#include <stdint.h>
+
+/**
+ * Converts interleaved 16-bit PCM from one sample rate to another with a
+ * polyphase windowed-sinc filter.
+ *
+ * The ratio between the rates is reduced to L / M. A Kaiser-windowed sinc
+ * low-pass filter, cut off below the lower of the two Nyquist frequencies,
+ * is designed at L times the input rate and split into L phases of TAPS
+ * coefficients each. Every output sample is then one dot product of a
+ * phase with the last TAPS input samples, which runs four lanes at a time
+ * with SSE or NEON where available.
+ *
+ * The quality setting picks the filter length and stop-band attenuation:
+ *  - QUALITY_LOW: 16 taps per phase, about 50 dB, cut off at 0.8 of the
+ *    lower Nyquist frequency.
+ *  - QUALITY_MEDIUM: 32 taps per phase, about 70 dB, cut off at 0.86.
+ *  - QUALITY_HIGH: 64 taps per phase, about 90 dB, cut off at 0.91.
+ * When decimating, the filter is lengthened by the decimation ratio so the
+ * transition band keeps its width. The filter delays the audio by half its
+ * length: 0.67 ms at 48 kHz for QUALITY_HIGH.
+ */
+class AudioResampler
+{
+public:
+
+    /**
+     * Filter length and attenuation.
+     */
+    enum EQuality
+    {
+        QUALITY_LOW,
+        QUALITY_MEDIUM,
+        QUALITY_HIGH
+    };
+
+    static const uint32_t MAX_CHANNELS = 8;
+
+    /** Most samples per channel a single call takes */
+    static const uint32_t MAX_INPUT_SAMPLES = 2048;
+
+    /**
+     * Most filter phases. Rates whose reduced ratio needs more, such as
+     * 48000 to 44099, are not supported.
+     */
+    static const uint32_t MAX_PHASES = 1024;
+
+    /** Constructor */
+    AudioResampler();
+
+    /** Destructor */
+    ~AudioResampler();
+
+    /**
+     * Design the filter for a conversion and reset the state. With equal
+     * rates, process() only copies.
+     *
+     * @param[in] inputRate sample rate of the input, in Hz
+     * @param[in] outputRate sample rate of the output, in Hz
+     * @param[in] numChannels interleaved channels, at most MAX_CHANNELS
+     * @param[in] quality filter length and attenuation
+     * @return true on success; false if the rates or channel count are not
+     *     supported or memory ran out.
+     */
+    bool init(uint32_t inputRate, uint32_t outputRate, uint32_t numChannels,
+              EQuality quality);
+
+    /**
+     * Forget the samples held in the filter.
+     */
+    void reset();
+
+    /**
+     * @return the most samples per channel process() can return for the
+     *     given number of input samples per channel
+     */
+    uint32_t getMaxOutputSamples(uint32_t inputSamples) const;
+
+    /**
+     * Convert a block of samples.
+     *
+     * @param[in] in interleaved input samples
+     * @param[in] inputSamples number of samples per channel in in; at most
+     *     MAX_INPUT_SAMPLES
+     * @param[out] out receives the interleaved output samples; must hold
+     *     getMaxOutputSamples(inputSamples) per channel
+     * @return the number of samples per channel written to out
+     */
+    uint32_t process(const int16_t *in, uint32_t inputSamples, int16_t *out);
+
+    /** @return true if the rates are equal and samples are only copied */
+    bool isPassthrough() const { return mInterpolation == mDecimation; }
+
+    /** @return the filter length per phase */
+    uint32_t getTaps() const { return mTaps; }
+
+    /**
+     * Parse a quality name: "low", "medium" or "high".
+     *
+     * @return the quality, or fallback if name is NULL or unknown
+     */
+    static EQuality qualityFromString(const char *name, EQuality fallback);
+
+private:
+
+    /** Free the filter and history */
+    void release();
+
+    /** Design the L phases of the filter into mFilter */
+    void designFilter(double cutoff, double beta);
+
+    /** Reduced ratio: L output samples for every M input samples */
+    uint32_t mInterpolation;
+    uint32_t mDecimation;
+
+    uint32_t mNumChannels;
+    uint32_t mTaps;
+
+    /**
+     * mInterpolation phases of mTaps coefficients, each in the order they
+     * meet the history
+     */
+    float *mFilter;
+
+    /**
+     * Per channel, mTaps - 1 + MAX_INPUT_SAMPLES input samples, oldest
+     * first
+     */
+    float *mHistory;
+    uint32_t mHistoryStride;
+
+    /** Valid samples per channel in mHistory */
+    uint32_t mHistorySamples;
+
+    /** Phase of the next output sample, in [0, mInterpolation) */
+    uint32_t mPhase;
+};
+
+#endif /* defined(__AppStreamSampleClient__AudioResampler__) */
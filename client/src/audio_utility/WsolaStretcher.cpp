@@ -0,0 +1,196 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "WsolaStretcher.h"
+
+#include <math.h>
+#include <string.h>
+
+const float WsolaStretcher::MIN_CORRELATION = 0.5f;
+
+// About -50 dBFS for the sum of both channels
+const float WsolaStretcher::QUIET_POWER = 4.0f * 100.0f * 100.0f;
+
+WsolaStretcher::WsolaStretcher()
+    : mPendingSamples(0)
+    , mAccelerated(0)
+    , mExpanded(0)
+    , mSamplesIn(0)
+    , mSamplesOut(0)
+{
+}
+
+void WsolaStretcher::reset()
+{
+    mPendingSamples = 0;
+}
+
+uint32_t WsolaStretcher::process(const int16_t *in, uint32_t samplesPerChannel,
+                                 EMode mode, int16_t *out)
+{
+    if (samplesPerChannel > MAX_FRAME_SAMPLES)
+    {
+        samplesPerChannel = MAX_FRAME_SAMPLES;
+    }
+    memcpy(mPending + mPendingSamples * NUM_CHANNELS, in,
+           samplesPerChannel * NUM_CHANNELS * sizeof(int16_t));
+    mPendingSamples += samplesPerChannel;
+    mSamplesIn += samplesPerChannel;
+
+    uint32_t maxLag = mPendingSamples / 2;
+    if (maxLag > MAX_LAG)
+    {
+        maxLag = MAX_LAG;
+    }
+    if (mode != MODE_NORMAL && maxLag >= MIN_LAG)
+    {
+        float correlation = 0;
+        float power = 0;
+        uint32_t lag = findLag(maxLag, correlation, power);
+        if (correlation >= MIN_CORRELATION || power < QUIET_POWER)
+        {
+            if (mode == MODE_ACCELERATE)
+            {
+                accelerate(lag);
+            }
+            else
+            {
+                expand(lag);
+            }
+        }
+    }
+
+    // Keep MAX_LAG samples back so the next search has its look-ahead
+    uint32_t ready = mPendingSamples > MAX_LAG ? mPendingSamples - MAX_LAG : 0;
+    memcpy(out, mPending, ready * NUM_CHANNELS * sizeof(int16_t));
+    memmove(mPending, mPending + ready * NUM_CHANNELS,
+            (mPendingSamples - ready) * NUM_CHANNELS * sizeof(int16_t));
+    mPendingSamples -= ready;
+    mSamplesOut += ready;
+    return ready;
+}
+
+uint32_t WsolaStretcher::findLag(uint32_t maxLag, float &correlation,
+                                 float &power)
+{
+    uint32_t length = 2 * maxLag;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        mMono[i] = (float)mPending[2 * i] + (float)mPending[2 * i + 1];
+    }
+
+    // Coarse search over every DECIMATION-th lag and sample, then refine
+    // around the best one at full rate
+    uint32_t bestLag = MIN_LAG;
+    float best = -2.0f;
+    for (uint32_t lag = MIN_LAG; lag <= maxLag; lag += DECIMATION)
+    {
+        float c = correlate(mMono, lag, DECIMATION, NULL);
+        if (c > best)
+        {
+            best = c;
+            bestLag = lag;
+        }
+    }
+
+    uint32_t first = bestLag > MIN_LAG + DECIMATION ?
+        bestLag - DECIMATION + 1 : MIN_LAG;
+    uint32_t last = bestLag + DECIMATION - 1 < maxLag ?
+        bestLag + DECIMATION - 1 : maxLag;
+    best = -2.0f;
+    for (uint32_t lag = first; lag <= last; lag++)
+    {
+        float segmentPower = 0;
+        float c = correlate(mMono, lag, 1, &segmentPower);
+        if (c > best)
+        {
+            best = c;
+            bestLag = lag;
+            power = segmentPower;
+        }
+    }
+
+    correlation = best;
+    return bestLag;
+}
+
+float WsolaStretcher::correlate(const float *mono, uint32_t lag,
+                                uint32_t step, float *power)
+{
+    float cross = 0;
+    float energy0 = 0;
+    float energy1 = 0;
+    for (uint32_t i = 0; i < lag; i += step)
+    {
+        float a = mono[i];
+        float b = mono[i + lag];
+        cross += a * b;
+        energy0 += a * a;
+        energy1 += b * b;
+    }
+    if (power != NULL)
+    {
+        *power = (energy0 + energy1) / (float)(2 * lag);
+    }
+    if (energy0 <= 0 || energy1 <= 0)
+    {
+        return 0;
+    }
+    return cross / sqrtf(energy0 * energy1);
+}
+
+void WsolaStretcher::accelerate(uint32_t lag)
+{
+    // [x0 x1 rest] becomes [fade(x0 -> x1) rest]
+    int16_t *x0 = mPending;
+    const int16_t *x1 = mPending + lag * NUM_CHANNELS;
+    for (uint32_t i = 0; i < lag; i++)
+    {
+        float w = ((float)i + 0.5f) / (float)lag;
+        for (uint32_t ch = 0; ch < NUM_CHANNELS; ch++)
+        {
+            uint32_t n = i * NUM_CHANNELS + ch;
+            x0[n] = (int16_t)floorf(x0[n] + w * (x1[n] - x0[n]) + 0.5f);
+        }
+    }
+    memmove(mPending + lag * NUM_CHANNELS, mPending + 2 * lag * NUM_CHANNELS,
+            (mPendingSamples - 2 * lag) * NUM_CHANNELS * sizeof(int16_t));
+    mPendingSamples -= lag;
+    mAccelerated++;
+}
+
+void WsolaStretcher::expand(uint32_t lag)
+{
+    // [x0 x1 rest] becomes [x0 fade(x1 -> x0) x1 rest]
+    memmove(mPending + 2 * lag * NUM_CHANNELS, mPending + lag * NUM_CHANNELS,
+            (mPendingSamples - lag) * NUM_CHANNELS * sizeof(int16_t));
+    const int16_t *x0 = mPending;
+    const int16_t *x1 = mPending + 2 * lag * NUM_CHANNELS;
+    int16_t *fade = mPending + lag * NUM_CHANNELS;
+    for (uint32_t i = 0; i < lag; i++)
+    {
+        float w = ((float)i + 0.5f) / (float)lag;
+        for (uint32_t ch = 0; ch < NUM_CHANNELS; ch++)
+        {
+            uint32_t n = i * NUM_CHANNELS + ch;
+            fade[n] = (int16_t)floorf(x1[n] + w * (x0[n] - x1[n]) + 0.5f);
+        }
+    }
+    mPendingSamples += lag;
+    mExpanded++;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef __AppStreamSampleClient__WsolaStretcher__
+#define __AppStreamSampleClient__WsolaStretcher__
+
+#include <stdint.h>
+
+/**
+ * Shortens or lengthens 48 kHz stereo PCM by whole pitch periods, the way
+ * WSOLA (waveform similarity overlap-add) does, so the playout delay can be
+ * moved without dropping audio or inserting silence.
+ *
+ * Each call looks for the lag L (2.5 to 10 ms) at which the next L samples
+ * best match the L samples after them. To accelerate, the two segments are
+ * cross-faded into one, which removes L samples. To expand, a cross-fade
+ * from the second segment back into the first is inserted between them,
+ * which adds L samples. Segments that don't repeat well enough are left
+ * alone unless they are quiet.
+ *
+ * The search needs 2 * MAX_LAG samples of look-ahead, so the stretcher
+ * holds back up to MAX_LAG samples per channel between calls; see
+ * getHeldSamples().
+ */
+class WsolaStretcher
+{
+public:
+
+    /**
+     * What to do with the next block of samples.
+     */
+    enum EMode
+    {
+        MODE_NORMAL,
+        MODE_ACCELERATE,
+        MODE_EXPAND
+    };
+
+    static const uint32_t NUM_CHANNELS = 2;
+
+    /** Shortest lag searched: 2.5 ms, a 400 Hz pitch */
+    static const uint32_t MIN_LAG = 120;
+
+    /** Longest lag searched: 10 ms, a 100 Hz pitch */
+    static const uint32_t MAX_LAG = 480;
+
+    /** Most samples per channel a single call takes */
+    static const uint32_t MAX_FRAME_SAMPLES = 960;
+
+    /** Samples per channel the output of a single call can hold */
+    static const uint32_t MAX_OUTPUT_SAMPLES = MAX_FRAME_SAMPLES + MAX_LAG;
+
+    /** Constructor */
+    WsolaStretcher();
+
+    /**
+     * Drop the held samples and start over.
+     */
+    void reset();
+
+    /**
+     * Add a block of samples and get back those ready to play.
+     *
+     * @param[in] in interleaved stereo samples
+     * @param[in] samplesPerChannel number of samples per channel in in; at
+     *     most MAX_FRAME_SAMPLES
+     * @param[in] mode whether to try to shorten or lengthen the audio
+     * @param[out] out receives the interleaved samples ready to play; must
+     *     hold MAX_OUTPUT_SAMPLES per channel
+     * @return the number of samples per channel written to out; more than
+     *     samplesPerChannel after an expansion, fewer after an acceleration
+     *     or while the look-ahead fills up.
+     */
+    uint32_t process(const int16_t *in, uint32_t samplesPerChannel,
+                     EMode mode, int16_t *out);
+
+    /**
+     * @return samples per channel held back for the next call
+     */
+    uint32_t getHeldSamples() const { return mPendingSamples; }
+
+    /** Counters since construction */
+    uint32_t getAccelerated() const { return mAccelerated; }
+    uint32_t getExpanded() const { return mExpanded; }
+    uint64_t getSamplesIn() const { return mSamplesIn; }
+    uint64_t getSamplesOut() const { return mSamplesOut; }
+
+private:
+
+    /** Lags are first searched on the mono signal at 1 / DECIMATION rate */
+    static const uint32_t DECIMATION = 4;
+
+    /** Segments must match at least this well to be cross-faded */
+    static const float MIN_CORRELATION;
+
+    /** Below this mean power per sample a segment is stretched regardless */
+    static const float QUIET_POWER;
+
+    /**
+     * Find the lag at which the pending samples best repeat.
+     *
+     * @param[in] maxLag longest lag to try
+     * @param[out] correlation normalized correlation at that lag
+     * @param[out] power mean power of the two segments
+     * @return the lag, in samples per channel
+     */
+    uint32_t findLag(uint32_t maxLag, float &correlation, float &power);
+
+    /**
+     * Normalized correlation of mono[0, lag) with mono[lag, 2 * lag),
+     * stepping by step.
+     */
+    static float correlate(const float *mono, uint32_t lag, uint32_t step,
+                           float *power);
+
+    /** Cross-fade the first two lag-long segments into one. */
+    void accelerate(uint32_t lag);
+
+    /** Insert a cross-fade from the second segment into the first. */
+    void expand(uint32_t lag);
+
+    /** Interleaved samples not played yet */
+    int16_t mPending[(MAX_LAG + MAX_OUTPUT_SAMPLES) * NUM_CHANNELS];
+    uint32_t mPendingSamples;
+
+    /** Mono mix of mPending used by the lag search */
+    float mMono[MAX_LAG + MAX_FRAME_SAMPLES];
+
+    uint32_t mAccelerated;
+    uint32_t mExpanded;
+    uint64_t mSamplesIn;
+    uint64_t mSamplesOut;
+};
+
+#endif /* defined(__AppStreamSampleClient__WsolaStretcher__) */
@@ -76,11 +76,7 @@ XStxRawAudioFrame* DummyAudioRenderer::popFrame(int delay, int msBuffer)
 {
     XStxRawAudioFrame * frame = NULL;
 
-    XStxResult result = XStxGetNextAudioFrame(
-                                    mClientHandle, 
-                                    &frame, 
-                                    delay, 
-                                    msBuffer);
+    XStxResult result = getNextFrame(&frame, delay, msBuffer);
 
     if (result != XSTX_RESULT_OK)
     {
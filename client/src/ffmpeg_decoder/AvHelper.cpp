@@ -115,8 +115,14 @@ void AvHelper::initialize()
 
         av_log_set_callback(&av_log_callback);
 
+        // Registration is automatic from FFmpeg 4.0, and the calls are
+        // gone from 5.0
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 9, 100)
         avcodec_register_all();
+#endif
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
         av_register_all();
+#endif
 
     }
 
@@ -19,27 +19,215 @@
 #include "AvHelper.h"
 #include "H264ToYuv.h"
 
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <errno.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
 #undef LOG_TAG
 #define LOG_TAG "H264ToYuv"
 
 #include "log.h"
 
+#ifndef AV_CODEC_FLAG_LOW_DELAY
+#define AV_CODEC_FLAG_LOW_DELAY CODEC_FLAG_LOW_DELAY
+#endif
+
+// The bundled SDK predates the AV_ prefixed codec ids and pixel formats;
+// current FFmpeg only has those
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(54, 25, 0)
+#define AV_CODEC_ID_H264 CODEC_ID_H264
+#endif
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(51, 42, 0)
+#define AV_PIX_FMT_YUV420P PIX_FMT_YUV420P
+#define AV_PIX_FMT_YUV444P PIX_FMT_YUV444P
+#endif
+
+// avcodec_send_packet/avcodec_receive_frame arrived in FFmpeg 3.1; older
+// versions fall back to avcodec_decode_video2
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 37, 100)
+#define H264TOYUV_SEND_RECEIVE 1
+#else
+#define H264TOYUV_SEND_RECEIVE 0
+#endif
+
+/** FFmpeg gains little beyond this many decoding threads */
+static const uint32_t MAX_DECODER_THREADS = 16;
+
+/** Reorder depth the decoder starts out configured for: none known */
+static const uint32_t UNKNOWN_REORDER_FRAMES = 0xffffffff;
+
+/** Frame interval assumed until timestamps tell us otherwise (60 FPS) */
+static const double DEFAULT_FRAME_INTERVAL_US = 16667.0;
+
+static AVFrame *allocAvFrame()
+{
+#if H264TOYUV_SEND_RECEIVE
+    return av_frame_alloc();
+#else
+    AVFrame *avFrame = avcodec_alloc_frame();
+    if (avFrame != NULL)
+    {
+        avcodec_get_frame_defaults(avFrame);
+    }
+    return avFrame;
+#endif
+}
+
+static void freeAvFrame(AVFrame *&avFrame)
+{
+#if H264TOYUV_SEND_RECEIVE
+    av_frame_free(&avFrame);
+#else
+    av_free(avFrame);
+    avFrame = NULL;
+#endif
+}
+
+static const char *threadingModeName(H264ToYuv::EThreadingMode mode)
+{
+    switch (mode)
+    {
+    case H264ToYuv::THREADING_SLICE: return "slice";
+    case H264ToYuv::THREADING_FRAME: return "frame";
+    default: return "none";
+    }
+}
+
+static const char *skipLoopFilterName(H264ToYuv::ESkipLoopFilter skip)
+{
+    switch (skip)
+    {
+    case H264ToYuv::SKIP_LOOP_FILTER_AUTO: return "auto";
+    case H264ToYuv::SKIP_LOOP_FILTER_NONREF: return "nonref";
+    case H264ToYuv::SKIP_LOOP_FILTER_ALL: return "all";
+    default: return "none";
+    }
+}
+
 /** Constructor */
 H264ToYuv::H264ToYuv()
     : mCodecContext(NULL)
+    , mDecodedFrame(NULL)
+    , mAllocatedAvFrames(0)
+    , mHeldAvFrames(0)
+    , mLeakedAvFrames(0)
     , mChromaSampling(XSTX_CHROMA_SAMPLING_YUV420)
+    , mThreadingMode(THREADING_SLICE)
+    , mThreadCount(0)
+    , mLowDelay(true)
+    , mSkipLoopFilter(SKIP_LOOP_FILTER_NONE)
+    , mLoopFilterSkipped(false)
+    , mOverBudgetFrames(0)
+    , mUnderBudgetFrames(0)
+    , mLastTimestampUs(0)
+    , mFrameIntervalUs(DEFAULT_FRAME_INTERVAL_US)
+    , mReorderFrames(0)
+    , mAppliedReorderFrames(UNKNOWN_REORDER_FRAMES)
+    , mSkippedLoopFilterFrames(0)
+    , mAsync(false)
+    , mFrameSink(NULL)
+    , mDecodeThread(NULL)
+    , mPacketQueue(MAX_QUEUED_PACKETS)
+    , mOutputFrame(NULL)
+    , mStopping(false)
+    , mQueueStalls(0)
+    , mDroppedFrames(0)
+    , mGeneration(0)
+    , mDecodedGeneration(0)
 {
+    const char *value = getenv("XSTX_DECODER_THREADING");
+    if (value != NULL)
+    {
+        if (strcmp(value, "frame") == 0)
+        {
+            mThreadingMode = THREADING_FRAME;
+        }
+        else if (strcmp(value, "none") == 0)
+        {
+            mThreadingMode = THREADING_NONE;
+        }
+    }
+
+    value = getenv("XSTX_DECODER_THREADS");
+    if (value != NULL && atoi(value) > 0)
+    {
+        mThreadCount = (uint32_t)atoi(value);
+    }
+
+    value = getenv("XSTX_DECODER_LOW_DELAY");
+    if (value != NULL && strcmp(value, "0") == 0)
+    {
+        mLowDelay = false;
+    }
+
+    value = getenv("XSTX_DECODER_SKIP_LOOP_FILTER");
+    if (value != NULL)
+    {
+        if (strcmp(value, "auto") == 0)
+        {
+            mSkipLoopFilter = SKIP_LOOP_FILTER_AUTO;
+        }
+        else if (strcmp(value, "nonref") == 0)
+        {
+            mSkipLoopFilter = SKIP_LOOP_FILTER_NONREF;
+        }
+        else if (strcmp(value, "all") == 0)
+        {
+            mSkipLoopFilter = SKIP_LOOP_FILTER_ALL;
+        }
+    }
+
+    value = getenv("XSTX_DECODER_ASYNC");
+    if (value != NULL && strcmp(value, "1") == 0)
+    {
+        mAsync = true;
+    }
 }
 
 /** Destructor */
 H264ToYuv::~H264ToYuv()
 {
+    // the decode thread uses the codec context
+    release();
+
+    if (mOutputFrame != NULL)
+    {
+        freeAvFrame(mOutputFrame);
+    }
+    if (mDecodedFrame != NULL)
+    {
+        freeAvFrame(mDecodedFrame);
+    }
+
+    // Pictures still referenced by frames that were never recycled can't
+    // be freed here; the frames still point at them
+    if (mHeldAvFrames != 0)
+    {
+        LOGW("H264 decoder destroyed with %u pictures still held",
+             mHeldAvFrames);
+    }
+    for (size_t i = 0; i < mFreeAvFrames.size(); i++)
+    {
+        freeAvFrame(mFreeAvFrames[i]);
+    }
+
     if (mCodecContext != NULL)
     {
         // free up FFmpeg codec context
+#if H264TOYUV_SEND_RECEIVE
+        avcodec_free_context(&mCodecContext);
+        av_packet_unref(&mAvPacket);
+#else
         avcodec_close(mCodecContext);
         av_freep(&mCodecContext);
         av_free_packet(&mAvPacket);
+#endif
     }
 
     // terminate logger
@@ -68,12 +256,12 @@ XStxResult H264ToYuv::init()
     // using video
     mCodecContext->codec_type           = AVMEDIA_TYPE_VIDEO;
     // H264 encoding
-    mCodecContext->codec_id             = CODEC_ID_H264;
+    mCodecContext->codec_id             = AV_CODEC_ID_H264;
     // YUV420P format
     mCodecContext->pix_fmt              = mChromaSampling == XSTX_CHROMA_SAMPLING_YUV420
-        ? PIX_FMT_YUV420P : PIX_FMT_YUV444P;
+        ? AV_PIX_FMT_YUV420P : AV_PIX_FMT_YUV444P;
 
-    AVCodec *codec = avcodec_find_decoder(CODEC_ID_H264);
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
 
     if (NULL == codec)
     {
@@ -81,6 +269,14 @@ XStxResult H264ToYuv::init()
         return XSTX_RESULT_VIDEO_DECODING_ERROR;
     }
 
+    // threading has to be configured before the codec is opened
+    configureThreading();
+
+#if !H264TOYUV_SEND_RECEIVE
+    // Pictures have to be refcounted so they can outlive the next decode
+    mCodecContext->refcounted_frames = 1;
+#endif
+
     if (avcodec_open2(mCodecContext, codec, NULL) < 0)
     {
         return XSTX_RESULT_VIDEO_DECODING_ERROR;
@@ -88,37 +284,43 @@ XStxResult H264ToYuv::init()
 
     av_init_packet(&mAvPacket);
 
-    // successfully initialized
-    return XSTX_RESULT_OK;
-}
-
-/**
- * Fetch A/V frame associated with given encoded video frame
- * @param[in] dec encoded video frame
- * @param[out] avFrame associated AV frame
- */
-XStxResult H264ToYuv::getAvFrame(XStxRawVideoFrame *dec, AVFrame *&avFrame)
-{
-    // check our A/V frame pool first
-    std::map<uint8_t *, AVFrame *>::iterator it =
-        planeToAvFrame.find(dec->mPlanes[0]);
-    if (it != planeToAvFrame.end())
+    if (mDecodedFrame == NULL)
     {
-        // found it
-        avFrame = it->second;
-        return XSTX_RESULT_OK;
+        mDecodedFrame = allocAvFrame();
+        if (mDecodedFrame == NULL)
+        {
+            return XSTX_RESULT_OUT_OF_MEMORY;
+        }
     }
 
-    // otherwise, allocate new frame
-    avFrame = avcodec_alloc_frame();
-    if (avFrame == NULL)
+    if (mAsync && mFrameSink != NULL && mDecodeThread == NULL)
     {
-        // failed to allocate new frame
-        LOGE("Failed to allocate new frame: %s",
-             XStxResultGetDescription(XSTX_RESULT_OUT_OF_MEMORY));
-        return XSTX_RESULT_OUT_OF_MEMORY;
+        // Kept across release() and init(), like mDecodedFrame
+        if (mOutputFrame == NULL)
+        {
+            mOutputFrame = allocAvFrame();
+            if (mOutputFrame == NULL)
+            {
+                return XSTX_RESULT_OUT_OF_MEMORY;
+            }
+        }
+
+        mStopping = false;
+        mDecodeThread = new(std::nothrow) DecodeThread("H264ToYuvDecode", *this);
+        if (mDecodeThread == NULL || mDecodeThread->start() != SIMPLE_RESULT_OK)
+        {
+            LOGE("Failed to start decode thread; decoding synchronously");
+            delete mDecodeThread;
+            mDecodeThread = NULL;
+        }
+        else
+        {
+            LOGI("H264 decoder: decoding asynchronously (%s)",
+                 H264TOYUV_SEND_RECEIVE ? "send/receive" : "decode_video2");
+        }
     }
-    avcodec_get_frame_defaults(avFrame);
+
+    // successfully initialized
     return XSTX_RESULT_OK;
 }
 
@@ -131,56 +333,59 @@ XStxResult H264ToYuv::decodeFrame(
     XStxEncodedVideoFrame *enc,
     XStxRawVideoFrame *dec)
 {
-    if (enc == NULL || dec == NULL)
+    if (enc == NULL)
     {
         return XSTX_RESULT_INVALID_ARGUMENTS;
     }
 
-    // fetch A/V frame from the pool
-    AVFrame *avFrame = NULL;
-    if (getAvFrame(dec, avFrame) != XSTX_RESULT_OK)
+    // Parameter sets only get parsed again when they change
+    mNALIndex.build(enc->mData, enc->mDataSize);
+    if (mParameterSets.update(mNALIndex, enc->mData))
     {
-        return XSTX_RESULT_OUT_OF_MEMORY;
+        streamParametersChanged();
     }
 
-    // decode frame
-    uint8_t *planeIndex = dec->mPlanes[0];
+    if (mDecodeThread != NULL)
+    {
+        // the decode thread renders the picture when it is ready
+        return queuePacket(enc);
+    }
 
+    if (dec == NULL)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+
+    applyFlush(currentGeneration());
+    applyReorderFrames(mReorderFrames);
+
+    // decode frame
     mAvPacket.data = enc->mData;
     mAvPacket.size = enc->mDataSize;
 
     int gotPicture = 0;
-    int avResult = avcodec_decode_video2(
-        mCodecContext,
-        avFrame,
-        &gotPicture,
-        &mAvPacket);
+    mud::TimeVal decodeStart = mud::TimeVal::mono();
+    int avResult = decodePacket(&mAvPacket, mDecodedFrame, gotPicture);
+    recordDecodeTime(decodeStart.elapsedMono().toMicroSeconds(),
+                     enc->mTimestampUs);
 
-    if (avResult >= 0 && gotPicture != 0)
+    if (avResult >= 0 && gotPicture == 0)
     {
-        // decoding succeeded
-        if (planeIndex != avFrame->data[0])
-        {
-            // our indexing changed, update our map
-            if (planeIndex != 0)
-            {
-                planeToAvFrame.erase(planeIndex);
-            }
-            planeToAvFrame[avFrame->data[0]] = avFrame;
-        }
-
-        // populate decoded frame
-        for (int i = 0; i < 3; i++)
-        {
-            dec->mPlanes[i] = avFrame->data[i];
-            dec->mStrides[i] = avFrame->linesize[i];
-        }
-        dec->mWidth = mCodecContext->width;
-        dec->mHeight = mCodecContext->height;
-        dec->mTimestampUs = enc->mTimestampUs;
+        // Nothing wrong with the stream; the picture is still in flight
+        // in the decoder (frame threading delays output by a frame per
+        // thread)
+        return XSTX_RESULT_FRAME_NOT_AVAILABLE;
+    }
 
-        // successfully decoded frame
-        return XSTX_RESULT_OK;
+    if (avResult >= 0 && gotPicture != 0)
+    {
+        // decoding succeeded; the frame keeps the picture alive until
+        // VideoModule recycles it
+        XStxResult result = attachAvFrame(
+            mDecodedFrame, static_cast<DecodedVideoFrame *>(dec),
+            enc->mTimestampUs);
+        av_frame_unref(mDecodedFrame);
+        return result;
     }
 
     return XSTX_RESULT_VIDEO_DECODING_ERROR;
@@ -210,3 +415,529 @@ bool H264ToYuv::isChromaSamplingSupported(XStxChromaSampling chromaSampling)
     return chromaSampling == XSTX_CHROMA_SAMPLING_YUV420
         || chromaSampling == XSTX_CHROMA_SAMPLING_YUV444;
 }
+
+void H264ToYuv::setThreading(EThreadingMode mode, uint32_t threadCount,
+                             bool lowDelay, ESkipLoopFilter skipLoopFilter)
+{
+    mThreadingMode = mode;
+    mThreadCount = threadCount;
+    mLowDelay = lowDelay;
+    mSkipLoopFilter = skipLoopFilter;
+}
+
+void H264ToYuv::configureThreading()
+{
+    uint32_t threads = mThreadCount;
+    if (threads == 0)
+    {
+        threads = mud::ThreadUtil::getProcessorCount();
+    }
+    if (threads > MAX_DECODER_THREADS)
+    {
+        threads = MAX_DECODER_THREADS;
+    }
+
+    switch (mThreadingMode)
+    {
+    case THREADING_SLICE:
+        mCodecContext->thread_type = FF_THREAD_SLICE;
+        mCodecContext->thread_count = threads;
+        break;
+    case THREADING_FRAME:
+        mCodecContext->thread_type = FF_THREAD_FRAME;
+        mCodecContext->thread_count = threads;
+        break;
+    default:
+        mCodecContext->thread_type = 0;
+        mCodecContext->thread_count = 1;
+        break;
+    }
+
+    // FFmpeg turns frame threading off when low delay is requested, so
+    // the two are exclusive
+    bool lowDelay = mLowDelay && mThreadingMode != THREADING_FRAME;
+    if (lowDelay)
+    {
+        mCodecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+    else
+    {
+        mCodecContext->flags &= ~AV_CODEC_FLAG_LOW_DELAY;
+    }
+
+    switch (mSkipLoopFilter)
+    {
+    case SKIP_LOOP_FILTER_NONREF:
+        mCodecContext->skip_loop_filter = AVDISCARD_NONREF;
+        break;
+    case SKIP_LOOP_FILTER_ALL:
+        mCodecContext->skip_loop_filter = AVDISCARD_ALL;
+        break;
+    default:
+        mCodecContext->skip_loop_filter = AVDISCARD_DEFAULT;
+        break;
+    }
+    mLoopFilterSkipped = false;
+    mOverBudgetFrames = 0;
+    mUnderBudgetFrames = 0;
+
+    LOGI("H264 decoder: %s threading, %u threads, low delay %s, skip loop filter %s",
+         threadingModeName(mThreadingMode), mCodecContext->thread_count,
+         lowDelay ? "on" : "off", skipLoopFilterName(mSkipLoopFilter));
+}
+
+void H264ToYuv::recordDecodeTime(uint64_t decodeTimeUs, uint64_t timestampUs)
+{
+    if (mLastTimestampUs != 0 && timestampUs > mLastTimestampUs &&
+        timestampUs - mLastTimestampUs < 1000000)
+    {
+        mFrameIntervalUs += ((double)(timestampUs - mLastTimestampUs) -
+                             mFrameIntervalUs) / 16.0;
+    }
+    mLastTimestampUs = timestampUs;
+
+    mDecodeTimeUs.add((double)decodeTimeUs);
+    if (mLoopFilterSkipped || mSkipLoopFilter == SKIP_LOOP_FILTER_NONREF ||
+        mSkipLoopFilter == SKIP_LOOP_FILTER_ALL)
+    {
+        mSkippedLoopFilterFrames++;
+    }
+
+    if (mSkipLoopFilter == SKIP_LOOP_FILTER_AUTO)
+    {
+        // Skip the filter on non-reference frames (no error propagation)
+        // once decoding keeps missing the frame interval, and restore it
+        // when there is comfortable headroom again
+        if ((double)decodeTimeUs > mFrameIntervalUs)
+        {
+            mUnderBudgetFrames = 0;
+            if (++mOverBudgetFrames >= OVERLOAD_FRAMES && !mLoopFilterSkipped)
+            {
+                setLoopFilterSkipped(true);
+            }
+        }
+        else if ((double)decodeTimeUs < mFrameIntervalUs / 2)
+        {
+            mOverBudgetFrames = 0;
+            if (++mUnderBudgetFrames >= RECOVERY_FRAMES && mLoopFilterSkipped)
+            {
+                setLoopFilterSkipped(false);
+            }
+        }
+    }
+
+    if (mDecodeTimeUs.count() >= STATS_INTERVAL_FRAMES)
+    {
+        LOGV("[decoder]={ \"Threading\":\"%s\", \"Threads\":%d, \"LowDelay\":%d, "
+             "\"SkipLoopFilter\":\"%s\", \"SkippedFrames\":%u, \"Frames\":%u, "
+             "\"MeanMs\":%.3f, \"StdDevMs\":%.3f, \"MaxMs\":%.3f, \"BudgetMs\":%.3f, "
+             "\"Async\":%d, \"Queued\":%u, \"QueueStalls\":%u, \"Dropped\":%u, "
+             "\"AvFrames\":%u, \"HeldAvFrames\":%u, \"LeakedAvFrames\":%u, "
+             "\"ReorderFrames\":%u, \"ParameterSetsParsed\":%u }",
+             threadingModeName(mThreadingMode), mCodecContext->thread_count,
+             (mCodecContext->flags & AV_CODEC_FLAG_LOW_DELAY) ? 1 : 0,
+             skipLoopFilterName(mSkipLoopFilter), mSkippedLoopFilterFrames,
+             (uint32_t)mDecodeTimeUs.count(),
+             mDecodeTimeUs.mean() / 1000.0, mDecodeTimeUs.stddev() / 1000.0,
+             mDecodeTimeUs.maximum() / 1000.0, mFrameIntervalUs / 1000.0,
+             mDecodeThread != NULL ? 1 : 0, (uint32_t)mPacketQueue.size(),
+             mQueueStalls, mDroppedFrames,
+             mAllocatedAvFrames, mHeldAvFrames, mLeakedAvFrames,
+             mReorderFrames, mParameterSets.getParseCount());
+        mDecodeTimeUs.reset();
+        mSkippedLoopFilterFrames = 0;
+        mQueueStalls = 0;
+        mDroppedFrames = 0;
+    }
+}
+
+void H264ToYuv::streamParametersChanged()
+{
+    const sps *activeSPS = mParameterSets.getActiveSPS();
+    if (activeSPS == NULL)
+    {
+        return;
+    }
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    getVideoSizeFromSPS(*activeSPS, width, height);
+    mReorderFrames = getMaxReorderFrames(*activeSPS);
+
+    const vui &timing = activeSPS->vui_parameters;
+    double fps = 0.0;
+    if (activeSPS->vui_parameters_present_flag && timing.timing_info_present_flag &&
+        timing.num_units_in_tick != 0)
+    {
+        // a frame is two ticks
+        fps = timing.time_scale / (2.0 * timing.num_units_in_tick);
+    }
+
+    LOGI("H264 stream: %ux%u, profile %u, level %u, %.2f fps, reorders up to %u frames",
+         width, height, activeSPS->profile, activeSPS->level, fps, mReorderFrames);
+}
+
+void H264ToYuv::applyReorderFrames(uint32_t reorderFrames)
+{
+    if (reorderFrames == mAppliedReorderFrames || mCodecContext == NULL)
+    {
+        return;
+    }
+    mAppliedReorderFrames = reorderFrames;
+
+    // Frame threading already holds pictures back a frame per thread,
+    // and FFmpeg turns it off if asked for low delay
+    if (mThreadingMode == THREADING_FRAME)
+    {
+        return;
+    }
+
+    // Low delay output hands pictures over in decode order, which is only
+    // right for a stream that doesn't reorder. Otherwise let the decoder
+    // hold back as many pictures as the SPS says it needs.
+    bool lowDelay = mLowDelay && reorderFrames == 0;
+    if (lowDelay)
+    {
+        mCodecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        mCodecContext->has_b_frames = 0;
+    }
+    else
+    {
+        mCodecContext->flags &= ~AV_CODEC_FLAG_LOW_DELAY;
+    }
+
+    LOGI("H264 decoder: low delay output %s, stream reorders up to %u frames",
+         lowDelay ? "on" : "off", reorderFrames);
+}
+
+void H264ToYuv::setLoopFilterSkipped(bool skip)
+{
+    mLoopFilterSkipped = skip;
+    mOverBudgetFrames = 0;
+    mUnderBudgetFrames = 0;
+    mCodecContext->skip_loop_filter = skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    LOGI("H264 decoder %s: loop filter on non-reference frames %s",
+         skip ? "overloaded" : "recovered", skip ? "skipped" : "restored");
+}
+
+void H264ToYuv::setFrameSink(DecodedFrameSink *sink)
+{
+    mFrameSink = sink;
+}
+
+void H264ToYuv::flush()
+{
+    {
+        mud::ScopeLock lock(mFlushLock);
+        mGeneration++;
+    }
+
+    // Whatever is still queued belongs to the old stream
+    drainPacketQueue();
+    LOGI("H264 decoder flush requested");
+}
+
+void H264ToYuv::release()
+{
+    if (mDecodeThread == NULL)
+    {
+        return;
+    }
+
+    mStopping = true;
+    mPacketQueue.interrupt();
+    mDecodeThread->join();
+    delete mDecodeThread;
+    mDecodeThread = NULL;
+
+    drainPacketQueue();
+}
+
+int H264ToYuv::decodePacket(AVPacket *packet, AVFrame *avFrame, int &gotPicture)
+{
+#if H264TOYUV_SEND_RECEIVE
+    gotPicture = 0;
+
+    // A full output queue only happens when an earlier picture was left
+    // behind; take it first and resubmit the packet afterwards
+    int avResult = avcodec_send_packet(mCodecContext, packet);
+    bool outputFull = avResult == AVERROR(EAGAIN);
+    if (avResult < 0 && !outputFull)
+    {
+        return avResult;
+    }
+
+    avResult = avcodec_receive_frame(mCodecContext, avFrame);
+    if (avResult == 0)
+    {
+        gotPicture = 1;
+    }
+    else if (avResult != AVERROR(EAGAIN))
+    {
+        return avResult;
+    }
+
+    if (outputFull)
+    {
+        return avcodec_send_packet(mCodecContext, packet);
+    }
+    return 0;
+#else
+    return avcodec_decode_video2(mCodecContext, avFrame, &gotPicture, packet);
+#endif
+}
+
+XStxResult H264ToYuv::queuePacket(XStxEncodedVideoFrame *enc)
+{
+    QueuedPacket *queued = new(std::nothrow) QueuedPacket;
+    if (queued == NULL)
+    {
+        return XSTX_RESULT_OUT_OF_MEMORY;
+    }
+
+    // av_new_packet adds the padding the bitstream reader needs
+    av_init_packet(&queued->mPacket);
+    if (av_new_packet(&queued->mPacket, enc->mDataSize) < 0)
+    {
+        delete queued;
+        return XSTX_RESULT_OUT_OF_MEMORY;
+    }
+    memcpy(queued->mPacket.data, enc->mData, enc->mDataSize);
+    queued->mPacket.pts = (int64_t)enc->mTimestampUs;
+    queued->mTimestampUs = enc->mTimestampUs;
+    queued->mGeneration = currentGeneration();
+    queued->mReorderFrames = mReorderFrames;
+
+    // Dropping a packet would corrupt every picture that references it,
+    // so hold the XStx thread back instead when the decoder falls behind
+    while (!mPacketQueue.push(queued))
+    {
+        if (mStopping)
+        {
+            freeQueuedPacket(queued);
+            return XSTX_RESULT_FRAME_NOT_AVAILABLE;
+        }
+        mQueueStalls++;
+        mud::ThreadUtil::sleep(1);
+    }
+
+    // the picture is not ready yet; the decode thread renders it
+    return XSTX_RESULT_FRAME_NOT_AVAILABLE;
+}
+
+void H264ToYuv::decodeLoop()
+{
+    while (!mStopping)
+    {
+        QueuedPacket *queued = NULL;
+        if (!mPacketQueue.waitAndPop(queued))
+        {
+            // interrupted
+            continue;
+        }
+
+        applyFlush(queued->mGeneration);
+        applyReorderFrames(queued->mReorderFrames);
+        decodeQueuedPacket(queued);
+        freeQueuedPacket(queued);
+    }
+}
+
+void H264ToYuv::decodeQueuedPacket(QueuedPacket *queued)
+{
+    uint64_t decodeTimeUs = 0;
+    mud::TimeVal decodeStart = mud::TimeVal::mono();
+
+#if H264TOYUV_SEND_RECEIVE
+    int avResult = avcodec_send_packet(mCodecContext, &queued->mPacket);
+    decodeTimeUs += decodeStart.elapsedMono().toMicroSeconds();
+    if (avResult < 0)
+    {
+        LOGW("avcodec_send_packet failed: %d", avResult);
+    }
+
+    // With frame threading one packet can complete several pictures;
+    // render each as soon as it comes out
+    for (;;)
+    {
+        decodeStart = mud::TimeVal::mono();
+        avResult = avcodec_receive_frame(mCodecContext, mOutputFrame);
+        decodeTimeUs += decodeStart.elapsedMono().toMicroSeconds();
+        if (avResult != 0)
+        {
+            break;
+        }
+        renderOutputFrame((uint64_t)mOutputFrame->pts);
+        av_frame_unref(mOutputFrame);
+    }
+#else
+    int gotPicture = 0;
+    int avResult = avcodec_decode_video2(
+        mCodecContext,
+        mOutputFrame,
+        &gotPicture,
+        &queued->mPacket);
+    decodeTimeUs = decodeStart.elapsedMono().toMicroSeconds();
+    if (avResult < 0)
+    {
+        LOGW("avcodec_decode_video2 failed: %d", avResult);
+    }
+    else if (gotPicture != 0)
+    {
+        renderOutputFrame((uint64_t)mOutputFrame->pkt_pts);
+        av_frame_unref(mOutputFrame);
+    }
+#endif
+
+    recordDecodeTime(decodeTimeUs, queued->mTimestampUs);
+}
+
+void H264ToYuv::renderOutputFrame(uint64_t timestampUs)
+{
+    if (currentGeneration() != mDecodedGeneration)
+    {
+        // flushed while decoding; this picture belongs to the old stream
+        return;
+    }
+
+    DecodedVideoFrame *frame = NULL;
+    if (mFrameSink->getDecodedFrame(&frame) != XSTX_RESULT_OK)
+    {
+        // paused, or the renderer is holding every frame
+        mDroppedFrames++;
+        return;
+    }
+
+    if (attachAvFrame(mOutputFrame, frame, timestampUs) == XSTX_RESULT_OK)
+    {
+        mFrameSink->renderDecodedFrame(frame);
+    }
+    else
+    {
+        mDroppedFrames++;
+    }
+
+    // releases the picture
+    mFrameSink->recycleDecodedFrame(frame);
+}
+
+XStxResult H264ToYuv::attachAvFrame(AVFrame *decoded, DecodedVideoFrame *frame,
+                                    uint64_t timestampUs)
+{
+    if (frame->mDecoderData != NULL)
+    {
+        // the frame was handed back to us without being recycled
+        mud::ScopeLock lock(mAvFramePoolLock);
+        mLeakedAvFrames++;
+    }
+    releaseFrame(frame);
+
+    AVFrame *held = acquireAvFrame();
+    if (held == NULL)
+    {
+        LOGE("Failed to reference picture: %s",
+             XStxResultGetDescription(XSTX_RESULT_OUT_OF_MEMORY));
+        return XSTX_RESULT_OUT_OF_MEMORY;
+    }
+    if (av_frame_ref(held, decoded) < 0)
+    {
+        mud::ScopeLock lock(mAvFramePoolLock);
+        mHeldAvFrames--;
+        mFreeAvFrames.push_back(held);
+        return XSTX_RESULT_OUT_OF_MEMORY;
+    }
+    frame->mDecoderData = held;
+
+    // populate decoded frame
+    for (int i = 0; i < 3; i++)
+    {
+        frame->mPlanes[i] = held->data[i];
+        frame->mStrides[i] = held->linesize[i];
+    }
+    frame->mWidth = mCodecContext->width;
+    frame->mHeight = mCodecContext->height;
+    frame->mTimestampUs = timestampUs;
+    return XSTX_RESULT_OK;
+}
+
+AVFrame *H264ToYuv::acquireAvFrame()
+{
+    mud::ScopeLock lock(mAvFramePoolLock);
+    AVFrame *avFrame = NULL;
+    if (!mFreeAvFrames.empty())
+    {
+        avFrame = mFreeAvFrames.back();
+        mFreeAvFrames.pop_back();
+    }
+    else if (mAllocatedAvFrames < MAX_HELD_AV_FRAMES)
+    {
+        avFrame = allocAvFrame();
+        if (avFrame != NULL)
+        {
+            mAllocatedAvFrames++;
+        }
+    }
+
+    if (avFrame != NULL)
+    {
+        mHeldAvFrames++;
+    }
+    return avFrame;
+}
+
+void H264ToYuv::releaseFrame(DecodedVideoFrame *frame)
+{
+    if (frame == NULL || frame->mDecoderData == NULL)
+    {
+        return;
+    }
+
+    AVFrame *held = (AVFrame *)frame->mDecoderData;
+    frame->mDecoderData = NULL;
+    av_frame_unref(held);
+
+    mud::ScopeLock lock(mAvFramePoolLock);
+    mHeldAvFrames--;
+    mFreeAvFrames.push_back(held);
+}
+
+void H264ToYuv::applyFlush(uint32_t generation)
+{
+    if (generation == mDecodedGeneration)
+    {
+        return;
+    }
+
+    avcodec_flush_buffers(mCodecContext);
+    mDecodedGeneration = generation;
+
+    // timestamps restart with the new stream
+    mLastTimestampUs = 0;
+    mFrameIntervalUs = DEFAULT_FRAME_INTERVAL_US;
+    LOGI("H264 decoder flushed");
+}
+
+uint32_t H264ToYuv::currentGeneration()
+{
+    mud::ScopeLock lock(mFlushLock);
+    return mGeneration;
+}
+
+void H264ToYuv::freeQueuedPacket(QueuedPacket *queued)
+{
+#if H264TOYUV_SEND_RECEIVE
+    av_packet_unref(&queued->mPacket);
+#else
+    av_free_packet(&queued->mPacket);
+#endif
+    delete queued;
+}
+
+void H264ToYuv::drainPacketQueue()
+{
+    QueuedPacket *queued = NULL;
+    while (mPacketQueue.pop(queued))
+    {
+        freeQueuedPacket(queued);
+    }
+}
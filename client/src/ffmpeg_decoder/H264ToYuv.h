@@ -20,24 +20,70 @@
 #define _included_H264ToYuv_h
 
 #include "VideoDecoder.h"
+#include "RunningStats.h"
+#include "ParameterSetStore.h"
+
+#include "MUD/memory/ThreadsafeQueue.h"
+#include "MUD/threading/SimpleLock.h"
+#include "MUD/threading/Thread.h"
 
 extern "C"
 {
 #include "libavcodec/avcodec.h"
 }
 
-#include <map>
+#include <vector>
 
 
 /**
  * An implementation of VideoDecoder that uses FFMPEG to do the
  * decoding.
+ *
+ * Threading and latency options are read from the environment when the
+ * decoder is constructed:
+ *  - XSTX_DECODER_THREADING: "slice" (default; lowest latency), "frame"
+ *    (highest throughput, adds one frame of delay per extra thread) or
+ *    "none".
+ *  - XSTX_DECODER_THREADS: number of decoding threads; 0 or unset picks
+ *    one per core.
+ *  - XSTX_DECODER_LOW_DELAY: set to 0 to clear the low-delay flag. The
+ *    flag is never set with frame threading, which FFmpeg would
+ *    otherwise silently turn off, and is only set while the active SPS
+ *    says the stream doesn't reorder frames.
+ *  - XSTX_DECODER_SKIP_LOOP_FILTER: "none" (default), "auto" (skip the
+ *    deblocking filter on non-reference frames while decoding can't keep
+ *    up with the stream), "nonref" or "all" (always skip).
+ *  - XSTX_DECODER_ASYNC: set to 1 to decode on a dedicated thread. The
+ *    XStx decode callback then only queues a copy of the packet and
+ *    returns; pictures go straight to the renderer as they come out of
+ *    the decoder, so decoding overlaps the arrival of the next packet.
  */
 class H264ToYuv : public VideoDecoder
 {
 
 public:
 
+    /**
+     * How decoding work is spread across threads.
+     */
+    enum EThreadingMode
+    {
+        THREADING_NONE,
+        THREADING_SLICE,
+        THREADING_FRAME
+    };
+
+    /**
+     * When the in-loop deblocking filter is skipped.
+     */
+    enum ESkipLoopFilter
+    {
+        SKIP_LOOP_FILTER_NONE,
+        SKIP_LOOP_FILTER_AUTO,
+        SKIP_LOOP_FILTER_NONREF,
+        SKIP_LOOP_FILTER_ALL
+    };
+
     /** Constructor */
     H264ToYuv();
 
@@ -70,24 +116,249 @@ public:
      */
     bool isChromaSamplingSupported(XStxChromaSampling chromaSampling);
 
+    /**
+     * Override the threading configuration. Takes effect on the next
+     * init().
+     *
+     * @param[in] mode threading mode
+     * @param[in] threadCount number of threads; 0 for one per core
+     * @param[in] lowDelay true to request the low-delay flag
+     * @param[in] skipLoopFilter when to skip the deblocking filter
+     */
+    void setThreading(EThreadingMode mode, uint32_t threadCount,
+                      bool lowDelay, ESkipLoopFilter skipLoopFilter);
+
+    /**
+     * Set where pictures go in asynchronous mode. Must be called before
+     * init().
+     */
+    void setFrameSink(DecodedFrameSink *sink);
+
+    /**
+     * Drop queued packets and flush the decoder before the next packet.
+     */
+    void flush();
+
+    /**
+     * Stop the decode thread.
+     */
+    void release();
+
+    /**
+     * Drop the reference decodeFrame() attached to a recycled frame.
+     */
+    void releaseFrame(DecodedVideoFrame *frame);
+
+    /**
+     * The SPS and PPS of the stream, parsed as decodeFrame() sees them.
+     * Only valid on the thread that calls decodeFrame().
+     */
+    const ParameterSetStore &getParameterSets() const { return mParameterSets; }
+
 private:
 
     /**
-     * Fetch A/V frame associated with given encoded video frame
-     * @param[in] dec encoded video frame
-     * @param[out] avFrame associated AV frame
+     * A copy of an encoded frame waiting for the decode thread.
+     */
+    struct QueuedPacket
+    {
+        AVPacket mPacket;
+        uint64_t mTimestampUs;
+        uint32_t mGeneration;
+        /** Reorder depth of the SPS active when it was queued */
+        uint32_t mReorderFrames;
+    };
+
+    /** Packets the XStx thread may run ahead of the decode thread */
+    static const uint32_t MAX_QUEUED_PACKETS = 8;
+
+    /**
+     * Pictures that can be referenced at once. Comfortably more than the
+     * frames in VideoModule's pool, so running out means frames are not
+     * being recycled.
+     */
+    static const uint32_t MAX_HELD_AV_FRAMES = 16;
+
+    /** How often (in frames) the decode time is logged. */
+    static const uint32_t STATS_INTERVAL_FRAMES = 300;
+
+    /** Consecutive over-budget frames before skipping the loop filter. */
+    static const uint32_t OVERLOAD_FRAMES = 8;
+
+    /** Consecutive frames well under budget before restoring it. */
+    static const uint32_t RECOVERY_FRAMES = 60;
+
+    /**
+     * Apply the threading configuration to mCodecContext before it is
+     * opened.
      */
-    XStxResult getAvFrame(XStxRawVideoFrame *dec, AVFrame *&avFrame);
+    void configureThreading();
+
+    /**
+     * Account for one decoded frame: update the statistics and, in auto
+     * mode, decide whether the loop filter should be skipped.
+     *
+     * @param[in] decodeTimeUs time spent in the decoder
+     * @param[in] timestampUs timestamp of the frame
+     */
+    void recordDecodeTime(uint64_t decodeTimeUs, uint64_t timestampUs);
+
+    /**
+     * Switch loop filter skipping on or off in auto mode.
+     */
+    void setLoopFilterSkipped(bool skip);
+
+    /**
+     * Log what a new or changed SPS says about the stream, and note its
+     * reorder depth for the packets that follow.
+     */
+    void streamParametersChanged();
+
+    /**
+     * Configure the decoder's output delay for a stream that reorders up
+     * to the given number of frames: no delay at all when it doesn't
+     * reorder, so each picture comes out as soon as it is decoded, and
+     * pictures in output order when it does. Called on the thread that
+     * feeds the decoder, before each packet; only acts on a change.
+     */
+    void applyReorderFrames(uint32_t reorderFrames);
+
+    /**
+     * Feed one packet to the decoder and fetch at most one picture.
+     *
+     * @param[in] packet the packet to decode
+     * @param[out] avFrame receives the picture
+     * @param[out] gotPicture set to non-zero when avFrame holds a picture
+     * @return the FFmpeg result
+     */
+    int decodePacket(AVPacket *packet, AVFrame *avFrame, int &gotPicture);
+
+    /**
+     * Copy an encoded frame onto the packet queue for the decode thread.
+     */
+    XStxResult queuePacket(XStxEncodedVideoFrame *enc);
+
+    /**
+     * Decode thread body.
+     */
+    void decodeLoop();
+
+    /**
+     * Decode one queued packet and render every picture it completes.
+     */
+    void decodeQueuedPacket(QueuedPacket *queued);
+
+    /**
+     * Hand the picture in mOutputFrame to the frame sink.
+     */
+    void renderOutputFrame(uint64_t timestampUs);
+
+    /**
+     * Flush the decoder if flush() was called since packets of the given
+     * generation were last decoded.
+     */
+    void applyFlush(uint32_t generation);
+
+    /**
+     * @return the generation that newly queued packets belong to
+     */
+    uint32_t currentGeneration();
+
+    /**
+     * Free a packet taken off the queue.
+     */
+    static void freeQueuedPacket(QueuedPacket *queued);
+
+    /**
+     * Free every packet still on the queue.
+     */
+    void drainPacketQueue();
+
+    DEFINE_METHOD_THREAD(DecodeThread, H264ToYuv, decodeLoop);
+
+    /**
+     * Reference the picture in decoded from a pooled AVFrame, attach it to
+     * the frame and describe the picture in it.
+     *
+     * @param[in] decoded the picture the decoder returned
+     * @param[in] frame the frame to attach it to
+     * @param[in] timestampUs presentation timestamp of the picture
+     * @return XSTX_RESULT_OK on success; XSTX_RESULT_OUT_OF_MEMORY if the
+     *     pool is exhausted.
+     */
+    XStxResult attachAvFrame(AVFrame *decoded, DecodedVideoFrame *frame,
+                             uint64_t timestampUs);
+
+    /**
+     * Take an AVFrame from the pool, allocating one if the pool is not
+     * yet at MAX_HELD_AV_FRAMES.
+     */
+    AVFrame *acquireAvFrame();
 
     /** FFmpeg context for decoding video */
 
     AVCodecContext *mCodecContext;
     AVPacket mAvPacket;
 
-    /** A/V frame pool */
-    std::map<uint8_t *, AVFrame *> planeToAvFrame;
+    /** The picture returned by the last synchronous decode */
+    AVFrame *mDecodedFrame;
+
+    /**
+     * A/V frame pool. Each frame handed to the renderer holds a reference
+     * to its picture in one of these until it is recycled; guarded by
+     * mAvFramePoolLock.
+     */
+    std::vector<AVFrame *> mFreeAvFrames;
+    uint32_t mAllocatedAvFrames;
+    uint32_t mHeldAvFrames;
+    uint32_t mLeakedAvFrames;
+    mud::SimpleLock mAvFramePoolLock;
 
     XStxChromaSampling mChromaSampling;
+
+    /** Threading configuration */
+    EThreadingMode mThreadingMode;
+    uint32_t mThreadCount;
+    bool mLowDelay;
+    ESkipLoopFilter mSkipLoopFilter;
+
+    /** Load tracking for SKIP_LOOP_FILTER_AUTO */
+    bool mLoopFilterSkipped;
+    uint32_t mOverBudgetFrames;
+    uint32_t mUnderBudgetFrames;
+    uint64_t mLastTimestampUs;
+    double mFrameIntervalUs;
+
+    /** NAL units of the frame decodeFrame() is working on */
+    NALUnitIndex mNALIndex;
+
+    /** Parameter sets seen in the stream */
+    ParameterSetStore mParameterSets;
+    /** Frames the stream may reorder, from its active SPS */
+    uint32_t mReorderFrames;
+    /** Reorder depth the decoder is configured for; decoding thread only */
+    uint32_t mAppliedReorderFrames;
+
+    /** Decode time per frame, in microseconds */
+    RunningStats mDecodeTimeUs;
+    uint32_t mSkippedLoopFilterFrames;
+
+    /** Asynchronous decoding */
+    bool mAsync;
+    DecodedFrameSink *mFrameSink;
+    DecodeThread *mDecodeThread;
+    mud::ThreadsafeQueue<QueuedPacket *> mPacketQueue;
+    AVFrame *mOutputFrame;
+    volatile bool mStopping;
+    uint32_t mQueueStalls;
+    uint32_t mDroppedFrames;
+
+    /** Bumped by flush(); guarded by mFlushLock */
+    uint32_t mGeneration;
+    mud::SimpleLock mFlushLock;
+
+    /** Generation of the packets the decoder last saw */
+    uint32_t mDecodedGeneration;
 };
 
 
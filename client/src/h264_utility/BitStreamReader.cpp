@@ -18,13 +18,115 @@
 
 #include "BitStreamReader.h"
 
-BitStreamReader::BitStreamReader(uint8_t *streamData, size_t streamLength):
-mCurrLoc(0),
-mBitsRemaining(0),
-mCurrBits(0),
+#include <stdio.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * @return the number of leading zero bits in value, 64 if it is 0
+ */
+static inline uint32_t countLeadingZeros(uint64_t value)
+{
+    if (value == 0) {
+        return 64;
+    }
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanReverse(&index, (unsigned long)(value >> 32))) {
+        return 31 - index;
+    }
+    _BitScanReverse(&index, (unsigned long)value);
+    return 63 - index;
+#else
+    return __builtin_clzll(value);
+#endif
+}
+
+/**
+ * @return true if any byte of value is 0x00
+ */
+static inline bool hasZeroByte(uint64_t value)
+{
+    return ((value - 0x0101010101010101ULL) & ~value & 0x8080808080808080ULL) != 0;
+}
+
+/**
+ * Maps an unsigned exp golomb code number onto its signed value:
+ * 0, 1, 2, 3, 4 ... become 0, 1, -1, 2, -2 ...
+ */
+static inline int32_t toSigned(uint32_t codeNum)
+{
+    if (codeNum & 1) {
+        return (int32_t)((codeNum >> 1) + 1);
+    }
+    return -(int32_t)(codeNum >> 1);
+}
+
+BitStreamReader::BitStreamReader(uint8_t *streamData, size_t streamLength, bool skipEmulationPrevention):
 mStreamData(streamData),
-mStreamLength(streamLength)
+mStreamLength(streamLength),
+mCurrLoc(0),
+mCache(0),
+mCacheBits(0),
+mStreamBits(streamLength * 8),
+mBitsRead(0),
+mSkipEmulationPrevention(skipEmulationPrevention),
+mZeroRun(0)
+{
+}
+
+void BitStreamReader::refill()
 {
+    while (mCacheBits <= 56) {
+        //Load a whole word at a time unless an emulation prevention byte
+        // might be in it
+        if (mCurrLoc + 8 <= mStreamLength) {
+            const uint8_t *p = mStreamData + mCurrLoc;
+            uint64_t word = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+                            ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+                            ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+                            ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+            
+            if (!mSkipEmulationPrevention || (mZeroRun < 2 && !hasZeroByte(word))) {
+                //Only whole bytes go into the cache
+                uint32_t numBytes = (64 - mCacheBits) / 8;
+                word &= ~(uint64_t)0 << (64 - numBytes * 8);
+                mCache |= word >> mCacheBits;
+                mCacheBits += numBytes * 8;
+                mCurrLoc += numBytes;
+                mZeroRun = 0;
+                continue;
+            }
+        }
+        
+        //Near the end of the stream, or near a possible emulation prevention
+        // byte, go a byte at a time
+        uint8_t byte = 0;
+        if (mCurrLoc < mStreamLength) {
+            byte = mStreamData[mCurrLoc++];
+            
+            //A 0x03 after two or more 0x00 was inserted by the encoder; drop
+            // it and start counting zeros again
+            if (mSkipEmulationPrevention && mZeroRun >= 2 && byte == 0x03) {
+                mZeroRun = 0;
+                mStreamBits -= 8;
+                byte = (mCurrLoc < mStreamLength) ? mStreamData[mCurrLoc++] : 0;
+            }
+            if (byte != 0) {
+                mZeroRun = 0;
+            } else if (mZeroRun < 2) {
+                mZeroRun++;
+            }
+        }
+        mCache |= (uint64_t)byte << (56 - mCacheBits);
+        mCacheBits += 8;
+    }
 }
 
 uint32_t BitStreamReader::getBits(uint8_t numBits)
@@ -39,70 +141,70 @@ uint32_t BitStreamReader::getBits(uint8_t numBits)
         return 0;
     }
 
-    //Shortcut if they aren't asking for any bits
-    // (this happens frequently with the exp golomb encoding)
-    if (numBits <= 0) {
+    return getBitsUnchecked(numBits);
+}
+
+int32_t BitStreamReader::getSExpGolomb()
+{
+    return toSigned(getUExpGolomb());
+}
+
+uint32_t BitStreamReader::getUExpGolomb()
+{
+    if (mCacheBits <= 56) {
+        refill();
+    }
+    
+    //A code is leadingZeroBits zeros, a one, then leadingZeroBits more bits
+    uint32_t leadingZeroBits = countLeadingZeros(mCache);
+    if (leadingZeroBits > 31) {
+        printf("Exp golomb code too long: %u leading zeros\n", leadingZeroBits);
         return 0;
     }
-
-    //Make sure our bit buffer has at least as many bits as they want to read
-    while (mBitsRemaining < numBits) {
-        //Shift the current bits left
-        mCurrBits = mCurrBits << 8;
-        //Add the first byte in the stream
-        mCurrBits += mStreamData[mCurrLoc++];
-        //Update the bits remaining
-        mBitsRemaining += 8;
+    if (leadingZeroBits * 2 + 1 > totalBitsRemaining()) {
+        printf("Not enough bits remaining in the stream. Remaining: %zu Requested: %u\n", totalBitsRemaining(), leadingZeroBits * 2 + 1);
+        return 0;
     }
 
-    //The bit buffer now holds enough bits for what they are trying to read
-
-    //Shift to the right to drop off any extra bits we don't want
-    uint8_t numBitsToDropOnRight = mBitsRemaining - numBits;
-    uint32_t retValue = (uint32_t)(mCurrBits >> numBitsToDropOnRight);
-
-    //Mask out any extra bits on the left from the number we do want
-    uint64_t cropValue = 1;
-    cropValue = cropValue << numBits;
-    cropValue -= 1;
-    retValue = retValue & cropValue;
-
-    //Update the bits remaining
-    mBitsRemaining -= numBits;
-
-    return retValue;
+    return getUExpGolombUnchecked();
 }
 
-int32_t BitStreamReader::getSExpGolomb()
+int32_t BitStreamReader::getSExpGolombUnchecked()
 {
-    int32_t codeNum = getUExpGolomb();
-
-    codeNum += 1;
-
-    if (codeNum & 1) {
-        return -(codeNum>>1);
-    } else
-    {
-        return codeNum>>1;
-    }
+    return toSigned(getUExpGolombUnchecked());
 }
 
-uint32_t BitStreamReader::getUExpGolomb()
+uint32_t BitStreamReader::getUExpGolombUnchecked()
 {
-    int leadingZeroBits = -1;
-    for (bool b=0; !b; leadingZeroBits++) {
-        b = getBits(1);
+    if (mCacheBits <= 56) {
+        refill();
     }
-    uint32_t codeNum = 1;
-    codeNum = ((codeNum << leadingZeroBits) - 1);
-    codeNum += getBits(leadingZeroBits);
-
-    return codeNum;
+    
+    uint32_t leadingZeroBits = countLeadingZeros(mCache);
+    if (leadingZeroBits <= 28) {
+        //The whole code is in the cache: it is the top 2n+1 bits, less one
+        uint32_t codeLength = leadingZeroBits * 2 + 1;
+        uint32_t codeNum = (uint32_t)(mCache >> (64 - codeLength)) - 1;
+        mCache <<= codeLength;
+        mCacheBits -= codeLength;
+        mBitsRead += codeLength;
+        return codeNum;
+    }
+    
+    if (leadingZeroBits > 31) {
+        //Can't be a valid 32-bit value; step over it
+        skipBits(32);
+        return 0xFFFFFFFF;
+    }
+    
+    //Codes for values of 2^29 and up are read in two goes
+    skipBits(leadingZeroBits + 1);
+    uint32_t codeNum = ((uint32_t)1 << leadingZeroBits) - 1;
+    return codeNum + getBitsUnchecked(leadingZeroBits);
 }
 
 
 size_t BitStreamReader::totalBitsRemaining()
 {
-    return ((mStreamLength - mCurrLoc) * 8) + mBitsRemaining;
+    return (mBitsRead < mStreamBits) ? mStreamBits - mBitsRead : 0;
 }
-
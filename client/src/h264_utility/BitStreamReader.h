@@ -19,8 +19,21 @@
 #ifndef __VDADecoderDetector__BitStreamReader__
 #define __VDADecoderDetector__BitStreamReader__
 
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Reads a bit stream MSB first, the way H.264 syntax elements are coded.
+ *
+ * The next bits of the stream are kept left aligned in a 64-bit cache that
+ * is refilled a word at a time, so reading a field is a shift and a mask,
+ * and an Exp-Golomb code is one count-leading-zeros plus a shift.
+ *
+ * getBits and the Exp-Golomb getters check that the stream holds what is
+ * asked for. The Unchecked variants skip those checks for buffers that are
+ * already known to be long enough; past the end of the stream they read
+ * zeros.
+ */
 class BitStreamReader {
     /**
      * Pointer to the bit stream
@@ -33,19 +46,47 @@ class BitStreamReader {
     size_t      mStreamLength;
     
     /**
-     * Current location in the bit stream (# of bytes in)
+     * Current location in the bit stream (# of bytes loaded into the cache)
+     */
+    size_t      mCurrLoc;
+    
+    /**
+     * Upcoming bits of the stream, left aligned. Bits below the top
+     * mCacheBits are always zero.
+     */
+    uint64_t    mCache;
+    
+    /**
+     * Number of valid bits in mCache
+     */
+    uint32_t    mCacheBits;
+    
+    /**
+     * Length of the stream in bits, less any emulation prevention bytes
+     * dropped so far
+     */
+    size_t      mStreamBits;
+    
+    /**
+     * Number of bits read so far
      */
-    uint32_t    mCurrLoc;
+    size_t      mBitsRead;
     
     /**
-     * Bits remaining in the current byte
+     * Whether 00 00 03 emulation prevention bytes are dropped while reading
      */
-    uint8_t     mBitsRemaining;
+    bool        mSkipEmulationPrevention;
     
     /**
-     * Current Byte being examined
+     * Number of 0x00 bytes loaded in a row, used to spot emulation prevention
      */
-    uint64_t     mCurrBits;
+    uint8_t     mZeroRun;
+    
+    /**
+     * Top up the cache so it holds at least 57 bits. Past the end of the
+     * stream it is topped up with zeros.
+     */
+    void refill();
     
 public:
     /**
@@ -53,8 +94,11 @@ public:
      *
      * @param[in] streamData pointer to the bit stream to parse
      * @param[in] streamLength length in bytes of the bit stream
+     * @param[in] skipEmulationPrevention true to read a NAL unit as it is in
+     * the stream, dropping the 0x03 of each 00 00 03 as extractRBSP would.
+     * The RBSP is then read without having to copy it out first.
      */
-    BitStreamReader(uint8_t *streamData, size_t streamLength);
+    BitStreamReader(uint8_t *streamData, size_t streamLength, bool skipEmulationPrevention = false);
     
     /**
      * An empty virtual destructor. Ensures that derived classes are destroyed correctly.
@@ -83,7 +127,68 @@ public:
     int32_t getSExpGolomb();
     
     /**
-     * Get the total bits remaining to the end of the stream
+     * Look at the next bits (up to 32) without reading them. No checks.
+     *
+     * @return int holding the next bits
+     */
+    inline uint32_t peekBits(uint8_t numBits)
+    {
+        if (mCacheBits < numBits) {
+            refill();
+        }
+        return numBits == 0 ? 0 : (uint32_t)(mCache >> (64 - numBits));
+    }
+    
+    /**
+     * Skip the given number of bits (up to 32). No checks.
+     */
+    inline void skipBits(uint8_t numBits)
+    {
+        if (mCacheBits < numBits) {
+            refill();
+        }
+        mCache <<= numBits;
+        mCacheBits -= numBits;
+        mBitsRead += numBits;
+    }
+    
+    /**
+     * Read the given number of bits (up to 32). No checks.
+     *
+     * @return int holding the desired bits
+     */
+    inline uint32_t getBitsUnchecked(uint8_t numBits)
+    {
+        uint32_t retValue = peekBits(numBits);
+        skipBits(numBits);
+        return retValue;
+    }
+    
+    /**
+     * Get an unsigned exp golomb encoded value. No checks.
+     *
+     * @return the unsigned exp golomb encoded value
+     */
+    uint32_t getUExpGolombUnchecked();
+    
+    /**
+     * Get a signed exp golomb encoded value. No checks.
+     *
+     * @return the signed exp golomb encoded value
+     */
+    int32_t getSExpGolombUnchecked();
+    
+    /**
+     * Get the number of bits read so far. Emulation prevention bytes that
+     * were skipped are not counted.
+     *
+     * @return bits read so far
+     */
+    size_t getBitsRead() const { return mBitsRead; }
+    
+    /**
+     * Get the total bits remaining to the end of the stream. When skipping
+     * emulation prevention bytes, those not reached yet are still counted.
      *
      * @return total bits remaining to the end of the stream
      */
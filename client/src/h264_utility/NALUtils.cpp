@@ -18,10 +18,34 @@
 
 #include "NALUtils.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NAL_USE_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NAL_USE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NAL_USE_NEON 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 #undef LOG_TAG
 #define LOG_TAG "NALUtils"
 #include "log.h"
 
+/**
+ * A start code is only reported when more than this many bytes follow
+ * its first zero, which is what the original scanner did.
+ */
+#define NAL_MIN_BYTES_AFTER_START_CODE 5
+
 
 /**
  * Finds and returns the NAL unit with the given type.
@@ -31,9 +55,9 @@
  * @param[in] dataEnd pointer to the end of the video frame data
  * @param[out] nalUnitStart on success will point to the beginning of the NAL unit
  * @param[out] nalUnitLength on success will have the length of the NAL unit in bytes
- * @return TRUE if the NAL unit was found FALSE if it was not
+ * @return true if the NAL unit was found false if it was not
  */
-BOOL getNALUnit( nalType whichNAL, uint8_t *dataStart, uint8_t *dataEnd,
+bool getNALUnit( nalType whichNAL, uint8_t *dataStart, uint8_t *dataEnd,
                 uint8_t *&nalUnitStart, uint32_t &nalUnitLength)
 {
     uint8_t *start = dataStart;
@@ -75,18 +99,272 @@ BOOL getNALUnit( nalType whichNAL, uint8_t *dataStart, uint8_t *dataEnd,
     return false;
 }
 
+/**
+ * Finds and returns the NAL unit with the given type in an indexed frame.
+ *
+ * @param[in] index index built from the frame
+ * @param[in] whichNAL The type of NAL unit being searched for
+ * @param[in] dataStart pointer to the beginning of the indexed frame data
+ * @param[out] nalUnitStart on success will point to the beginning of the NAL unit
+ * @param[out] nalUnitLength on success will have the length of the NAL unit in bytes
+ * @return true if the NAL unit was found false if it was not
+ */
+bool getNALUnit( const NALUnitIndex &index, nalType whichNAL, uint8_t *dataStart,
+                uint8_t *&nalUnitStart, uint32_t &nalUnitLength)
+{
+    const nalUnit *unit = index.find(whichNAL);
+    if (unit == NULL) {
+        return false;
+    }
+    nalUnitStart = dataStart + unit->offset;
+    nalUnitLength = unit->length;
+    return true;
+}
+
+/**
+ * Index a frame, replacing what was indexed before.
+ *
+ * @param[in] dataStart pointer to the beginning of the video frame data
+ * @param[in] dataSize size of the video frame data
+ * @return the number of NAL units found
+ */
+uint32_t NALUnitIndex::build(uint8_t *dataStart, uint32_t dataSize)
+{
+    uint8_t *dataEnd = dataStart + dataSize;
+    mUnits.clear();
+
+    uint8_t headerLength = 0;
+    uint8_t *start = findNALUnitStart(dataStart, dataEnd, headerLength);
+    while (start != NULL) {
+        nalUnit unit;
+        unit.offset = (uint32_t)(start - dataStart);
+        unit.type = start[0] & 0x1F;
+        unit.headerLength = headerLength;
+
+        //Each NAL ends where the start code of the next one begins
+        uint8_t *next = findNALUnitStart(start, dataEnd, headerLength);
+        if (next == NULL) {
+            unit.length = (uint32_t)(dataEnd - start);
+        } else
+        {
+            unit.length = (uint32_t)(next - headerLength - start);
+        }
+        mUnits.push_back(unit);
+        start = next;
+    }
+    return (uint32_t)mUnits.size();
+}
+
+/**
+ * @return the first NAL unit with the given type, or NULL if the frame
+ *     has none
+ */
+const nalUnit *NALUnitIndex::find(nalType whichNAL) const
+{
+    for (size_t i = 0; i < mUnits.size(); i++) {
+        if (mUnits[i].type == whichNAL) {
+            return &mUnits[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Checks for a start code at a position followed by more than
+ * NAL_MIN_BYTES_AFTER_START_CODE bytes.
+ *
+ * @param[in] p candidate position; p[0] and p[1] are already known to be 0
+ * @param[out] nalUnitHeaderLength 3 or 4 if a start code is found
+ * @return pointer to the first byte of the NAL or NULL
+ */
+static inline uint8_t *checkStartCode(uint8_t *p, uint8_t &nalUnitHeaderLength)
+{
+    // 0 0 1 is valid
+    if (p[2] == 1)
+    {
+        nalUnitHeaderLength = 3;
+        return p + 3;
+    }
+    // 0 0 0 1 is valid
+    if (p[2] == 0 && p[3] == 1)
+    {
+        nalUnitHeaderLength = 4;
+        return p + 4;
+    }
+    return NULL;
+}
+
+#if NAL_USE_SSE2 || NAL_USE_AVX2
+static inline uint32_t countTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+#endif
+
 /**
  * NALUnits start with 2 or 3 0x00 bytes followed by 0x01
  * This function returns the location of the start of the next
  * NAL unit. The first byte pointed to is the type byte
  * and can be used to determine which type of NAL it is
  *
+ * The vector loops look for 0 0 followed by 0 or 1 at 16 (32 with AVX2)
+ * positions at a time and only check the candidates they find, so long
+ * runs of data with no zero pairs are skipped without touching each byte.
+ *
  * @param[in] start pointer to the beginning of the video frame data
  * @param[in] end pointer to the end of the video frame data
  * @param[out] nalUnitHeaderLength length of the NAL header (should be be 3 or 4 if a NAL is found)
  * @return pointer to location of the first byte in the NAL or NULL if no NAL is found
  */
 uint8_t * findNALUnitStart( uint8_t *start, uint8_t *end, uint8_t &nalUnitHeaderLength)
+{
+    // Same rule as the reference: a start code needs room for a header
+    // and data after it
+    if (end - start <= NAL_MIN_BYTES_AFTER_START_CODE)
+    {
+        return NULL;
+    }
+    uint8_t *last = end - NAL_MIN_BYTES_AFTER_START_CODE - 1;
+    uint8_t *p = start;
+
+#if NAL_USE_AVX2
+    // Each step reads p .. p + 33
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i notOne = _mm256_set1_epi8((char)0xFE);
+    for (; end - p >= 34; p += 32)
+    {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+        __m256i candidates = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+            _mm256_cmpeq_epi8(_mm256_and_si256(b2, notOne), zero));
+
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(candidates);
+        while (mask != 0)
+        {
+            uint8_t *q = p + countTrailingZeros(mask);
+            if (q > last)
+            {
+                return NULL;
+            }
+            uint8_t *nal = checkStartCode(q, nalUnitHeaderLength);
+            if (nal != NULL)
+            {
+                return nal;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif NAL_USE_SSE2
+    // Each step reads p .. p + 17
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i notOne = _mm_set1_epi8((char)0xFE);
+    for (; end - p >= 18; p += 16)
+    {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i candidates = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+            _mm_cmpeq_epi8(_mm_and_si128(b2, notOne), zero));
+
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(candidates);
+        while (mask != 0)
+        {
+            uint8_t *q = p + countTrailingZeros(mask);
+            if (q > last)
+            {
+                return NULL;
+            }
+            uint8_t *nal = checkStartCode(q, nalUnitHeaderLength);
+            if (nal != NULL)
+            {
+                return nal;
+            }
+            mask &= mask - 1;
+        }
+    }
+#elif NAL_USE_NEON
+    // Each step reads p .. p + 17. NEON has no movemask, so a block with
+    // any candidate is checked byte by byte.
+    const uint8x16_t notOne = vdupq_n_u8(0xFE);
+    for (; end - p >= 18; p += 16)
+    {
+        uint8x16_t b0 = vld1q_u8(p);
+        uint8x16_t b1 = vld1q_u8(p + 1);
+        uint8x16_t b2 = vld1q_u8(p + 2);
+        // zero where a start code may begin
+        uint8x16_t any = vorrq_u8(vorrq_u8(b0, b1), vandq_u8(b2, notOne));
+        uint8x16_t candidates = vceqq_u8(any, vdupq_n_u8(0));
+        uint64x2_t halves = vreinterpretq_u64_u8(candidates);
+        if ((vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1)) == 0)
+        {
+            continue;
+        }
+        for (uint8_t *q = p; q < p + 16; q++)
+        {
+            if (q > last)
+            {
+                return NULL;
+            }
+            if (q[0] == 0 && q[1] == 0)
+            {
+                uint8_t *nal = checkStartCode(q, nalUnitHeaderLength);
+                if (nal != NULL)
+                {
+                    return nal;
+                }
+            }
+        }
+    }
+#endif
+
+    // A start code needs p[2] <= 1 and zeros at p[1] and p[0], so each
+    // byte that rules one out lets us skip that far
+    while (p <= last)
+    {
+        if (p[2] > 1)
+        {
+            p += 3;
+        }
+        else if (p[1] != 0)
+        {
+            p += 2;
+        }
+        else if (p[0] != 0)
+        {
+            p++;
+        }
+        else
+        {
+            uint8_t *nal = checkStartCode(p, nalUnitHeaderLength);
+            if (nal != NULL)
+            {
+                return nal;
+            }
+            p++;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The original memchr based scanner. findNALUnitStart must return
+ * exactly what this returns for any input.
+ *
+ * @param[in] start pointer to the beginning of the video frame data
+ * @param[in] end pointer to the end of the video frame data
+ * @param[out] nalUnitHeaderLength length of the NAL header (should be be 3 or 4 if a NAL is found)
+ * @return pointer to location of the first byte in the NAL or NULL if no NAL is found
+ */
+uint8_t * findNALUnitStartReference( uint8_t *start, uint8_t *end, uint8_t &nalUnitHeaderLength)
 {
     while (end > start)
     {
@@ -131,8 +409,6 @@ uint8_t * findNALUnitStart( uint8_t *start, uint8_t *end, uint8_t &nalUnitHeader
             //Lots of 0's but we need 001 so keep looking
             start ++;
         }
-        
-        return start;
     }
     
     return NULL;
@@ -152,11 +428,11 @@ void extractRBSP(uint8_t *dataStart, uint32_t dataLength, uint8_t *&rbspOut, uin
     //Start off with a 0 length
     rbspLength = 0;
     
-    //Create a temp buffer to put the rbsp data into
-    uint8_t rbspOutData[dataLength];
-    memset(&rbspOutData, 0x00, dataLength);
+    //The rbsp is never longer than the NAL, so write it straight into the
+    // output buffer
+    uint8_t *rbspOutData = (uint8_t*) malloc(dataLength);
     
-    int currLocInData = 0;
+    uint32_t currLocInData = 0;
     
     //First byte is the NAL type so put it in the rbsp
     rbspOutData[rbspLength++] = dataStart[currLocInData++];
@@ -186,9 +462,7 @@ void extractRBSP(uint8_t *dataStart, uint32_t dataLength, uint8_t *&rbspOut, uin
         }
     }
     
-    //Put the rbsp in the out variable and return it
-    rbspOut = (uint8_t*) malloc(rbspLength);
-    memcpy(rbspOut, rbspOutData, rbspLength);
+    rbspOut = rbspOutData;
 }
 
 
@@ -212,18 +486,15 @@ void makeExtraData( uint8_t *&extraData, uint8_t *spsData, uint8_t spsLength,
     extraData[currIndex++] = 0xFC | 3; // reserved 6-bits, NALU length size - 1 (2 bits)
     extraData[currIndex++] = 0xE0 | 1; // reserved 3-bits, number of SPS (5 bits)
     
-    uint16_t spsLength16;
-    spsLength16 = htons(spsLength);
-    memcpy(&extraData[currIndex], &spsLength16, 2); //SPS length in 2 bytes
-    currIndex += 2;
+    extraData[currIndex++] = 0; //SPS length in 2 bytes (Big Endian)
+    extraData[currIndex++] = spsLength;
     
     memcpy(&extraData[currIndex], spsData, spsLength); //Copy the SPS
     currIndex += spsLength;
     
     extraData[currIndex++] = 0x01; // number of PPS frames (1)
-    uint16_t ppsLength16 = htons(ppsLength);
-    memcpy(&extraData[currIndex], &ppsLength16, 2); //PPS length in 2 bytes
-    currIndex += 2;
+    extraData[currIndex++] = 0; //PPS length in 2 bytes (Big Endian)
+    extraData[currIndex++] = ppsLength;
     
     memcpy(&extraData[currIndex], ppsData, ppsLength); //Copy the PPS
     
@@ -231,127 +502,145 @@ void makeExtraData( uint8_t *&extraData, uint8_t *spsData, uint8_t spsLength,
 }
 
 
+/**
+ * @return true if NALs of this type are kept by convertToSizeEncodedVideoFrame
+ */
+static inline bool isSliceNAL(uint8_t type)
+{
+    return type >= NAL_TYPE_NON_IDR_SLICE && type <= NAL_TYPE_IDR_SLICE;
+}
+
+/**
+ * Writes a 32-bit big endian NAL size
+ */
+static inline void putSize(uint8_t *out, uint32_t size)
+{
+    out[0] = (uint8_t)(size >> 24);
+    out[1] = (uint8_t)(size >> 16);
+    out[2] = (uint8_t)(size >> 8);
+    out[3] = (uint8_t)size;
+}
+
+SizeEncodedFrameBuffer::SizeEncodedFrameBuffer()
+    : mData(NULL)
+    , mCapacity(0)
+{
+}
+
+SizeEncodedFrameBuffer::~SizeEncodedFrameBuffer()
+{
+    free(mData);
+}
+
+/**
+ * Make sure the buffer can hold size bytes. The contents are not kept.
+ *
+ * @param[in] size number of bytes needed
+ * @return the buffer, or NULL if it could not be grown
+ */
+uint8_t *SizeEncodedFrameBuffer::reserve(uint32_t size)
+{
+    if (size <= mCapacity) {
+        return mData;
+    }
+    //Grow by at least half again so a slowly growing stream doesn't
+    // reallocate on every frame
+    uint32_t newCapacity = mCapacity + mCapacity / 2;
+    if (newCapacity < size) {
+        newCapacity = size;
+    }
+    uint8_t *newData = (uint8_t*)malloc(newCapacity);
+    if (newData == NULL) {
+        LOGE("Could not grow frame buffer to %u bytes", newCapacity);
+        return NULL;
+    }
+    free(mData);
+    mData = newData;
+    mCapacity = newCapacity;
+    LOGI("IncreasingBufferTo: %u", mCapacity);
+    return mData;
+}
+
 /**
  * Converts the passed in H.264 frame data into one that encodes each NAL size
- * as a 4-byte size instead of a NAL header (00 00 01).
+ * as a 4-byte size instead of a NAL header (00 00 01). Only the slice NALs
+ * are kept.
+ *
+ * When every slice NAL has a 4-byte start code the sizes simply replace the
+ * start codes, so the frame is converted in place and dataStart is
+ * overwritten. Otherwise the frame is written into buffer.
  *
- * @param[in] dataStart pointer to the beginning of the frame data
- * @param[in] dataSize size of the data pointed at by dataStart
+ * @param[in] index index built from the frame
+ * @param[in] dataStart pointer to the beginning of the indexed frame data
+ * @param[in] buffer where the frame is written when it can't be converted in place
  * @param[out] newFrameData pointer to the start of the restructured H.264 frame data
  * @param[out] newFrameLength length of the new frame
- * @return TRUE if a frame was created, FALSE otherwise
+ * @return true if a frame was created, false otherwise
  */
-BOOL convertToSizeEncodedVideoFrame ( uint8_t *dataStart, uint32_t dataSize,
+bool convertToSizeEncodedVideoFrame ( const NALUnitIndex &index, uint8_t *dataStart,
+                                     SizeEncodedFrameBuffer &buffer,
                                      uint8_t *&newFrameData, uint32_t &newFrameLength)
 {
-    //Make sure we know where the incoming data ends
-    uint8_t *dataEnd = dataStart + dataSize;
-    
-    //Keep track of the buffer size so it can be resized larger if needed
-    static uint32_t currBufferSize = 0;
-    static uint8_t *frameBuffer = NULL;
+    uint32_t nalCount = index.getCount();
     
-    //Make sure the frameBuffer is large enough to store the data with a bit of
-    // extra padding since we will need to add space for the NAL headers we inject
-    if (currBufferSize < (dataSize + 100)) {
-        //It's too small so free our old buffer and create a new one
-        if (frameBuffer != NULL) {
-            free(frameBuffer);
+    //Work out how big the new frame is and whether it fits where the old one is
+    uint32_t frameLength = 0;
+    uint32_t firstSlice = nalCount;
+    bool inPlace = true;
+    for (uint32_t i = 0; i < nalCount; i++) {
+        const nalUnit &unit = index.getUnit(i);
+        if (!isSliceNAL(unit.type)) {
+            //SPS, PPS and any other non VCL NAL are dropped
+            LOGV("Not a VCL NAL: %i", unit.type);
+            continue;
         }
-        
-        currBufferSize = dataSize + 100;
-        frameBuffer = (uint8_t*)malloc(currBufferSize);
-        NSLog(@"IncreasingBufferTo: %i", currBufferSize);
+        if (firstSlice == nalCount) {
+            firstSlice = i;
+        }
+        frameLength += 4 + unit.length;
+        inPlace = inPlace && unit.headerLength == 4;
     }
-    //0 out the buffer
-    memset(frameBuffer, 0, currBufferSize);
     
+    if (frameLength == 0) {
+        //We didn't find any frame data
+        return false;
+    }
     
-    uint32_t currBufferLen = 0;
-    //Go through the data looking for NALs
-    while (dataStart < dataEnd) {
-        uint8_t headerLength;
-        uint8_t *nalStart;
-        
-        nalStart = findNALUnitStart(dataStart, dataEnd, headerLength);
-        
-        if (nalStart == NULL) {
-            //No NAL unit
-            break;
-        }
-        
-        //Update dataStart location
-        dataStart = nalStart;
-        
-        //We found a NAL unit so check the type
-        uint8_t nalType = nalStart[0] & 0x1F;
-        
-        if (nalType == NAL_TYPE_SPS) {
-            //SPS
-            LOGV("Found SPS");
-            continue;
-        } else if (nalType == NAL_TYPE_PPS) {
-            //PPS
-            LOGV("Found PPS");
-            continue;
+    uint8_t *frameData;
+    if (inPlace) {
+        //Each size goes where the start code was. The slices only ever move
+        // towards the front, so this never overwrites a NAL not yet moved.
+        frameData = dataStart + index.getUnit(firstSlice).offset - 4;
+    } else
+    {
+        frameData = buffer.reserve(frameLength);
+        if (frameData == NULL) {
+            return false;
         }
-        if (nalType < NAL_TYPE_NON_IDR_SLICE || nalType > NAL_TYPE_IDR_SLICE) {
-            //Not a VCL NAL type so skip it and go to the next one
-            LOGV("Not a VCL NAL: %i", nalType);
+    }
+    
+    uint32_t currBufferLen = 0;
+    for (uint32_t i = firstSlice; i < nalCount; i++) {
+        const nalUnit &unit = index.getUnit(i);
+        if (!isSliceNAL(unit.type)) {
             continue;
         }
         
-        //We have a VCL NAL so we want this in our frame data
-        
-        //Find the end of this one
-        uint8_t nextNALHeaderLen;
-        uint32_t nalUnitLength;
-        uint8_t *nextNALStart = findNALUnitStart(nalStart, dataEnd, nextNALHeaderLen);
-        if (nextNALStart == NULL) {
-            //This was the last NAL unit so it ends at dataEnd
-            nalUnitLength = (uint32_t)(dataEnd - nalStart);
-        } else
-        {
-            uint8_t *startLessHeader = (nextNALStart - nextNALHeaderLen);
-            uint32_t theLength = (uint32_t)(startLessHeader - nalStart);
-            nalUnitLength = theLength;
-            
-            //Save some searching time for the next loop by updating dataStart
-            dataStart = startLessHeader;
-        }
-        
-        //We padded our buffer with 100 extra bytes. As long as there aren't
-        // 100 NALs in the frame we shouldn't run out of space, but just in
-        // case let's double check
-        if ((currBufferLen + nalUnitLength + 4) >= currBufferSize) {
-            //Something must be wrong becaues we don't have space for this
-            // More than 100 NALs - crazy!
-            //However we may still have some valid video data so we will return
-            // the NALs we did copy in
-            LOGE("Overran the buffer when converting to size encoded frame");
-            break;
-        }
-        
         //Put the length of the NAL into the buffer (Big Endian)
-        uint32_t nalUnitLengthBigEndian = CFSwapInt32HostToBig(nalUnitLength);
-        memcpy(&frameBuffer[currBufferLen], &nalUnitLengthBigEndian, 4);
+        putSize(&frameData[currBufferLen], unit.length);
         currBufferLen += 4;
         
-        //Put the NAL data itself into the buffer
-        memcpy(&frameBuffer[currBufferLen], nalStart, nalUnitLength);
-        currBufferLen += nalUnitLength;
+        //Put the NAL data itself into the buffer, unless it is already there
+        uint8_t *nalStart = dataStart + unit.offset;
+        if (&frameData[currBufferLen] != nalStart) {
+            memmove(&frameData[currBufferLen], nalStart, unit.length);
+        }
+        currBufferLen += unit.length;
     }
     
-    
-    if (currBufferLen <= 0) {
-        //We didn't find any frame data
-        return false;
-    } else
-    {
-        newFrameData = frameBuffer;
-        newFrameLength = currBufferLen;
-        return true;
-    }
+    newFrameData = frameData;
+    newFrameLength = currBufferLen;
+    return true;
 }
 
 
@@ -377,6 +666,94 @@ void scalingList(BitStreamReader *bitReader, uint8_t sizeOfScalingList)
     }
 }
 
+/**
+ * Steps over the hrd_parameters of the VUI; nothing in them is kept
+ *
+ * @param[in] bitReader the BitStreamReader being used
+ */
+static void skipHRDParameters(BitStreamReader &bitReader)
+{
+    uint32_t cpb_cnt_minus1 = bitReader.getUExpGolomb();
+    //bit_rate_scale, cpb_size_scale
+    bitReader.getBits(8);
+    for (uint32_t i = 0; i <= cpb_cnt_minus1 && i < 32; i++) {
+        //bit_rate_value_minus1, cpb_size_value_minus1, cbr_flag
+        bitReader.getUExpGolomb();
+        bitReader.getUExpGolomb();
+        bitReader.getBits(1);
+    }
+    //initial_cpb_removal_delay_length_minus1, cpb_removal_delay_length_minus1,
+    // dpb_output_delay_length_minus1, time_offset_length
+    bitReader.getBits(20);
+}
+
+/**
+ * Parses the vui_parameters at the end of an SPS
+ *
+ * @param[in] bitReader the BitStreamReader being used
+ * @param[out] theVUI vui struct to fill in
+ */
+static void parseVUI(BitStreamReader &bitReader, vui &theVUI)
+{
+    theVUI.aspect_ratio_info_present_flag = bitReader.getBits(1);
+    if (theVUI.aspect_ratio_info_present_flag) {
+        theVUI.aspect_ratio_idc = bitReader.getBits(8);
+        //Extended_SAR
+        if (theVUI.aspect_ratio_idc == 255) {
+            theVUI.sar_width = bitReader.getBits(16);
+            theVUI.sar_height = bitReader.getBits(16);
+        }
+    }
+    theVUI.overscan_info_present_flag = bitReader.getBits(1);
+    if (theVUI.overscan_info_present_flag) {
+        theVUI.overscan_appropriate_flag = bitReader.getBits(1);
+    }
+    theVUI.video_signal_type_present_flag = bitReader.getBits(1);
+    if (theVUI.video_signal_type_present_flag) {
+        theVUI.video_format = bitReader.getBits(3);
+        theVUI.video_full_range_flag = bitReader.getBits(1);
+        theVUI.colour_description_present_flag = bitReader.getBits(1);
+        if (theVUI.colour_description_present_flag) {
+            theVUI.colour_primaries = bitReader.getBits(8);
+            theVUI.transfer_characteristics = bitReader.getBits(8);
+            theVUI.matrix_coefficients = bitReader.getBits(8);
+        }
+    }
+    theVUI.chroma_loc_info_present_flag = bitReader.getBits(1);
+    if (theVUI.chroma_loc_info_present_flag) {
+        theVUI.chroma_sample_loc_type_top_field = bitReader.getUExpGolomb();
+        theVUI.chroma_sample_loc_type_bottom_field = bitReader.getUExpGolomb();
+    }
+    theVUI.timing_info_present_flag = bitReader.getBits(1);
+    if (theVUI.timing_info_present_flag) {
+        theVUI.num_units_in_tick = bitReader.getBits(32);
+        theVUI.time_scale = bitReader.getBits(32);
+        theVUI.fixed_frame_rate_flag = bitReader.getBits(1);
+    }
+    theVUI.nal_hrd_parameters_present_flag = bitReader.getBits(1);
+    if (theVUI.nal_hrd_parameters_present_flag) {
+        skipHRDParameters(bitReader);
+    }
+    theVUI.vcl_hrd_parameters_present_flag = bitReader.getBits(1);
+    if (theVUI.vcl_hrd_parameters_present_flag) {
+        skipHRDParameters(bitReader);
+    }
+    if (theVUI.nal_hrd_parameters_present_flag || theVUI.vcl_hrd_parameters_present_flag) {
+        theVUI.low_delay_hrd_flag = bitReader.getBits(1);
+    }
+    theVUI.pic_struct_present_flag = bitReader.getBits(1);
+    theVUI.bitstream_restriction_flag = bitReader.getBits(1);
+    if (theVUI.bitstream_restriction_flag) {
+        theVUI.motion_vectors_over_pic_boundaries_flag = bitReader.getBits(1);
+        theVUI.max_bytes_per_pic_denom = bitReader.getUExpGolomb();
+        theVUI.max_bits_per_mb_denom = bitReader.getUExpGolomb();
+        theVUI.log2_max_mv_length_horizontal = bitReader.getUExpGolomb();
+        theVUI.log2_max_mv_length_vertical = bitReader.getUExpGolomb();
+        theVUI.max_num_reorder_frames = bitReader.getUExpGolomb();
+        theVUI.max_dec_frame_buffering = bitReader.getUExpGolomb();
+    }
+}
+
 /**
  * Parses the SPS NAL Unit into a sps struct
  *
@@ -386,94 +763,264 @@ void scalingList(BitStreamReader *bitReader, uint8_t sizeOfScalingList)
  */
 sps parseSPS(uint8_t *spsData, uint32_t spsLength)
 {
-    uint8 *spsRBSPData = NULL;
-    uint32_t spsRBSPLength = 0;
-    extractRBSP(spsData, spsLength, spsRBSPData, spsRBSPLength);
-    
-    BitStreamReader *bitReader = new BitStreamReader(spsRBSPData, spsRBSPLength);
+    //Read the rbsp straight out of the NAL, skipping the emulation
+    // prevention bytes as they come
+    BitStreamReader bitReader(spsData, spsLength, true);
     
-    //We now have the rbsp
+    //Anything not in the SPS is 0, except chroma_format which is 4:2:0
     sps theSPS;
+    memset(&theSPS, 0, sizeof(theSPS));
+    theSPS.chroma_format = 1;
     
     //Read the first byte (which is just the SPS type)
-    bitReader->getBits(8);
+    bitReader.getBits(8);
     //Second byte is the profile
-    theSPS.profile = bitReader->getBits(8);
+    theSPS.profile = bitReader.getBits(8);
     //Third byte is constraints and reserved zero bits
-    bitReader->getBits(8);
+    theSPS.constraint_flags = bitReader.getBits(8);
     //Fourth byte is the level
-    theSPS.level = bitReader->getBits(8);
-    theSPS.seq_parameter_set_id = bitReader->getUExpGolomb();
+    theSPS.level = bitReader.getBits(8);
+    theSPS.seq_parameter_set_id = bitReader.getUExpGolomb();
     
-    if (theSPS.profile == 100 || theSPS.profile == 110 || theSPS.profile == 122 || theSPS.profile == 244 || theSPS.profile == 244 || theSPS.profile == 44 || theSPS.profile == 83 || theSPS.profile == 86 || theSPS.profile == 118 || theSPS.profile == 128 || theSPS.profile == 138) {
-        theSPS.chroma_format = bitReader->getUExpGolomb();
+    if (theSPS.profile == 100 || theSPS.profile == 110 || theSPS.profile == 122 || theSPS.profile == 244 || theSPS.profile == 244 || theSPS.profile == 44 || theSPS.profile == 83 || theSPS.profile == 86 || theSPS.profile == 118 || theSPS.profile == 128 || theSPS.profile == 138 || theSPS.profile == 139 || theSPS.profile == 134 || theSPS.profile == 135) {
+        theSPS.chroma_format = bitReader.getUExpGolomb();
         if (theSPS.chroma_format == 3) {
-            theSPS.separate_color_plane = bitReader->getBits(1);
+            theSPS.separate_color_plane = bitReader.getBits(1);
         }
-        theSPS.bit_depth_luma_minus8 = bitReader->getUExpGolomb();
-        theSPS.bit_depth_chroma_minus8 = bitReader->getUExpGolomb();
-        theSPS.qpprime_y_zero_transform_bypass_flag = bitReader->getBits(1);
-        theSPS.seq_scaling_matrix_present_flag = bitReader->getBits(1);
+        theSPS.bit_depth_luma_minus8 = bitReader.getUExpGolomb();
+        theSPS.bit_depth_chroma_minus8 = bitReader.getUExpGolomb();
+        theSPS.qpprime_y_zero_transform_bypass_flag = bitReader.getBits(1);
+        theSPS.seq_scaling_matrix_present_flag = bitReader.getBits(1);
         if (theSPS.seq_scaling_matrix_present_flag) {
             for (int i=0;i<((theSPS.chroma_format != 3)?8:12);i++) {
-                bool seq_scaling_flag = bitReader->getBits(1);
+                bool seq_scaling_flag = bitReader.getBits(1);
                 if (seq_scaling_flag) {
                     if (i < 6) {
-                        scalingList(bitReader, 16);
+                        scalingList(&bitReader, 16);
                     } else
                     {
-                        scalingList(bitReader, 64);
+                        scalingList(&bitReader, 64);
                     }
                 }
             }
         }
     }
-    theSPS.log2_max_frame_num_minus4 = bitReader->getUExpGolomb();
-    theSPS.pic_order_cnt_type = bitReader->getUExpGolomb();
+    theSPS.log2_max_frame_num_minus4 = bitReader.getUExpGolomb();
+    theSPS.pic_order_cnt_type = bitReader.getUExpGolomb();
     if (theSPS.pic_order_cnt_type == 0) {
-        theSPS.log2_max_pic_order_cnt_lsb_minus4 = bitReader->getUExpGolomb();
+        theSPS.log2_max_pic_order_cnt_lsb_minus4 = bitReader.getUExpGolomb();
     } else if (theSPS.pic_order_cnt_type == 1)
     {
-        theSPS.delta_pic_order_always_zero_flag = bitReader->getBits(1);
-        theSPS.offset_for_non_ref_pic = bitReader->getSExpGolomb();
-        theSPS.offset_for_top_to_bottom_field = bitReader->getSExpGolomb();
-        theSPS.num_ref_frames_in_pic_order_cnt_cycle = bitReader->getUExpGolomb();
+        theSPS.delta_pic_order_always_zero_flag = bitReader.getBits(1);
+        theSPS.offset_for_non_ref_pic = bitReader.getSExpGolomb();
+        theSPS.offset_for_top_to_bottom_field = bitReader.getSExpGolomb();
+        theSPS.num_ref_frames_in_pic_order_cnt_cycle = bitReader.getUExpGolomb();
         for (int i=0; i < theSPS.num_ref_frames_in_pic_order_cnt_cycle; ++i) {
             //offset_for_ref_frame[i] = se(v)
-            bitReader->getSExpGolomb();
+            bitReader.getSExpGolomb();
         }
     }
     
-    theSPS.max_num_ref_frames = bitReader->getUExpGolomb();
-    theSPS.gaps_in_frame_num_value_allowed_flag = bitReader->getBits(1);
-    theSPS.pic_width_in_mbs_minus1 = bitReader->getUExpGolomb();
-    theSPS.pic_height_in_map_units_minus1 = bitReader->getUExpGolomb();
-    theSPS.frame_mbs_only_flag = bitReader->getBits(1);
+    theSPS.max_num_ref_frames = bitReader.getUExpGolomb();
+    theSPS.gaps_in_frame_num_value_allowed_flag = bitReader.getBits(1);
+    theSPS.pic_width_in_mbs_minus1 = bitReader.getUExpGolomb();
+    theSPS.pic_height_in_map_units_minus1 = bitReader.getUExpGolomb();
+    theSPS.frame_mbs_only_flag = bitReader.getBits(1);
     if (!theSPS.frame_mbs_only_flag) {
-        theSPS.mb_adaptive_frame_field_flag = bitReader->getBits(1);
+        theSPS.mb_adaptive_frame_field_flag = bitReader.getBits(1);
     }
-    theSPS.direct_8x8_inference_flag = bitReader->getBits(1);
-    theSPS.frame_cropping_flag = bitReader->getBits(1);
+    theSPS.direct_8x8_inference_flag = bitReader.getBits(1);
+    theSPS.frame_cropping_flag = bitReader.getBits(1);
     if (theSPS.frame_cropping_flag) {
-        theSPS.frame_crop_left_offset = bitReader->getUExpGolomb();
-        theSPS.frame_crop_right_offset = bitReader->getUExpGolomb();
-        theSPS.frame_crop_top_offset = bitReader->getUExpGolomb();
-        theSPS.frame_crop_bottom_offset = bitReader->getUExpGolomb();
+        theSPS.frame_crop_left_offset = bitReader.getUExpGolomb();
+        theSPS.frame_crop_right_offset = bitReader.getUExpGolomb();
+        theSPS.frame_crop_top_offset = bitReader.getUExpGolomb();
+        theSPS.frame_crop_bottom_offset = bitReader.getUExpGolomb();
     }
-    theSPS.vui_parameters_present_flag = bitReader->getBits(1);
+    theSPS.vui_parameters_present_flag = bitReader.getBits(1);
     
     if (theSPS.vui_parameters_present_flag)
     {
-        LOGE("VUI Parameters parsing not implemented");
+        parseVUI(bitReader, theSPS.vui_parameters);
+    }
+    
+    return theSPS;
+}
+
+/**
+ * Finds the rbsp_stop_one_bit that ends a NAL, for more_rbsp_data()
+ *
+ * @param[in] data pointer to the NAL unit data
+ * @param[in] length length of the NAL unit data
+ * @return position of the stop bit counted in RBSP bits, that is with
+ * emulation prevention bytes left out
+ */
+static size_t findRBSPStopBit(uint8_t *data, uint32_t length)
+{
+    //Trailing zero bytes (cabac_zero_words) come after the stop bit
+    uint32_t last = length;
+    while (last > 0 && data[last - 1] == 0) {
+        last--;
+    }
+    if (last == 0) {
+        return 0;
     }
     
+    //Emulation prevention bytes in front of the last byte don't count
+    uint32_t epbCount = 0;
+    uint32_t zeroRun = 0;
+    for (uint32_t i = 1; i + 1 < last; i++) {
+        if (zeroRun >= 2 && data[i] == 0x03) {
+            epbCount++;
+            zeroRun = 0;
+            continue;
+        }
+        zeroRun = (data[i] == 0) ? zeroRun + 1 : 0;
+    }
     
-    //Clean up the SPS RBSP data
-    if (spsRBSPData != NULL) {
-        free(spsRBSPData);
+    uint8_t lastByte = data[last - 1];
+    uint32_t trailingZeros = 0;
+    while (!(lastByte & (1 << trailingZeros))) {
+        trailingZeros++;
     }
+    return (size_t)(last - 1 - epbCount) * 8 + (7 - trailingZeros);
+}
+
+/**
+ * Parses the PPS NAL Unit into a pps struct
+ *
+ * @param[in] ppsData pointer to the PPS NAL unit data
+ * @param[in] ppsLength length of the PPS NAL unit data
+ * @param[in] chromaFormat chroma_format of the SPS the PPS refers to
+ * @return pps struct holding the parsed PPS NAL unit
+ */
+pps parsePPS(uint8_t *ppsData, uint32_t ppsLength, uint8_t chromaFormat)
+{
+    BitStreamReader bitReader(ppsData, ppsLength, true);
     
-    return theSPS;
+    pps thePPS;
+    memset(&thePPS, 0, sizeof(thePPS));
+    
+    //Read the first byte (which is just the PPS type)
+    bitReader.getBits(8);
+    thePPS.pic_parameter_set_id = bitReader.getUExpGolomb();
+    thePPS.seq_parameter_set_id = bitReader.getUExpGolomb();
+    thePPS.entropy_coding_mode_flag = bitReader.getBits(1);
+    thePPS.bottom_field_pic_order_in_frame_present_flag = bitReader.getBits(1);
+    thePPS.num_slice_groups_minus1 = bitReader.getUExpGolomb();
+    if (thePPS.num_slice_groups_minus1 > 0) {
+        //Slice groups (FMO) aren't kept, just stepped over
+        uint32_t slice_group_map_type = bitReader.getUExpGolomb();
+        if (slice_group_map_type == 0) {
+            for (uint32_t i = 0; i <= thePPS.num_slice_groups_minus1 && i < 8; i++) {
+                //run_length_minus1
+                bitReader.getUExpGolomb();
+            }
+        } else if (slice_group_map_type == 2)
+        {
+            for (uint32_t i = 0; i < thePPS.num_slice_groups_minus1 && i < 8; i++) {
+                //top_left, bottom_right
+                bitReader.getUExpGolomb();
+                bitReader.getUExpGolomb();
+            }
+        } else if (slice_group_map_type >= 3 && slice_group_map_type <= 5)
+        {
+            //slice_group_change_direction_flag, slice_group_change_rate_minus1
+            bitReader.getBits(1);
+            bitReader.getUExpGolomb();
+        } else if (slice_group_map_type == 6)
+        {
+            uint32_t pic_size_in_map_units_minus1 = bitReader.getUExpGolomb();
+            uint8_t idBits = 0;
+            while (((uint32_t)1 << idBits) < thePPS.num_slice_groups_minus1 + 1) {
+                idBits++;
+            }
+            for (uint32_t i = 0; i <= pic_size_in_map_units_minus1 && bitReader.totalBitsRemaining() > 0; i++) {
+                //slice_group_id
+                bitReader.getBits(idBits);
+            }
+        }
+    }
+    thePPS.num_ref_idx_l0_default_active_minus1 = bitReader.getUExpGolomb();
+    thePPS.num_ref_idx_l1_default_active_minus1 = bitReader.getUExpGolomb();
+    thePPS.weighted_pred_flag = bitReader.getBits(1);
+    thePPS.weighted_bipred_idc = bitReader.getBits(2);
+    thePPS.pic_init_qp_minus26 = bitReader.getSExpGolomb();
+    thePPS.pic_init_qs_minus26 = bitReader.getSExpGolomb();
+    thePPS.chroma_qp_index_offset = bitReader.getSExpGolomb();
+    thePPS.deblocking_filter_control_present_flag = bitReader.getBits(1);
+    thePPS.constrained_intra_pred_flag = bitReader.getBits(1);
+    thePPS.redundant_pic_cnt_present_flag = bitReader.getBits(1);
+    
+    //Without the High profile extension the second offset is the first
+    thePPS.second_chroma_qp_index_offset = thePPS.chroma_qp_index_offset;
+    if (bitReader.getBitsRead() < findRBSPStopBit(ppsData, ppsLength)) {
+        thePPS.transform_8x8_mode_flag = bitReader.getBits(1);
+        thePPS.pic_scaling_matrix_present_flag = bitReader.getBits(1);
+        if (thePPS.pic_scaling_matrix_present_flag) {
+            int lists = 6 + ((chromaFormat != 3) ? 2 : 6) * thePPS.transform_8x8_mode_flag;
+            for (int i = 0; i < lists; i++) {
+                bool pic_scaling_list_present_flag = bitReader.getBits(1);
+                if (pic_scaling_list_present_flag) {
+                    scalingList(&bitReader, (i < 6) ? 16 : 64);
+                }
+            }
+        }
+        thePPS.second_chroma_qp_index_offset = bitReader.getSExpGolomb();
+    }
+    
+    return thePPS;
+}
+
+/**
+ * Works out how many frames the decoder may have to hold back to put
+ * pictures in output order
+ *
+ * @param[in] theSPS filled in sps struct
+ * @return max_num_reorder_frames from the VUI, or the value the standard
+ * implies when the VUI leaves it out
+ */
+uint32_t getMaxReorderFrames(const sps &theSPS)
+{
+    if (theSPS.vui_parameters_present_flag && theSPS.vui_parameters.bitstream_restriction_flag) {
+        return theSPS.vui_parameters.max_num_reorder_frames;
+    }
+    
+    //Baseline has no B slices, and neither do the intra profiles
+    // (constraint_set3_flag)
+    bool intraOnly = (theSPS.constraint_flags & 0x10) &&
+        (theSPS.profile == 44 || theSPS.profile == 86 || theSPS.profile == 100 ||
+         theSPS.profile == 110 || theSPS.profile == 122 || theSPS.profile == 244);
+    if (theSPS.profile == 66 || intraOnly) {
+        return 0;
+    }
+    
+    //Otherwise it is MaxDpbFrames, from MaxDpbMbs for the level (Table A-1)
+    uint32_t maxDpbMbs;
+    switch (theSPS.level) {
+        case 9: case 10: maxDpbMbs = 396; break;
+        case 11: maxDpbMbs = (theSPS.constraint_flags & 0x10) ? 396 : 900; break;
+        case 12: case 13: case 20: maxDpbMbs = 2376; break;
+        case 21: maxDpbMbs = 4752; break;
+        case 22: case 30: maxDpbMbs = 8100; break;
+        case 31: maxDpbMbs = 18000; break;
+        case 32: maxDpbMbs = 20480; break;
+        case 40: case 41: maxDpbMbs = 32768; break;
+        case 42: maxDpbMbs = 34816; break;
+        case 50: maxDpbMbs = 110400; break;
+        case 51: case 52: maxDpbMbs = 184320; break;
+        default: maxDpbMbs = 696320; break;
+    }
+    //The fields come straight from the stream, so the product can be
+    // anything; don't let it wrap to 0
+    uint64_t frameMbs = ((uint64_t)theSPS.pic_width_in_mbs_minus1 + 1) *
+        (2 - theSPS.frame_mbs_only_flag) *
+        ((uint64_t)theSPS.pic_height_in_map_units_minus1 + 1);
+    if (frameMbs == 0 || frameMbs > maxDpbMbs) {
+        return 16;
+    }
+    uint32_t maxDpbFrames = (uint32_t)(maxDpbMbs / frameMbs);
+    return (maxDpbFrames < 16) ? maxDpbFrames : 16;
 }
 
 /**
@@ -485,14 +1032,24 @@ sps parseSPS(uint8_t *spsData, uint32_t spsLength)
  */
 void getVideoSizeFromSPS(sps theSPS, uint32_t &videoWidth, uint32_t &videoHeight)
 {
+    //Cropping is in chroma samples, so it is 2 luma samples wide (4:2:0 and
+    // 4:2:2) and high (4:2:0 only), or 1 without chroma (monochrome or
+    // separate colour planes). Field coding doubles the height.
+    uint32_t cropUnitX = 1;
+    uint32_t cropUnitY = 2 - theSPS.frame_mbs_only_flag;
+    if (theSPS.chroma_format != 0 && !theSPS.separate_color_plane) {
+        cropUnitX = (theSPS.chroma_format == 3) ? 1 : 2;
+        cropUnitY *= (theSPS.chroma_format == 1) ? 2 : 1;
+    }
+    
     videoWidth = ((theSPS.pic_width_in_mbs_minus1 + 1) * 16);
     if (theSPS.frame_cropping_flag)
     {
-        videoWidth -= (theSPS.frame_crop_left_offset * 2 + theSPS.frame_crop_right_offset * 2);
+        videoWidth -= (theSPS.frame_crop_left_offset + theSPS.frame_crop_right_offset) * cropUnitX;
     }
     
     videoHeight = ((2 - theSPS.frame_mbs_only_flag) * (theSPS.pic_height_in_map_units_minus1 + 1) * 16);
     if (theSPS.frame_cropping_flag) {
-        videoHeight -= (theSPS.frame_crop_top_offset * 2 + theSPS.frame_crop_bottom_offset * 2);
+        videoHeight -= (theSPS.frame_crop_top_offset + theSPS.frame_crop_bottom_offset) * cropUnitY;
     }
-}
\ No newline at end of file
+}
@@ -19,7 +19,10 @@
 #ifndef __AppStreamSampleClient__NALUtils__
 #define __AppStreamSampleClient__NALUtils__
 
-#import "BitStreamReader.h"
+#include <stdint.h>
+#include <vector>
+
+#include "BitStreamReader.h"
 
 typedef enum {
     NAL_TYPE_UNDEFINED              = 0,
@@ -47,9 +50,49 @@ typedef enum {
 } nalType;
 
 
+/**
+ * Video usability information (Annex E) carried at the end of an SPS
+ */
+typedef struct
+{
+    bool aspect_ratio_info_present_flag;
+    uint8_t aspect_ratio_idc;
+    uint16_t sar_width;
+    uint16_t sar_height;
+    bool overscan_info_present_flag;
+    bool overscan_appropriate_flag;
+    bool video_signal_type_present_flag;
+    uint8_t video_format;
+    bool video_full_range_flag;
+    bool colour_description_present_flag;
+    uint8_t colour_primaries;
+    uint8_t transfer_characteristics;
+    uint8_t matrix_coefficients;
+    bool chroma_loc_info_present_flag;
+    uint8_t chroma_sample_loc_type_top_field;
+    uint8_t chroma_sample_loc_type_bottom_field;
+    bool timing_info_present_flag;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+    bool fixed_frame_rate_flag;
+    bool nal_hrd_parameters_present_flag;
+    bool vcl_hrd_parameters_present_flag;
+    bool low_delay_hrd_flag;
+    bool pic_struct_present_flag;
+    bool bitstream_restriction_flag;
+    bool motion_vectors_over_pic_boundaries_flag;
+    uint8_t max_bytes_per_pic_denom;
+    uint8_t max_bits_per_mb_denom;
+    uint8_t log2_max_mv_length_horizontal;
+    uint8_t log2_max_mv_length_vertical;
+    uint8_t max_num_reorder_frames;
+    uint8_t max_dec_frame_buffering;
+} vui;
+
 typedef struct
 {
     uint8_t profile;
+    uint8_t constraint_flags;
     uint8_t level;
     uint8_t seq_parameter_set_id;
     uint8_t chroma_format;
@@ -62,24 +105,132 @@ typedef struct
     uint8_t pic_order_cnt_type;
     uint8_t log2_max_pic_order_cnt_lsb_minus4;
     bool delta_pic_order_always_zero_flag;
-    int8_t offset_for_non_ref_pic;
-    int8_t offset_for_top_to_bottom_field;
+    int32_t offset_for_non_ref_pic;
+    int32_t offset_for_top_to_bottom_field;
     uint8_t num_ref_frames_in_pic_order_cnt_cycle;
     uint8_t max_num_ref_frames;
     bool gaps_in_frame_num_value_allowed_flag;
-    uint8_t pic_width_in_mbs_minus1;
-    uint8_t pic_height_in_map_units_minus1;
+    uint32_t pic_width_in_mbs_minus1;
+    uint32_t pic_height_in_map_units_minus1;
     bool frame_mbs_only_flag;
     bool mb_adaptive_frame_field_flag;
     bool direct_8x8_inference_flag;
     bool frame_cropping_flag;
-    uint8_t frame_crop_left_offset;
-    uint8_t frame_crop_right_offset;
-    uint8_t frame_crop_top_offset;
-    uint8_t frame_crop_bottom_offset;
+    uint32_t frame_crop_left_offset;
+    uint32_t frame_crop_right_offset;
+    uint32_t frame_crop_top_offset;
+    uint32_t frame_crop_bottom_offset;
     bool vui_parameters_present_flag;
+    vui vui_parameters;
 } sps;
 
+typedef struct
+{
+    uint8_t pic_parameter_set_id;
+    uint8_t seq_parameter_set_id;
+    bool entropy_coding_mode_flag;
+    bool bottom_field_pic_order_in_frame_present_flag;
+    uint32_t num_slice_groups_minus1;
+    uint8_t num_ref_idx_l0_default_active_minus1;
+    uint8_t num_ref_idx_l1_default_active_minus1;
+    bool weighted_pred_flag;
+    uint8_t weighted_bipred_idc;
+    int8_t pic_init_qp_minus26;
+    int8_t pic_init_qs_minus26;
+    int8_t chroma_qp_index_offset;
+    bool deblocking_filter_control_present_flag;
+    bool constrained_intra_pred_flag;
+    bool redundant_pic_cnt_present_flag;
+    bool transform_8x8_mode_flag;
+    bool pic_scaling_matrix_present_flag;
+    int8_t second_chroma_qp_index_offset;
+} pps;
+
+/**
+ * Where one NAL unit sits in an Annex-B frame
+ */
+typedef struct
+{
+    /** Offset of the NAL's first (type) byte from the start of the frame */
+    uint32_t offset;
+    /** Length of the NAL, not counting its start code */
+    uint32_t length;
+    /** nal_unit_type, the low 5 bits of the first byte */
+    uint8_t type;
+    /** Length of the start code in front of the NAL: 3 or 4 */
+    uint8_t headerLength;
+} nalUnit;
+
+/**
+ * The NAL units of one Annex-B frame, found in a single pass over it.
+ *
+ * Build the index once per frame and hand it to every NALUtils call that
+ * needs NALs from that frame, instead of letting each one rescan the
+ * frame. The storage is kept from frame to frame, so once it has grown to
+ * the largest NAL count seen, indexing allocates nothing.
+ */
+class NALUnitIndex
+{
+public:
+
+    /**
+     * Index a frame, replacing what was indexed before.
+     *
+     * @param[in] dataStart pointer to the beginning of the video frame data
+     * @param[in] dataSize size of the video frame data
+     * @return the number of NAL units found
+     */
+    uint32_t build(uint8_t *dataStart, uint32_t dataSize);
+
+    /** @return the number of NAL units in the frame */
+    uint32_t getCount() const { return (uint32_t)mUnits.size(); }
+
+    /** @return the i'th NAL unit of the frame, in stream order */
+    const nalUnit &getUnit(uint32_t i) const { return mUnits[i]; }
+
+    /**
+     * @return the first NAL unit with the given type, or NULL if the
+     *     frame has none
+     */
+    const nalUnit *find(nalType whichNAL) const;
+
+private:
+
+    std::vector<nalUnit> mUnits;
+};
+
+/**
+ * Output buffer for convertToSizeEncodedVideoFrame. Give each decoder its
+ * own; the memory is kept and reused for every frame, and only grows when a
+ * frame doesn't fit.
+ */
+class SizeEncodedFrameBuffer
+{
+public:
+
+    SizeEncodedFrameBuffer();
+    ~SizeEncodedFrameBuffer();
+
+    /**
+     * Make sure the buffer can hold size bytes. The contents are not kept.
+     *
+     * @param[in] size number of bytes needed
+     * @return the buffer, or NULL if it could not be grown
+     */
+    uint8_t *reserve(uint32_t size);
+
+    /** @return the number of bytes the buffer can hold */
+    uint32_t getCapacity() const { return mCapacity; }
+
+private:
+
+    SizeEncodedFrameBuffer(const SizeEncodedFrameBuffer &);
+    SizeEncodedFrameBuffer &operator=(const SizeEncodedFrameBuffer &);
+
+    uint8_t *mData;
+    uint32_t mCapacity;
+};
+
 /**
  * Finds and returns the NAL unit with the given type.
  *
@@ -88,9 +239,21 @@ typedef struct
  * @param[in] dataEnd pointer to the end of the video frame data
  * @param[out] nalUnitStart on success will point to the beginning of the NAL unit
  * @param[out] nalUnitLength on success will have the length of the NAL unit in bytes
- * @return TRUE if the NAL unit was found FALSE if it was not
+ * @return true if the NAL unit was found false if it was not
  */
-BOOL getNALUnit( nalType whichNAL, uint8_t *dataStart, uint8_t *dataEnd, uint8_t *&nalUnitStart, uint32_t &nalUnitLength);
+bool getNALUnit( nalType whichNAL, uint8_t *dataStart, uint8_t *dataEnd, uint8_t *&nalUnitStart, uint32_t &nalUnitLength);
+
+/**
+ * Finds and returns the NAL unit with the given type in an indexed frame.
+ *
+ * @param[in] index index built from the frame
+ * @param[in] whichNAL The type of NAL unit being searched for
+ * @param[in] dataStart pointer to the beginning of the indexed frame data
+ * @param[out] nalUnitStart on success will point to the beginning of the NAL unit
+ * @param[out] nalUnitLength on success will have the length of the NAL unit in bytes
+ * @return true if the NAL unit was found false if it was not
+ */
+bool getNALUnit( const NALUnitIndex &index, nalType whichNAL, uint8_t *dataStart, uint8_t *&nalUnitStart, uint32_t &nalUnitLength);
 
 /**
  * NALUnits start with 2 or 3 0x00 bytes followed by 0x01
@@ -105,6 +268,18 @@ BOOL getNALUnit( nalType whichNAL, uint8_t *dataStart, uint8_t *dataEnd, uint8_t
  */
 uint8_t * findNALUnitStart( uint8_t *start, uint8_t *end, uint8_t &nalUnitHeaderLength);
 
+/**
+ * Portable byte-at-a-time version of findNALUnitStart. The vectorized
+ * scanner must return the same result for every input; this is kept to
+ * check it against.
+ *
+ * @param[in] start pointer to the beginning of the video frame data
+ * @param[in] end pointer to the end of the video frame data
+ * @param[out] nalUnitHeaderLength length of the NAL header (3 or 4 if a NAL is found)
+ * @return pointer to location of the first byte in the NAL or NULL if no NAL is found
+ */
+uint8_t * findNALUnitStartReference( uint8_t *start, uint8_t *end, uint8_t &nalUnitHeaderLength);
+
 /**
  * Extracts the RBSP from an input NAL unit. RBSP has the data emulation
  * prevention bits stripped out.
@@ -131,15 +306,25 @@ void makeExtraData( uint8_t *&extraData, uint8_t *spsData, uint8_t spsLength, ui
 
 /**
  * Converts the passed in H.264 frame data into one that encodes each NAL size
- * as a 4-byte size instead of a NAL header (00 00 01).
+ * as a 4-byte size instead of a NAL header (00 00 01). Only the slice NALs
+ * are kept.
+ *
+ * When every slice NAL has a 4-byte start code the sizes simply replace the
+ * start codes, so the frame is converted in place and dataStart is
+ * overwritten (as is the index, which no longer describes it). Otherwise the
+ * frame is written into buffer, which grows as needed. Nothing is shared
+ * between calls, so decoders can convert frames concurrently as long as each
+ * one has its own buffer.
  *
- * @param[in] dataStart pointer to the beginning of the frame data
- * @param[in] dataSize size of the data pointed at by dataStart
+ * @param[in] index index built from the frame
+ * @param[in] dataStart pointer to the beginning of the indexed frame data
+ * @param[in] buffer where the frame is written when it can't be converted in place
  * @param[out] newFrameData pointer to the start of the restructured H.264 frame data
  * @param[out] newFrameLength length of the new frame
- * @return TRUE if a frame was created, FALSE otherwise
+ * @return true if a frame was created, false otherwise
  */
-BOOL convertToSizeEncodedVideoFrame ( uint8_t *dataStart, uint32_t dataSize,
+bool convertToSizeEncodedVideoFrame ( const NALUnitIndex &index, uint8_t *dataStart,
+                                     SizeEncodedFrameBuffer &buffer,
                                      uint8_t *&newFrameData, uint32_t &newFrameLength);
 
 /**
@@ -162,6 +347,28 @@ void scalingList(BitStreamReader *bitReader, uint8_t sizeOfScalingList);
  */
 sps parseSPS(uint8_t *spsData, uint32_t spsLength);
 
+/**
+ * Parses the PPS NAL Unit into a pps struct
+ *
+ * @param[in] ppsData pointer to the PPS NAL unit data
+ * @param[in] ppsLength length of the PPS NAL unit data
+ * @param[in] chromaFormat chroma_format of the SPS the PPS refers to; only
+ * needed to step over PPS scaling lists
+ * @return pps struct holding the parsed PPS NAL unit
+ */
+pps parsePPS(uint8_t *ppsData, uint32_t ppsLength, uint8_t chromaFormat = 1);
+
+/**
+ * Works out how many frames the decoder may have to hold back to put
+ * pictures in output order. 0 means every frame can be output as soon as
+ * it is decoded.
+ *
+ * @param[in] theSPS filled in sps struct
+ * @return max_num_reorder_frames from the VUI, or the value the standard
+ * implies when the VUI leaves it out
+ */
+uint32_t getMaxReorderFrames(const sps &theSPS);
+
 /**
  * Calculates the video resolution from the SPS struct given
  *
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "ParameterSetStore.h"
+
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "ParameterSetStore"
+#include "log.h"
+
+/**
+ * FNV-1a hash of a parameter set's bytes
+ */
+static uint32_t hashBytes(const uint8_t *data, uint32_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+ParameterSetStore::ParameterSetStore()
+{
+    clear();
+}
+
+void ParameterSetStore::clear()
+{
+    memset(mSPSEntries, 0, sizeof(mSPSEntries));
+    memset(mPPSEntries, 0, sizeof(mPPSEntries));
+    mActiveSPS = -1;
+    mParseCount = 0;
+    mSeenCount = 0;
+}
+
+bool ParameterSetStore::update(uint8_t *dataStart, uint32_t dataSize)
+{
+    uint8_t *dataEnd = dataStart + dataSize;
+    bool changed = false;
+    
+    uint8_t headerLength = 0;
+    uint8_t *start = findNALUnitStart(dataStart, dataEnd, headerLength);
+    while (start != NULL) {
+        uint8_t type = start[0] & 0x1F;
+        if (type >= NAL_TYPE_NON_IDR_SLICE && type <= NAL_TYPE_IDR_SLICE) {
+            //Slices are last; nothing after them is of interest
+            break;
+        }
+        
+        uint8_t *next = findNALUnitStart(start, dataEnd, headerLength);
+        uint32_t length = (uint32_t)((next != NULL ? next - headerLength : dataEnd) - start);
+        if (type == NAL_TYPE_SPS) {
+            changed = updateSPS(start, length) || changed;
+        } else if (type == NAL_TYPE_PPS)
+        {
+            changed = updatePPS(start, length) || changed;
+        }
+        start = next;
+    }
+    return changed;
+}
+
+bool ParameterSetStore::update(const NALUnitIndex &index, uint8_t *dataStart)
+{
+    bool changed = false;
+    for (uint32_t i = 0; i < index.getCount(); i++) {
+        const nalUnit &unit = index.getUnit(i);
+        if (unit.type == NAL_TYPE_SPS) {
+            changed = updateSPS(dataStart + unit.offset, unit.length) || changed;
+        } else if (unit.type == NAL_TYPE_PPS)
+        {
+            changed = updatePPS(dataStart + unit.offset, unit.length) || changed;
+        }
+    }
+    return changed;
+}
+
+int ParameterSetStore::findKnown(const Entry *entries, uint32_t count,
+                                 uint32_t hash, uint32_t length)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (entries[i].mValid && entries[i].mHash == hash &&
+            entries[i].mLength == length) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool ParameterSetStore::updateSPS(uint8_t *data, uint32_t length)
+{
+    mSeenCount++;
+    uint32_t hash = hashBytes(data, length);
+    int known = findKnown(mSPSEntries, MAX_SPS, hash, length);
+    if (known >= 0) {
+        //The stream may have switched back to an SPS parsed earlier
+        bool switched = (known != mActiveSPS);
+        mActiveSPS = known;
+        return switched;
+    }
+    
+    sps theSPS = parseSPS(data, length);
+    mParseCount++;
+    if (theSPS.seq_parameter_set_id >= MAX_SPS) {
+        LOGE("Dropping SPS with bad id %u", theSPS.seq_parameter_set_id);
+        return false;
+    }
+    
+    uint32_t id = theSPS.seq_parameter_set_id;
+    mSPS[id] = theSPS;
+    mSPSEntries[id].mValid = true;
+    mSPSEntries[id].mHash = hash;
+    mSPSEntries[id].mLength = length;
+    mActiveSPS = (int)id;
+    LOGV("Parsed SPS %u", id);
+    return true;
+}
+
+bool ParameterSetStore::updatePPS(uint8_t *data, uint32_t length)
+{
+    mSeenCount++;
+    uint32_t hash = hashBytes(data, length);
+    if (findKnown(mPPSEntries, MAX_PPS, hash, length) >= 0) {
+        return false;
+    }
+    
+    //The scaling lists at the end of a PPS depend on the chroma format of
+    // its SPS, so parse the ids first to find it
+    pps thePPS = parsePPS(data, length);
+    const sps *theSPS = getSPS(thePPS.seq_parameter_set_id);
+    if (theSPS != NULL && theSPS->chroma_format != 1) {
+        thePPS = parsePPS(data, length, theSPS->chroma_format);
+    }
+    mParseCount++;
+    
+    uint32_t id = thePPS.pic_parameter_set_id;
+    mPPS[id] = thePPS;
+    mPPSEntries[id].mValid = true;
+    mPPSEntries[id].mHash = hash;
+    mPPSEntries[id].mLength = length;
+    LOGV("Parsed PPS %u", id);
+    return true;
+}
+
+const sps *ParameterSetStore::getSPS(uint32_t id) const
+{
+    return (id < MAX_SPS && mSPSEntries[id].mValid) ? &mSPS[id] : NULL;
+}
+
+const pps *ParameterSetStore::getPPS(uint32_t id) const
+{
+    return (id < MAX_PPS && mPPSEntries[id].mValid) ? &mPPS[id] : NULL;
+}
+
+const sps *ParameterSetStore::getActiveSPS() const
+{
+    return (mActiveSPS >= 0) ? &mSPS[mActiveSPS] : NULL;
+}
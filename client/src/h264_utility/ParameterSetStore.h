@@ -0,0 +1,130 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef __AppStreamSampleClient__ParameterSetStore__
+#define __AppStreamSampleClient__ParameterSetStore__
+
+#include "NALUtils.h"
+
+/**
+ * Keeps the parsed SPS and PPS of a stream, by id.
+ *
+ * The encoder repeats its parameter sets with every key frame, but they
+ * rarely change. Each one seen is hashed; it is only parsed again when the
+ * hash says its bytes are different from the copy already parsed. Decoders
+ * feed every frame through update() and read the parsed sets from here,
+ * instead of parsing the same headers on every IDR.
+ */
+class ParameterSetStore
+{
+public:
+
+    /** SPS ids run from 0 to 31 */
+    static const uint32_t MAX_SPS = 32;
+    /** PPS ids run from 0 to 255 */
+    static const uint32_t MAX_PPS = 256;
+
+    ParameterSetStore();
+
+    /**
+     * Pick up the parameter sets of an Annex-B frame. Parameter sets come
+     * ahead of the slices of an access unit, so scanning stops at the first
+     * slice and costs next to nothing on frames without them.
+     *
+     * @param[in] dataStart pointer to the beginning of the video frame data
+     * @param[in] dataSize size of the video frame data
+     * @return true if an SPS or PPS was new or had changed, or the active
+     *     SPS switched
+     */
+    bool update(uint8_t *dataStart, uint32_t dataSize);
+
+    /**
+     * Same as above, for a frame that has already been indexed.
+     *
+     * @param[in] index index built from the frame
+     * @param[in] dataStart pointer to the beginning of the indexed frame data
+     * @return true if an SPS or PPS was new or had changed, or the active
+     *     SPS switched
+     */
+    bool update(const NALUnitIndex &index, uint8_t *dataStart);
+
+    /**
+     * Add an SPS NAL unit, parsing it if it is new or has changed. It
+     * becomes the active SPS either way.
+     *
+     * @param[in] data pointer to the SPS NAL unit data
+     * @param[in] length length of the SPS NAL unit data
+     * @return true if the SPS was new or had changed, or the stream
+     *     switched to a different SPS that was already known
+     */
+    bool updateSPS(uint8_t *data, uint32_t length);
+
+    /**
+     * Add a PPS NAL unit, parsing it if it is new or has changed.
+     *
+     * @param[in] data pointer to the PPS NAL unit data
+     * @param[in] length length of the PPS NAL unit data
+     * @return true if the PPS was new or had changed
+     */
+    bool updatePPS(uint8_t *data, uint32_t length);
+
+    /** @return the SPS with the given id, or NULL if there isn't one */
+    const sps *getSPS(uint32_t id) const;
+
+    /** @return the PPS with the given id, or NULL if there isn't one */
+    const pps *getPPS(uint32_t id) const;
+
+    /** @return the SPS most recently seen, or NULL if none */
+    const sps *getActiveSPS() const;
+
+    /** @return the number of parameter sets parsed so far */
+    uint32_t getParseCount() const { return mParseCount; }
+
+    /** @return the number of parameter sets seen so far */
+    uint32_t getSeenCount() const { return mSeenCount; }
+
+    /** Forget every parameter set, e.g. when the stream restarts */
+    void clear();
+
+private:
+
+    /** What identifies the bytes a parameter set was parsed from */
+    struct Entry
+    {
+        bool mValid;
+        uint32_t mHash;
+        uint32_t mLength;
+    };
+
+    /**
+     * @return the id of the entry parsed from these bytes, or -1 if
+     *     there is none
+     */
+    static int findKnown(const Entry *entries, uint32_t count,
+                         uint32_t hash, uint32_t length);
+
+    Entry mSPSEntries[MAX_SPS];
+    sps mSPS[MAX_SPS];
+    Entry mPPSEntries[MAX_PPS];
+    pps mPPS[MAX_PPS];
+    int mActiveSPS;
+    uint32_t mParseCount;
+    uint32_t mSeenCount;
+};
+
+#endif /* defined(__AppStreamSampleClient__ParameterSetStore__) */
@@ -21,20 +21,37 @@
 #include <stdio.h>
 
 #include "HeadlessAudioDecoder.h"
+#include "../opus_decoder/OpusDecoder.h"
 #include "log.h"
 /** Constructor */
 HeadlessAudioDecoder::HeadlessAudioDecoder()
+    : mDecoder(NULL)
+    , mStats("audio")
 {
+    if (DecodeStats::isRealDecodeEnabled("audio"))
+    {
+        mDecoder = new(std::nothrow) OpusDecoder();
+        if (mDecoder == NULL)
+        {
+            LOGE("HeadlessAudioDecoder: failed to create OpusDecoder");
+        }
+    }
 }
 
 /** Destructor */
 HeadlessAudioDecoder::~HeadlessAudioDecoder()
 {
+    delete mDecoder;
 }
 
 /** Initialize Opus decoder */
 XStxResult HeadlessAudioDecoder::start()
 {
+    if (mDecoder != NULL)
+    {
+        LOGI("HeadlessAudioDecoder: decoding audio with OpusDecoder");
+        return mDecoder->start();
+    }
     return XSTX_RESULT_OK;
 }
 
@@ -66,6 +83,14 @@ XStxResult HeadlessAudioDecoder::decodeFrame(
         LOGE("HeadlessAudioDecoder: decoding errors");
         return XSTX_RESULT_AUDIO_DECODING_ERROR;
     }
+
+    if (mDecoder != NULL)
+    {
+        mStats.frameStarted();
+        XStxResult result = mDecoder->decodeFrame(in, out);
+        mStats.frameFinished(in->mDataSize, result);
+        return result;
+    }
     // successfully decoded
     out->mTimestampUs = in->mTimestampUs;
     static uint64_t count = 0;
@@ -16,18 +16,23 @@
  */
 
 
-#ifndef _included_OpusToPcm_h
-#define _included_OpusToPcm_h
+#ifndef _included_HeadlessAudioDecoder_h
+#define _included_HeadlessAudioDecoder_h
 
 
 #include "AudioDecoder.h"
+#include "../headless_client/DecodeStats.h"
 
 
 #include "XStx/common/XStxAPI.h"
 
+class OpusDecoder;
+
 /**
- * The Audio Decoder implementation using Opus; decodes Opus samples into
- * PCM samples.
+ * The headless client's AudioDecoder. By default it only validates the
+ * frames; with XSTX_HEADLESS_DECODE set to "audio" or "all" it decodes
+ * them with OpusDecoder and reports the cost of decoding through
+ * DecodeStats.
  */
 class HeadlessAudioDecoder : public AudioDecoder
 {
@@ -51,7 +56,12 @@ public:
     virtual XStxResult decodeFrame(XStxEncodedAudioFrame *in, XStxRawAudioFrame *out);
 
 private:
-  
+
+    /** The real decoder; NULL when decoding is simulated */
+    OpusDecoder *mDecoder;
+
+    DecodeStats mStats;
+
     // constants as defined by headers in XStxClientAPI.h:DecodeAudioFrame
     static const uint32_t NUM_CHANNELS = 2;
     static const uint32_t SAMPLING_RATE = 48000;
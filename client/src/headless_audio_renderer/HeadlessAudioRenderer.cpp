@@ -16,15 +16,22 @@
  */
 
 #include "HeadlessAudioRenderer.h"
+#include "AVSyncClock.h"
 
 #undef LOG_TAG
 #define LOG_TAG "AudioRenderer"
 
 #include "log.h"
 
-/**
- * The PortAudio based audio renderer.
- */
+#include <string.h>
+
+/** Upper bounds of the lateness histogram buckets; the last is open ended */
+static const int64_t LATENESS_BUCKET_US[] =
+    { 50, 100, 250, 500, 1000, 2000, 5000, 10000 };
+
+/** Drift beyond which the stream is taken to have restarted */
+static const int64_t MAX_DRIFT_US = 1000000;
+
 /** Constructor */
 HeadlessAudioRenderer::HeadlessAudioRenderer(
                         mud::FixedSizePool<XStxRawAudioFrame> &framePool,
@@ -35,9 +42,18 @@ HeadlessAudioRenderer::HeadlessAudioRenderer(
                               mFrame(NULL),
                               mPlaybackPosInFrame(0),
                               mShouldStop(false),
+                              rt("HeadlessAudioRenderer", *this),
+                              mQueuedSamples(0),
                               mReceivedPackets(0),
-                              rt("HeadlessAudioRenderer", *this)
+                              mStartTimestampUs(0),
+                              mUnderruns(0),
+                              mSilenceSamples(0),
+                              mDriftUs(0),
+                              mMinDriftUs(0),
+                              mMaxDriftUs(0)
 {
+    memset(mWakeLateUs, 0, sizeof(mWakeLateUs));
+    memset(mFrameLateUs, 0, sizeof(mFrameLateUs));
 }
 
 
@@ -54,11 +70,7 @@ XStxRawAudioFrame* HeadlessAudioRenderer::popFrame(int delay, int msBuffer)
 {
     XStxRawAudioFrame * frame = NULL;
 
-    XStxResult result = XStxGetNextAudioFrame(
-                                    mClientHandle, 
-                                    &frame, 
-                                    delay, 
-                                    msBuffer);
+    XStxResult result = getNextFrame(&frame, delay, msBuffer);
 
     if (result != XSTX_RESULT_OK)
     {
@@ -98,42 +110,159 @@ void HeadlessAudioRenderer::pause(bool pause)
  */
 void HeadlessAudioRenderer::stop()
 {
-    {
-        mud::ScopeLock sl(mStopLock);
-        mShouldStop = true;
-    }
+    mShouldStop = true;
     rt.join();
 }
 
 void HeadlessAudioRenderer::renderLoop()
 {
-   while(1)
+    while (!mShouldStop)
+    {
+        // Let the SDK wait for the next frame until the device would run dry,
+        // less the margin
+        int64_t remainingUs = DEVICE_BUFFER_MS * 1000;
+        if (mReceivedPackets > 0)
+        {
+            remainingUs = (int64_t)queuedEnd().toMicroSeconds() -
+                          (int64_t)mud::TimeVal::mono().toMicroSeconds();
+        }
+        int delay = remainingUs > 0 ? (int)(remainingUs / 1000) : 0;
+        int msBuffer = delay > (int)mTimeoutMarginInMs ?
+                       delay - (int)mTimeoutMarginInMs : 0;
+
+        XStxRawAudioFrame * frame = popFrame(delay, msBuffer);
+        //this should always happen, frame can't be NULL, if an audio packet
+        //arrives late then we should expect a concealment frame here, not NULL
+        if (frame == NULL)
+        {
+            mud::ThreadUtil::sleep(1);
+            continue;
+        }
+        mud::TimeVal arrival = mud::TimeVal::mono();
+        uint32_t samples = frame->mDataSize / (NUM_CHANNELS * BYTES_PER_SAMPLE);
+        uint64_t timestampUs = frame->mTimestampUs;
+        //no real render, so just recycle:
+        mFramePool.recycleElement(frame);
+
+        // An empty frame stands for a lost one that the decoder is holding
+        // back; it comes out later together with the frames after it
+        if (samples == 0)
+        {
+            continue;
+        }
+        playFrame(samples, timestampUs, arrival);
+        if (mReceivedPackets % STATS_INTERVAL_FRAMES == 0)
+        {
+            logStats();
+        }
+
+        // Come back when only DEVICE_BUFFER_MS is left queued. The deadline
+        // follows from the samples queued, not from when we last woke up.
+        mud::TimeVal deadline = queuedEnd() -
+                                mud::TimeVal::fromMilliSeconds(DEVICE_BUFFER_MS);
+        if (deadline > mud::TimeVal::mono())
+        {
+            mud::ThreadUtil::sleepUntil(deadline);
+            addLateness(mWakeLateUs,
+                        (int64_t)mud::TimeVal::mono().toMicroSeconds() -
+                        (int64_t)deadline.toMicroSeconds());
+        }
+    }
+}
+
+void HeadlessAudioRenderer::playFrame(uint32_t samples, uint64_t timestampUs,
+                                      const mud::TimeVal &arrival)
+{
+    if (mReceivedPackets == 0)
     {
+        // The device starts playing with the first frame
+        mStartTime = arrival;
+        mQueuedSamples = 0;
+        mStartTimestampUs = timestampUs;
+    }
+    else
+    {
+        int64_t lateUs = (int64_t)arrival.toMicroSeconds() -
+                         (int64_t)queuedEnd().toMicroSeconds();
+        addLateness(mFrameLateUs, lateUs);
+        if (lateUs > 0)
         {
-            mud::ScopeLock sl(mStopLock);
-            if (mShouldStop) 
-            {
-                return ;
-            }
+            // The device ran dry and played silence until now
+            uint64_t silence = (uint64_t)lateUs * SAMPLING_RATE / 1000000;
+            mQueuedSamples += silence;
+            mSilenceSamples += silence;
+            mUnderruns++;
         }
-            XStxRawAudioFrame * frame = popFrame(20,10);
-            //this should always happen, frame can't be NULL, if an audio packet
-            //arrives late then we should expect a concealment frame here, not NULL
-            //but if this is NULL, we will have a problem with the logic below
-            if(frame != NULL)
-            {
-                //start the clock on first packet received
-                if(mReceivedPackets == 0)
-                   mClock.resetMono();
-                //no real render, so just recycle:
-                mFramePool.recycleElement(frame);
-
-                int sleepTime = (mReceivedPackets + 1) * 10 - mClock.elapsedMono().toMilliSeconds();
-                if (sleepTime > 0)
-                    mud::ThreadUtil::sleep(sleepTime);
-                mReceivedPackets++;
-
-            }
-            
     }
+
+    // How far the stream clock is ahead of the device clock where this
+    // frame starts to play; underruns and sender clock drift both show up
+    int64_t deviceUs = (int64_t)(mQueuedSamples * 1000000 / SAMPLING_RATE);
+    int64_t driftUs = (int64_t)(timestampUs - mStartTimestampUs) - deviceUs;
+    if (driftUs > MAX_DRIFT_US || driftUs < -MAX_DRIFT_US)
+    {
+        LOGV("Audio timestamps jumped by %lld us; rebasing",
+             (long long)driftUs);
+        mStartTimestampUs = timestampUs - (uint64_t)deviceUs;
+        driftUs = 0;
+    }
+    if (mReceivedPackets % STATS_INTERVAL_FRAMES == 0 || driftUs < mMinDriftUs)
+    {
+        mMinDriftUs = driftUs;
+    }
+    if (mReceivedPackets % STATS_INTERVAL_FRAMES == 0 || driftUs > mMaxDriftUs)
+    {
+        mMaxDriftUs = driftUs;
+    }
+    mDriftUs = driftUs;
+
+    if (mSyncClock != NULL)
+    {
+        mSyncClock->audioScheduled(timestampUs, queuedEnd().toMicroSeconds());
+    }
+
+    mQueuedSamples += samples;
+    mReceivedPackets++;
+}
+
+mud::TimeVal HeadlessAudioRenderer::queuedEnd() const
+{
+    // Computed from the total so that rounding never accumulates
+    return mStartTime +
+           mud::TimeVal::fromMicroSeconds(mQueuedSamples * 1000000 / SAMPLING_RATE);
+}
+
+void HeadlessAudioRenderer::addLateness(uint32_t *histogram, int64_t latenessUs)
+{
+    uint32_t bucket = 0;
+    while (bucket < NUM_LATENESS_BUCKETS - 1 &&
+           latenessUs > LATENESS_BUCKET_US[bucket])
+    {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+void HeadlessAudioRenderer::logStats()
+{
+    LOGV("[headlessaudio]={ \"Frames\":%u, \"Underruns\":%u, "
+         "\"SilenceMs\":%.1f, \"DriftUs\":%lld, \"MinDriftUs\":%lld, "
+         "\"MaxDriftUs\":%lld, "
+         "\"LatenessBucketsUs\":[50,100,250,500,1000,2000,5000,10000], "
+         "\"WakeLateUs\":[%u,%u,%u,%u,%u,%u,%u,%u,%u], "
+         "\"FrameLateUs\":[%u,%u,%u,%u,%u,%u,%u,%u,%u] }",
+         mReceivedPackets, mUnderruns,
+         mSilenceSamples * 1000.0 / SAMPLING_RATE,
+         (long long)mDriftUs, (long long)mMinDriftUs, (long long)mMaxDriftUs,
+         mWakeLateUs[0], mWakeLateUs[1], mWakeLateUs[2], mWakeLateUs[3],
+         mWakeLateUs[4], mWakeLateUs[5], mWakeLateUs[6], mWakeLateUs[7],
+         mWakeLateUs[8],
+         mFrameLateUs[0], mFrameLateUs[1], mFrameLateUs[2], mFrameLateUs[3],
+         mFrameLateUs[4], mFrameLateUs[5], mFrameLateUs[6], mFrameLateUs[7],
+         mFrameLateUs[8]);
+
+    memset(mWakeLateUs, 0, sizeof(mWakeLateUs));
+    memset(mFrameLateUs, 0, sizeof(mFrameLateUs));
+    mUnderruns = 0;
+    mSilenceSamples = 0;
 }
@@ -33,7 +33,17 @@
 #include "MUD/base/TimeVal.h"
 
 /**
- * The PortAudio based audio renderer.
+ * An audio renderer for clients without a sound device. Frames are taken
+ * from the SDK at the pace a device would play them: the render thread
+ * keeps DEVICE_BUFFER_MS of audio queued on a simulated device that plays
+ * exactly SAMPLING_RATE samples a second, and sleeps to absolute deadlines
+ * on the monotonic clock so that oversleeping never accumulates. When a
+ * frame comes in after the simulated device has run dry, the gap is
+ * counted as an underrun of silence.
+ *
+ * Every STATS_INTERVAL_FRAMES frames a [headlessaudio] metrics line reports
+ * histograms of how late the thread woke up and how late frames arrived,
+ * and the drift of the stream timestamps against the device clock.
  */
 class HeadlessAudioRenderer : public AudioRenderer
 {
@@ -85,16 +95,16 @@ protected:
    
     // These values set a time margin between the time that the portaudio renderer
     // needs a frame and the time we allow the SDK to wait for the next packet
-    // to arrive. For instance, if we set the mTimeoutMarginInMs to 15, it means
-    // that if the portaudio renderer tells us that it needs the next frame 
-    // within 40 ms, we'll allow the SDK to wait for at most 25 ms before it 
+    // to arrive. For instance, if we set the mTimeoutMarginInMs to 10, it means
+    // that if the simulated device tells us that it needs the next frame 
+    // within 20 ms, we'll allow the SDK to wait for at most 10 ms before it 
     // treats the a packet as late and returns a pakcet loss concealment frame.
     // On the one hand we'd like to set this margin as low as possible to
     // give rtp packets time to arrive before we insert concealment.  On the other,
     // we need to provide this margin because we find empirically that if we 
     // don't portaudio doesn't write to the driver in time and we hear ugly
     // audio discontinuities. 
-    static const uint32_t INITIAL_TIMEOUT_MARGIN_MS = 15;
+    static const uint32_t INITIAL_TIMEOUT_MARGIN_MS = 10;
     uint32_t mTimeoutMarginInMs;
      
     // constants as defined by headers in XStxClientAPI.h:RenderAudioFrame
@@ -103,18 +113,68 @@ protected:
     static const uint32_t NUM_MS_PER_FRAME = 10;
     static const int BYTES_PER_SAMPLE = 2; // 16 bit samples
 
+    /** Audio kept queued on the simulated device */
+    static const uint32_t DEVICE_BUFFER_MS = 20;
+
+    /** How often (in frames) the metrics line is logged */
+    static const uint32_t STATS_INTERVAL_FRAMES = 500;
+
+    /** Buckets of the lateness histograms; see LATENESS_BUCKET_US */
+    static const uint32_t NUM_LATENESS_BUCKETS = 9;
+
     XStxRawAudioFrame *mFrame;
     bool mAudioIsPlaying;
     uint32_t mPlaybackPosInFrame;
 
-    mud::SimpleLock mStopLock;
-    bool mShouldStop;
+    volatile bool mShouldStop;
 private:
     DEFINE_METHOD_THREAD(RenderThread, HeadlessAudioRenderer, renderLoop);
     RenderThread rt;
     void renderLoop();
-    mud::TimeVal mClock;
+
+    /**
+     * Queue one frame's worth of samples on the simulated device.
+     *
+     * @param[in] samples samples per channel in the frame
+     * @param[in] timestampUs stream timestamp of the frame
+     * @param[in] arrival when the frame came back from the SDK
+     */
+    void playFrame(uint32_t samples, uint64_t timestampUs,
+                   const mud::TimeVal &arrival);
+
+    /**
+     * @return the time at which the simulated device has played out
+     *     everything queued so far.
+     */
+    mud::TimeVal queuedEnd() const;
+
+    /**
+     * Count a lateness in a histogram.
+     */
+    static void addLateness(uint32_t *histogram, int64_t latenessUs);
+
+    /**
+     * Log the [headlessaudio] metrics line and start a new interval.
+     */
+    void logStats();
+
+    /** When the simulated device started playing */
+    mud::TimeVal mStartTime;
+    /** Samples per channel queued on the device since mStartTime, silence included */
+    uint64_t mQueuedSamples;
     uint32_t mReceivedPackets;
+
+    /** Stream timestamp that mStartTime corresponds to */
+    uint64_t mStartTimestampUs;
+
+    /** Metrics for the current interval */
+    uint32_t mWakeLateUs[NUM_LATENESS_BUCKETS];
+    uint32_t mFrameLateUs[NUM_LATENESS_BUCKETS];
+    uint32_t mUnderruns;
+    uint64_t mSilenceSamples;
+    int64_t mDriftUs;
+    int64_t mMinDriftUs;
+    int64_t mMaxDriftUs;
 };
 
 #endif //_included_HeadlessAudioRenderer_h
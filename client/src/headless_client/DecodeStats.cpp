@@ -0,0 +1,123 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "DecodeStats.h"
+
+#include "MUD/base/TimeVal.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#undef LOG_TAG
+#define LOG_TAG "DecodeStats"
+#include "log.h"
+
+bool DecodeStats::isRealDecodeEnabled(const char *stream)
+{
+    const char *value = getenv("XSTX_HEADLESS_DECODE");
+    if (value == NULL)
+    {
+        return false;
+    }
+    return strcmp(value, "all") == 0 || strcmp(value, stream) == 0;
+}
+
+DecodeStats::DecodeStats(const char *stream)
+    : mStream(stream)
+    , mFrameStartUs(0)
+    , mFrameStartCpuUs(0)
+    , mWindowStartUs(0)
+    , mWindowCpuUs(0)
+    , mWindowBytes(0)
+    , mWindowFrames(0)
+    , mWindowPending(0)
+    , mWindowErrors(0)
+    , mTotalFrames(0)
+{
+}
+
+void DecodeStats::frameStarted()
+{
+    mFrameStartUs = mud::TimeVal::mono().toMicroSeconds();
+    mFrameStartCpuUs = threadCpuUs();
+    if (mWindowStartUs == 0)
+    {
+        mWindowStartUs = mFrameStartUs;
+    }
+}
+
+void DecodeStats::frameFinished(uint32_t encodedBytes, XStxResult result)
+{
+    uint64_t nowUs = mud::TimeVal::mono().toMicroSeconds();
+    uint64_t cpuUs = threadCpuUs() - mFrameStartCpuUs;
+
+    mLatencyUs.add((double)(nowUs - mFrameStartUs));
+    mCpuUs.add((double)cpuUs);
+    mWindowCpuUs += cpuUs;
+    mWindowBytes += encodedBytes;
+    mWindowFrames++;
+    mTotalFrames++;
+    if (result == XSTX_RESULT_FRAME_NOT_AVAILABLE)
+    {
+        // buffered by the decoder (frame threading, async decode)
+        mWindowPending++;
+    }
+    else if (result != XSTX_RESULT_OK)
+    {
+        mWindowErrors++;
+    }
+
+    if (nowUs - mWindowStartUs >= REPORT_INTERVAL_US)
+    {
+        report(nowUs);
+    }
+}
+
+void DecodeStats::report(uint64_t nowUs)
+{
+    double seconds = (double)(nowUs - mWindowStartUs) / 1000000.0;
+
+    LOGV("[decode]={ \"Stream\":\"%s\", \"Frames\":%u, \"TotalFrames\":%llu, "
+         "\"FramesPerSec\":%.1f, \"Mbps\":%.3f, \"CpuPct\":%.1f, "
+         "\"CpuUsPerFrame\":%.1f, \"LatencyMeanMs\":%.3f, \"LatencyStdDevMs\":%.3f, "
+         "\"LatencyMaxMs\":%.3f, \"Pending\":%u, \"Errors\":%u }",
+         mStream, mWindowFrames, (unsigned long long)mTotalFrames,
+         mWindowFrames / seconds, mWindowBytes * 8.0 / seconds / 1000000.0,
+         mWindowCpuUs / seconds / 10000.0,
+         mCpuUs.mean(), mLatencyUs.mean() / 1000.0, mLatencyUs.stddev() / 1000.0,
+         mLatencyUs.maximum() / 1000.0, mWindowPending, mWindowErrors);
+
+    mWindowStartUs = nowUs;
+    mWindowCpuUs = 0;
+    mWindowBytes = 0;
+    mWindowFrames = 0;
+    mWindowPending = 0;
+    mWindowErrors = 0;
+    mLatencyUs.reset();
+    mCpuUs.reset();
+}
+
+uint64_t DecodeStats::threadCpuUs()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_DecodeStats_h
+#define _included_DecodeStats_h
+
+#include <stdint.h>
+
+#include "XStx/common/XStxAPI.h"
+#include "RunningStats.h"
+
+/**
+ * Decode accounting for one stream of the headless client: throughput,
+ * CPU time spent in the decoder and per-frame latency. Logged as
+ * [decode]={...} every REPORT_INTERVAL_US, so one box running many
+ * headless clients gives a capacity number.
+ *
+ * CPU time is that of the calling thread. Decoder worker threads are not
+ * counted, so use XSTX_DECODER_THREADING=none when measuring video.
+ *
+ * Not thread safe; each stream decodes on a single thread.
+ */
+class DecodeStats
+{
+public:
+
+    /**
+     * Whether the headless client decodes the given stream for real, as
+     * selected by XSTX_HEADLESS_DECODE ("video", "audio" or "all").
+     *
+     * @param[in] stream "video" or "audio"
+     */
+    static bool isRealDecodeEnabled(const char *stream);
+
+    /**
+     * Constructor.
+     *
+     * @param[in] stream name of the stream in the report; must outlive
+     *     this object
+     */
+    DecodeStats(const char *stream);
+
+    /**
+     * Call right before a frame is handed to the decoder.
+     */
+    void frameStarted();
+
+    /**
+     * Call when the decoder returns.
+     *
+     * @param[in] encodedBytes size of the encoded frame
+     * @param[in] result what the decoder returned
+     */
+    void frameFinished(uint32_t encodedBytes, XStxResult result);
+
+private:
+
+    /** How often the statistics are logged */
+    static const uint64_t REPORT_INTERVAL_US = 5000000;
+
+    /**
+     * Log and restart the statistics window.
+     */
+    void report(uint64_t nowUs);
+
+    /**
+     * @return CPU time consumed by the calling thread, in microseconds
+     */
+    static uint64_t threadCpuUs();
+
+    const char *mStream;
+
+    uint64_t mFrameStartUs;
+    uint64_t mFrameStartCpuUs;
+
+    uint64_t mWindowStartUs;
+    uint64_t mWindowCpuUs;
+    uint64_t mWindowBytes;
+    uint32_t mWindowFrames;
+    uint32_t mWindowPending;
+    uint32_t mWindowErrors;
+
+    /** Wall and CPU time per decodeFrame call, in microseconds */
+    RunningStats mLatencyUs;
+    RunningStats mCpuUs;
+
+    uint64_t mTotalFrames;
+};
+
+#endif // _included_DecodeStats_h
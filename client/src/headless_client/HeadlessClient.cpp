@@ -17,8 +17,14 @@
 
 #include "HeadlessClient.h"
 #include <iostream>
+
+#include "MUD/threading/ThreadUtil.h"
+
 #define IDR_MAINFRAME                   128
 
+/** How often the event loop checks whether the session has stopped */
+static const uint32_t EVENT_LOOP_POLL_MS = 10;
+
 /** Constructor */
 HeadlessClient::HeadlessClient()
                     : mAppStreamWrapper(NULL),
@@ -111,6 +117,9 @@ int32_t HeadlessClient::eventLoop()
                 return errorCode;
         }
 
+        // Don't spin; a busy loop here dominates any profile of the client
+        mud::ThreadUtil::sleep(EVENT_LOOP_POLL_MS);
+
     }
 }
 
@@ -19,6 +19,7 @@
 #include "VideoPipeline.h"
 #include "../headless_video_decoder/HeadlessVideoDecoder.h"
 #include "../headless_video_renderer/HeadlessVideoRenderer.h"
+#include "../software_renderer/SoftwareRenderer.h"
 #undef LOG_TAG
 #define LOG_TAG "VideoPipeline"
 #include "log.h"
@@ -36,7 +37,17 @@ VideoDecoder * newVideoDecoder()
 
 VideoRenderer *newVideoRenderer()
 {
-    VideoRenderer* renderer = new(std::nothrow) HeadlessVideoRenderer();
+    // XSTX_SOFTWARE_RENDERER selects the CPU renderer, which converts
+    // frames for real instead of discarding them
+    VideoRenderer* renderer = NULL;
+    if (getenv("XSTX_SOFTWARE_RENDERER"))
+    {
+        renderer = new(std::nothrow) SoftwareRenderer();
+    }
+    else
+    {
+        renderer = new(std::nothrow) HeadlessVideoRenderer();
+    }
     if (!renderer)
     {
         LOGE("Failed to create Video Renderer\n");
@@ -42,3 +42,18 @@ void platformOnConnectSuccess()
 {
 }
 
+
+/**
+ * Let the platform know we are reconnecting.
+ */
+void platformOnReconnecting(uint32_t timeoutMs, const char *message)
+{
+    LOGW("Reconnecting within %u ms: %s", timeoutMs, message);
+}
+
+/**
+ * Let the platform know we are reconnected.
+ */
+void platformOnReconnected()
+{
+}
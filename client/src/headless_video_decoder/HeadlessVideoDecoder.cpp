@@ -18,6 +18,9 @@
 
 #include "MUD/threading/ThreadUtil.h"
 #include "HeadlessVideoDecoder.h"
+#include "../ffmpeg_decoder/H264ToYuv.h"
+
+#include <new>
 
 #undef LOG_TAG
 #define LOG_TAG "HeadlessVideoDecoder"
@@ -26,17 +29,34 @@
 
 /** Constructor */
 HeadlessVideoDecoder::HeadlessVideoDecoder()
+    : mDecoder(NULL)
+    , mStats("video")
 {
+    if (DecodeStats::isRealDecodeEnabled("video"))
+    {
+        mDecoder = new(std::nothrow) H264ToYuv();
+        if (mDecoder == NULL)
+        {
+            LOGE("Failed to create H264ToYuv; simulating video decoding");
+        }
+    }
 }
 
 /** Destructor */
 HeadlessVideoDecoder::~HeadlessVideoDecoder()
 {
+    delete mDecoder;
 }
 
 /** initialize */
 XStxResult HeadlessVideoDecoder::init()
 {
+    if (mDecoder != NULL)
+    {
+        LOGI("Decoding video with H264ToYuv");
+        return mDecoder->init();
+    }
+
     // successfully initialized
     return XSTX_RESULT_OK;
 }
@@ -55,6 +75,14 @@ XStxResult HeadlessVideoDecoder::decodeFrame(
         return XSTX_RESULT_INVALID_ARGUMENTS;
     }
 
+    if (mDecoder != NULL)
+    {
+        mStats.frameStarted();
+        XStxResult result = mDecoder->decodeFrame(enc, dec);
+        mStats.frameFinished(enc->mDataSize, result);
+        return result;
+    }
+
     mud::ThreadUtil::sleep(5);
     dec->mTimestampUs = enc->mTimestampUs;
 
@@ -62,3 +90,54 @@ XStxResult HeadlessVideoDecoder::decodeFrame(
     return XSTX_RESULT_OK;
 }
 
+void HeadlessVideoDecoder::release()
+{
+    if (mDecoder != NULL)
+    {
+        mDecoder->release();
+    }
+}
+
+bool HeadlessVideoDecoder::receivedClientConfiguration(
+    const XStxClientConfiguration* config)
+{
+    if (mDecoder != NULL)
+    {
+        return mDecoder->receivedClientConfiguration(config);
+    }
+    return true;
+}
+
+bool HeadlessVideoDecoder::isChromaSamplingSupported(
+    XStxChromaSampling chromaSampling)
+{
+    if (mDecoder != NULL)
+    {
+        return mDecoder->isChromaSamplingSupported(chromaSampling);
+    }
+    return false;
+}
+
+void HeadlessVideoDecoder::setFrameSink(DecodedFrameSink *sink)
+{
+    if (mDecoder != NULL)
+    {
+        mDecoder->setFrameSink(sink);
+    }
+}
+
+void HeadlessVideoDecoder::flush()
+{
+    if (mDecoder != NULL)
+    {
+        mDecoder->flush();
+    }
+}
+
+void HeadlessVideoDecoder::releaseFrame(DecodedVideoFrame *frame)
+{
+    if (mDecoder != NULL)
+    {
+        mDecoder->releaseFrame(frame);
+    }
+}
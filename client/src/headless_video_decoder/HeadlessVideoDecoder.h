@@ -20,13 +20,14 @@
 #define _included_HeadlessVideoDecoder_h
 
 #include "VideoDecoder.h"
-
-#include <map>
+#include "../headless_client/DecodeStats.h"
 
 
 /**
- * An implementation of VideoDecoder that uses FFMPEG to do the
- * decoding.
+ * The headless client's VideoDecoder. By default it only simulates
+ * decoding; with XSTX_HEADLESS_DECODE set to "video" or "all" it hands
+ * every frame to H264ToYuv and reports the cost of decoding through
+ * DecodeStats.
  */
 class HeadlessVideoDecoder : public VideoDecoder
 {
@@ -54,6 +55,23 @@ public:
     XStxResult decodeFrame(
         XStxEncodedVideoFrame *enc,
         XStxRawVideoFrame *dec);
+
+    /**
+     * The remaining calls are forwarded to the real decoder, if any.
+     */
+    void release();
+    bool receivedClientConfiguration(const XStxClientConfiguration* config);
+    bool isChromaSamplingSupported(XStxChromaSampling chromaSampling);
+    void setFrameSink(DecodedFrameSink *sink);
+    void flush();
+    void releaseFrame(DecodedVideoFrame *frame);
+
+private:
+
+    /** The real decoder; NULL when decoding is simulated */
+    VideoDecoder *mDecoder;
+
+    DecodeStats mStats;
 };
 
 
@@ -0,0 +1,479 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "FrameHasher.h"
+
+#include "MUD/base/TimeVal.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE4_2__) || defined(__AVX__)
+#include <nmmintrin.h>
+#define CRC32C_USE_SSE42 1
+#define CRC32C_TARGET_SSE42
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// Not built for SSE4.2; compile the SSE4.2 version anyway and pick it at
+// run time when the CPU has the instruction
+#include <nmmintrin.h>
+#define CRC32C_USE_SSE42 1
+#define CRC32C_DISPATCH 1
+#define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <nmmintrin.h>
+#include <intrin.h>
+#define CRC32C_USE_SSE42 1
+#define CRC32C_DISPATCH 1
+#define CRC32C_TARGET_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_USE_ARM 1
+#endif
+
+#undef LOG_TAG
+#define LOG_TAG "FrameHasher"
+#include "log.h"
+
+/** CRC32C polynomial, bit reversed */
+#define CRC32C_POLY 0x82f63b78
+
+namespace
+{
+
+/**
+ * Slice-by-8 lookup tables for the portable implementation; table k
+ * advances a CRC over a byte followed by k zero bytes.
+ */
+struct Crc32cTables
+{
+    uint32_t mTable[8][256];
+
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+            }
+            mTable[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int k = 1; k < 8; k++)
+            {
+                uint32_t prev = mTable[k - 1][i];
+                mTable[k][i] = (prev >> 8) ^ mTable[0][prev & 0xff];
+            }
+        }
+    }
+};
+
+#if CRC32C_DISPATCH || (!CRC32C_USE_SSE42 && !CRC32C_USE_ARM)
+#define CRC32C_USE_PORTABLE 1
+
+// Built before main() so no thread ever sees it half filled
+const Crc32cTables gTables;
+#endif
+
+inline uint64_t load64(const uint8_t *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+#if CRC32C_USE_SSE42
+/**
+ * Advance a (non-inverted) CRC over the data with the SSE4.2 instruction.
+ */
+CRC32C_TARGET_SSE42
+uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t size)
+{
+    // Byte at a time up to 8-byte alignment, then 8 bytes per instruction
+    while (size > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, load64(data));
+    }
+    crc = (uint32_t)crc64;
+#else
+    for (; size >= 4; data += 4, size -= 4)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        crc = _mm_crc32_u32(crc, value);
+    }
+#endif
+    while (size > 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+        size--;
+    }
+    return crc;
+}
+#endif
+
+#if CRC32C_USE_ARM
+/**
+ * Advance a (non-inverted) CRC over the data with the ARMv8 instructions.
+ */
+uint32_t crc32cArm(uint32_t crc, const uint8_t *data, size_t size)
+{
+    while (size > 0 && ((uintptr_t)data & 7) != 0)
+    {
+        crc = __crc32cb(crc, *data++);
+        size--;
+    }
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        crc = __crc32cd(crc, load64(data));
+    }
+    while (size > 0)
+    {
+        crc = __crc32cb(crc, *data++);
+        size--;
+    }
+    return crc;
+}
+#endif
+
+#if CRC32C_USE_PORTABLE
+/**
+ * Advance a (non-inverted) CRC over the data, 8 bytes per step.
+ */
+uint32_t crc32cPortable(uint32_t crc, const uint8_t *data, size_t size)
+{
+    const uint32_t (*t)[256] = gTables.mTable;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        // Little-endian byte order, as the CRC consumes the bytes
+        uint32_t lo = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                             ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+              t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    while (size > 0)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+        size--;
+    }
+    return crc;
+}
+#endif
+
+#if CRC32C_DISPATCH
+/**
+ * @return true if the CPU has the SSE4.2 CRC32 instruction
+ */
+bool detectSse42()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    // May run before the compiler's own CPU detection has
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+const bool gHaveSse42 = detectSse42();
+#endif
+
+/**
+ * Advance a (non-inverted) CRC over the data with the best implementation
+ * the CPU has.
+ */
+inline uint32_t crc32cUpdate(uint32_t crc, const uint8_t *data, size_t size)
+{
+#if CRC32C_DISPATCH
+    return gHaveSse42 ? crc32cSse42(crc, data, size) :
+                        crc32cPortable(crc, data, size);
+#elif CRC32C_USE_SSE42
+    return crc32cSse42(crc, data, size);
+#elif CRC32C_USE_ARM
+    return crc32cArm(crc, data, size);
+#else
+    return crc32cPortable(crc, data, size);
+#endif
+}
+
+} // namespace
+
+FrameHasher *FrameHasher::createFromEnvironment()
+{
+    const char *outputPath = getenv("XSTX_FRAME_HASH_OUTPUT");
+    const char *goldenPath = getenv("XSTX_FRAME_HASH_GOLDEN");
+    const char *enabled = getenv("XSTX_FRAME_HASH");
+    if (outputPath != NULL && outputPath[0] == '\0')
+    {
+        outputPath = NULL;
+    }
+    if (goldenPath != NULL && goldenPath[0] == '\0')
+    {
+        goldenPath = NULL;
+    }
+    if (outputPath == NULL && goldenPath == NULL &&
+        (enabled == NULL || atoi(enabled) == 0))
+    {
+        return NULL;
+    }
+
+    FrameHasher *hasher = new(std::nothrow) FrameHasher();
+    if (hasher == NULL)
+    {
+        return NULL;
+    }
+    if (!hasher->open(outputPath, goldenPath))
+    {
+        delete hasher;
+        return NULL;
+    }
+    return hasher;
+}
+
+FrameHasher::FrameHasher()
+    : mOutput(NULL)
+    , mChromaSampling(XSTX_CHROMA_SAMPLING_YUV420)
+    , mHashedBytes(0)
+    , mTotalHashTimeUs(0)
+    , mFrames(0)
+    , mEmptyFrames(0)
+    , mMatched(0)
+    , mMismatched(0)
+    , mUnlisted(0)
+{
+}
+
+FrameHasher::~FrameHasher()
+{
+    if (mFrames > 0 || !mGolden.empty())
+    {
+        logStats(true);
+    }
+    if (mOutput != NULL)
+    {
+        fclose(mOutput);
+    }
+}
+
+bool FrameHasher::open(const char *outputPath, const char *goldenPath)
+{
+    if (goldenPath != NULL && !loadGolden(goldenPath))
+    {
+        return false;
+    }
+    if (outputPath != NULL)
+    {
+        mOutput = fopen(outputPath, "w");
+        if (mOutput == NULL)
+        {
+            LOGE("Failed to create frame hash records %s", outputPath);
+            return false;
+        }
+        fprintf(mOutput, "# timestampUs crc32c\n");
+    }
+
+    LOGI("Hashing frames with %s CRC32C%s%s%s", implementationName(),
+         outputPath != NULL ? "; records to " : "",
+         outputPath != NULL ? outputPath : "",
+         goldenPath != NULL ? "; checking against golden records" : "");
+    return true;
+}
+
+void FrameHasher::setChromaSampling(XStxChromaSampling chromaSampling)
+{
+    mChromaSampling = chromaSampling;
+}
+
+void FrameHasher::hashFrame(const XStxRawVideoFrame *frame)
+{
+    // Frames that weren't decoded carry no pictures
+    if (frame->mPlanes[0] == NULL || frame->mWidth == 0 || frame->mHeight == 0)
+    {
+        mEmptyFrames++;
+        return;
+    }
+
+    uint64_t start = mud::TimeVal::mono().toMicroSeconds();
+    uint64_t bytes = 0;
+    uint32_t hash = hashPlanes(frame,
+        mChromaSampling == XSTX_CHROMA_SAMPLING_YUV444, bytes);
+    uint64_t elapsedUs = mud::TimeVal::mono().toMicroSeconds() - start;
+
+    mHashTimeUs.add((double)elapsedUs);
+    mTotalHashTimeUs += elapsedUs;
+    mHashedBytes += bytes;
+    mFrames++;
+
+    if (mOutput != NULL)
+    {
+        fprintf(mOutput, "%llu %08x\n",
+                (unsigned long long)frame->mTimestampUs, hash);
+    }
+
+    if (!mGolden.empty())
+    {
+        std::map<uint64_t, GoldenRecord>::iterator it =
+            mGolden.find(frame->mTimestampUs);
+        if (it == mGolden.end())
+        {
+            mUnlisted++;
+        }
+        else
+        {
+            it->second.mSeen = true;
+            if (it->second.mHash == hash)
+            {
+                mMatched++;
+            }
+            else if (mMismatched++ < MAX_LOGGED_MISMATCHES)
+            {
+                LOGW("Frame %llu hashed to %08x, expected %08x",
+                     (unsigned long long)frame->mTimestampUs, hash,
+                     it->second.mHash);
+            }
+        }
+    }
+
+    if (mFrames % STATS_INTERVAL_FRAMES == 0)
+    {
+        logStats(false);
+    }
+}
+
+uint32_t FrameHasher::hashPlanes(const XStxRawVideoFrame *frame, bool is444,
+                                 uint64_t &bytes)
+{
+    uint32_t chromaWidth = is444 ? frame->mWidth : (frame->mWidth + 1) / 2;
+    uint32_t chromaHeight = is444 ? frame->mHeight : (frame->mHeight + 1) / 2;
+
+    uint32_t crc = 0xffffffff;
+    bytes = 0;
+    for (int plane = 0; plane < 3; plane++)
+    {
+        uint32_t width = plane == 0 ? frame->mWidth : chromaWidth;
+        uint32_t height = plane == 0 ? frame->mHeight : chromaHeight;
+        const uint8_t *row = frame->mPlanes[plane];
+        for (uint32_t y = 0; y < height; y++, row += frame->mStrides[plane])
+        {
+            crc = crc32cUpdate(crc, row, width);
+        }
+        bytes += (uint64_t)width * height;
+    }
+    return ~crc;
+}
+
+uint32_t FrameHasher::crc32c(uint32_t crc, const uint8_t *data, size_t size)
+{
+    return ~crc32cUpdate(~crc, data, size);
+}
+
+const char *FrameHasher::implementationName()
+{
+#if CRC32C_DISPATCH
+    return gHaveSse42 ? "sse4.2" : "slice-by-8";
+#elif CRC32C_USE_SSE42
+    return "sse4.2";
+#elif CRC32C_USE_ARM
+    return "armv8";
+#else
+    return "slice-by-8";
+#endif
+}
+
+bool FrameHasher::loadGolden(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        LOGE("Can't open golden frame hashes %s", path);
+        return false;
+    }
+
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long timestampUs = 0;
+        unsigned int hash = 0;
+        if (line[0] == '#' || sscanf(line, "%llu %x", &timestampUs, &hash) != 2)
+        {
+            continue;
+        }
+        GoldenRecord record;
+        record.mHash = hash;
+        record.mSeen = false;
+        mGolden[timestampUs] = record;
+    }
+    fclose(file);
+
+    if (mGolden.empty())
+    {
+        LOGE("%s holds no frame hashes", path);
+        return false;
+    }
+    LOGI("Loaded %u golden frame hashes", (uint32_t)mGolden.size());
+    return true;
+}
+
+void FrameHasher::logStats(bool final)
+{
+    double mbPerSec = mTotalHashTimeUs > 0 ?
+        (double)mHashedBytes / (double)mTotalHashTimeUs : 0;
+
+    if (!final)
+    {
+        LOGV("[framehash]={ \"Impl\":\"%s\", \"Frames\":%u, \"Empty\":%u, "
+             "\"HashUsMean\":%.1f, \"HashUsMax\":%.0f, \"MBps\":%.0f, "
+             "\"Matched\":%u, \"Mismatched\":%u, \"Unlisted\":%u }",
+             implementationName(), mFrames, mEmptyFrames,
+             mHashTimeUs.mean(), mHashTimeUs.maximum(), mbPerSec,
+             mMatched, mMismatched, mUnlisted);
+        return;
+    }
+
+    uint32_t missing = 0;
+    for (std::map<uint64_t, GoldenRecord>::const_iterator it = mGolden.begin();
+         it != mGolden.end(); ++it)
+    {
+        if (!it->second.mSeen)
+        {
+            missing++;
+        }
+    }
+    const char *result = mGolden.empty() ? "none" :
+        (mMismatched == 0 && missing == 0 ? "pass" : "fail");
+
+    LOGI("[framehash]={ \"Impl\":\"%s\", \"Frames\":%u, \"Empty\":%u, "
+         "\"HashUsMean\":%.1f, \"HashUsMax\":%.0f, \"MBps\":%.0f, "
+         "\"Matched\":%u, \"Mismatched\":%u, \"Unlisted\":%u, "
+         "\"Missing\":%u, \"Result\":\"%s\" }",
+         implementationName(), mFrames, mEmptyFrames,
+         mHashTimeUs.mean(), mHashTimeUs.maximum(), mbPerSec,
+         mMatched, mMismatched, mUnlisted, missing, result);
+}
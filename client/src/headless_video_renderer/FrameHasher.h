@@ -0,0 +1,152 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_FrameHasher_h
+#define _included_FrameHasher_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <map>
+
+#include "XStx/common/XStxAPI.h"
+#include "RunningStats.h"
+
+/**
+ * Hashes the visible planes of every rendered frame so decoder output can
+ * be checked without keeping the pictures. Configured from the
+ * environment:
+ *  - XSTX_FRAME_HASH: set to 1 to hash frames and report the cost.
+ *  - XSTX_FRAME_HASH_OUTPUT: file to write a "<timestamp> <hash>" record
+ *    for every frame to; implies XSTX_FRAME_HASH.
+ *  - XSTX_FRAME_HASH_GOLDEN: records in the same format to compare the
+ *    frames against; implies XSTX_FRAME_HASH.
+ *
+ * The hash is CRC32C over the rows of the Y, U and V planes in turn,
+ * without the stride padding, so it only depends on the picture. On x86
+ * the SSE4.2 CRC instruction is used whenever the CPU has it, whatever
+ * the compiler flags; on ARM the ARMv8 CRC instructions are used when the
+ * target has them. The portable version gives identical results. Its cost is reported in
+ * the [framehash] statistics; at a few gigabytes per second it is small
+ * enough to leave on in canaries.
+ */
+class FrameHasher
+{
+public:
+
+    /**
+     * Create a hasher if the environment asks for one.
+     *
+     * @return a hasher, or NULL if hashing is not requested or its files
+     *     can't be opened.
+     */
+    static FrameHasher *createFromEnvironment();
+
+    /** Constructor */
+    FrameHasher();
+
+    /** Destructor; reports the totals and closes the output */
+    ~FrameHasher();
+
+    /**
+     * Open the record output and load the golden records.
+     *
+     * @param[in] outputPath records to write, or NULL
+     * @param[in] goldenPath records to compare against, or NULL
+     * @return true on success
+     */
+    bool open(const char *outputPath, const char *goldenPath);
+
+    /**
+     * Set the chroma sampling of the frames that will be hashed. 4:2:0
+     * is assumed until this is called.
+     */
+    void setChromaSampling(XStxChromaSampling chromaSampling);
+
+    /**
+     * Hash a frame, record it and check it against the golden records.
+     */
+    void hashFrame(const XStxRawVideoFrame *frame);
+
+    /**
+     * Hash the visible planes of a frame.
+     *
+     * @param[in] frame the frame
+     * @param[in] is444 true if the chroma planes are full resolution
+     * @param[out] bytes number of bytes hashed
+     * @return the hash
+     */
+    static uint32_t hashPlanes(const XStxRawVideoFrame *frame, bool is444,
+                               uint64_t &bytes);
+
+    /**
+     * Extend a CRC32C (Castagnoli) with more data. Start with 0.
+     *
+     * @param[in] crc  CRC of the data so far
+     * @param[in] data the data
+     * @param[in] size number of bytes
+     * @return CRC of all the data
+     */
+    static uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t size);
+
+    /**
+     * @return The name of the compiled-in CRC implementation.
+     */
+    static const char *implementationName();
+
+private:
+
+    /** How often (in frames) the statistics are logged */
+    static const uint32_t STATS_INTERVAL_FRAMES = 300;
+
+    /** Mismatches logged one by one before only counting them */
+    static const uint32_t MAX_LOGGED_MISMATCHES = 10;
+
+    struct GoldenRecord
+    {
+        uint32_t mHash;
+        bool mSeen;
+    };
+
+    /**
+     * Read "<timestamp> <hash>" records; '#' starts a comment line.
+     */
+    bool loadGolden(const char *path);
+
+    /**
+     * Log the statistics; the final report also tells whether the frames
+     * matched the golden records.
+     */
+    void logStats(bool final);
+
+    FILE *mOutput;
+    std::map<uint64_t, GoldenRecord> mGolden;
+    XStxChromaSampling mChromaSampling;
+
+    /** Time to hash a frame, in microseconds */
+    RunningStats mHashTimeUs;
+    uint64_t mHashedBytes;
+    uint64_t mTotalHashTimeUs;
+
+    uint32_t mFrames;
+    uint32_t mEmptyFrames;
+    uint32_t mMatched;
+    uint32_t mMismatched;
+    uint32_t mUnlisted;
+};
+
+#endif // _included_FrameHasher_h
@@ -8,13 +8,19 @@
 
     /** Constructor */
     HeadlessVideoRenderer::HeadlessVideoRenderer()
+        : mHasher(FrameHasher::createFromEnvironment())
     {
     }
 
     /** Destructor */
     HeadlessVideoRenderer::~HeadlessVideoRenderer()
     {
-       
+        delete mHasher;
+    }
+
+    bool HeadlessVideoRenderer::init()
+    {
+        return true;
     }
 
 	bool HeadlessVideoRenderer::init(uint32_t w, uint32_t h)
@@ -30,6 +36,10 @@
 
     void HeadlessVideoRenderer::render()
     {
+        if (mHasher != NULL)
+        {
+            mHasher->hashFrame(mFrame);
+        }
         //convertAndCopyFrameData();
         mud::ThreadUtil::sleep(5);
     }
@@ -52,6 +62,19 @@
 
     }
 
+    bool HeadlessVideoRenderer::receivedClientConfiguration(const XStxClientConfiguration* config)
+    {
+        if (mHasher != NULL)
+        {
+            mHasher->setChromaSampling(config->mChromaSampling);
+        }
+        if (config->mChromaSampling == XSTX_CHROMA_SAMPLING_YUV444)
+        {
+            mDecodeType = VideoDecoder::DECODE_PLANES444;
+        }
+        return true;
+    }
+
     void HeadlessVideoRenderer::post()
     {
        
@@ -2,6 +2,7 @@
 #define _included_HeadlessVideoRenderer_h
 
 #include "VideoRenderer.h"
+#include "FrameHasher.h"
 #include "MUD/threading/ScopeLock.h"
 #include "MUD/threading/SimpleLock.h"
 
@@ -9,7 +10,8 @@
 #include <string>
 #include "XStx/common/XStxUtil.h"
 /**
- * This is a headless renderer
+ * This is a headless renderer. With XSTX_FRAME_HASH set it hashes every
+ * frame it is given; see FrameHasher.
  */
 class HeadlessVideoRenderer : public VideoRenderer
 {
@@ -19,6 +21,11 @@ public:
     //destructor
     ~HeadlessVideoRenderer();
 
+    /**
+     * Nothing to set up without a display.
+     */
+    virtual bool init();
+
     /**
      * Set up the size for the backbuffer
      * System-side and GPU-side textures are always 1080p
@@ -43,6 +50,19 @@ public:
     virtual void clearScreen();
     virtual void post();
 
+    /**
+     * Note the chroma sampling, which decides the size of the planes
+     * that are hashed.
+     */
+    virtual bool receivedClientConfiguration(const XStxClientConfiguration* config);
+
+private:
+
+    /**
+     * Hashes rendered frames, or NULL.
+     */
+    FrameHasher *mHasher;
+
 };
 
 
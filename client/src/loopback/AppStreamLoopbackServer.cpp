@@ -0,0 +1,170 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MUD/threading/Thread.h"
+
+#include "LoopbackServer.h"
+#include "LoopbackSocket.h"
+
+#undef LOG_TAG
+#define LOG_TAG "AppStreamLoopbackServer"
+#include "log.h"
+
+/**
+ * Serves one loopback client: frames go out on the socket while a
+ * thread takes the client's messages and input.
+ */
+class SocketConnection : public LoopbackServer::Output
+{
+public:
+
+    SocketConnection(LoopbackSocket &socket)
+        : mSocket(socket)
+        , mServer(NULL)
+        , mReceiveThread("LoopbackReceive", *this)
+    {
+    }
+
+    /** Stream to the client; returns when done or the client has left */
+    bool serve(LoopbackServer &server)
+    {
+        mServer = &server;
+        mReceiveThread.start();
+
+        bool complete = server.run();
+        if (complete)
+        {
+            mSocket.sendRecord(LoopbackSocket::STREAM_END, 0, 0, NULL, 0);
+        }
+
+        // The client closes once it has played out what it received
+        mReceiveThread.join();
+        return complete;
+    }
+
+    virtual bool sendFrame(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+                           const uint8_t *data, uint32_t size)
+    {
+        return mSocket.sendRecord(stream, flags, timestampUs, data, size);
+    }
+
+    void receiveLoop()
+    {
+        LoopbackLink::Packet packet;
+        while (mSocket.receiveRecord(packet))
+        {
+            const uint8_t *data = packet.mData.empty() ? NULL : &packet.mData[0];
+            uint32_t size = (uint32_t)packet.mData.size();
+            if (packet.mStream == LoopbackSocket::STREAM_MESSAGE)
+            {
+                mServer->messageReceived(data, size);
+            }
+            else if (packet.mStream == LoopbackSocket::STREAM_INPUT)
+            {
+                mServer->inputReceived(data, size);
+            }
+        }
+        // The client has gone away; nothing more to stream
+        mServer->stop();
+    }
+
+private:
+
+    DEFINE_METHOD_THREAD(ReceiveThread, SocketConnection, receiveLoop);
+
+    LoopbackSocket &mSocket;
+    LoopbackServer *mServer;
+    ReceiveThread mReceiveThread;
+};
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options] <recording>\n"
+           "\n"
+           "Streams a capture written with XSTX_RECORD_STREAM to a client\n"
+           "built against the loopback library, which connects with the\n"
+           "entitlement URL unix://<socket>.\n"
+           "\n"
+           "  -s <socket> socket path (default /tmp/appstream-loopback)\n"
+           "  -n <loops>  stream the recording this many times (default 1)\n"
+           "\n"
+           "The client simulates the network; see XSTX_LOOPBACK_LATENCY_MS,\n"
+           "XSTX_LOOPBACK_JITTER_MS and XSTX_LOOPBACK_LOSS_PCT.\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *socketPath = "/tmp/appstream-loopback";
+    const char *capturePath = NULL;
+    uint32_t loops = 1;
+
+    int count = 1;
+    while (count < argc)
+    {
+        const char *arg = argv[count++];
+        bool hasValue = count < argc;
+
+        if (strcmp(arg, "-s") == 0 && hasValue)
+        {
+            socketPath = argv[count++];
+        }
+        else if (strcmp(arg, "-n") == 0 && hasValue)
+        {
+            loops = (uint32_t)atoi(argv[count++]);
+        }
+        else if (arg[0] != '-' && capturePath == NULL)
+        {
+            capturePath = arg;
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (capturePath == NULL || loops == 0)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    LoopbackSocket listener;
+    LoopbackSocket client;
+    SocketConnection connection(client);
+    LoopbackServer server(connection, loops);
+    if (!server.open(capturePath) || !listener.listen(socketPath))
+    {
+        return 1;
+    }
+
+    LOGI("Waiting for a client on %s", socketPath);
+    if (!listener.accept(client))
+    {
+        return 1;
+    }
+    listener.close();
+
+    bool complete = connection.serve(server);
+    server.logStats();
+    return complete ? 0 : 2;
+}
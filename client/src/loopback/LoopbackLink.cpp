@@ -0,0 +1,248 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "LoopbackLink.h"
+#include "LoopbackSocket.h"
+#include "../StreamRecorder.h"
+
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <new>
+#include <stdlib.h>
+
+#undef LOG_TAG
+#define LOG_TAG "LoopbackLink"
+#include "log.h"
+
+/** How long the delivery thread sleeps with nothing in flight */
+static const uint64_t IDLE_WAIT_MS = 100;
+
+static uint64_t nowUs()
+{
+    return mud::TimeVal::mono().toMicroSeconds();
+}
+
+static uint32_t getEnvironmentValue(const char *name, uint32_t defaultValue)
+{
+    const char *value = getenv(name);
+    return (value != NULL && value[0] != '\0') ? (uint32_t)atoi(value) : defaultValue;
+}
+
+LoopbackLink::Settings::Settings()
+    : mLatencyMs(0)
+    , mJitterMs(0)
+    , mLossPct(0)
+    , mSeed(1)
+{
+}
+
+LoopbackLink::Settings LoopbackLink::Settings::fromEnvironment()
+{
+    Settings settings;
+    settings.mLatencyMs = getEnvironmentValue("XSTX_LOOPBACK_LATENCY_MS", 0);
+    settings.mJitterMs = getEnvironmentValue("XSTX_LOOPBACK_JITTER_MS", 0);
+    settings.mSeed = getEnvironmentValue("XSTX_LOOPBACK_SEED", 1);
+
+    const char *loss = getenv("XSTX_LOOPBACK_LOSS_PCT");
+    if (loss != NULL)
+    {
+        settings.mLossPct = atof(loss);
+    }
+    return settings;
+}
+
+LoopbackLink::LoopbackLink(Sink &sink, const Settings &settings)
+    : mSink(sink)
+    , mSettings(settings)
+    , mDeliveryThread("LoopbackLink", *this)
+    , mStop(false)
+    , mDelivering(false)
+    , mRandomState(settings.mSeed)
+    , mSent(0)
+    , mLost(0)
+    , mDelivered(0)
+    , mTotalDelayUs(0)
+    , mMaxDelayUs(0)
+{
+    for (uint32_t i = 0; i < MAX_STREAMS; i++)
+    {
+        mLastDeliveryUs[i] = 0;
+    }
+}
+
+LoopbackLink::~LoopbackLink()
+{
+    stop();
+}
+
+bool LoopbackLink::start()
+{
+    LOGI("Loopback link: latency %u ms, jitter %u ms, loss %.2f%%",
+         mSettings.mLatencyMs, mSettings.mJitterMs, mSettings.mLossPct);
+    return mDeliveryThread.start() == SIMPLE_RESULT_OK;
+}
+
+void LoopbackLink::stop()
+{
+    mLock.lock();
+    mStop = true;
+    mLock.signal();
+    mLock.unlock();
+
+    mDeliveryThread.join();
+
+    mLock.lock();
+    for (InFlightMap::iterator it = mInFlight.begin(); it != mInFlight.end(); ++it)
+    {
+        delete it->second;
+    }
+    mInFlight.clear();
+    mLock.unlock();
+}
+
+double LoopbackLink::nextRandom()
+{
+    // Numerical Recipes LCG; reproducible for a given seed
+    mRandomState = mRandomState * 1664525 + 1013904223;
+    return (mRandomState >> 8) / 16777216.0;
+}
+
+void LoopbackLink::send(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+                        const uint8_t *data, uint32_t size)
+{
+    mLock.lock();
+    mSent++;
+
+    // Messages travel on the reliable control channel
+    bool lost = stream != LoopbackSocket::STREAM_MESSAGE &&
+                mSettings.mLossPct > 0 && nextRandom() * 100 < mSettings.mLossPct;
+    if (lost)
+    {
+        mLost++;
+        if (stream != StreamRecorder::STREAM_AUDIO)
+        {
+            mLock.unlock();
+            return;
+        }
+    }
+
+    Packet *packet = new(std::nothrow) Packet();
+    if (packet == NULL)
+    {
+        mLost++;
+        mLock.unlock();
+        return;
+    }
+    packet->mStream = stream;
+    packet->mTimestampUs = timestampUs;
+    if (lost)
+    {
+        packet->mFlags = StreamRecorder::FLAG_EMPTY;
+    }
+    else
+    {
+        packet->mFlags = flags;
+        packet->mData.assign(data, data + size);
+    }
+
+    uint64_t deliveryUs = nowUs() + mSettings.mLatencyMs * 1000ULL +
+        (uint64_t)(nextRandom() * mSettings.mJitterMs * 1000);
+    uint32_t index = stream < MAX_STREAMS ? stream : MAX_STREAMS - 1;
+    if (deliveryUs < mLastDeliveryUs[index])
+    {
+        deliveryUs = mLastDeliveryUs[index];
+    }
+    mLastDeliveryUs[index] = deliveryUs;
+
+    // equal keys keep insertion order, so a stream stays in order
+    mInFlight.insert(std::make_pair(deliveryUs, packet));
+    mLock.signal();
+    mLock.unlock();
+}
+
+bool LoopbackLink::waitUntilIdle(uint32_t timeoutMs)
+{
+    for (uint32_t waited = 0; ; waited++)
+    {
+        mLock.lock();
+        bool idle = mInFlight.empty() && !mDelivering;
+        mLock.unlock();
+        if (idle)
+        {
+            return true;
+        }
+        if (waited >= timeoutMs)
+        {
+            return false;
+        }
+        mud::ThreadUtil::sleep(1);
+    }
+}
+
+void LoopbackLink::deliveryLoop()
+{
+    mLock.lock();
+    while (!mStop)
+    {
+        uint64_t now = nowUs();
+        if (!mInFlight.empty() && mInFlight.begin()->first <= now)
+        {
+            InFlightMap::iterator first = mInFlight.begin();
+            uint64_t dueUs = first->first;
+            Packet *packet = first->second;
+            mInFlight.erase(first);
+            mDelivering = true;
+            mLock.unlock();
+
+            mSink.deliver(*packet);
+            delete packet;
+
+            mLock.lock();
+            mDelivering = false;
+            mDelivered++;
+            // how late the sink let us be, on top of the simulated delay
+            uint64_t lateUs = nowUs() - dueUs;
+            mTotalDelayUs += lateUs;
+            if (lateUs > mMaxDelayUs)
+            {
+                mMaxDelayUs = lateUs;
+            }
+            continue;
+        }
+
+        uint64_t waitMs = mInFlight.empty() ? IDLE_WAIT_MS :
+            (mInFlight.begin()->first - now + 999) / 1000;
+        mLock.unlock();
+        mLock.waitForSignalAndLock(waitMs);
+    }
+    mLock.unlock();
+}
+
+void LoopbackLink::logStats()
+{
+    mLock.lock();
+    LOGI("[loopback]={ \"Sent\":%llu, \"Lost\":%llu, \"Delivered\":%llu, "
+         "\"InFlight\":%u, \"DeliveryLagMeanMs\":%.3f, \"DeliveryLagMaxMs\":%.3f }",
+         (unsigned long long)mSent, (unsigned long long)mLost,
+         (unsigned long long)mDelivered, (uint32_t)mInFlight.size(),
+         mDelivered ? mTotalDelayUs / 1000.0 / mDelivered : 0.0,
+         mMaxDelayUs / 1000.0);
+    mLock.unlock();
+}
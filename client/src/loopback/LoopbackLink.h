@@ -0,0 +1,153 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_LoopbackLink_h
+#define _included_LoopbackLink_h
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "MUD/threading/Thread.h"
+#include "MUD/threading/WaitableLock.h"
+
+/**
+ * Simulated network between the loopback server and client: every packet
+ * sent is delivered to the sink on the link's own thread after a fixed
+ * latency plus a random jitter, or lost.
+ *
+ * Packets of one stream stay in order, as they do on the real transport.
+ * A lost video packet is never delivered, so the decoder sees the gap; a
+ * lost audio packet is delivered empty, which makes the audio decoder
+ * conceal it the way the library does.
+ *
+ * Settings come from the environment:
+ *   XSTX_LOOPBACK_LATENCY_MS  one-way latency (default 0)
+ *   XSTX_LOOPBACK_JITTER_MS   maximum extra random delay (default 0)
+ *   XSTX_LOOPBACK_LOSS_PCT    percentage of packets lost (default 0)
+ *   XSTX_LOOPBACK_SEED        seed of the jitter and loss (default 1)
+ */
+class LoopbackLink
+{
+public:
+
+    /** A frame on its way to the client */
+    struct Packet
+    {
+        /** StreamRecorder::EStream or LoopbackSocket::STREAM_MESSAGE */
+        uint8_t mStream;
+        /** StreamRecorder::EFlags */
+        uint8_t mFlags;
+        uint64_t mTimestampUs;
+        std::vector<uint8_t> mData;
+    };
+
+    /** Receives the packets that make it across */
+    class Sink
+    {
+    public:
+        virtual ~Sink() {}
+
+        /** Called on the link thread, in delivery order */
+        virtual void deliver(Packet &packet) = 0;
+    };
+
+    /** Link conditions */
+    struct Settings
+    {
+        Settings();
+
+        /** @return settings read from the XSTX_LOOPBACK_* variables */
+        static Settings fromEnvironment();
+
+        uint32_t mLatencyMs;
+        uint32_t mJitterMs;
+        /** Loss in percent */
+        double mLossPct;
+        uint32_t mSeed;
+    };
+
+    /** Constructor */
+    LoopbackLink(Sink &sink, const Settings &settings);
+
+    /** Destructor; drops packets still in flight */
+    ~LoopbackLink();
+
+    /** Start the delivery thread */
+    bool start();
+
+    /**
+     * Stop the delivery thread. Packets still in flight are dropped.
+     */
+    void stop();
+
+    /**
+     * Put a packet on the link. Returns immediately.
+     */
+    void send(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+              const uint8_t *data, uint32_t size);
+
+    /**
+     * Wait until everything sent has been delivered (or lost).
+     *
+     * @param[in] timeoutMs longest to wait
+     * @return true if the link is empty
+     */
+    bool waitUntilIdle(uint32_t timeoutMs);
+
+    /** Log what happened on the link */
+    void logStats();
+
+    /** Delivery thread body */
+    void deliveryLoop();
+
+private:
+
+    DEFINE_METHOD_THREAD(DeliveryThread, LoopbackLink, deliveryLoop);
+
+    /** Number of stream values the link keeps ordering for */
+    static const uint32_t MAX_STREAMS = 4;
+
+    /** @return a pseudo random number in [0, 1) */
+    double nextRandom();
+
+    Sink &mSink;
+    Settings mSettings;
+
+    DeliveryThread mDeliveryThread;
+
+    /** Guards everything below and signals new packets */
+    mud::WaitableLock mLock;
+    bool mStop;
+    bool mDelivering;
+
+    /** Packets in flight by delivery time (microseconds, monotonic) */
+    typedef std::multimap<uint64_t, Packet *> InFlightMap;
+    InFlightMap mInFlight;
+    /** Latest delivery time given to each stream, to keep it in order */
+    uint64_t mLastDeliveryUs[MAX_STREAMS];
+
+    uint32_t mRandomState;
+
+    uint64_t mSent;
+    uint64_t mLost;
+    uint64_t mDelivered;
+    uint64_t mTotalDelayUs;
+    uint64_t mMaxDelayUs;
+};
+
+#endif //_included_LoopbackLink_h
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "LoopbackServer.h"
+#include "LoopbackSocket.h"
+#include "../StreamRecorder.h"
+
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <algorithm>
+
+#undef LOG_TAG
+#define LOG_TAG "LoopbackServer"
+#include "log.h"
+
+/** Media time between the end of one loop and the start of the next */
+static const uint64_t LOOP_GAP_US = 10000;
+/** A frame sent later than this behind its schedule counts as late */
+static const uint64_t LATE_THRESHOLD_US = 10000;
+
+static uint64_t nowUs()
+{
+    return mud::TimeVal::mono().toMicroSeconds();
+}
+
+LoopbackServer::LoopbackServer(Output &output, uint32_t loops)
+    : mOutput(output)
+    , mLoops(loops > 0 ? loops : 1)
+    , mStop(false)
+    , mFramesSent(0)
+    , mBytesSent(0)
+    , mLateFrames(0)
+    , mMessages(0)
+    , mInputs(0)
+{
+}
+
+LoopbackServer::~LoopbackServer()
+{
+}
+
+bool LoopbackServer::open(const char *capturePath)
+{
+    return mReader.open(capturePath);
+}
+
+bool LoopbackServer::run()
+{
+    StreamReader::Record record;
+    uint64_t startUs = nowUs();
+    uint64_t firstTimestampUs = 0;
+    // media time at which the current loop starts
+    uint64_t loopStartUs = 0;
+
+    for (uint32_t loop = 0; loop < mLoops; loop++)
+    {
+        if (loop > 0 && !mReader.rewind())
+        {
+            return false;
+        }
+
+        bool first = true;
+        uint64_t loopFirstUs = 0;
+        uint64_t loopLengthUs = 0;
+        while (mReader.readRecord(record))
+        {
+            if (shouldStop())
+            {
+                return false;
+            }
+            if (record.mStream != StreamRecorder::STREAM_VIDEO &&
+                record.mStream != StreamRecorder::STREAM_AUDIO)
+            {
+                continue;
+            }
+
+            if (first)
+            {
+                loopFirstUs = record.mTimestampUs;
+                if (loop == 0)
+                {
+                    firstTimestampUs = record.mTimestampUs;
+                }
+                first = false;
+            }
+            uint64_t offsetUs = record.mTimestampUs > loopFirstUs ?
+                record.mTimestampUs - loopFirstUs : 0;
+            loopLengthUs = std::max(loopLengthUs, offsetUs);
+            uint64_t mediaUs = loopStartUs + offsetUs;
+
+            // Send each frame when the encoder would have produced it
+            uint64_t dueUs = startUs + mediaUs;
+            uint64_t sendUs = nowUs();
+            if (sendUs < dueUs)
+            {
+                mud::ThreadUtil::sleep((uint32_t)((dueUs - sendUs + 999) / 1000));
+            }
+            else if (sendUs - dueUs > LATE_THRESHOLD_US)
+            {
+                mLateFrames++;
+            }
+
+            uint32_t size = (uint32_t)record.mData.size();
+            if (!mOutput.sendFrame(record.mStream, record.mFlags,
+                                   firstTimestampUs + mediaUs,
+                                   size > 0 ? &record.mData[0] : NULL, size))
+            {
+                LOGW("Client went away");
+                return false;
+            }
+            mFramesSent++;
+            mBytesSent += size;
+        }
+        if (first)
+        {
+            LOGE("The capture has no frames");
+            return false;
+        }
+        loopStartUs += loopLengthUs + LOOP_GAP_US;
+    }
+    return true;
+}
+
+void LoopbackServer::stop()
+{
+    mud::ScopeLock sl(mLock);
+    mStop = true;
+}
+
+bool LoopbackServer::shouldStop()
+{
+    mud::ScopeLock sl(mLock);
+    return mStop;
+}
+
+void LoopbackServer::messageReceived(const uint8_t *data, uint32_t size)
+{
+    {
+        mud::ScopeLock sl(mLock);
+        mMessages++;
+    }
+    // Echo, so the client can time the round trip
+    mOutput.sendFrame(LoopbackSocket::STREAM_MESSAGE, 0,
+                      nowUs(), data, size);
+}
+
+void LoopbackServer::inputReceived(const uint8_t * /*data*/, uint32_t /*size*/)
+{
+    mud::ScopeLock sl(mLock);
+    mInputs++;
+}
+
+void LoopbackServer::logStats()
+{
+    mud::ScopeLock sl(mLock);
+    LOGI("[loopbackServer]={ \"Frames\":%llu, \"Bytes\":%llu, \"Late\":%llu, "
+         "\"Messages\":%llu, \"Inputs\":%llu }",
+         (unsigned long long)mFramesSent,
+         (unsigned long long)mBytesSent,
+         (unsigned long long)mLateFrames,
+         (unsigned long long)mMessages,
+         (unsigned long long)mInputs);
+}
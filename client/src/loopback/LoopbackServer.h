@@ -0,0 +1,108 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_LoopbackServer_h
+#define _included_LoopbackServer_h
+
+#include <stdint.h>
+
+#include "MUD/threading/SimpleLock.h"
+
+#include "../replay/StreamReader.h"
+
+/**
+ * Server end of the loopback stand-in. It streams the encoded frames of a
+ * StreamRecorder capture at the pace they were recorded, instead of
+ * capturing and encoding a live application, and echoes application
+ * messages back to the client.
+ */
+class LoopbackServer
+{
+public:
+
+    /** Where the server's frames go: the link or a socket */
+    class Output
+    {
+    public:
+        virtual ~Output() {}
+
+        /**
+         * Send one frame to the client.
+         * @return false if the client has gone away
+         */
+        virtual bool sendFrame(uint8_t stream, uint8_t flags,
+                               uint64_t timestampUs,
+                               const uint8_t *data, uint32_t size) = 0;
+    };
+
+    /**
+     * Constructor
+     *
+     * @param[in] output receives the frames
+     * @param[in] loops times to stream the capture; later loops continue
+     *     the timeline of the first
+     */
+    LoopbackServer(Output &output, uint32_t loops);
+
+    /** Destructor */
+    ~LoopbackServer();
+
+    /**
+     * Open the capture to stream.
+     * @return true on success
+     */
+    bool open(const char *capturePath);
+
+    /**
+     * Stream the capture. Blocks until it has all been sent, the output
+     * fails or stop() is called.
+     *
+     * @return true if the whole capture was sent
+     */
+    bool run();
+
+    /** Make run() return early; safe from any thread */
+    void stop();
+
+    /** Handle an application message from the client */
+    void messageReceived(const uint8_t *data, uint32_t size);
+
+    /** Handle an input event from the client */
+    void inputReceived(const uint8_t *data, uint32_t size);
+
+    /** Log what was streamed */
+    void logStats();
+
+private:
+
+    bool shouldStop();
+
+    Output &mOutput;
+    uint32_t mLoops;
+    StreamReader mReader;
+
+    mud::SimpleLock mLock;
+    bool mStop;
+
+    uint64_t mFramesSent;
+    uint64_t mBytesSent;
+    uint64_t mLateFrames;
+    uint64_t mMessages;
+    uint64_t mInputs;
+};
+
+#endif //_included_LoopbackServer_h
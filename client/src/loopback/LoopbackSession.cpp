@@ -0,0 +1,613 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "LoopbackSession.h"
+#include "../StreamRecorder.h"
+
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "LoopbackSession"
+#include "log.h"
+
+static const char LOOPBACK_SCHEME[] = "loopback://";
+static const char UNIX_SCHEME[] = "unix://";
+
+/** Version the stand-in reports from XStxGetLibraryVersion() */
+static const uint32_t LOOPBACK_BUILD = 0;
+
+static uint32_t getEnvironmentValue(const char *name, uint32_t defaultValue)
+{
+    const char *value = getenv(name);
+    return (value != NULL && value[0] != '\0') ? (uint32_t)atoi(value) : defaultValue;
+}
+
+LoopbackSession::LoopbackSession()
+    : mWidth(getEnvironmentValue("XSTX_LOOPBACK_WIDTH", 1280))
+    , mHeight(getEnvironmentValue("XSTX_LOOPBACK_HEIGHT", 720))
+    , mLink(*this, LoopbackLink::Settings::fromEnvironment())
+    , mServer(NULL)
+    , mSessionThread("LoopbackSession", *this)
+    , mStarted(false)
+    , mStopRequested(false)
+    , mVideoFrames(0)
+    , mVideoDropped(0)
+    , mAudioFrames(0)
+    , mAudioDropped(0)
+    , mMessages(0)
+{
+    memset(&mListener, 0, sizeof(mListener));
+}
+
+LoopbackSession::~LoopbackSession()
+{
+    stop();
+    mSessionThread.join();
+    mLink.stop();
+}
+
+XStxResult LoopbackSession::setListener(const XStxIClientListener2 *listener)
+{
+    if (listener == NULL || listener->mSize == 0)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    memset(&mListener, 0, sizeof(mListener));
+    memcpy(&mListener, listener, std::min((size_t)listener->mSize, sizeof(mListener)));
+    return XSTX_RESULT_OK;
+}
+
+XStxResult LoopbackSession::setEntitlementUrl(const char *url)
+{
+    if (url == NULL)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+
+    mCapturePath.clear();
+    mSocketPath.clear();
+    if (strncmp(url, LOOPBACK_SCHEME, sizeof(LOOPBACK_SCHEME) - 1) == 0)
+    {
+        mCapturePath = url + sizeof(LOOPBACK_SCHEME) - 1;
+    }
+    else if (strncmp(url, UNIX_SCHEME, sizeof(UNIX_SCHEME) - 1) == 0)
+    {
+        mSocketPath = url + sizeof(UNIX_SCHEME) - 1;
+    }
+    // Anything else fails when the session starts, like a bad
+    // entitlement URL does with the library
+    return XSTX_RESULT_OK;
+}
+
+XStxResult LoopbackSession::start()
+{
+    mud::ScopeLock sl(mLock);
+    if (mStarted)
+    {
+        return XSTX_RESULT_INVALID_STATE;
+    }
+    if (mSessionThread.start() != SIMPLE_RESULT_OK)
+    {
+        return XSTX_RESULT_NOT_INITIALIZED_PROPERLY;
+    }
+    mStarted = true;
+    return XSTX_RESULT_OK;
+}
+
+XStxResult LoopbackSession::stop()
+{
+    mud::ScopeLock sl(mLock);
+    mStopRequested = true;
+    if (mServer != NULL)
+    {
+        mServer->stop();
+    }
+    mSocket.shutdown();
+    return XSTX_RESULT_OK;
+}
+
+bool LoopbackSession::isStopRequested()
+{
+    mud::ScopeLock sl(mLock);
+    return mStopRequested;
+}
+
+XStxResult LoopbackSession::sendMessage(const uint8_t *data, uint32_t size)
+{
+    if (data == NULL && size > 0)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    if (!mSocketPath.empty())
+    {
+        return mSocket.sendRecord(LoopbackSocket::STREAM_MESSAGE, 0, 0, data, size) ?
+            XSTX_RESULT_OK : XSTX_RESULT_INVALID_STATE;
+    }
+
+    mud::ScopeLock sl(mLock);
+    if (mServer == NULL)
+    {
+        return XSTX_RESULT_INVALID_STATE;
+    }
+    mServer->messageReceived(data, size);
+    return XSTX_RESULT_OK;
+}
+
+XStxResult LoopbackSession::sendInput(const uint8_t *data, uint32_t size)
+{
+    if (data == NULL && size > 0)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    if (!mSocketPath.empty())
+    {
+        return mSocket.sendRecord(LoopbackSocket::STREAM_INPUT, 0, 0, data, size) ?
+            XSTX_RESULT_OK : XSTX_RESULT_INVALID_STATE;
+    }
+
+    mud::ScopeLock sl(mLock);
+    if (mServer == NULL)
+    {
+        return XSTX_RESULT_INVALID_STATE;
+    }
+    mServer->inputReceived(data, size);
+    return XSTX_RESULT_OK;
+}
+
+void LoopbackSession::sessionLoop()
+{
+    XStxStopReason reason;
+    if (!mCapturePath.empty())
+    {
+        reason = runCapture();
+    }
+    else if (!mSocketPath.empty())
+    {
+        reason = runSocket();
+    }
+    else
+    {
+        LOGE("Not a loopback URL; use loopback://<capture> or unix://<socket>");
+        reason = XSTX_STOP_REASON_SESSION_REQUEST_INVALID_ENTITLEMENT_URL;
+    }
+    if (isStopRequested())
+    {
+        reason = XSTX_STOP_REASON_REQUESTED;
+    }
+
+    mLink.stop();
+    mLink.logStats();
+    LOGI("[loopbackClient]={ \"VideoFrames\":%llu, \"VideoDropped\":%llu, "
+         "\"AudioFrames\":%llu, \"AudioDropped\":%llu, \"AudioUnderruns\":%u, "
+         "\"Messages\":%llu }",
+         (unsigned long long)mVideoFrames, (unsigned long long)mVideoDropped,
+         (unsigned long long)mAudioFrames, (unsigned long long)mAudioDropped,
+         getAudioUnderruns(), (unsigned long long)mMessages);
+
+    if (mListener.mStoppedFcn != NULL)
+    {
+        mListener.mStoppedFcn(mListener.mStoppedCtx, reason);
+    }
+}
+
+XStxStopReason LoopbackSession::runCapture()
+{
+    LoopbackServer *server = new(std::nothrow) LoopbackServer(
+        *this, getEnvironmentValue("XSTX_LOOPBACK_LOOPS", 1));
+    if (server == NULL || !server->open(mCapturePath.c_str()))
+    {
+        delete server;
+        return XSTX_STOP_REASON_SESSION_REQUEST_INVALID_ENTITLEMENT_URL;
+    }
+
+    XStxResult result = startPipelines(mWidth, mHeight, true);
+    if (result != XSTX_RESULT_OK || !mLink.start())
+    {
+        LOGE("Can't start the client pipelines: %s", XStxResultGetDescription(result));
+        delete server;
+        return XSTX_STOP_REASON_SESSION_REQUEST_FAILED;
+    }
+    {
+        mud::ScopeLock sl(mLock);
+        mServer = server;
+        if (mStopRequested)
+        {
+            mServer->stop();
+        }
+    }
+
+    if (mListener.mReadyFcn != NULL)
+    {
+        mListener.mReadyFcn(mListener.mReadyCtx, 0, NULL);
+    }
+
+    bool complete = server->run();
+    if (complete)
+    {
+        mLink.waitUntilIdle(LINK_DRAIN_MS);
+    }
+    server->logStats();
+
+    {
+        mud::ScopeLock sl(mLock);
+        mServer = NULL;
+    }
+    delete server;
+    return complete ? XSTX_STOP_REASON_SESSION_CLOSED : XSTX_STOP_REASON_CONNECTION_LOST;
+}
+
+XStxStopReason LoopbackSession::runSocket()
+{
+    if (!mSocket.connect(mSocketPath.c_str()))
+    {
+        return XSTX_STOP_REASON_TCP_CONNECT_FAILED;
+    }
+    if (isStopRequested())
+    {
+        // stop() may have missed the socket while it was connecting
+        return XSTX_STOP_REASON_REQUESTED;
+    }
+
+    XStxResult result = startPipelines(mWidth, mHeight, true);
+    if (result != XSTX_RESULT_OK || !mLink.start())
+    {
+        LOGE("Can't start the client pipelines: %s", XStxResultGetDescription(result));
+        return XSTX_STOP_REASON_SESSION_REQUEST_FAILED;
+    }
+
+    if (mListener.mReadyFcn != NULL)
+    {
+        mListener.mReadyFcn(mListener.mReadyCtx, 0, NULL);
+    }
+
+    LoopbackLink::Packet packet;
+    while (mSocket.receiveRecord(packet))
+    {
+        if (packet.mStream == LoopbackSocket::STREAM_END)
+        {
+            mLink.waitUntilIdle(LINK_DRAIN_MS);
+            return XSTX_STOP_REASON_SESSION_CLOSED;
+        }
+        mLink.send(packet.mStream, packet.mFlags, packet.mTimestampUs,
+                   packet.mData.empty() ? NULL : &packet.mData[0],
+                   (uint32_t)packet.mData.size());
+    }
+    return XSTX_STOP_REASON_CONNECTION_LOST;
+}
+
+bool LoopbackSession::sendFrame(uint8_t stream, uint8_t flags,
+                                uint64_t timestampUs,
+                                const uint8_t *data, uint32_t size)
+{
+    mLink.send(stream, flags, timestampUs, data, size);
+    return true;
+}
+
+void LoopbackSession::deliver(LoopbackLink::Packet &packet)
+{
+    if (packet.mStream == StreamRecorder::STREAM_VIDEO)
+    {
+        deliverVideo(packet);
+    }
+    else if (packet.mStream == StreamRecorder::STREAM_AUDIO)
+    {
+        deliverAudio(packet);
+    }
+    else if (packet.mStream == LoopbackSocket::STREAM_MESSAGE)
+    {
+        mMessages++;
+        if (mListener.mMessageReceivedFcn != NULL)
+        {
+            mListener.mMessageReceivedFcn(mListener.mMessageReceivedCtx,
+                packet.mData.empty() ? NULL : &packet.mData[0],
+                (uint32_t)packet.mData.size());
+        }
+    }
+}
+
+void LoopbackSession::deliverVideo(LoopbackLink::Packet &packet)
+{
+    if (packet.mData.empty())
+    {
+        return;
+    }
+    const XStxIRawVideoFrameAllocator &allocator = getVideoFrameAllocator();
+    const XStxIVideoDecoder &decoder = getVideoDecoder();
+    const XStxIVideoRenderer &renderer = getVideoRenderer();
+
+    mVideoFrames++;
+    XStxRawVideoFrame *frame = NULL;
+    if (allocator.mGetVideoFrameBufferFcn(allocator.mGetVideoFrameBufferCtx,
+            mWidth, mHeight, &frame) != XSTX_RESULT_OK)
+    {
+        // The renderer is holding every frame; a live session drops
+        mVideoDropped++;
+        return;
+    }
+
+    XStxEncodedVideoFrame encoded;
+    memset(&encoded, 0, sizeof(encoded));
+    encoded.mData = &packet.mData[0];
+    encoded.mDataSize = (uint32_t)packet.mData.size();
+    encoded.mTimestampUs = packet.mTimestampUs;
+
+    if (decoder.mDecodeVideoFrameFcn(decoder.mDecodeVideoFrameCtx,
+            &encoded, frame) == XSTX_RESULT_OK)
+    {
+        renderer.mRenderVideoFrameFcn(renderer.mRenderVideoFrameCtx, frame);
+    }
+
+    allocator.mRecycleVideoFrameBufferFcn(
+        allocator.mRecycleVideoFrameBufferCtx, frame);
+}
+
+void LoopbackSession::deliverAudio(LoopbackLink::Packet &packet)
+{
+    const XStxIRawAudioFrameAllocator &allocator = getAudioFrameAllocator();
+    const XStxIAudioDecoder &decoder = getAudioDecoder();
+
+    mAudioFrames++;
+    XStxRawAudioFrame *frame = NULL;
+    if (allocator.mGetAudioFrameBufferFcn(allocator.mGetAudioFrameBufferCtx,
+            AUDIO_FRAME_SIZE, &frame) != XSTX_RESULT_OK)
+    {
+        mAudioDropped++;
+        return;
+    }
+
+    // An empty packet was lost on the link; the decoder conceals it
+    XStxEncodedAudioFrame encoded;
+    memset(&encoded, 0, sizeof(encoded));
+    if (!packet.mData.empty())
+    {
+        encoded.mData = &packet.mData[0];
+        encoded.mDataSize = (uint32_t)packet.mData.size();
+    }
+    encoded.mTimestampUs = packet.mTimestampUs;
+
+    if (decoder.mDecodeAudioFrameFcn(decoder.mDecodeAudioFrameCtx,
+            &encoded, frame) == XSTX_RESULT_OK && queueAudioFrame(frame))
+    {
+        return;
+    }
+    mAudioDropped++;
+    allocator.mRecycleAudioFrameBufferFcn(
+        allocator.mRecycleAudioFrameBufferCtx, frame);
+}
+
+/*
+ * The part of the XStx client API that AppStreamWrapper uses, on top of the
+ * interface setters in ReplayClient.cpp.
+ */
+
+/** Stands in for the library handle; there is no per-library state */
+static int sLoopbackLibrary;
+
+XStxResult XStxClientLibraryCreate(uint32_t majorVersion, uint32_t minorVersion,
+    XStxClientLibraryHandle *libraryHandle)
+{
+    if (libraryHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    // Any minor version of the same major API is compatible
+    (void)minorVersion;
+    if (majorVersion != XSTX_CLIENT_API_VERSION_MAJOR)
+    {
+        return XSTX_RESULT_NOT_INITIALIZED_PROPERLY;
+    }
+    *libraryHandle = (XStxClientLibraryHandle)&sLoopbackLibrary;
+    return XSTX_RESULT_OK;
+}
+
+XStxResult XStxClientLibraryRecycle(XStxClientLibraryHandle libraryHandle)
+{
+    return libraryHandle == (XStxClientLibraryHandle)&sLoopbackLibrary ?
+        XSTX_RESULT_OK : XSTX_RESULT_INVALID_HANDLE;
+}
+
+XStxResult XStxClientCreate(XStxClientLibraryHandle libraryHandle,
+    XStxClientHandle *clientHandle)
+{
+    if (libraryHandle != (XStxClientLibraryHandle)&sLoopbackLibrary)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    LoopbackSession *session = new(std::nothrow) LoopbackSession();
+    if (session == NULL)
+    {
+        return XSTX_RESULT_OUT_OF_MEMORY;
+    }
+    *clientHandle = session->getHandle();
+    return XSTX_RESULT_OK;
+}
+
+XStxResult XStxClientRecycle(XStxClientHandle clientHandle)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    delete LoopbackSession::fromHandle(clientHandle);
+    return XSTX_RESULT_OK;
+}
+
+XStxResult XStxClientSetListener2(XStxClientHandle clientHandle,
+    XStxIClientListener2 *listener)
+{
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->setListener(listener);
+}
+
+XStxResult XStxClientSetEntitlementUrl(XStxClientHandle clientHandle,
+    const char *url)
+{
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->setEntitlementUrl(url);
+}
+
+XStxResult XStxClientStart(XStxClientHandle clientHandle)
+{
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->start();
+}
+
+XStxResult XStxClientStop(XStxClientHandle clientHandle)
+{
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->stop();
+}
+
+XStxResult XStxClientSendInput(XStxClientHandle clientHandle,
+    const XStxInputEvent *event)
+{
+    if (event == NULL)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->sendInput(
+            (const uint8_t *)event, sizeof(*event));
+}
+
+XStxResult XStxClientSendRawInput(XStxClientHandle clientHandle,
+    const uint8_t *input, uint32_t length)
+{
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->sendInput(input, length);
+}
+
+XStxResult XStxClientSendMessage(XStxClientHandle clientHandle,
+    const unsigned char *message, uint32_t length)
+{
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE :
+        LoopbackSession::fromHandle(clientHandle)->sendMessage(message, length);
+}
+
+XStxResult XStxGetLibraryVersion(uint32_t size, XStxLibraryVersion *version)
+{
+    if (version == NULL || size < sizeof(*version))
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    memset(version, 0, sizeof(*version));
+    version->mSize = sizeof(*version);
+    version->mMajorVersion = XSTX_CLIENT_API_VERSION_MAJOR;
+    version->mMinorVersion = XSTX_CLIENT_API_VERSION_MINOR;
+    version->mBuild = LOOPBACK_BUILD;
+    return XSTX_RESULT_OK;
+}
+
+void XStxResultGetInfo(XStxResult result, const char **name,
+    const char **description)
+{
+    if (name != NULL)
+    {
+        *name = XStxResultGetName(result);
+    }
+    if (description != NULL)
+    {
+        *description = XStxResultGetDescription(result);
+    }
+}
+
+const char *XStxResultGetName(XStxResult result)
+{
+    switch (result)
+    {
+    case XSTX_RESULT_OK:
+        return "XSTX_RESULT_OK";
+    case XSTX_RESULT_INVALID_ARGUMENTS:
+        return "XSTX_RESULT_INVALID_ARGUMENTS";
+    case XSTX_RESULT_OUT_OF_MEMORY:
+        return "XSTX_RESULT_OUT_OF_MEMORY";
+    case XSTX_RESULT_INVALID_STATE:
+        return "XSTX_RESULT_INVALID_STATE";
+    case XSTX_RESULT_INVALID_HANDLE:
+        return "XSTX_RESULT_INVALID_HANDLE";
+    case XSTX_RESULT_NOT_INITIALIZED_PROPERLY:
+        return "XSTX_RESULT_NOT_INITIALIZED_PROPERLY";
+    default:
+        return "XSTX_RESULT_UNKNOWN";
+    }
+}
+
+const char *XStxStopReasonGetName(XStxStopReason reason)
+{
+    switch (reason)
+    {
+    case XSTX_STOP_REASON_REQUESTED:
+        return "XSTX_STOP_REASON_REQUESTED";
+    case XSTX_STOP_REASON_SESSION_CLOSED:
+        return "XSTX_STOP_REASON_SESSION_CLOSED";
+    case XSTX_STOP_REASON_CONNECTION_LOST:
+        return "XSTX_STOP_REASON_CONNECTION_LOST";
+    case XSTX_STOP_REASON_TCP_CONNECT_FAILED:
+        return "XSTX_STOP_REASON_TCP_CONNECT_FAILED";
+    case XSTX_STOP_REASON_SESSION_REQUEST_INVALID_ENTITLEMENT_URL:
+        return "XSTX_STOP_REASON_SESSION_REQUEST_INVALID_ENTITLEMENT_URL";
+    case XSTX_STOP_REASON_SESSION_REQUEST_FAILED:
+        return "XSTX_STOP_REASON_SESSION_REQUEST_FAILED";
+    default:
+        return "XSTX_STOP_REASON_UNKNOWN";
+    }
+}
+
+const char *XStxStopReasonGetDescription(XStxStopReason reason)
+{
+    switch (reason)
+    {
+    case XSTX_STOP_REASON_REQUESTED:
+        return "The session was stopped by the client";
+    case XSTX_STOP_REASON_SESSION_CLOSED:
+        return "The loopback server streamed the whole capture";
+    case XSTX_STOP_REASON_CONNECTION_LOST:
+        return "The loopback server went away";
+    case XSTX_STOP_REASON_TCP_CONNECT_FAILED:
+        return "Can't connect to the loopback server";
+    case XSTX_STOP_REASON_SESSION_REQUEST_INVALID_ENTITLEMENT_URL:
+        return "Not a loopback URL, or the capture can't be read";
+    case XSTX_STOP_REASON_SESSION_REQUEST_FAILED:
+        return "The client pipelines failed to start";
+    default:
+        return "Unknown stop reason";
+    }
+}
+
+const char *XStxDisconnectReasonGetName(XStxDisconnectReason /*reason*/)
+{
+    // The loopback link never reconnects
+    return "XSTX_DISCONNECT_REASON_UNKNOWN";
+}
+
+const char *XStxDisconnectReasonGetDescription(XStxDisconnectReason /*reason*/)
+{
+    return "Unknown disconnect reason";
+}
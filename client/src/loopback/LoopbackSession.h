@@ -0,0 +1,131 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_LoopbackSession_h
+#define _included_LoopbackSession_h
+
+#include <stdint.h>
+#include <string>
+
+#include "XStx/client/XStxClientAPI.h"
+
+#include "MUD/threading/SimpleLock.h"
+#include "MUD/threading/Thread.h"
+
+#include "../replay/ReplayClient.h"
+#include "LoopbackLink.h"
+#include "LoopbackServer.h"
+#include "LoopbackSocket.h"
+
+/**
+ * Client session of the loopback stand-in for the XStx library. It runs
+ * an unmodified client (AppStreamWrapper and its modules) against frames
+ * that come over a simulated link instead of the AppStream service:
+ *
+ *   loopback://<capture>   stream a StreamRecorder capture in process
+ *   unix://<socket path>   connect to AppStreamLoopbackServer
+ *
+ * Frames arrive at the pace they were recorded, pass through the
+ * LoopbackLink (latency, jitter and loss) and are decoded and rendered on
+ * the link thread, as the library does on its own threads.
+ */
+class LoopbackSession : public ReplayClient,
+                        private LoopbackLink::Sink,
+                        private LoopbackServer::Output
+{
+public:
+
+    /** Constructor */
+    LoopbackSession();
+
+    /** Destructor; stops the session and waits for its threads */
+    virtual ~LoopbackSession();
+
+    /** @return the session behind a client handle */
+    static LoopbackSession *fromHandle(XStxClientHandle handle)
+    {
+        return static_cast<LoopbackSession *>(ReplayClient::fromHandle(handle));
+    }
+
+    XStxResult setListener(const XStxIClientListener2 *listener);
+    XStxResult setEntitlementUrl(const char *url);
+
+    /** Start the session thread; returns immediately */
+    XStxResult start();
+
+    /** End the session; the listener hears XSTX_STOP_REASON_REQUESTED */
+    XStxResult stop();
+
+    /** Send an application message; the server echoes it back */
+    XStxResult sendMessage(const uint8_t *data, uint32_t size);
+
+    /** Send an input event (or raw input) to the server */
+    XStxResult sendInput(const uint8_t *data, uint32_t size);
+
+    /** Session thread body */
+    void sessionLoop();
+
+private:
+
+    DEFINE_METHOD_THREAD(SessionThread, LoopbackSession, sessionLoop);
+
+    /** How long to let frames in flight reach the client at the end */
+    static const uint32_t LINK_DRAIN_MS = 5000;
+
+    /** Stream the capture in this process */
+    XStxStopReason runCapture();
+
+    /** Receive the frames of AppStreamLoopbackServer */
+    XStxStopReason runSocket();
+
+    /** LoopbackLink::Sink */
+    virtual void deliver(LoopbackLink::Packet &packet);
+
+    /** LoopbackServer::Output, for an in-process server */
+    virtual bool sendFrame(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+                           const uint8_t *data, uint32_t size);
+
+    void deliverVideo(LoopbackLink::Packet &packet);
+    void deliverAudio(LoopbackLink::Packet &packet);
+
+    bool isStopRequested();
+
+    XStxIClientListener2 mListener;
+    std::string mCapturePath;
+    std::string mSocketPath;
+    uint32_t mWidth;
+    uint32_t mHeight;
+
+    LoopbackLink mLink;
+    LoopbackServer *mServer;
+    LoopbackSocket mSocket;
+
+    SessionThread mSessionThread;
+
+    /** Guards mServer, mStarted and mStopRequested */
+    mud::SimpleLock mLock;
+    bool mStarted;
+    bool mStopRequested;
+
+    uint64_t mVideoFrames;
+    uint64_t mVideoDropped;
+    uint64_t mAudioFrames;
+    uint64_t mAudioDropped;
+    uint64_t mMessages;
+};
+
+#endif //_included_LoopbackSession_h
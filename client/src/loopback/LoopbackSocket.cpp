@@ -0,0 +1,265 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "LoopbackSocket.h"
+#include "../StreamRecorder.h"
+
+#include "MUD/threading/ScopeLock.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#undef LOG_TAG
+#define LOG_TAG "LoopbackSocket"
+#include "log.h"
+
+/** Largest payload accepted before the connection is treated as corrupt */
+static const uint32_t MAX_RECORD_SIZE = 16 * 1024 * 1024;
+
+static bool fillAddress(const char *path, struct sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        LOGE("Socket path too long: %s", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+    return true;
+}
+
+LoopbackSocket::LoopbackSocket()
+    : mFd(-1)
+{
+}
+
+LoopbackSocket::~LoopbackSocket()
+{
+    close();
+}
+
+bool LoopbackSocket::listen(const char *path)
+{
+    struct sockaddr_un address;
+    if (!fillAddress(path, address))
+    {
+        return false;
+    }
+
+    mFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mFd < 0)
+    {
+        LOGE("socket() failed: %s", strerror(errno));
+        return false;
+    }
+    unlink(path);
+    if (bind(mFd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        ::listen(mFd, 1) != 0)
+    {
+        LOGE("Can't listen on %s: %s", path, strerror(errno));
+        close();
+        return false;
+    }
+    mListenPath = path;
+    return true;
+}
+
+bool LoopbackSocket::accept(LoopbackSocket &connection)
+{
+    int fd = ::accept(mFd, NULL, NULL);
+    if (fd < 0)
+    {
+        LOGE("accept() failed: %s", strerror(errno));
+        return false;
+    }
+    connection.close();
+    connection.mFd = fd;
+    return true;
+}
+
+bool LoopbackSocket::connect(const char *path)
+{
+    struct sockaddr_un address;
+    if (!fillAddress(path, address))
+    {
+        return false;
+    }
+
+    mFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mFd < 0)
+    {
+        LOGE("socket() failed: %s", strerror(errno));
+        return false;
+    }
+    if (::connect(mFd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        LOGE("Can't connect to %s: %s", path, strerror(errno));
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool LoopbackSocket::sendRecord(uint8_t stream, uint8_t flags,
+                                uint64_t timestampUs,
+                                const uint8_t *data, uint32_t size)
+{
+    uint8_t header[StreamRecorder::RECORD_HEADER_SIZE];
+    header[0] = stream;
+    header[1] = flags;
+    header[2] = 0;
+    header[3] = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        header[4 + i] = (uint8_t)(size >> (8 * i));
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        header[8 + i] = (uint8_t)(timestampUs >> (8 * i));
+    }
+
+    struct iovec parts[2];
+    parts[0].iov_base = header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = (void *)data;
+    parts[1].iov_len = size;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = size > 0 ? 2 : 1;
+
+    mud::ScopeLock sl(mSendLock);
+    size_t remaining = sizeof(header) + size;
+    while (remaining > 0)
+    {
+        // MSG_NOSIGNAL: a vanished peer is an error, not SIGPIPE
+        ssize_t sent = sendmsg(mFd, &message, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        remaining -= sent;
+
+        // skip what went out
+        while (sent > 0 && message.msg_iovlen > 0)
+        {
+            size_t step = (size_t)sent < message.msg_iov->iov_len ?
+                (size_t)sent : message.msg_iov->iov_len;
+            message.msg_iov->iov_base = (uint8_t *)message.msg_iov->iov_base + step;
+            message.msg_iov->iov_len -= step;
+            sent -= step;
+            if (message.msg_iov->iov_len == 0)
+            {
+                message.msg_iov++;
+                message.msg_iovlen--;
+            }
+        }
+    }
+    return true;
+}
+
+bool LoopbackSocket::receiveRecord(LoopbackLink::Packet &packet)
+{
+    uint8_t header[StreamRecorder::RECORD_HEADER_SIZE];
+    if (!readBytes(header, sizeof(header)))
+    {
+        return false;
+    }
+
+    uint32_t size = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        size |= (uint32_t)header[4 + i] << (8 * i);
+    }
+    uint64_t timestampUs = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        timestampUs |= (uint64_t)header[8 + i] << (8 * i);
+    }
+    if (size > MAX_RECORD_SIZE)
+    {
+        LOGE("Oversized record (%u bytes); dropping the connection", size);
+        return false;
+    }
+
+    packet.mStream = header[0];
+    packet.mFlags = header[1];
+    packet.mTimestampUs = timestampUs;
+    packet.mData.resize(size);
+    return size == 0 || readBytes(&packet.mData[0], size);
+}
+
+bool LoopbackSocket::waitReadable(uint32_t timeoutMs)
+{
+    struct pollfd pfd;
+    pfd.fd = mFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, (int)timeoutMs) > 0;
+}
+
+bool LoopbackSocket::readBytes(uint8_t *data, uint32_t size)
+{
+    while (size > 0)
+    {
+        ssize_t received = recv(mFd, data, size, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return false;
+        }
+        data += received;
+        size -= (uint32_t)received;
+    }
+    return true;
+}
+
+void LoopbackSocket::shutdown()
+{
+    if (mFd >= 0)
+    {
+        ::shutdown(mFd, SHUT_RDWR);
+    }
+}
+
+void LoopbackSocket::close()
+{
+    if (mFd >= 0)
+    {
+        ::close(mFd);
+        mFd = -1;
+    }
+    if (!mListenPath.empty())
+    {
+        unlink(mListenPath.c_str());
+        mListenPath.clear();
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_LoopbackSocket_h
+#define _included_LoopbackSocket_h
+
+#include <stdint.h>
+#include <string>
+
+#include "MUD/threading/SimpleLock.h"
+
+#include "LoopbackLink.h"
+
+/**
+ * Unix domain socket between the loopback server and client. Frames are
+ * sent as StreamRecorder records: a 16 byte header (stream, flags, size,
+ * timestamp) followed by the payload.
+ */
+class LoopbackSocket
+{
+public:
+
+    /** Stream value of an application message, sent either way */
+    static const uint8_t STREAM_MESSAGE = 2;
+
+    /** Stream value of an input event, sent to the server */
+    static const uint8_t STREAM_INPUT = 3;
+
+    /** Stream value the server sends after the last frame */
+    static const uint8_t STREAM_END = 0xff;
+
+    /** Constructor */
+    LoopbackSocket();
+
+    /** Destructor; closes the socket */
+    ~LoopbackSocket();
+
+    /**
+     * Listen on a socket path, replacing a stale socket file.
+     * @return true on success
+     */
+    bool listen(const char *path);
+
+    /**
+     * Wait for a client to connect to a listening socket.
+     *
+     * @param[out] connection socket of the accepted client
+     * @return true on success
+     */
+    bool accept(LoopbackSocket &connection);
+
+    /**
+     * Connect to a loopback server.
+     * @return true on success
+     */
+    bool connect(const char *path);
+
+    /**
+     * Send one record. Safe to call from several threads.
+     * @return false if the peer has gone away
+     */
+    bool sendRecord(uint8_t stream, uint8_t flags, uint64_t timestampUs,
+                    const uint8_t *data, uint32_t size);
+
+    /**
+     * Block until a record arrives.
+     * @return false if the peer closed the connection or shutdown() was called
+     */
+    bool receiveRecord(LoopbackLink::Packet &packet);
+
+    /**
+     * @return true if a record (or the end of the connection) can be
+     *     received without blocking for longer than timeoutMs
+     */
+    bool waitReadable(uint32_t timeoutMs);
+
+    /** Wake up a thread blocked in receiveRecord() */
+    void shutdown();
+
+    /** Close the socket */
+    void close();
+
+private:
+
+    bool readBytes(uint8_t *data, uint32_t size);
+
+    int mFd;
+    /** Path to remove when a listening socket closes */
+    std::string mListenPath;
+    mud::SimpleLock mSendLock;
+};
+
+#endif //_included_LoopbackSocket_h
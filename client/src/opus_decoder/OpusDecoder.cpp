@@ -19,14 +19,33 @@
 #include <assert.h>
 #include <new>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "OpusDecoder.h"
+#include "MUD/base/TimeVal.h"
+
+#undef LOG_TAG
+#define LOG_TAG "OpusDecoder"
+#include "log.h"
 
 /** Constructor */
 OpusDecoder::OpusDecoder()
     :
-      mOpusDecoderContext(NULL)
+      mOpusDecoderContext(NULL),
+      mFec(true),
+      mDeferredFrames(0),
+      mDeferredTimestampUs(0),
+      mDecodedFrames(0),
+      mRecoveredFrames(0),
+      mConcealedFrames(0),
+      mConcealCalls(0)
 {
+    const char *value = getenv("XSTX_AUDIO_FEC");
+    if (value != NULL && strcmp(value, "0") == 0)
+    {
+        mFec = false;
+    }
 }
 
 /** Destructor */
@@ -52,6 +71,7 @@ XStxResult OpusDecoder::start()
         // failed to instantiate decoder
         return XSTX_RESULT_OUT_OF_MEMORY;
     }
+    mDeferredFrames = 0;
     return XSTX_RESULT_OK;
 }
 
@@ -80,26 +100,199 @@ XStxResult OpusDecoder::decodeFrame(
         return XSTX_RESULT_NOT_INITIALIZED_PROPERLY;
     }
 
-    // decode
-    int numSamples = opus_decode(
-        mOpusDecoderContext,
-        in->mData,
-        in->mDataSize,
-        (opus_int16 *)out->mData,
-        SAMPLES_PER_FRAME,
-        0);
+    // Frames the output buffer can take; deferring a loss needs room for
+    // the deferred frames and the next one
+    uint32_t capacityFrames = out->mBufferSize / BYTES_PER_FRAME;
+    uint32_t maxDeferredFrames = capacityFrames > 1 ? capacityFrames - 1 : 0;
+    if (maxDeferredFrames > MAX_DEFERRED_FRAMES)
+    {
+        maxDeferredFrames = MAX_DEFERRED_FRAMES;
+    }
+
+    int16_t *pcm = (int16_t *)out->mData;
+    uint32_t numFrames = 0;
 
-    if (numSamples <= 0)
+    if (in->mData == NULL)
     {
-        // decoding failed
-        return XSTX_RESULT_AUDIO_DECODING_ERROR;
+        if (mDeferredFrames == 0)
+        {
+            mDeferredTimestampUs = in->mTimestampUs;
+        }
+        if (mFec && mDeferredFrames < maxDeferredFrames)
+        {
+            // Wait for the next packet; it may be able to rebuild this one
+            mDeferredFrames++;
+            out->mTimestampUs = in->mTimestampUs;
+            out->mDataSize = 0;
+            return XSTX_RESULT_OK;
+        }
+
+        // Out of room: conceal the deferred frames and this one at once
+        numFrames = mDeferredFrames + 1;
+        mDeferredFrames = 0;
+        if (!conceal(pcm, numFrames))
+        {
+            return XSTX_RESULT_AUDIO_DECODING_ERROR;
+        }
+        out->mTimestampUs = mDeferredTimestampUs;
+        out->mDataSize = numFrames * BYTES_PER_FRAME;
     }
+    else
+    {
+        uint64_t timestampUs = in->mTimestampUs;
+        if (mDeferredFrames > 0)
+        {
+            // Only the frame right before this packet can be rebuilt from
+            // it; conceal the others in one call
+            bool fec = hasFec(in->mData, in->mDataSize);
+            uint32_t numConcealed = fec ? mDeferredFrames - 1 : mDeferredFrames;
+            if (numConcealed > 0 && !conceal(pcm, numConcealed))
+            {
+                mDeferredFrames = 0;
+                return XSTX_RESULT_AUDIO_DECODING_ERROR;
+            }
+            numFrames = numConcealed;
 
-    // successfully decoded
-    out->mTimestampUs = in->mTimestampUs;
-    out->mDataSize = numSamples * NUM_CHANNELS * (16 / 8);
+            if (fec)
+            {
+                uint64_t startUs = mud::TimeVal::mono().toMicroSeconds();
+                int numSamples = opus_decode(
+                    mOpusDecoderContext,
+                    in->mData,
+                    in->mDataSize,
+                    (opus_int16 *)pcm + numFrames * SAMPLES_PER_FRAME * NUM_CHANNELS,
+                    SAMPLES_PER_FRAME,
+                    1);
+                mRecoverTimeUs.add((double)(mud::TimeVal::mono().toMicroSeconds()
+                                            - startUs));
+                if (numSamples <= 0)
+                {
+                    mDeferredFrames = 0;
+                    return XSTX_RESULT_AUDIO_DECODING_ERROR;
+                }
+                mRecoveredFrames++;
+                numFrames++;
+            }
+
+            timestampUs = mDeferredTimestampUs;
+            mDeferredFrames = 0;
+        }
 
+        // decode
+        uint64_t startUs = mud::TimeVal::mono().toMicroSeconds();
+        int numSamples = opus_decode(
+            mOpusDecoderContext,
+            in->mData,
+            in->mDataSize,
+            (opus_int16 *)pcm + numFrames * SAMPLES_PER_FRAME * NUM_CHANNELS,
+            (out->mBufferSize / (NUM_CHANNELS * 2))
+                - numFrames * SAMPLES_PER_FRAME,
+            0);
+        mDecodeTimeUs.add((double)(mud::TimeVal::mono().toMicroSeconds()
+                                   - startUs));
+
+        if (numSamples <= 0)
+        {
+            // decoding failed
+            return XSTX_RESULT_AUDIO_DECODING_ERROR;
+        }
+        mDecodedFrames++;
+
+        out->mTimestampUs = timestampUs;
+        out->mDataSize = (numFrames * SAMPLES_PER_FRAME + numSamples)
+                         * NUM_CHANNELS * (16 / 8);
+    }
+
+    if (mDecodedFrames + mRecoveredFrames + mConcealedFrames
+            >= STATS_INTERVAL_FRAMES)
+    {
+        logStats();
+    }
+
+    // successfully decoded
     return XSTX_RESULT_OK;
 }
 
+/**
+ * Check an Opus packet for FEC data
+ */
+bool OpusDecoder::hasFec(const uint8_t *data, uint32_t size)
+{
+    const unsigned char *frames[48];
+    opus_int16 sizes[48];
+    unsigned char toc = 0;
+    if (opus_packet_parse(data, size, &toc, frames, sizes, NULL) <= 0 ||
+        sizes[0] == 0)
+    {
+        return false;
+    }
+
+    // CELT-only packets (configurations 16 to 31) carry no FEC
+    uint32_t config = toc >> 3;
+    if (config >= 16)
+    {
+        return false;
+    }
+
+    // SILK frames last 10, 20, 40 or 60 ms, hybrid ones 10 or 20 ms
+    static const uint32_t SILK_FRAME_MS[4] = { 10, 20, 40, 60 };
+    uint32_t frameMs = config < 12 ? SILK_FRAME_MS[config & 3] :
+                                     ((config & 1) ? 20 : 10);
+
+    // The SILK layer opens with one VAD flag per 20 ms subframe and then
+    // the LBRR (FEC) flag, per channel. They are coded with even odds, so
+    // they are the leading bits of the first frame's first byte.
+    uint32_t numSilkFrames = frameMs > 20 ? frameMs / 20 : 1;
+    bool lbrr = ((frames[0][0] >> (7 - numSilkFrames)) & 1) != 0;
+    if (toc & 0x4)
+    {
+        lbrr = lbrr || ((frames[0][0] >> (6 - 2 * numSilkFrames)) & 1) != 0;
+    }
+    return lbrr;
+}
+
+/**
+ * Conceal frames with one PLC call
+ */
+bool OpusDecoder::conceal(int16_t *pcm, uint32_t numFrames)
+{
+    uint64_t startUs = mud::TimeVal::mono().toMicroSeconds();
+    int numSamples = opus_decode(
+        mOpusDecoderContext,
+        NULL,
+        0,
+        (opus_int16 *)pcm,
+        numFrames * SAMPLES_PER_FRAME,
+        0);
+    mConcealTimeUs.add((double)(mud::TimeVal::mono().toMicroSeconds()
+                                - startUs));
+    mConcealCalls++;
+
+    if (numSamples != (int)(numFrames * SAMPLES_PER_FRAME))
+    {
+        return false;
+    }
+    mConcealedFrames += numFrames;
+    return true;
+}
+
+/**
+ * Log the frame counts and decode times
+ */
+void OpusDecoder::logStats()
+{
+    LOGV("[opus]={ \"Fec\":%d, \"Decoded\":%u, \"Recovered\":%u, "
+         "\"Concealed\":%u, \"ConcealCalls\":%u, \"DecodeUs\":%.1f, "
+         "\"RecoverUs\":%.1f, \"ConcealUs\":%.1f, \"MaxDecodeUs\":%.1f }",
+         mFec ? 1 : 0, mDecodedFrames, mRecoveredFrames, mConcealedFrames,
+         mConcealCalls, mDecodeTimeUs.mean(), mRecoverTimeUs.mean(),
+         mConcealTimeUs.mean(), mDecodeTimeUs.maximum());
 
+    mDecodedFrames = 0;
+    mRecoveredFrames = 0;
+    mConcealedFrames = 0;
+    mConcealCalls = 0;
+    mDecodeTimeUs.reset();
+    mRecoverTimeUs.reset();
+    mConcealTimeUs.reset();
+}
@@ -28,10 +28,22 @@ extern "C"
 };
 
 #include "XStx/common/XStxAPI.h"
+#include "RunningStats.h"
 
 /**
  * The Audio Decoder implementation using Opus; decodes Opus samples into
  * PCM samples.
+ *
+ * A lost packet is not concealed straight away. The decoder returns an
+ * empty frame and waits for the next packet: if that packet carries
+ * in-band forward error correction (FEC) data, the lost frame is rebuilt
+ * from it with decode_fec=1, and the rebuilt frame and the new one are
+ * returned together. Consecutive losses are concealed with a single PLC
+ * call once the next packet arrives or the output buffer is full.
+ * Returning several frames at once needs frame buffers that can hold them;
+ * with buffers for a single frame, every loss is concealed as it comes.
+ *
+ * Set XSTX_AUDIO_FEC to 0 to conceal every loss straight away.
  */
 class OpusDecoder : public AudioDecoder
 {
@@ -55,13 +67,59 @@ public:
     virtual XStxResult decodeFrame(XStxEncodedAudioFrame *in, XStxRawAudioFrame *out);
 
 private:
+
+    /**
+     * @return true if an Opus packet carries FEC data for the frame before
+     *     it
+     */
+    static bool hasFec(const uint8_t *data, uint32_t size);
+
+    /**
+     * Conceal frames with a single PLC call.
+     *
+     * @param[out] pcm where to write the concealed frames
+     * @param[in] numFrames number of frames to conceal
+     * @return false if decoding failed
+     */
+    bool conceal(int16_t *pcm, uint32_t numFrames);
+
+    /**
+     * Log the frame counts and decode times, then reset them.
+     */
+    void logStats();
+
     /** opus decoder context for decoding audio */
     OpusDecoder *mOpusDecoderContext;
 
+    /** Whether lost frames wait for the next packet's FEC data */
+    bool mFec;
+
+    /** Lost frames waiting for the next packet */
+    uint32_t mDeferredFrames;
+    uint64_t mDeferredTimestampUs;
+
+    /** Frames since the last logStats() */
+    uint32_t mDecodedFrames;
+    uint32_t mRecoveredFrames;
+    uint32_t mConcealedFrames;
+    uint32_t mConcealCalls;
+
+    /** Time spent in the decoder, in microseconds per call */
+    RunningStats mDecodeTimeUs;
+    RunningStats mRecoverTimeUs;
+    RunningStats mConcealTimeUs;
+
     // constants as defined by headers in XStxClientAPI.h:DecodeAudioFrame
     static const uint32_t NUM_CHANNELS = 2;
     static const uint32_t SAMPLING_RATE = 48000;
     static const uint32_t SAMPLES_PER_FRAME = 480;
+    static const uint32_t BYTES_PER_FRAME = SAMPLES_PER_FRAME * NUM_CHANNELS * 2;
+
+    /** Most lost frames held back waiting for FEC data */
+    static const uint32_t MAX_DEFERRED_FRAMES = 3;
+
+    /** How often (in frames) the statistics are logged */
+    static const uint32_t STATS_INTERVAL_FRAMES = 500;
 };
 
 
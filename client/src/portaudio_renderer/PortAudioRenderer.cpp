@@ -17,6 +17,9 @@
 
 #include "PortAudioRenderer.h"
 
+#include <new>
+#include <stdlib.h>
+
 #undef LOG_TAG
 #define LOG_TAG "AudioRenderer"
 
@@ -31,19 +34,27 @@ PortAudioRenderer::PortAudioRenderer(
                         XStxClientHandle clientHandle) 
                             : AudioRenderer(framePool, clientHandle),
                               mPortAudioStream(NULL),
-                              mTimeoutMarginInMs(INITIAL_TIMEOUT_MARGIN_MS),
-                              mAudioIsPlaying(false),
-                              mFrame(NULL),
-                              mPlaybackPosInFrame(0),
                               mDidInit(false),
-                              mShouldStop(false)
+                              mAudioIsPlaying(false),
+                              mFeeder(*this),
+                              mFeedThread(NULL),
+                              mShouldStop(false),
+                              mDeviceRate(SAMPLING_RATE),
+                              mDeviceChannels(NUM_CHANNELS),
+                              mResamplerQuality(AudioResampler::QUALITY_MEDIUM)
 {
+    mFeeder.setOutputLatencyUs(SUGGESTED_PA_LATENCY_MS * 1000);
+    mResamplerQuality = AudioResampler::qualityFromString(
+        getenv("XSTX_AUDIO_RESAMPLER_QUALITY"), AudioResampler::QUALITY_MEDIUM);
 }
 
 
 /** Destructor */
 PortAudioRenderer::~PortAudioRenderer()
 {
+    mShouldStop = true;
+    stopFeeder();
+
     // If we've got a portAudioStream, Pa_Initialize has succeeded,
     // and Pa_OpenStream has succeeded. We need to close the stream,
     // and call Pa_Terminate to clean up. If portAudioStream is NULL,
@@ -74,11 +85,7 @@ XStxRawAudioFrame* PortAudioRenderer::popFrame(int delay, int msBuffer)
 {
     XStxRawAudioFrame * frame = NULL;
 
-    XStxResult result = XStxGetNextAudioFrame(
-                                    mClientHandle, 
-                                    &frame, 
-                                    delay, 
-                                    msBuffer);
+    XStxResult result = getNextFrame(&frame, delay, msBuffer);
 
     if (result != XSTX_RESULT_OK)
     {
@@ -102,15 +109,40 @@ XStxResult PortAudioRenderer::start()
         {
             return XSTX_RESULT_NOT_INITIALIZED_PROPERLY;
         }
+        if (!allocateBuffers())
+        {
+            LOGW("Failed to set up audio conversion to %u Hz, %u channels",
+                 mDeviceRate, mDeviceChannels);
+            Pa_CloseStream(mPortAudioStream);
+            mPortAudioStream = NULL;
+            Pa_Terminate();
+            return XSTX_RESULT_OUT_OF_MEMORY;
+        }
         mDidInit = true;
     }
 
     if (!mAudioIsPlaying)  
     {
+        // Neither the feeder nor the callback is running, so the ring can
+        // be emptied of whatever was left from before a stop().
+        mFeeder.reset();
+        mShouldStop = false;
+
+        mFeedThread = new(std::nothrow) FeedThread("PortAudioFeed", *this);
+        if (mFeedThread == NULL || mFeedThread->start() != SIMPLE_RESULT_OK)
+        {
+            LOGW("Failed to start the audio feeder thread");
+            delete mFeedThread;
+            mFeedThread = NULL;
+            return XSTX_RESULT_AUDIO_RENDERING_ERROR;
+        }
+
         PaError err = Pa_StartStream(mPortAudioStream);
         if(paNoError != err) 
         {
             LOGW("Failed to start port audio stream");
+            mShouldStop = true;
+            stopFeeder();
             return XSTX_RESULT_AUDIO_RENDERING_ERROR;
         }
         mAudioIsPlaying = true;
@@ -133,12 +165,27 @@ void PortAudioRenderer::pause(bool pause)
  */
 void PortAudioRenderer::stop()
 {
-    mud::ScopeLock sl(mStopLock);
     mShouldStop = true;
     if (mPortAudioStream != NULL) 
     {
         Pa_StopStream(mPortAudioStream);
     }
+    stopFeeder();
+    mAudioIsPlaying = false;
+}
+
+/**
+ * Stop and delete the feeder thread.
+ */
+void PortAudioRenderer::stopFeeder()
+{
+    if (mFeedThread == NULL)
+    {
+        return;
+    }
+    mFeedThread->join();
+    delete mFeedThread;
+    mFeedThread = NULL;
 }
 
 /**
@@ -164,16 +211,17 @@ bool PortAudioRenderer::initializePortAudio()
     paStreamParams.suggestedLatency = (double) SUGGESTED_PA_LATENCY_MS 
                                                 / 1000; // in seconds.
     paStreamParams.hostApiSpecificStreamInfo = NULL;
+    chooseDeviceFormat(paStreamParams);
 
     // open PortAudio stream with configured parameters
     err = Pa_OpenStream(
                 &mPortAudioStream,
                 NULL,
                 &paStreamParams,
-                SAMPLING_RATE,
+                mDeviceRate,
                     // we want PortAudio to give us Buffers of the right size, 
                     // otherwise we will be more likely to hear glitches.
-                (SAMPLING_RATE * NUM_MS_PER_FRAME) / 1000,
+                (mDeviceRate * NUM_MS_PER_FRAME) / 1000,
                 paClipOff,
                 paStreamCallback,
                 this);
@@ -186,92 +234,91 @@ bool PortAudioRenderer::initializePortAudio()
         return false;
     }
 
+    const PaStreamInfo *info = Pa_GetStreamInfo(mPortAudioStream);
+    if (info != NULL && info->outputLatency > 0.0)
+    {
+        mFeeder.setOutputLatencyUs((uint64_t)(info->outputLatency * 1000000.0));
+    }
+
     // successfully initialized PortAudio stream
     return true;
 
 }
 
 /**
- * The fillPABuffer method
+ * Pick the device format.
  */
-bool PortAudioRenderer::fillPABuffer(
-                            int16_t* buffer, 
-                            int numSamplesPerChannel,
-                            const PaStreamCallbackTimeInfo* timeInfo)
+void PortAudioRenderer::chooseDeviceFormat(PaStreamParameters &params)
 {
-    mud::ScopeLock sl(mStopLock);
-    if (mShouldStop) {
-        return false;
-    }
-
-    uint32_t  initialTimeUntilDeadlineInMs = static_cast<uint32_t>((timeInfo->outputBufferDacTime 
-                                                                        - timeInfo->currentTime) * 1000.0);
-
-    mud::TimeVal timeWaited = mud::TimeVal::mono();
-    
-    // Loop until we've written out all the samples that are requested, or
-    // until we've run out of sample received from the decoder.
+    mDeviceRate = SAMPLING_RATE;
+    mDeviceChannels = NUM_CHANNELS;
 
-    uint32_t numSamplesRequested = numSamplesPerChannel * NUM_CHANNELS;
-    uint32_t numSamplesWritten = 0;
-
-    while((numSamplesWritten < numSamplesRequested))
+    const char *rate = getenv("XSTX_AUDIO_DEVICE_RATE");
+    const char *channels = getenv("XSTX_AUDIO_DEVICE_CHANNELS");
+    if (rate != NULL || channels != NULL)
     {
-        mud::TimeVal timeRemaining =  
-            mud::TimeVal::fromMilliSeconds(initialTimeUntilDeadlineInMs) - 
-            timeWaited.elapsedMono();
-        uint32_t timeout = 0;
-        if(timeRemaining.toMilliSeconds() > mTimeoutMarginInMs)
+        if (rate != NULL && atoi(rate) > 0)
         {
-            timeout = (uint32_t)(timeRemaining.toMilliSeconds()) - mTimeoutMarginInMs;
+            mDeviceRate = (uint32_t)atoi(rate);
         }
-
-        if(mFrame == NULL) 
+        if (channels != NULL && atoi(channels) > 0 &&
+            atoi(channels) <= (int)AudioChannelMixer::MAX_CHANNELS)
         {
-            mFrame = popFrame(
-                static_cast<uint32_t>(timeRemaining.toMilliSeconds()), 
-                timeout);
+            mDeviceChannels = (uint32_t)atoi(channels);
+        }
+        params.channelCount = mDeviceChannels;
+        return;
+    }
 
-            if (mFrame == NULL)
-            {
-                return false;
-            }
+    const PaDeviceInfo *info = Pa_GetDeviceInfo(params.device);
+    if (info == NULL)
+    {
+        return;
+    }
+    if (info->maxOutputChannels > 0 &&
+        info->maxOutputChannels < (int)NUM_CHANNELS)
+    {
+        mDeviceChannels = (uint32_t)info->maxOutputChannels;
+        params.channelCount = mDeviceChannels;
+    }
+    if (Pa_IsFormatSupported(NULL, &params, SAMPLING_RATE) != paFormatIsSupported &&
+        info->defaultSampleRate > 0.0)
+    {
+        mDeviceRate = (uint32_t)(info->defaultSampleRate + 0.5);
+    }
+}
 
-            mPlaybackPosInFrame = 0;
-        }
+/**
+ * Set up the feeder's converter and ring for the device format.
+ */
+bool PortAudioRenderer::allocateBuffers()
+{
+    mFeeder.setJitterBuffer(mJitterBuffer);
+    mFeeder.setSyncClock(mSyncClock);
+    return mFeeder.init(mDeviceRate, mDeviceChannels, mResamplerQuality);
+}
 
-        if(mPlaybackPosInFrame >= mFrame->mDataSize)
-        {
-            // nothing left in this frame that we can read from
-            mPlaybackPosInFrame = 0;
-            mFramePool.recycleElement(mFrame);
-            mFrame = NULL;
-            continue;
-        }
-        
-        uint32_t maxSamplesInFrame = (mFrame->mDataSize - mPlaybackPosInFrame) /
-            BYTES_PER_SAMPLE;
-        uint32_t maxSamplesCanWrite = numSamplesRequested - numSamplesWritten;
-        uint32_t numSamplesToTake = maxSamplesInFrame > maxSamplesCanWrite ?
-            maxSamplesCanWrite : maxSamplesInFrame;
-
-        memcpy(
-            (void*)buffer,
-            (void*)((mFrame)->mData +
-                mPlaybackPosInFrame),
-            numSamplesToTake * BYTES_PER_SAMPLE);
-       
-        buffer += numSamplesToTake;
-        mPlaybackPosInFrame += numSamplesToTake * BYTES_PER_SAMPLE;
-        numSamplesWritten += numSamplesToTake;
-        if(mPlaybackPosInFrame >= mFrame->mDataSize) 
-        {
-            mFramePool.recycleElement(mFrame);
-            mFrame=NULL;
-            mPlaybackPosInFrame = 0;
-        }
+/**
+ * Feeder thread body.
+ */
+void PortAudioRenderer::feedLoop()
+{
+    while (!mShouldStop)
+    {
+        mFeeder.feed();
+    }
+}
+
+/**
+ * The fillPABuffer method
+ */
+bool PortAudioRenderer::fillPABuffer(int16_t* buffer, int numSamplesPerChannel)
+{
+    if (mShouldStop) {
+        return false;
     }
 
+    mFeeder.fill(buffer, (uint32_t)numSamplesPerChannel);
     return true;
 }
 
@@ -288,7 +335,7 @@ int PortAudioRenderer::paStreamCallback(
 
     int16_t* out = (int16_t*) outputBuffer;
 
-    if (renderer->fillPABuffer(out, framesPerBuffer, timeInfo))
+    if (renderer->fillPABuffer(out, framesPerBuffer))
     {
         return paContinue;
     }
@@ -23,7 +23,7 @@
 
 
 #include <MUD/memory/FixedSizePool.h>
-#include "MUD/memory/ThreadsafeQueue.h"
+#include "MUD/threading/Thread.h"
 
 #include <portaudio.h>
 
@@ -31,9 +31,23 @@
 #include <XStx/client/XStxClientAPI.h>
 
 #include "AudioRenderer.h"
+#include "AudioRingFeeder.h"
 
 /**
  * The PortAudio based audio renderer.
+ *
+ * A feeder thread pulls decoded frames from the SDK and copies their PCM
+ * samples into a wait-free ring, and the PortAudio callback, which runs in
+ * the real-time audio thread, only copies samples out of it; the
+ * AudioRingFeeder does both halves.
+ *
+ * The device is opened at 48 kHz stereo if it supports that; otherwise at
+ * its default sample rate and at most two channels, and the feeder
+ * converts the decoded audio with AudioFormatConverter on its way into the
+ * ring. Options are read from the environment when the stream is opened:
+ *  - XSTX_AUDIO_DEVICE_RATE, XSTX_AUDIO_DEVICE_CHANNELS: open the device
+ *    in this format instead.
+ *  - XSTX_AUDIO_RESAMPLER_QUALITY: "low", "medium" (default) or "high".
  */
 class PortAudioRenderer : public AudioRenderer
 {
@@ -84,28 +98,45 @@ protected:
     bool initializePortAudio();
 
     /**
-     * The fillPABuffer method writes PCM samples to the buffer provided
-     * by PortAudio. PortAudio specifies how many samples it wants. If
-     * that number is not available, fillPABuffer writes zeros. If a
-     * number of zeros were written to the portaudio callback's output
-     * buffer in an earlier fillPABuffer call, it needs to drop that many
-     * samples when they become available to prevent the injected zeros
-     * from adding latency. We should report dropped audio as a real-time
-     * metric, though, and potentially grow latency if we need to by not
-     * dropping the samples.
+     * Pick the format the device is opened in: 48 kHz stereo when the
+     * device supports it, else its own default rate and channel count,
+     * unless overridden from the environment. Sets mDeviceRate and
+     * mDeviceChannels.
+     */
+    void chooseDeviceFormat(PaStreamParameters &params);
+
+    /**
+     * Set up the feeder's converter and ring for the device format.
+     *
+     * @return false if memory ran out or the conversion is not supported.
+     */
+    bool allocateBuffers();
+
+    /**
+     * Copy PCM samples from the ring to the buffer provided by PortAudio,
+     * which holds mDeviceChannels interleaved channels. Called from the
+     * real-time audio thread, so it must never block.
+     *
+     * @see AudioRingFeeder::fill
+     *
+     * @return false once the renderer is stopping.
+     */
+    bool fillPABuffer(int16_t* buff, int numSamplesPerChannel);
+
+    /**
+     * Feeder thread body. Keeps the ring topped up with frames from the SDK
+     * until the renderer is stopped.
      *
-     * This function first drops any PCM samples that are arriving late
-     * and have already been replaced with zeros. Then it fills the
-     * callback's output buffer with as many requested samples as are
-     * available. If the number of samples requested is more than the
-     * number available, zeros are written.  The method keeps track of how
-     * many zeros are written so that number can be dropped when they
-     * become available.
+     * @see AudioRingFeeder::feed
+     */
+    void feedLoop();
+
+    /**
+     * Stop and delete the feeder thread.
      */
-    bool fillPABuffer(
-        int16_t* buff, 
-        int numSamplesPerChannel,
-        const PaStreamCallbackTimeInfo* timeInfo); 
+    void stopFeeder();
+
+    DEFINE_METHOD_THREAD(FeedThread, PortAudioRenderer, feedLoop);
 
     /** PortAudio callback */
     static int paStreamCallback(
@@ -127,32 +158,23 @@ protected:
 
     static const int SUGGESTED_PA_LATENCY_MS = 40; // in ms.
 
-    // These values set a time margin between the time that the portaudio renderer
-    // needs a frame and the time we allow the SDK to wait for the next packet
-    // to arrive. For instance, if we set the mTimeoutMarginInMs to 15, it means
-    // that if the portaudio renderer tells us that it needs the next frame 
-    // within 40 ms, we'll allow the SDK to wait for at most 25 ms before it 
-    // treats the a packet as late and returns a pakcet loss concealment frame.
-    // On the one hand we'd like to set this margin as low as possible to
-    // give rtp packets time to arrive before we insert concealment.  On the other,
-    // we need to provide this margin because we find empirically that if we 
-    // don't portaudio doesn't write to the driver in time and we hear ugly
-    // audio discontinuities. 
-    static const uint32_t INITIAL_TIMEOUT_MARGIN_MS = 15;
-    uint32_t mTimeoutMarginInMs;
-     
     // constants as defined by headers in XStxClientAPI.h:RenderAudioFrame
-    static const uint32_t NUM_CHANNELS = 2;
-    static const uint32_t SAMPLING_RATE = 48000;
-    static const uint32_t NUM_MS_PER_FRAME = 10;
-    static const int BYTES_PER_SAMPLE = 2; // 16 bit samples
+    static const uint32_t NUM_CHANNELS = AudioRingFeeder::NUM_CHANNELS;
+    static const uint32_t SAMPLING_RATE = AudioRingFeeder::SAMPLING_RATE;
+    static const uint32_t NUM_MS_PER_FRAME = AudioRingFeeder::NUM_MS_PER_FRAME;
 
-    XStxRawAudioFrame *mFrame;
     bool mAudioIsPlaying;
-    uint32_t mPlaybackPosInFrame;
 
-    mud::SimpleLock mStopLock;
-    bool mShouldStop;
+    /** Moves frames from the SDK through the ring to the callback */
+    AudioRingFeeder mFeeder;
+    FeedThread *mFeedThread;
+    volatile bool mShouldStop;
+
+    /** Format the device was opened in; the ring holds samples in it */
+    uint32_t mDeviceRate;
+    uint32_t mDeviceChannels;
+
+    AudioResampler::EQuality mResamplerQuality;
 };
 
 #endif //_included_PortAudioRenderer_h
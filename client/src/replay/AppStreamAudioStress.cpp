@@ -0,0 +1,152 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AudioStressHarness.h"
+
+#undef LOG_TAG
+#define LOG_TAG "AppStreamAudioStress"
+#include "log.h"
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Drives AudioModule's allocator and decoder callbacks and a\n"
+           "renderer fill routine from a simulated device callback, under\n"
+           "CPU load and lock contention, and reports how often the\n"
+           "callback missed its deadline or ran out of audio.\n"
+           "\n"
+           "  -m <mode>   fill strategy: \"ring\" (default; PortAudioRenderer's\n"
+           "              feeder, jitter buffer, converter and wait-free ring)\n"
+           "              or \"pull\" (wait for the SDK inside the callback)\n"
+           "  -r <hz>     ring mode device sample rate (default 48000)\n"
+           "  -n <n>      ring mode device channels (default 2)\n"
+           "  -t <sec>    how long to run (default 30)\n"
+           "  -p <ms>     callback period (default 10)\n"
+           "  -l <n>      threads burning CPU (default 0)\n"
+           "  -d <pct>    busy share of each load thread (default 100)\n"
+           "  -c <n>      threads contending for the audio path's locks\n"
+           "              (default 0)\n"
+           "  -j <ms>     delay frame delivery by up to this much (default 0)\n"
+           "  -R          run the callback thread with SCHED_FIFO\n"
+           "\n"
+           "XSTX_HEADLESS_DECODE defaults to \"audio\" so frames are really\n"
+           "decoded.\n",
+           name);
+}
+
+static bool parseCommandLine(int argc, char **argv,
+                             AudioStressHarness::Options &options)
+{
+    int count = 1;
+    while (count < argc)
+    {
+        const char *arg = argv[count++];
+        bool hasValue = count < argc;
+
+        if (strcmp(arg, "-R") == 0)
+        {
+            options.mRealTimePriority = true;
+        }
+        else if (strcmp(arg, "-m") == 0 && hasValue)
+        {
+            const char *mode = argv[count++];
+            if (strcmp(mode, "pull") == 0)
+            {
+                options.mFillMode = AudioStressHarness::FILL_PULL;
+            }
+            else if (strcmp(mode, "ring") == 0)
+            {
+                options.mFillMode = AudioStressHarness::FILL_RING;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "-r") == 0 && hasValue)
+        {
+            options.mDeviceRate = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-n") == 0 && hasValue)
+        {
+            options.mDeviceChannels = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-t") == 0 && hasValue)
+        {
+            options.mSeconds = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-p") == 0 && hasValue)
+        {
+            options.mPeriodMs = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-l") == 0 && hasValue)
+        {
+            options.mLoadThreads = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-d") == 0 && hasValue)
+        {
+            options.mLoadPercent = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-c") == 0 && hasValue)
+        {
+            options.mLockThreads = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-j") == 0 && hasValue)
+        {
+            options.mJitterMs = (uint32_t)atoi(argv[count++]);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options.mSeconds > 0 && options.mPeriodMs > 0 &&
+           options.mLoadPercent <= 100 && options.mDeviceRate > 0 &&
+           options.mDeviceChannels > 0;
+}
+
+int main(int argc, char **argv)
+{
+    AudioStressHarness::Options options;
+    if (!parseCommandLine(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // The headless pipeline only decodes for real when asked to
+    setenv("XSTX_HEADLESS_DECODE", "audio", 0);
+
+    AudioStressHarness harness(options);
+    if (!harness.init())
+    {
+        LOGE("Failed to start the audio pipeline");
+        return 1;
+    }
+
+    bool complete = harness.run();
+    harness.report();
+
+    return complete ? 0 : 1;
+}
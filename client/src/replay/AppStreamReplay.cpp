@@ -0,0 +1,140 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ReplayHarness.h"
+#include "StreamReader.h"
+
+#undef LOG_TAG
+#define LOG_TAG "AppStreamReplay"
+#include "log.h"
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options] <recording>\n"
+           "\n"
+           "Replays a capture written with XSTX_RECORD_STREAM through the\n"
+           "client's video and audio pipelines.\n"
+           "\n"
+           "  -r          deliver records at their recorded timestamps\n"
+           "              (default: as fast as the pipelines accept them)\n"
+           "  -n <loops>  play the recording this many times (default 1)\n"
+           "  -w <width>  display and maximum stream width (default 1280)\n"
+           "  -h <height> display and maximum stream height (default 720)\n"
+           "  -s <ms>     render calls blocking longer count as stalls (default 33)\n"
+           "  -V          skip video\n"
+           "  -A          skip audio\n"
+           "\n"
+           "The pipelines read their usual environment, e.g.\n"
+           "XSTX_DECODER_ASYNC, XSTX_SOFTWARE_RENDERER and XSTX_HEADLESS_OUTPUT.\n"
+           "XSTX_HEADLESS_DECODE defaults to \"all\" so frames are really decoded.\n"
+           "Set XSTX_CAPTURE_VIDEO and XSTX_CAPTURE_AUDIO to write the rendered\n"
+           "frames to Y4M and WAV files.\n",
+           name);
+}
+
+static bool parseCommandLine(int argc, char **argv,
+                             ReplayHarness::Options &options,
+                             const char *&path)
+{
+    path = NULL;
+
+    int count = 1;
+    while (count < argc)
+    {
+        const char *arg = argv[count++];
+        bool hasValue = count < argc;
+
+        if (strcmp(arg, "-r") == 0)
+        {
+            options.mRealTime = true;
+        }
+        else if (strcmp(arg, "-V") == 0)
+        {
+            options.mVideo = false;
+        }
+        else if (strcmp(arg, "-A") == 0)
+        {
+            options.mAudio = false;
+        }
+        else if (strcmp(arg, "-n") == 0 && hasValue)
+        {
+            options.mLoops = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-w") == 0 && hasValue)
+        {
+            options.mWidth = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-h") == 0 && hasValue)
+        {
+            options.mHeight = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-s") == 0 && hasValue)
+        {
+            options.mRenderStallMs = (uint32_t)atoi(argv[count++]);
+        }
+        else if (arg[0] != '-' && path == NULL)
+        {
+            path = arg;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return path != NULL && options.mLoops > 0 &&
+           options.mWidth > 0 && options.mHeight > 0;
+}
+
+int main(int argc, char **argv)
+{
+    ReplayHarness::Options options;
+    const char *path = NULL;
+    if (!parseCommandLine(argc, argv, options, path))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // The headless pipelines only decode for real when asked to
+    setenv("XSTX_HEADLESS_DECODE", "all", 0);
+
+    StreamReader reader;
+    if (!reader.open(path))
+    {
+        return 1;
+    }
+    LOGI("Replaying %s (%u keyframes indexed)", path, reader.getIndexEntries());
+
+    ReplayHarness harness(options);
+    if (!harness.init())
+    {
+        LOGE("Failed to start the pipelines");
+        return 1;
+    }
+
+    bool complete = harness.run(reader);
+    harness.shutdown();
+    harness.report();
+
+    return complete ? 0 : 1;
+}
@@ -0,0 +1,623 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "AudioStressHarness.h"
+#include "../VideoPipeline.h"
+
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <opus/opus.h>
+
+#include <math.h>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#undef LOG_TAG
+#define LOG_TAG "AudioStress"
+#include "log.h"
+
+/** Bit rate of the synthetic Opus stream */
+static const int SOURCE_BITRATE = 64000;
+
+/** Work slice of a load thread; its duty cycle applies per slice */
+static const uint64_t LOAD_SLICE_US = 10000;
+
+static uint64_t nowUs()
+{
+    return mud::TimeVal::mono().toMicroSeconds();
+}
+
+XStxRawAudioFrame* StressAudioRenderer::popFrame(int delay, int msBuffer)
+{
+    XStxRawAudioFrame *frame = NULL;
+    if (getNextFrame(&frame, delay, msBuffer) != XSTX_RESULT_OK)
+    {
+        return NULL;
+    }
+    return frame;
+}
+
+AudioStressHarness::Options::Options()
+    : mFillMode(FILL_RING)
+    , mSeconds(30)
+    , mPeriodMs(10)
+    , mLoadThreads(0)
+    , mLoadPercent(100)
+    , mLockThreads(0)
+    , mJitterMs(0)
+    , mRealTimePriority(false)
+    , mDeviceRate(AudioRingFeeder::SAMPLING_RATE)
+    , mDeviceChannels(AudioRingFeeder::NUM_CHANNELS)
+{
+}
+
+AudioStressHarness::AudioStressHarness(const Options &options)
+    : mOptions(options)
+    , mVideoRenderer(NULL)
+    , mAudioRenderer(NULL)
+    , mStarted(false)
+    , mCallbackThread(NULL)
+    , mProducerThread(NULL)
+    , mFeedThread(NULL)
+    , mShouldStop(false)
+    , mFrame(NULL)
+    , mPlaybackPos(0)
+    , mFeeder(NULL)
+    , mPeriods(0)
+    , mDeadlineMisses(0)
+    , mSkippedPeriods(0)
+    , mUnderruns(0)
+    , mUnderrunUs(0)
+    , mAudioStarted(false)
+    , mRealTimePriority(false)
+    , mFramesProduced(0)
+    , mPoolExhausted(0)
+    , mDecodeErrors(0)
+    , mQueueFull(0)
+    , mLockRounds(0)
+    , mElapsedUs(0)
+{
+}
+
+AudioStressHarness::~AudioStressHarness()
+{
+    shutdown();
+
+    // the modules don't own the video renderer
+    delete mVideoRenderer;
+    delete mFeeder;
+    delete mAudioRenderer;
+}
+
+bool AudioStressHarness::encodeSource()
+{
+    uint32_t samplesPerPeriod = SAMPLING_RATE * mOptions.mPeriodMs / 1000;
+    uint32_t numPeriods = SOURCE_SECONDS * 1000 / mOptions.mPeriodMs;
+
+    // A 440 Hz tone over quiet noise, so the encoder has real work to do
+    const double pi = 3.14159265358979323846;
+    mSourcePcm.resize(numPeriods * samplesPerPeriod * NUM_CHANNELS);
+    srand(1);
+    for (size_t i = 0; i < mSourcePcm.size() / NUM_CHANNELS; i++)
+    {
+        double tone = 8000.0 * sin(2.0 * pi * 440.0 * i / SAMPLING_RATE);
+        for (uint32_t c = 0; c < NUM_CHANNELS; c++)
+        {
+            int noise = rand() % 1024 - 512;
+            mSourcePcm[i * NUM_CHANNELS + c] = (int16_t)(tone + noise);
+        }
+    }
+
+    int error = OPUS_OK;
+    OpusEncoder *encoder = opus_encoder_create(SAMPLING_RATE, NUM_CHANNELS,
+                                               OPUS_APPLICATION_AUDIO, &error);
+    if (encoder == NULL || error != OPUS_OK)
+    {
+        LOGE("Failed to create the Opus encoder: %d", error);
+        return false;
+    }
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(SOURCE_BITRATE));
+
+    bool ok = true;
+    uint8_t packet[1500];
+    mPackets.clear();
+    for (uint32_t i = 0; i < numPeriods && ok; i++)
+    {
+        int size = opus_encode(encoder,
+            &mSourcePcm[i * samplesPerPeriod * NUM_CHANNELS],
+            samplesPerPeriod, packet, sizeof(packet));
+        if (size <= 0)
+        {
+            LOGE("Failed to encode the synthetic audio: %d", size);
+            ok = false;
+            break;
+        }
+        mPackets.push_back(std::vector<uint8_t>(packet, packet + size));
+    }
+    opus_encoder_destroy(encoder);
+    return ok;
+}
+
+bool AudioStressHarness::init()
+{
+    // Opus only codes 2.5 to 60 ms frames; 10 ms is what the library uses
+    if (mOptions.mPeriodMs < 5 || mOptions.mPeriodMs > 40 ||
+        1000 % mOptions.mPeriodMs != 0)
+    {
+        LOGE("Unsupported period %u ms", mOptions.mPeriodMs);
+        return false;
+    }
+    if (!encodeSource())
+    {
+        return false;
+    }
+
+    // Every XStx interface has to be registered before the pipelines
+    // start, so video is set up too even though nothing is streamed to it
+    mVideoRenderer = newVideoRenderer();
+    if (mVideoRenderer == NULL)
+    {
+        return false;
+    }
+    if (!mVideoModule.initialize(mClient.getHandle(), *mVideoRenderer) ||
+        !mAudioModule.initialize(mClient.getHandle()))
+    {
+        LOGE("Failed to initialize the pipelines");
+        return false;
+    }
+
+    // AudioModule's own renderer stays stopped; the callback thread is
+    // the renderer under test
+    if (mClient.startPipelines(640, 480, false) != XSTX_RESULT_OK)
+    {
+        return false;
+    }
+
+    // The renderer under test takes its frames from the SDK queue and
+    // recycles them to AudioModule's pool
+    mAudioRenderer = new(std::nothrow) StressAudioRenderer(
+        mAudioModule.getFramePool(), mClient.getHandle());
+    if (mAudioRenderer == NULL)
+    {
+        return false;
+    }
+    if (mOptions.mFillMode == FILL_RING)
+    {
+        mFeeder = new(std::nothrow) AudioRingFeeder(*mAudioRenderer);
+        if (mFeeder == NULL)
+        {
+            return false;
+        }
+        mFeeder->setJitterBuffer(&mAudioModule.getJitterBuffer());
+        if (!mFeeder->init(mOptions.mDeviceRate, mOptions.mDeviceChannels,
+                AudioResampler::qualityFromString(
+                    getenv("XSTX_AUDIO_RESAMPLER_QUALITY"),
+                    AudioResampler::QUALITY_MEDIUM)))
+        {
+            LOGE("Unsupported device format %u Hz, %u channels",
+                 mOptions.mDeviceRate, mOptions.mDeviceChannels);
+            return false;
+        }
+    }
+
+    // One sample per period; add() must not allocate in the callback
+    size_t expectedPeriods = (size_t)mOptions.mSeconds * 1000 / mOptions.mPeriodMs + 16;
+    mCallbackUs.reserve(expectedPeriods);
+    mWakeLateUs.reserve(expectedPeriods);
+    mDecodeUs.reserve(expectedPeriods);
+
+    mStarted = true;
+    return true;
+}
+
+bool AudioStressHarness::run()
+{
+    if (!mStarted)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < mOptions.mLoadThreads; i++)
+    {
+        mLoadThreads.push_back(new(std::nothrow) LoadThread("StressLoad", *this));
+    }
+    for (uint32_t i = 0; i < mOptions.mLockThreads; i++)
+    {
+        mLoadThreads.push_back(new(std::nothrow) LockThread("StressLock", *this));
+    }
+    mProducerThread = new(std::nothrow) ProducerThread("StressProducer", *this);
+    if (mOptions.mFillMode == FILL_RING)
+    {
+        mFeedThread = new(std::nothrow) FeedThread("StressFeed", *this);
+    }
+    mCallbackThread = new(std::nothrow) CallbackThread("StressCallback", *this);
+
+    for (size_t i = 0; i < mLoadThreads.size(); i++)
+    {
+        if (mLoadThreads[i] == NULL)
+        {
+            LOGE("Failed to create the load threads");
+            return false;
+        }
+        mLoadThreads[i]->start();
+    }
+    if (mProducerThread == NULL || mCallbackThread == NULL ||
+        (mOptions.mFillMode == FILL_RING && mFeedThread == NULL))
+    {
+        LOGE("Failed to create the audio threads");
+        return false;
+    }
+    mProducerThread->start();
+    if (mFeedThread != NULL)
+    {
+        mFeedThread->start();
+    }
+    mCallbackThread->start();
+
+    uint64_t startUs = nowUs();
+    mud::ThreadUtil::sleepUntil(mud::TimeVal::mono() +
+        mud::TimeVal::fromMilliSeconds(mOptions.mSeconds * 1000));
+    mElapsedUs = nowUs() - startUs;
+
+    shutdown();
+    return true;
+}
+
+void AudioStressHarness::producerLoop()
+{
+    const XStxIRawAudioFrameAllocator &allocator = mClient.getAudioFrameAllocator();
+    const XStxIAudioDecoder &decoder = mClient.getAudioDecoder();
+
+    uint32_t samplesPerPeriod = SAMPLING_RATE * mOptions.mPeriodMs / 1000;
+    uint32_t periodBytes = samplesPerPeriod * NUM_CHANNELS * BYTES_PER_SAMPLE;
+    mud::TimeVal period = mud::TimeVal::fromMilliSeconds(mOptions.mPeriodMs);
+    mud::TimeVal next = mud::TimeVal::mono();
+    uint64_t timestampUs = 0;
+    size_t packet = 0;
+
+    while (!shouldStop())
+    {
+        // Packets leave the server on schedule and arrive up to mJitterMs
+        // late, never overtaking one another
+        next = next + period;
+        mud::TimeVal due = next;
+        if (mOptions.mJitterMs > 0)
+        {
+            due = due + mud::TimeVal::fromMicroSeconds(
+                rand() % (mOptions.mJitterMs * 1000));
+        }
+        mud::ThreadUtil::sleepUntil(due);
+
+        XStxRawAudioFrame *frame = NULL;
+        if (allocator.mGetAudioFrameBufferFcn(allocator.mGetAudioFrameBufferCtx,
+                ReplayClient::AUDIO_FRAME_SIZE, &frame) != XSTX_RESULT_OK)
+        {
+            mPoolExhausted++;
+            continue;
+        }
+
+        XStxEncodedAudioFrame encoded;
+        memset(&encoded, 0, sizeof(encoded));
+        encoded.mData = &mPackets[packet][0];
+        encoded.mDataSize = (uint32_t)mPackets[packet].size();
+        encoded.mTimestampUs = timestampUs;
+
+        uint64_t decodeStartUs = nowUs();
+        XStxResult result = decoder.mDecodeAudioFrameFcn(
+            decoder.mDecodeAudioFrameCtx, &encoded, frame);
+        mDecodeUs.add(nowUs() - decodeStartUs);
+
+        if (result == XSTX_RESULT_OK && frame->mDataSize == 0 &&
+            frame->mBufferSize >= periodBytes)
+        {
+            // Decoding is off (XSTX_HEADLESS_DECODE); stand in for it
+            memcpy(frame->mData,
+                   &mSourcePcm[packet * samplesPerPeriod * NUM_CHANNELS],
+                   periodBytes);
+            frame->mDataSize = periodBytes;
+        }
+        packet = (packet + 1) % mPackets.size();
+        timestampUs += mOptions.mPeriodMs * 1000;
+
+        if (result != XSTX_RESULT_OK)
+        {
+            mDecodeErrors++;
+            recycleFrame(frame);
+        }
+        else if (!mClient.queueAudioFrame(frame))
+        {
+            mQueueFull++;
+            recycleFrame(frame);
+        }
+        else
+        {
+            mFramesProduced++;
+        }
+    }
+}
+
+void AudioStressHarness::callbackLoop()
+{
+#if defined(__linux__)
+    if (mOptions.mRealTimePriority)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+        mRealTimePriority =
+            pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+        if (!mRealTimePriority)
+        {
+            LOGW("Can't run the callback thread with SCHED_FIFO; "
+                 "measuring at normal priority");
+        }
+    }
+#endif
+
+    // The pull callback plays the decoded format; the ring is in the
+    // device format
+    uint32_t deviceRate = SAMPLING_RATE;
+    uint32_t deviceChannels = NUM_CHANNELS;
+    if (mFeeder != NULL)
+    {
+        deviceRate = mFeeder->getDeviceRate();
+        deviceChannels = mFeeder->getDeviceChannels();
+    }
+    uint32_t samplesPerPeriod = deviceRate * mOptions.mPeriodMs / 1000;
+    std::vector<int16_t> buffer(samplesPerPeriod * deviceChannels);
+    uint64_t periodUs = mOptions.mPeriodMs * 1000ULL;
+    mud::TimeVal period = mud::TimeVal::fromMilliSeconds(mOptions.mPeriodMs);
+
+    // Let the first frames arrive before the device starts
+    mud::TimeVal next = mud::TimeVal::mono() + period + period;
+
+    while (!shouldStop())
+    {
+        mud::ThreadUtil::sleepUntil(next);
+        uint64_t scheduledUs = next.toMicroSeconds();
+        uint64_t wakeUs = nowUs();
+
+        uint32_t filled = mFeeder == NULL ?
+            fillPull(&buffer[0], samplesPerPeriod) :
+            mFeeder->fill(&buffer[0], samplesPerPeriod);
+
+        uint64_t endUs = nowUs();
+        mPeriods++;
+        mWakeLateUs.add(wakeUs > scheduledUs ? wakeUs - scheduledUs : 0);
+        mCallbackUs.add(endUs - wakeUs);
+
+        if (filled > 0)
+        {
+            mAudioStarted = true;
+        }
+        if (mAudioStarted && filled < samplesPerPeriod)
+        {
+            mUnderruns++;
+            mUnderrunUs += (uint64_t)(samplesPerPeriod - filled) * 1000000 /
+                           deviceRate;
+        }
+
+        // The device needs the buffer before the next callback is due.
+        // Periods that went by while this one ran were played as silence
+        // by the device, and their callbacks are never made.
+        next = next + period;
+        if (endUs > scheduledUs + periodUs)
+        {
+            mDeadlineMisses++;
+            while (next.toMicroSeconds() + periodUs <= endUs)
+            {
+                next = next + period;
+                mSkippedPeriods++;
+            }
+        }
+    }
+}
+
+uint32_t AudioStressHarness::fillPull(int16_t *buffer,
+                                      uint32_t numSamplesPerChannel)
+{
+    // The callback waits for the SDK until the device would run dry, less
+    // a margin, as the original fillPABuffer did
+    uint64_t startUs = nowUs();
+    uint32_t numSamplesRequested = numSamplesPerChannel * NUM_CHANNELS;
+    uint32_t numSamplesWritten = 0;
+
+    while (numSamplesWritten < numSamplesRequested)
+    {
+        if (mFrame == NULL)
+        {
+            uint64_t elapsedMs = (nowUs() - startUs) / 1000;
+            uint32_t remainingMs = elapsedMs < PULL_LATENCY_MS ?
+                (uint32_t)(PULL_LATENCY_MS - elapsedMs) : 0;
+            uint32_t timeout = remainingMs > PULL_TIMEOUT_MARGIN_MS ?
+                remainingMs - PULL_TIMEOUT_MARGIN_MS : 0;
+
+            mFrame = mAudioRenderer->popFrame(remainingMs, timeout);
+            if (mFrame == NULL)
+            {
+                break;
+            }
+            mPlaybackPos = 0;
+        }
+
+        uint32_t maxSamplesInFrame =
+            (mFrame->mDataSize - mPlaybackPos) / BYTES_PER_SAMPLE;
+        uint32_t maxSamplesCanWrite = numSamplesRequested - numSamplesWritten;
+        uint32_t numSamplesToTake = maxSamplesInFrame > maxSamplesCanWrite ?
+            maxSamplesCanWrite : maxSamplesInFrame;
+
+        memcpy(buffer + numSamplesWritten, mFrame->mData + mPlaybackPos,
+               numSamplesToTake * BYTES_PER_SAMPLE);
+        mPlaybackPos += numSamplesToTake * BYTES_PER_SAMPLE;
+        numSamplesWritten += numSamplesToTake;
+
+        if (mPlaybackPos >= mFrame->mDataSize)
+        {
+            mAudioRenderer->recycleFrame(mFrame);
+            mFrame = NULL;
+        }
+    }
+
+    memset(buffer + numSamplesWritten, 0,
+           (numSamplesRequested - numSamplesWritten) * BYTES_PER_SAMPLE);
+    return numSamplesWritten / NUM_CHANNELS;
+}
+
+void AudioStressHarness::feedLoop()
+{
+    while (!shouldStop())
+    {
+        mFeeder->feed();
+    }
+}
+
+void AudioStressHarness::loadLoop()
+{
+    uint64_t busyUs = LOAD_SLICE_US * mOptions.mLoadPercent / 100;
+    while (!shouldStop())
+    {
+        spin(busyUs);
+        if (busyUs < LOAD_SLICE_US)
+        {
+            mud::ThreadUtil::sleep((unsigned long)((LOAD_SLICE_US - busyUs) / 1000));
+        }
+    }
+}
+
+void AudioStressHarness::lockLoop()
+{
+    // Takes the locks the audio path shares, as fast as it can: the frame
+    // pool's, through the allocator callbacks, and the SDK queue's. Under
+    // CPU load a contender gets preempted holding one, which is when the
+    // pull callback waits behind it.
+    const XStxIRawAudioFrameAllocator &allocator = mClient.getAudioFrameAllocator();
+    uint32_t rounds = 0;
+
+    while (!shouldStop())
+    {
+        XStxRawAudioFrame *frame = NULL;
+        if (allocator.mGetAudioFrameBufferFcn(allocator.mGetAudioFrameBufferCtx,
+                ReplayClient::AUDIO_FRAME_SIZE, &frame) == XSTX_RESULT_OK)
+        {
+            recycleFrame(frame);
+        }
+        mClient.getQueuedAudioFrames();
+        rounds++;
+        if ((rounds & 0xff) == 0)
+        {
+            mud::ThreadUtil::yield();
+        }
+    }
+
+    mud::ScopeLock sl(mLockRoundsLock);
+    mLockRounds += rounds;
+}
+
+void AudioStressHarness::recycleFrame(XStxRawAudioFrame *frame)
+{
+    const XStxIRawAudioFrameAllocator &allocator = mClient.getAudioFrameAllocator();
+    allocator.mRecycleAudioFrameBufferFcn(
+        allocator.mRecycleAudioFrameBufferCtx, frame);
+}
+
+void AudioStressHarness::spin(uint64_t us)
+{
+    uint64_t endUs = nowUs() + us;
+    volatile double sink = 1.0;
+    while (nowUs() < endUs)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            sink = sink * 1.0000001 + 0.5;
+        }
+    }
+}
+
+void AudioStressHarness::shutdown()
+{
+    if (!mStarted)
+    {
+        return;
+    }
+    mStarted = false;
+    mShouldStop = true;
+
+    // The callback and feeder pull from the SDK queue, so they stop first
+    delete mCallbackThread;
+    mCallbackThread = NULL;
+    delete mFeedThread;
+    mFeedThread = NULL;
+    delete mProducerThread;
+    mProducerThread = NULL;
+    for (size_t i = 0; i < mLoadThreads.size(); i++)
+    {
+        delete mLoadThreads[i];
+    }
+    mLoadThreads.clear();
+
+    if (mFrame != NULL)
+    {
+        mAudioRenderer->recycleFrame(mFrame);
+        mFrame = NULL;
+    }
+    mClient.drainAudioFrames();
+    mVideoRenderer->stop();
+    mVideoModule.stop();
+}
+
+void AudioStressHarness::report()
+{
+    double seconds = mElapsedUs / 1000000.0;
+    if (seconds <= 0)
+    {
+        return;
+    }
+
+    LOGI("[audiostress]={ \"Mode\":\"%s\", \"Seconds\":%.3f, \"PeriodMs\":%u, "
+         "\"LoadThreads\":%u, \"LoadPercent\":%u, \"LockThreads\":%u, "
+         "\"JitterMs\":%u, \"RealTime\":%d, \"Periods\":%u, "
+         "\"DeadlineMisses\":%u, \"SkippedPeriods\":%u, \"Underruns\":%u, "
+         "\"UnderrunMs\":%.1f, \"CallbackP50Us\":%u, \"CallbackP99Us\":%u, "
+         "\"CallbackP999Us\":%u, \"CallbackMaxUs\":%u, \"WakeLateP99Us\":%u, "
+         "\"WakeLateMaxUs\":%u, \"DeviceRate\":%u, \"DeviceChannels\":%u, "
+         "\"DroppedSamples\":%u }",
+         mOptions.mFillMode == FILL_PULL ? "pull" : "ring", seconds,
+         mOptions.mPeriodMs, mOptions.mLoadThreads, mOptions.mLoadPercent,
+         mOptions.mLockThreads, mOptions.mJitterMs, mRealTimePriority ? 1 : 0,
+         mPeriods, mDeadlineMisses, mSkippedPeriods, mUnderruns,
+         mUnderrunUs / 1000.0,
+         mCallbackUs.percentile(50), mCallbackUs.percentile(99),
+         mCallbackUs.percentile(99.9), mCallbackUs.percentile(100),
+         mWakeLateUs.percentile(99), mWakeLateUs.percentile(100),
+         mFeeder != NULL ? mFeeder->getDeviceRate() : SAMPLING_RATE,
+         mFeeder != NULL ? mFeeder->getDeviceChannels() : NUM_CHANNELS,
+         mFeeder != NULL ? mFeeder->getDroppedSamples() : 0);
+    LOGI("[audiostressProducer]={ \"Frames\":%u, \"PoolExhausted\":%u, "
+         "\"DecodeErrors\":%u, \"QueueFull\":%u, \"DecodeP50Us\":%u, "
+         "\"DecodeMaxUs\":%u, \"LockRounds\":%u }",
+         mFramesProduced, mPoolExhausted, mDecodeErrors, mQueueFull,
+         mDecodeUs.percentile(50), mDecodeUs.percentile(100), mLockRounds);
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _included_AudioStressHarness_h
+#define _included_AudioStressHarness_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "MUD/threading/SimpleLock.h"
+#include "MUD/threading/Thread.h"
+
+#include "LatencySamples.h"
+#include "ReplayClient.h"
+#include "../AudioModule.h"
+#include "../AudioRenderer.h"
+#include "../AudioRingFeeder.h"
+#include "../VideoModule.h"
+#include "../VideoRenderer.h"
+
+/**
+ * The renderer the stress harness measures: it takes frames from the SDK
+ * the way every renderer does, and leaves the device side to the
+ * harness's callback thread.
+ */
+class StressAudioRenderer : public AudioRenderer
+{
+public:
+    StressAudioRenderer(mud::FixedSizePool<XStxRawAudioFrame> &framePool,
+                        XStxClientHandle clientHandle)
+        : AudioRenderer(framePool, clientHandle)
+    {
+    }
+
+    virtual XStxRawAudioFrame* popFrame(int delay, int msBuffer);
+    virtual XStxResult start() { return XSTX_RESULT_OK; }
+    virtual void pause(bool pause) { (void)pause; }
+    virtual void stop() { }
+};
+
+/**
+ * Measures how close the audio path comes to glitching under load.
+ *
+ * A producer thread plays the network and the XStx library: every period
+ * it takes a frame from AudioModule's allocator callback, decodes a
+ * synthetic Opus packet into it with AudioModule's decoder callback and
+ * queues it for XStxGetNextAudioFrame(). A callback thread plays the
+ * audio device: it wakes at absolute period deadlines, like a device
+ * callback, and has a renderer fill one period of PCM. Other threads burn
+ * CPU and hammer the locks the audio path shares.
+ *
+ * Two fill strategies can be compared:
+ *  - FILL_PULL waits for frames from the SDK inside the callback and
+ *    recycles them there, as the original PortAudio and DummyAudio
+ *    fillPABuffer did.
+ *  - FILL_RING runs PortAudioRenderer's AudioRingFeeder: a feeder thread
+ *    passes frames through AudioModule's jitter buffer and the format
+ *    converter into a wait-free ring, and the callback only copies from
+ *    it. The device format can be set to exercise the converter.
+ *
+ * The report gives deadline misses, callback duration percentiles, wake
+ * up lateness and underruns.
+ */
+class AudioStressHarness
+{
+public:
+
+    /** How the simulated device callback gets its samples */
+    enum EFillMode
+    {
+        FILL_PULL,
+        FILL_RING
+    };
+
+    /** Benchmark settings */
+    struct Options
+    {
+        Options();
+
+        EFillMode mFillMode;
+        /** How long to run */
+        uint32_t mSeconds;
+        /** Device callback period; also the length of a decoded frame */
+        uint32_t mPeriodMs;
+        /** Threads burning CPU */
+        uint32_t mLoadThreads;
+        /** Share of each load thread's time spent busy, in percent */
+        uint32_t mLoadPercent;
+        /** Threads contending for the frame pool and SDK queue locks */
+        uint32_t mLockThreads;
+        /** Most a frame's delivery is delayed by, like network jitter */
+        uint32_t mJitterMs;
+        /** Ask for SCHED_FIFO for the callback thread */
+        bool mRealTimePriority;
+        /** FILL_RING: format of the simulated device */
+        uint32_t mDeviceRate;
+        uint32_t mDeviceChannels;
+    };
+
+    /** Constructor */
+    AudioStressHarness(const Options &options);
+
+    /** Destructor; stops every thread */
+    ~AudioStressHarness();
+
+    /**
+     * Encode the synthetic audio, create the pipelines and start them the
+     * way the XStx library does.
+     *
+     * @return true on success
+     */
+    bool init();
+
+    /**
+     * Run the benchmark for the configured time.
+     *
+     * @return true if it ran to the end
+     */
+    bool run();
+
+    /** Stop every thread; called by the destructor if needed */
+    void shutdown();
+
+    /** Log the results */
+    void report();
+
+    /** Thread bodies */
+    void callbackLoop();
+    void producerLoop();
+    void feedLoop();
+    void loadLoop();
+    void lockLoop();
+
+private:
+
+    DEFINE_METHOD_THREAD(CallbackThread, AudioStressHarness, callbackLoop);
+    DEFINE_METHOD_THREAD(ProducerThread, AudioStressHarness, producerLoop);
+    DEFINE_METHOD_THREAD(FeedThread, AudioStressHarness, feedLoop);
+    DEFINE_METHOD_THREAD(LoadThread, AudioStressHarness, loadLoop);
+    DEFINE_METHOD_THREAD(LockThread, AudioStressHarness, lockLoop);
+
+    /** The audio is 48 kHz stereo, as the XStx library decodes it */
+    static const uint32_t SAMPLING_RATE = 48000;
+    static const uint32_t NUM_CHANNELS = 2;
+    static const uint32_t BYTES_PER_SAMPLE = 2;
+
+    /** Seconds of synthetic audio, looped */
+    static const uint32_t SOURCE_SECONDS = 1;
+
+    /**
+     * Device latency the pull callback is told it has, and the margin it
+     * leaves the SDK, as in the original fillPABuffer.
+     */
+    static const uint32_t PULL_LATENCY_MS = 40;
+    static const uint32_t PULL_TIMEOUT_MARGIN_MS = 15;
+
+    /**
+     * Encode SOURCE_SECONDS of a tone over noise into one Opus packet per
+     * period.
+     */
+    bool encodeSource();
+
+    /**
+     * Fill one period the FILL_PULL way.
+     *
+     * @return the samples per channel that came from decoded audio; the
+     *     rest of the buffer is zeros
+     */
+    uint32_t fillPull(int16_t *buffer, uint32_t numSamplesPerChannel);
+
+    /** Return a frame to AudioModule's pool through the allocator callback */
+    void recycleFrame(XStxRawAudioFrame *frame);
+
+    bool shouldStop() const { return mShouldStop; }
+
+    /** Spin for the given time without giving up the CPU */
+    static void spin(uint64_t us);
+
+    Options mOptions;
+
+    ReplayClient mClient;
+    VideoRenderer *mVideoRenderer;
+    VideoModule mVideoModule;
+    AudioModule mAudioModule;
+    StressAudioRenderer *mAudioRenderer;
+    bool mStarted;
+
+    /** Synthetic Opus packets and the PCM they were encoded from */
+    std::vector< std::vector<uint8_t> > mPackets;
+    std::vector<int16_t> mSourcePcm;
+
+    CallbackThread *mCallbackThread;
+    ProducerThread *mProducerThread;
+    FeedThread *mFeedThread;
+    std::vector<mud::Thread *> mLoadThreads;
+    volatile bool mShouldStop;
+
+    /** FILL_PULL: the frame being played and the position in it */
+    XStxRawAudioFrame *mFrame;
+    uint32_t mPlaybackPos;
+
+    /** FILL_RING: the renderer's feeder, ring and converter */
+    AudioRingFeeder *mFeeder;
+
+    /** Written by the callback thread only */
+    uint32_t mPeriods;
+    uint32_t mDeadlineMisses;
+    uint32_t mSkippedPeriods;
+    uint32_t mUnderruns;
+    uint64_t mUnderrunUs;
+    bool mAudioStarted;
+    bool mRealTimePriority;
+    LatencySamples mCallbackUs;
+    LatencySamples mWakeLateUs;
+
+    /** Written by the producer thread only */
+    uint32_t mFramesProduced;
+    uint32_t mPoolExhausted;
+    uint32_t mDecodeErrors;
+    uint32_t mQueueFull;
+    LatencySamples mDecodeUs;
+
+    /** Lock round trips made by the contention threads; guarded by
+        mLockRoundsLock */
+    uint32_t mLockRounds;
+    mud::SimpleLock mLockRoundsLock;
+
+    /** Wall clock time the benchmark ran for */
+    uint64_t mElapsedUs;
+};
+
+#endif //_included_AudioStressHarness_h
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _included_LatencySamples_h
+#define _included_LatencySamples_h
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+/**
+ * Latency samples of one measurement, in microseconds, for reporting
+ * percentiles once a run is over.
+ */
+class LatencySamples
+{
+public:
+    LatencySamples() : mSorted(true) {}
+
+    /**
+     * Make room for the given number of samples, so that add() doesn't
+     * allocate in a thread being measured.
+     */
+    void reserve(size_t count) { mSamples.reserve(count); }
+
+    void add(uint64_t us) { mSamples.push_back((uint32_t)us); mSorted = false; }
+    size_t size() const { return mSamples.size(); }
+
+    /** @return the p-th percentile (0..100), or 0 without samples */
+    uint32_t percentile(double p)
+    {
+        if (mSamples.empty())
+        {
+            return 0;
+        }
+        if (!mSorted)
+        {
+            std::sort(mSamples.begin(), mSamples.end());
+            mSorted = true;
+        }
+        size_t rank = (size_t)(p / 100.0 * (mSamples.size() - 1) + 0.5);
+        return mSamples[rank];
+    }
+
+private:
+    std::vector<uint32_t> mSamples;
+    bool mSorted;
+};
+
+#endif //_included_LatencySamples_h
@@ -0,0 +1,364 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "ReplayClient.h"
+
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <set>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "ReplayClient"
+#include "log.h"
+
+/**
+ * Copy an interface struct registered by the client, honoring the size
+ * the caller declared in mSize.
+ */
+template <typename T>
+static XStxResult copyInterface(T &to, const T *from)
+{
+    if (from == NULL || from->mSize == 0)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+    memset(&to, 0, sizeof(to));
+    memcpy(&to, from, from->mSize < sizeof(to) ? from->mSize : sizeof(to));
+    return XSTX_RESULT_OK;
+}
+
+/** Clients that haven't been destroyed, for acquire() */
+static mud::SimpleLock sLiveClientsLock;
+static std::set<ReplayClient *> sLiveClients;
+
+ReplayClient::ReplayClient()
+    : mAudioQueue(MAX_QUEUED_AUDIO_FRAMES)
+    , mUsers(0)
+    , mAudioStarted(false)
+    , mAudioStopped(false)
+    , mAudioUnderruns(0)
+{
+    memset(&mVideoFrameAllocator, 0, sizeof(mVideoFrameAllocator));
+    memset(&mVideoRenderer, 0, sizeof(mVideoRenderer));
+    memset(&mVideoDecoder, 0, sizeof(mVideoDecoder));
+    memset(&mAudioFrameAllocator, 0, sizeof(mAudioFrameAllocator));
+    memset(&mAudioDecoder, 0, sizeof(mAudioDecoder));
+    memset(&mAudioRenderer, 0, sizeof(mAudioRenderer));
+
+    mud::ScopeLock sl(sLiveClientsLock);
+    sLiveClients.insert(this);
+}
+
+ReplayClient::~ReplayClient()
+{
+    // Wait out calls that found the client before it was unlisted
+    {
+        mud::ScopeLock sl(sLiveClientsLock);
+        sLiveClients.erase(this);
+    }
+    while (true)
+    {
+        {
+            mud::ScopeLock sl(sLiveClientsLock);
+            if (mUsers == 0)
+            {
+                break;
+            }
+        }
+        mud::ThreadUtil::sleep(1);
+    }
+
+    drainAudioFrames();
+}
+
+ReplayClient *ReplayClient::acquire(XStxClientHandle handle)
+{
+    mud::ScopeLock sl(sLiveClientsLock);
+    std::set<ReplayClient *>::iterator it = sLiveClients.find(fromHandle(handle));
+    if (it == sLiveClients.end())
+    {
+        return NULL;
+    }
+    (*it)->mUsers++;
+    return *it;
+}
+
+void ReplayClient::release()
+{
+    mud::ScopeLock sl(sLiveClientsLock);
+    mUsers--;
+}
+
+XStxResult ReplayClient::setVideoFrameAllocator(
+    const XStxIRawVideoFrameAllocator *allocator)
+{
+    return copyInterface(mVideoFrameAllocator, allocator);
+}
+
+XStxResult ReplayClient::setVideoRenderer(const XStxIVideoRenderer *renderer)
+{
+    return copyInterface(mVideoRenderer, renderer);
+}
+
+XStxResult ReplayClient::setVideoDecoder(const XStxIVideoDecoder *decoder)
+{
+    return copyInterface(mVideoDecoder, decoder);
+}
+
+XStxResult ReplayClient::setAudioFrameAllocator(
+    const XStxIRawAudioFrameAllocator *allocator)
+{
+    return copyInterface(mAudioFrameAllocator, allocator);
+}
+
+XStxResult ReplayClient::setAudioDecoder(const XStxIAudioDecoder *decoder)
+{
+    return copyInterface(mAudioDecoder, decoder);
+}
+
+XStxResult ReplayClient::setAudioRenderer(const XStxIAudioRenderer *renderer)
+{
+    return copyInterface(mAudioRenderer, renderer);
+}
+
+bool ReplayClient::isComplete() const
+{
+    return mVideoFrameAllocator.mGetVideoFrameBufferFcn != NULL &&
+           mVideoFrameAllocator.mRecycleVideoFrameBufferFcn != NULL &&
+           mVideoRenderer.mRenderVideoFrameFcn != NULL &&
+           mVideoDecoder.mDecodeVideoFrameFcn != NULL &&
+           mAudioFrameAllocator.mGetAudioFrameBufferFcn != NULL &&
+           mAudioFrameAllocator.mRecycleAudioFrameBufferFcn != NULL &&
+           mAudioDecoder.mDecodeAudioFrameFcn != NULL &&
+           mAudioRenderer.mStartFcn != NULL;
+}
+
+XStxResult ReplayClient::startPipelines(uint32_t maxWidth, uint32_t maxHeight,
+                                        bool startAudioRenderer)
+{
+    if (!isComplete())
+    {
+        LOGE("The pipelines didn't register every XStx interface");
+        return XSTX_RESULT_NOT_INITIALIZED_PROPERLY;
+    }
+
+    XStxResult result = mVideoFrameAllocator.mInitFcn(
+        mVideoFrameAllocator.mInitCtx, maxWidth, maxHeight);
+    if (result != XSTX_RESULT_OK)
+    {
+        LOGE("Failed to initialize the video frame allocator");
+        return result;
+    }
+    if (mVideoRenderer.mSetMaxResolutionFcn != NULL)
+    {
+        mVideoRenderer.mSetMaxResolutionFcn(mVideoRenderer.mSetMaxResolutionCtx,
+                                            maxWidth, maxHeight);
+    }
+    if (mVideoDecoder.mStartFcn != NULL &&
+        (result = mVideoDecoder.mStartFcn(mVideoDecoder.mStartCtx)) != XSTX_RESULT_OK)
+    {
+        LOGE("Failed to start the video decoder");
+        return result;
+    }
+
+    result = mAudioFrameAllocator.mInitFcn(mAudioFrameAllocator.mInitCtx,
+                                           AUDIO_FRAME_SIZE);
+    if (result != XSTX_RESULT_OK)
+    {
+        LOGE("Failed to initialize the audio frame allocator");
+        return result;
+    }
+    if (mAudioDecoder.mStartFcn != NULL &&
+        (result = mAudioDecoder.mStartFcn(mAudioDecoder.mStartCtx)) != XSTX_RESULT_OK)
+    {
+        LOGE("Failed to start the audio decoder");
+        return result;
+    }
+    if (startAudioRenderer &&
+        (result = mAudioRenderer.mStartFcn(mAudioRenderer.mStartCtx)) != XSTX_RESULT_OK)
+    {
+        LOGE("Failed to start the audio renderer");
+        return result;
+    }
+    return XSTX_RESULT_OK;
+}
+
+bool ReplayClient::queueAudioFrame(XStxRawAudioFrame *frame)
+{
+    {
+        mud::ScopeLock sl(mAudioStateLock);
+        mAudioStarted = true;
+    }
+    return mAudioQueue.push(frame);
+}
+
+XStxResult ReplayClient::getNextAudioFrame(XStxRawAudioFrame **frame,
+                                           uint32_t waitMs)
+{
+    if (frame == NULL)
+    {
+        return XSTX_RESULT_INVALID_ARGUMENTS;
+    }
+
+    // Single consumer: the frame at the front can't be taken by anyone else
+    XStxRawAudioFrame *next = NULL;
+    if (mAudioQueue.waitForFront(next, mud::TimeVal::fromMilliSeconds(waitMs)) &&
+        mAudioQueue.pop(next))
+    {
+        *frame = next;
+        return XSTX_RESULT_OK;
+    }
+
+    mud::ScopeLock sl(mAudioStateLock);
+    if (mAudioStarted && !mAudioStopped)
+    {
+        mAudioUnderruns++;
+    }
+    return XSTX_RESULT_FRAME_NOT_AVAILABLE;
+}
+
+void ReplayClient::drainAudioFrames()
+{
+    {
+        mud::ScopeLock sl(mAudioStateLock);
+        mAudioStopped = true;
+    }
+
+    XStxRawAudioFrame *frame = NULL;
+    while (mAudioQueue.pop(frame))
+    {
+        mAudioFrameAllocator.mRecycleAudioFrameBufferFcn(
+            mAudioFrameAllocator.mRecycleAudioFrameBufferCtx, frame);
+    }
+}
+
+uint32_t ReplayClient::getAudioUnderruns()
+{
+    mud::ScopeLock sl(mAudioStateLock);
+    return mAudioUnderruns;
+}
+
+//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//
+//          XStx client library stand-ins
+//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//
+
+XStxResult XStxClientSetVideoFrameAllocator(XStxClientHandle clientHandle,
+    XStxIRawVideoFrameAllocator *allocator)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    return ReplayClient::fromHandle(clientHandle)->setVideoFrameAllocator(allocator);
+}
+
+XStxResult XStxClientSetVideoRenderer(XStxClientHandle clientHandle,
+    XStxIVideoRenderer *renderer)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    return ReplayClient::fromHandle(clientHandle)->setVideoRenderer(renderer);
+}
+
+XStxResult XStxClientSetVideoDecoder(XStxClientHandle clientHandle,
+    XStxIVideoDecoder *decoder)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    return ReplayClient::fromHandle(clientHandle)->setVideoDecoder(decoder);
+}
+
+XStxResult XStxClientSetAudioFrameAllocator(XStxClientHandle clientHandle,
+    XStxIRawAudioFrameAllocator *allocator)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    return ReplayClient::fromHandle(clientHandle)->setAudioFrameAllocator(allocator);
+}
+
+XStxResult XStxClientSetAudioDecoder(XStxClientHandle clientHandle,
+    XStxIAudioDecoder *decoder)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    return ReplayClient::fromHandle(clientHandle)->setAudioDecoder(decoder);
+}
+
+XStxResult XStxClientSetAudioRenderer(XStxClientHandle clientHandle,
+    XStxIAudioRenderer *renderer)
+{
+    if (clientHandle == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    return ReplayClient::fromHandle(clientHandle)->setAudioRenderer(renderer);
+}
+
+XStxResult XStxClientAddChromaSamplingOption(XStxClientHandle clientHandle,
+    XStxChromaSampling chromaSampling)
+{
+    // A recording has whatever sampling the session negotiated
+    (void)chromaSampling;
+    return clientHandle == NULL ? XSTX_RESULT_INVALID_HANDLE : XSTX_RESULT_OK;
+}
+
+XStxResult XStxGetNextAudioFrame(XStxClientHandle clientHandle,
+    XStxRawAudioFrame **frame, uint32_t delay, uint32_t msBuffer)
+{
+    // Frames are handed out in order; there is no playout delay to honour
+    (void)delay;
+
+    // The audio renderer keeps pulling until its module is destroyed,
+    // which can be after the client has been recycled
+    ReplayClient *client = ReplayClient::acquire(clientHandle);
+    if (client == NULL)
+    {
+        return XSTX_RESULT_INVALID_HANDLE;
+    }
+    XStxResult result = client->getNextAudioFrame(frame, msBuffer);
+    client->release();
+    return result;
+}
+
+const char *XStxResultGetDescription(XStxResult result)
+{
+    switch (result)
+    {
+    case XSTX_RESULT_OK:
+        return "OK";
+    case XSTX_RESULT_INVALID_ARGUMENTS:
+        return "Invalid arguments";
+    case XSTX_RESULT_OUT_OF_MEMORY:
+        return "Out of memory";
+    case XSTX_RESULT_FRAME_NOT_AVAILABLE:
+        return "Frame not available";
+    default:
+        return "Unknown result";
+    }
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_ReplayClient_h
+#define _included_ReplayClient_h
+
+#include "XStx/common/XStxAPI.h"
+#include "XStx/client/XStxClientAPI.h"
+
+#include "MUD/memory/ThreadsafeQueue.h"
+#include "MUD/threading/SimpleLock.h"
+
+/**
+ * Stands in for the XStx client library when replaying a recording.
+ *
+ * The replay executable links against this instead of the library: the
+ * XStxClient* registration calls made by VideoModule and AudioModule end
+ * up here, so the harness can drive the captured callbacks the way the
+ * library would. A ReplayClient pointer is used as the XStxClientHandle.
+ *
+ * Decoded audio frames are queued here and handed to the audio renderer
+ * through XStxGetNextAudioFrame(), as the library's jitter buffer does.
+ */
+class ReplayClient
+{
+public:
+
+    /** Constructor */
+    ReplayClient();
+
+    /** Destructor */
+    virtual ~ReplayClient();
+
+    /** @return the handle to pass to VideoModule and AudioModule */
+    XStxClientHandle getHandle() { return (XStxClientHandle)this; }
+
+    /** @return the client behind a handle returned by getHandle() */
+    static ReplayClient *fromHandle(XStxClientHandle handle)
+    {
+        return (ReplayClient *)handle;
+    }
+
+    /**
+     * Look up a client for a call that may race with its destruction,
+     * like the audio renderer's XStxGetNextAudioFrame() calls. The client
+     * is not destroyed before release() is called.
+     *
+     * @return the client, or NULL if the handle has been recycled
+     */
+    static ReplayClient *acquire(XStxClientHandle handle);
+
+    /** Release a client returned by acquire() */
+    void release();
+
+    /** Size of the audio frames the library asks the allocator for: 10 ms
+     *  of 48 kHz stereo 16 bit PCM */
+    static const uint32_t AUDIO_FRAME_SIZE = 480 * 2 * 2;
+
+    XStxResult setVideoFrameAllocator(const XStxIRawVideoFrameAllocator *allocator);
+    XStxResult setVideoRenderer(const XStxIVideoRenderer *renderer);
+    XStxResult setVideoDecoder(const XStxIVideoDecoder *decoder);
+    XStxResult setAudioFrameAllocator(const XStxIRawAudioFrameAllocator *allocator);
+    XStxResult setAudioDecoder(const XStxIAudioDecoder *decoder);
+    XStxResult setAudioRenderer(const XStxIAudioRenderer *renderer);
+
+    /** @return true if both pipelines registered all of their interfaces */
+    bool isComplete() const;
+
+    /**
+     * Start the pipelines the way the library does when a session starts:
+     * initialize the frame allocators, announce the maximum resolution and
+     * start the decoders and, if asked to, the audio renderer.
+     */
+    XStxResult startPipelines(uint32_t maxWidth, uint32_t maxHeight,
+                              bool startAudioRenderer);
+
+    const XStxIRawVideoFrameAllocator &getVideoFrameAllocator() const
+    {
+        return mVideoFrameAllocator;
+    }
+    const XStxIVideoRenderer &getVideoRenderer() const { return mVideoRenderer; }
+    const XStxIVideoDecoder &getVideoDecoder() const { return mVideoDecoder; }
+    const XStxIRawAudioFrameAllocator &getAudioFrameAllocator() const
+    {
+        return mAudioFrameAllocator;
+    }
+    const XStxIAudioDecoder &getAudioDecoder() const { return mAudioDecoder; }
+    const XStxIAudioRenderer &getAudioRenderer() const { return mAudioRenderer; }
+
+    /**
+     * Hand a decoded audio frame to the renderer.
+     *
+     * @return false if the queue is full; the caller keeps the frame
+     */
+    bool queueAudioFrame(XStxRawAudioFrame *frame);
+
+    /**
+     * Implementation of XStxGetNextAudioFrame().
+     *
+     * @param[out] frame next decoded frame
+     * @param[in] waitMs how long to wait for one
+     */
+    XStxResult getNextAudioFrame(XStxRawAudioFrame **frame, uint32_t waitMs);
+
+    /** @return decoded audio frames waiting for the renderer */
+    size_t getQueuedAudioFrames() { return mAudioQueue.size(); }
+
+    /**
+     * Stop counting underruns and recycle every frame still queued.
+     * Call once the audio renderer has stopped pulling.
+     */
+    void drainAudioFrames();
+
+    /**
+     * @return how often the renderer asked for audio after playback
+     *     started and none was queued
+     */
+    uint32_t getAudioUnderruns();
+
+private:
+
+    /** Most decoded audio the library would buffer, in 10 ms frames */
+    static const size_t MAX_QUEUED_AUDIO_FRAMES = 50;
+
+    XStxIRawVideoFrameAllocator mVideoFrameAllocator;
+    XStxIVideoRenderer mVideoRenderer;
+    XStxIVideoDecoder mVideoDecoder;
+    XStxIRawAudioFrameAllocator mAudioFrameAllocator;
+    XStxIAudioDecoder mAudioDecoder;
+    XStxIAudioRenderer mAudioRenderer;
+
+    mud::ThreadsafeQueue<XStxRawAudioFrame *> mAudioQueue;
+
+    /** acquire() calls not yet released */
+    uint32_t mUsers;
+
+    mud::SimpleLock mAudioStateLock;
+    bool mAudioStarted;
+    bool mAudioStopped;
+    uint32_t mAudioUnderruns;
+};
+
+#endif //_included_ReplayClient_h
@@ -0,0 +1,480 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "ReplayHarness.h"
+#include "../AudioRenderer.h"
+#include "../StreamRecorder.h"
+#include "../VideoPipeline.h"
+
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <algorithm>
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "ReplayHarness"
+#include "log.h"
+
+/** Longest an as-fast-as-possible replay waits for a pool frame */
+static const uint32_t POOL_WAIT_MS = 1000;
+
+/** A real-time record delivered this much past its time counts as late */
+static const uint64_t LATE_THRESHOLD_US = 10000;
+
+/** Gap between the last record of a loop and the first of the next */
+static const uint64_t LOOP_GAP_US = 10000;
+
+static uint64_t nowUs()
+{
+    return mud::TimeVal::mono().toMicroSeconds();
+}
+
+ReplayHarness::Options::Options()
+    : mRealTime(false)
+    , mLoops(1)
+    , mVideo(true)
+    , mAudio(true)
+    , mWidth(1280)
+    , mHeight(720)
+    , mRenderStallMs(33)
+{
+}
+
+ReplayHarness::StreamStats::StreamStats()
+    : mFrames(0)
+    , mDecoded(0)
+    , mPending(0)
+    , mErrors(0)
+    , mPoolExhausted(0)
+    , mDropped(0)
+    , mRenderStalls(0)
+    , mLate(0)
+{
+}
+
+ReplayHarness::ReplayHarness(const Options &options)
+    : mOptions(options)
+    , mVideoRenderer(NULL)
+    , mCaptureSink(NULL)
+    , mRenderThread("ReplayRender", *this)
+    , mStopRendering(false)
+    , mStarted(false)
+    , mFramesDrawn(0)
+    , mElapsedUs(0)
+    , mMediaUs(0)
+{
+}
+
+ReplayHarness::~ReplayHarness()
+{
+    shutdown();
+
+    // the modules don't own the video renderer
+    delete mVideoRenderer;
+
+    // nothing renders any more, so everything captured can be flushed
+    delete mCaptureSink;
+}
+
+bool ReplayHarness::init()
+{
+    mVideoRenderer = newVideoRenderer();
+    if (mVideoRenderer == NULL)
+    {
+        return false;
+    }
+    mCaptureSink = CaptureSink::createFromEnvironment();
+    mVideoRenderer->setCaptureSink(mCaptureSink);
+    mAudioModule.setCaptureSink(mCaptureSink);
+    if (!mVideoModule.initialize(mClient.getHandle(), *mVideoRenderer) ||
+        !mAudioModule.initialize(mClient.getHandle()))
+    {
+        LOGE("Failed to initialize the pipelines");
+        return false;
+    }
+    mVideoRenderer->init();
+    mVideoRenderer->setDisplayDimensions(mOptions.mWidth, mOptions.mHeight);
+
+    // Without pacing there is nobody to play to; decoded audio is
+    // recycled straight away instead
+    if (mClient.startPipelines(mOptions.mWidth, mOptions.mHeight,
+                               mOptions.mRealTime && mOptions.mAudio)
+        != XSTX_RESULT_OK)
+    {
+        return false;
+    }
+
+    mStarted = true;
+    mRenderThread.start();
+    return true;
+}
+
+bool ReplayHarness::run(StreamReader &reader)
+{
+    if (!mStarted)
+    {
+        return false;
+    }
+
+    StreamReader::Record record;
+    uint64_t startUs = nowUs();
+    uint64_t firstTimestampUs = 0;
+    // media time at which the current loop starts
+    uint64_t loopStartUs = 0;
+    bool complete = true;
+
+    for (uint32_t loop = 0; loop < mOptions.mLoops; loop++)
+    {
+        if (loop > 0 && !reader.rewind())
+        {
+            complete = false;
+            break;
+        }
+
+        bool first = true;
+        uint64_t loopFirstUs = 0;
+        uint64_t loopLengthUs = 0;
+        while (reader.readRecord(record))
+        {
+            if (first)
+            {
+                loopFirstUs = record.mTimestampUs;
+                if (loop == 0)
+                {
+                    firstTimestampUs = record.mTimestampUs;
+                }
+                first = false;
+            }
+
+            // audio and video are interleaved in arrival order, so a
+            // timestamp may be slightly behind the first one of the loop
+            uint64_t offsetUs = record.mTimestampUs > loopFirstUs ?
+                record.mTimestampUs - loopFirstUs : 0;
+            loopLengthUs = std::max(loopLengthUs, offsetUs);
+
+            // Later loops continue the timeline instead of jumping back
+            uint64_t mediaUs = loopStartUs + offsetUs;
+            uint64_t arrivalUs = nowUs();
+            if (mOptions.mRealTime)
+            {
+                uint64_t dueUs = startUs + mediaUs;
+                if (arrivalUs < dueUs)
+                {
+                    mud::ThreadUtil::sleep((uint32_t)((dueUs - arrivalUs + 999) / 1000));
+                }
+                else if (arrivalUs - dueUs > LATE_THRESHOLD_US)
+                {
+                    (record.mStream == StreamRecorder::STREAM_VIDEO ?
+                        mVideoStats : mAudioStats).mLate++;
+                }
+                arrivalUs = dueUs;
+            }
+
+            if (record.mStream == StreamRecorder::STREAM_VIDEO)
+            {
+                if (mOptions.mVideo && !record.mData.empty())
+                {
+                    replayVideo(record, firstTimestampUs + mediaUs, arrivalUs);
+                }
+            }
+            else if (record.mStream == StreamRecorder::STREAM_AUDIO)
+            {
+                if (mOptions.mAudio)
+                {
+                    replayAudio(record, firstTimestampUs + mediaUs, arrivalUs);
+                }
+            }
+        }
+        if (first)
+        {
+            LOGE("The recording has no records");
+            complete = false;
+            break;
+        }
+        loopStartUs += loopLengthUs + LOOP_GAP_US;
+        mMediaUs = loopStartUs - LOOP_GAP_US;
+    }
+
+    // Let the audio renderer play out what is queued
+    for (uint32_t waited = 0;
+         mClient.getQueuedAudioFrames() > 0 && waited < POOL_WAIT_MS; waited += 10)
+    {
+        mud::ThreadUtil::sleep(10);
+    }
+
+    mElapsedUs = nowUs() - startUs;
+    return complete;
+}
+
+void ReplayHarness::replayVideo(StreamReader::Record &record,
+                                uint64_t timestampUs, uint64_t arrivalUs)
+{
+    const XStxIRawVideoFrameAllocator &allocator = mClient.getVideoFrameAllocator();
+    const XStxIVideoDecoder &decoder = mClient.getVideoDecoder();
+    const XStxIVideoRenderer &renderer = mClient.getVideoRenderer();
+
+    mVideoStats.mFrames++;
+    XStxRawVideoFrame *frame = getVideoFrame(mVideoStats);
+    if (frame == NULL)
+    {
+        mVideoStats.mDropped++;
+        return;
+    }
+
+    XStxEncodedVideoFrame encoded;
+    memset(&encoded, 0, sizeof(encoded));
+    encoded.mData = &record.mData[0];
+    encoded.mDataSize = (uint32_t)record.mData.size();
+    encoded.mTimestampUs = timestampUs;
+
+    uint64_t decodeStartUs = nowUs();
+    XStxResult result = decoder.mDecodeVideoFrameFcn(
+        decoder.mDecodeVideoFrameCtx, &encoded, frame);
+    uint64_t decodeEndUs = nowUs();
+    mVideoStats.mDecodeUs.add(decodeEndUs - decodeStartUs);
+
+    if (result == XSTX_RESULT_OK)
+    {
+        mVideoStats.mDecoded++;
+
+        // blocks until the render thread picks the frame up
+        renderer.mRenderVideoFrameFcn(renderer.mRenderVideoFrameCtx, frame);
+        uint64_t renderEndUs = nowUs();
+        mVideoStats.mRenderUs.add(renderEndUs - decodeEndUs);
+        if (renderEndUs - decodeEndUs > mOptions.mRenderStallMs * 1000ULL)
+        {
+            mVideoStats.mRenderStalls++;
+        }
+        mVideoStats.mTotalUs.add(renderEndUs - arrivalUs);
+    }
+    else if (result == XSTX_RESULT_FRAME_NOT_AVAILABLE)
+    {
+        // buffered by the decoder, or handed to its own thread
+        mVideoStats.mPending++;
+    }
+    else
+    {
+        mVideoStats.mErrors++;
+    }
+
+    allocator.mRecycleVideoFrameBufferFcn(
+        allocator.mRecycleVideoFrameBufferCtx, frame);
+}
+
+void ReplayHarness::replayAudio(StreamReader::Record &record,
+                                uint64_t timestampUs, uint64_t arrivalUs)
+{
+    const XStxIRawAudioFrameAllocator &allocator = mClient.getAudioFrameAllocator();
+    const XStxIAudioDecoder &decoder = mClient.getAudioDecoder();
+
+    mAudioStats.mFrames++;
+    XStxRawAudioFrame *frame = getAudioFrame(mAudioStats);
+    if (frame == NULL)
+    {
+        mAudioStats.mDropped++;
+        return;
+    }
+
+    // An empty record is a lost packet; the decoder conceals it
+    XStxEncodedAudioFrame encoded;
+    memset(&encoded, 0, sizeof(encoded));
+    if (!record.mData.empty())
+    {
+        encoded.mData = &record.mData[0];
+        encoded.mDataSize = (uint32_t)record.mData.size();
+    }
+    encoded.mTimestampUs = timestampUs;
+
+    uint64_t decodeStartUs = nowUs();
+    XStxResult result = decoder.mDecodeAudioFrameFcn(
+        decoder.mDecodeAudioFrameCtx, &encoded, frame);
+    uint64_t decodeEndUs = nowUs();
+    mAudioStats.mDecodeUs.add(decodeEndUs - decodeStartUs);
+
+    if (result != XSTX_RESULT_OK)
+    {
+        mAudioStats.mErrors++;
+    }
+    else
+    {
+        mAudioStats.mDecoded++;
+        mAudioStats.mTotalUs.add(decodeEndUs - arrivalUs);
+        if (mOptions.mRealTime && mClient.queueAudioFrame(frame))
+        {
+            return;
+        }
+        if (mOptions.mRealTime)
+        {
+            mAudioStats.mDropped++;
+        }
+    }
+
+    allocator.mRecycleAudioFrameBufferFcn(
+        allocator.mRecycleAudioFrameBufferCtx, frame);
+}
+
+XStxRawVideoFrame *ReplayHarness::getVideoFrame(StreamStats &stats)
+{
+    const XStxIRawVideoFrameAllocator &allocator = mClient.getVideoFrameAllocator();
+
+    XStxRawVideoFrame *frame = NULL;
+    if (allocator.mGetVideoFrameBufferFcn(allocator.mGetVideoFrameBufferCtx,
+            mOptions.mWidth, mOptions.mHeight, &frame) == XSTX_RESULT_OK)
+    {
+        return frame;
+    }
+    stats.mPoolExhausted++;
+
+    // A live session drops the frame; otherwise wait for one to come back
+    for (uint32_t waited = 0; !mOptions.mRealTime && waited < POOL_WAIT_MS; waited++)
+    {
+        mud::ThreadUtil::sleep(1);
+        if (allocator.mGetVideoFrameBufferFcn(allocator.mGetVideoFrameBufferCtx,
+                mOptions.mWidth, mOptions.mHeight, &frame) == XSTX_RESULT_OK)
+        {
+            return frame;
+        }
+    }
+    return NULL;
+}
+
+XStxRawAudioFrame *ReplayHarness::getAudioFrame(StreamStats &stats)
+{
+    const XStxIRawAudioFrameAllocator &allocator = mClient.getAudioFrameAllocator();
+
+    XStxRawAudioFrame *frame = NULL;
+    if (allocator.mGetAudioFrameBufferFcn(allocator.mGetAudioFrameBufferCtx,
+            ReplayClient::AUDIO_FRAME_SIZE, &frame) == XSTX_RESULT_OK)
+    {
+        return frame;
+    }
+    stats.mPoolExhausted++;
+
+    for (uint32_t waited = 0; !mOptions.mRealTime && waited < POOL_WAIT_MS; waited++)
+    {
+        mud::ThreadUtil::sleep(1);
+        if (allocator.mGetAudioFrameBufferFcn(allocator.mGetAudioFrameBufferCtx,
+                ReplayClient::AUDIO_FRAME_SIZE, &frame) == XSTX_RESULT_OK)
+        {
+            return frame;
+        }
+    }
+    return NULL;
+}
+
+void ReplayHarness::renderLoop()
+{
+    while (!shouldStopRendering())
+    {
+        if (mVideoRenderer->isInitialized())
+        {
+            mFramesDrawn += mVideoRenderer->draw();
+        }
+        else
+        {
+            mud::ThreadUtil::sleep(5);
+        }
+    }
+}
+
+bool ReplayHarness::shouldStopRendering()
+{
+    mud::ScopeLock sl(mStopLock);
+    return mStopRendering;
+}
+
+void ReplayHarness::shutdown()
+{
+    if (!mStarted)
+    {
+        return;
+    }
+    mStarted = false;
+
+    // The audio renderer must stop pulling before its frames are reclaimed
+    if (mAudioModule.getRenderer() != NULL)
+    {
+        mAudioModule.getRenderer()->stop();
+    }
+    mClient.drainAudioFrames();
+
+    // Release a decoder thread blocked in postFrame() before joining it
+    mVideoRenderer->stop();
+    {
+        mud::ScopeLock sl(mStopLock);
+        mStopRendering = true;
+    }
+    mRenderThread.join();
+    mVideoModule.stop();
+}
+
+void ReplayHarness::report()
+{
+    double seconds = mElapsedUs / 1000000.0;
+    if (seconds <= 0)
+    {
+        return;
+    }
+
+    LOGI("[replay]={ \"Mode\":\"%s\", \"Loops\":%u, \"MediaSec\":%.3f, "
+         "\"ElapsedSec\":%.3f, \"Speed\":%.2f, \"FramesDrawn\":%u, "
+         "\"DrawnFps\":%.1f, \"AudioUnderruns\":%u }",
+         mOptions.mRealTime ? "realtime" : "fast", mOptions.mLoops,
+         mMediaUs / 1000000.0, seconds, mMediaUs / 1000000.0 / seconds,
+         mFramesDrawn, mFramesDrawn / seconds, mClient.getAudioUnderruns());
+    if (mOptions.mVideo)
+    {
+        reportStream("video", mVideoStats, seconds);
+    }
+    if (mOptions.mAudio)
+    {
+        reportStream("audio", mAudioStats, seconds);
+    }
+}
+
+void ReplayHarness::reportStream(const char *name, StreamStats &stats,
+                                 double seconds)
+{
+    LOGI("[replay]={ \"Stream\":\"%s\", \"Frames\":%u, \"Decoded\":%u, "
+         "\"DecodeFps\":%.1f, \"Pending\":%u, \"Errors\":%u, "
+         "\"PoolExhausted\":%u, \"Dropped\":%u, \"Late\":%u, "
+         "\"RenderStalls\":%u }",
+         name, stats.mFrames, stats.mDecoded, stats.mDecoded / seconds,
+         stats.mPending, stats.mErrors, stats.mPoolExhausted, stats.mDropped,
+         stats.mLate, stats.mRenderStalls);
+
+    LatencySamples *samples[] = { &stats.mDecodeUs, &stats.mRenderUs, &stats.mTotalUs };
+    const char *names[] = { "decode", "render", "total" };
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+    {
+        if (samples[i]->size() == 0)
+        {
+            continue;
+        }
+        LOGI("[replayLatency]={ \"Stream\":\"%s\", \"Stage\":\"%s\", "
+             "\"Samples\":%u, \"P50Ms\":%.3f, \"P95Ms\":%.3f, \"P99Ms\":%.3f, "
+             "\"MaxMs\":%.3f }",
+             name, names[i], (uint32_t)samples[i]->size(),
+             samples[i]->percentile(50) / 1000.0,
+             samples[i]->percentile(95) / 1000.0,
+             samples[i]->percentile(99) / 1000.0,
+             samples[i]->percentile(100) / 1000.0);
+    }
+}
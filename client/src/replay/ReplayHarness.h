@@ -0,0 +1,167 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_ReplayHarness_h
+#define _included_ReplayHarness_h
+
+#include <stdint.h>
+#include <vector>
+
+#include "MUD/threading/Thread.h"
+#include "MUD/threading/SimpleLock.h"
+
+#include "LatencySamples.h"
+#include "ReplayClient.h"
+#include "StreamReader.h"
+#include "../AudioModule.h"
+#include "../CaptureSink.h"
+#include "../VideoModule.h"
+#include "../VideoRenderer.h"
+
+/**
+ * Feeds a StreamRecorder capture through the real VideoModule and
+ * AudioModule callbacks, in the order and with the threading the XStx
+ * library uses: one thread allocates, decodes, renders and recycles
+ * video frames and decodes audio frames, a render thread draws, and the
+ * audio renderer pulls decoded audio with XStxGetNextAudioFrame().
+ *
+ * In real-time mode every record is delivered at its recorded timestamp
+ * and frames are dropped when the client can't keep up, as in a live
+ * session. Otherwise records are delivered as fast as the client
+ * accepts them, which measures decode throughput.
+ */
+class ReplayHarness
+{
+public:
+
+    /** Replay settings */
+    struct Options
+    {
+        Options();
+
+        /** Deliver records at their recorded timestamps */
+        bool mRealTime;
+        /** How many times to play the recording */
+        uint32_t mLoops;
+        bool mVideo;
+        bool mAudio;
+        /** Display and maximum stream resolution */
+        uint32_t mWidth;
+        uint32_t mHeight;
+        /** A render call blocking longer than this counts as a stall */
+        uint32_t mRenderStallMs;
+    };
+
+    /** Constructor */
+    ReplayHarness(const Options &options);
+
+    /** Destructor; shuts the pipelines down */
+    ~ReplayHarness();
+
+    /**
+     * Create the platform pipelines and start them the way the XStx
+     * library does when a session starts.
+     *
+     * @return true on success
+     */
+    bool init();
+
+    /**
+     * Replay every record of the capture file.
+     *
+     * @return true if the recording was played to the end
+     */
+    bool run(StreamReader &reader);
+
+    /** Stop the pipelines; called by the destructor if needed */
+    void shutdown();
+
+    /** Log the summary of the replay */
+    void report();
+
+    /** Render thread body */
+    void renderLoop();
+
+private:
+
+    DEFINE_METHOD_THREAD(RenderThread, ReplayHarness, renderLoop);
+
+    /** Counters of one stream */
+    struct StreamStats
+    {
+        StreamStats();
+
+        /** Records delivered to the pipeline */
+        uint32_t mFrames;
+        /** Decode calls that produced a frame */
+        uint32_t mDecoded;
+        /** Decode calls that returned no frame (buffered or async) */
+        uint32_t mPending;
+        uint32_t mErrors;
+        /** The frame pool had nothing to give */
+        uint32_t mPoolExhausted;
+        /** Records dropped because no frame could be allocated */
+        uint32_t mDropped;
+        /** Render calls that blocked longer than the stall threshold */
+        uint32_t mRenderStalls;
+        /** Real-time records delivered later than their timestamp allowed */
+        uint32_t mLate;
+
+        LatencySamples mDecodeUs;
+        LatencySamples mRenderUs;
+        LatencySamples mTotalUs;
+    };
+
+    void replayVideo(StreamReader::Record &record, uint64_t timestampUs,
+                     uint64_t arrivalUs);
+    void replayAudio(StreamReader::Record &record, uint64_t timestampUs,
+                     uint64_t arrivalUs);
+
+    /** Get a frame from a pool, waiting for one unless in real time */
+    XStxRawVideoFrame *getVideoFrame(StreamStats &stats);
+    XStxRawAudioFrame *getAudioFrame(StreamStats &stats);
+
+    void reportStream(const char *name, StreamStats &stats, double seconds);
+
+    bool shouldStopRendering();
+
+    Options mOptions;
+
+    ReplayClient mClient;
+    VideoRenderer *mVideoRenderer;
+    CaptureSink *mCaptureSink;
+    VideoModule mVideoModule;
+    AudioModule mAudioModule;
+
+    RenderThread mRenderThread;
+    mud::SimpleLock mStopLock;
+    bool mStopRendering;
+    bool mStarted;
+
+    /** Frames the render thread drew */
+    uint32_t mFramesDrawn;
+
+    StreamStats mVideoStats;
+    StreamStats mAudioStats;
+
+    /** Wall clock time spent replaying */
+    uint64_t mElapsedUs;
+    /** Media time covered by the replayed records */
+    uint64_t mMediaUs;
+};
+
+#endif //_included_ReplayHarness_h
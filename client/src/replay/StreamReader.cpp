@@ -0,0 +1,183 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include "StreamReader.h"
+#include "../StreamRecorder.h"
+
+#include <string.h>
+
+#undef LOG_TAG
+#define LOG_TAG "StreamReader"
+#include "log.h"
+
+/** Largest payload accepted before a record is treated as corrupt */
+static const uint32_t MAX_RECORD_SIZE = 16 * 1024 * 1024;
+
+static uint16_t getLE16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t getLE32(const uint8_t *in)
+{
+    return getLE16(in) | ((uint32_t)getLE16(in + 2) << 16);
+}
+
+static uint64_t getLE64(const uint8_t *in)
+{
+    return getLE32(in) | ((uint64_t)getLE32(in + 4) << 32);
+}
+
+StreamReader::StreamReader()
+    : mFile(NULL)
+    , mRecordsStart(0)
+    , mRecordsEnd(0)
+    , mPosition(0)
+    , mIndexEntries(0)
+{
+}
+
+StreamReader::~StreamReader()
+{
+    close();
+}
+
+bool StreamReader::open(const char *path)
+{
+    close();
+
+    mFile = fopen(path, "rb");
+    if (mFile == NULL)
+    {
+        LOGE("Can't open %s", path);
+        return false;
+    }
+
+    uint8_t header[StreamRecorder::FILE_HEADER_SIZE];
+    if (!readBytes(header, sizeof(header)) ||
+        memcmp(header, StreamRecorder::FILE_MAGIC,
+               sizeof(StreamRecorder::FILE_MAGIC)) != 0)
+    {
+        LOGE("%s is not a stream recording", path);
+        close();
+        return false;
+    }
+    if (getLE32(header + 8) != StreamRecorder::FILE_VERSION)
+    {
+        LOGE("%s has unsupported version %u", path, getLE32(header + 8));
+        close();
+        return false;
+    }
+    uint32_t headerSize = getLE32(header + 12);
+    if (headerSize < StreamRecorder::FILE_HEADER_SIZE)
+    {
+        LOGE("%s has a corrupt header", path);
+        close();
+        return false;
+    }
+
+    // The trailer tells where the records stop and the index starts
+    fseek(mFile, 0, SEEK_END);
+    uint64_t fileSize = (uint64_t)ftell(mFile);
+    mRecordsEnd = fileSize;
+    mIndexEntries = 0;
+
+    uint8_t trailer[StreamRecorder::TRAILER_SIZE];
+    if (fileSize >= headerSize + StreamRecorder::TRAILER_SIZE &&
+        fseek(mFile, (long)(fileSize - StreamRecorder::TRAILER_SIZE),
+              SEEK_SET) == 0 &&
+        readBytes(trailer, sizeof(trailer)) &&
+        memcmp(trailer + 12, StreamRecorder::INDEX_MAGIC,
+               sizeof(StreamRecorder::INDEX_MAGIC)) == 0)
+    {
+        uint64_t indexOffset = getLE64(trailer);
+        uint32_t entries = getLE32(trailer + 8);
+        if (indexOffset >= headerSize &&
+            indexOffset + (uint64_t)entries * StreamRecorder::INDEX_ENTRY_SIZE
+                + StreamRecorder::TRAILER_SIZE == fileSize)
+        {
+            mRecordsEnd = indexOffset;
+            mIndexEntries = entries;
+        }
+    }
+    if (mRecordsEnd == fileSize)
+    {
+        LOGW("%s has no index; reading up to the last complete record", path);
+    }
+
+    mRecordsStart = headerSize;
+    return rewind();
+}
+
+void StreamReader::close()
+{
+    if (mFile != NULL)
+    {
+        fclose(mFile);
+        mFile = NULL;
+    }
+}
+
+bool StreamReader::rewind()
+{
+    if (mFile == NULL)
+    {
+        return false;
+    }
+    mPosition = mRecordsStart;
+    return fseek(mFile, (long)mPosition, SEEK_SET) == 0;
+}
+
+bool StreamReader::readRecord(Record &record)
+{
+    if (mFile == NULL ||
+        mPosition + StreamRecorder::RECORD_HEADER_SIZE > mRecordsEnd)
+    {
+        return false;
+    }
+
+    uint8_t header[StreamRecorder::RECORD_HEADER_SIZE];
+    if (!readBytes(header, sizeof(header)))
+    {
+        return false;
+    }
+    uint32_t size = getLE32(header + 4);
+    if (size > MAX_RECORD_SIZE ||
+        mPosition + sizeof(header) + size > mRecordsEnd)
+    {
+        LOGW("Truncated record at offset %llu", (unsigned long long)mPosition);
+        return false;
+    }
+
+    record.mStream = header[0];
+    record.mFlags = header[1];
+    record.mTimestampUs = getLE64(header + 8);
+    record.mData.resize(size);
+    if (size > 0 && !readBytes(&record.mData[0], size))
+    {
+        return false;
+    }
+
+    mPosition += sizeof(header) + size;
+    return true;
+}
+
+bool StreamReader::readBytes(void *data, size_t size)
+{
+    return fread(data, 1, size, mFile) == size;
+}
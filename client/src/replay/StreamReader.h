@@ -0,0 +1,94 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_StreamReader_h
+#define _included_StreamReader_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/**
+ * Reads a capture file written by StreamRecorder one record at a time.
+ * Files without a trailer (the recording client didn't shut down
+ * cleanly) are read up to the last complete record.
+ */
+class StreamReader
+{
+public:
+
+    /** One record of the capture file */
+    struct Record
+    {
+        /** StreamRecorder::EStream */
+        uint8_t mStream;
+        /** StreamRecorder::EFlags */
+        uint8_t mFlags;
+        /** Timestamp the frame was delivered with, in microseconds */
+        uint64_t mTimestampUs;
+        /** Payload; Annex-B H.264 or one Opus packet */
+        std::vector<uint8_t> mData;
+    };
+
+    /** Constructor */
+    StreamReader();
+
+    /** Destructor; closes the file */
+    ~StreamReader();
+
+    /**
+     * Open a capture file and validate its header and trailer.
+     *
+     * @param[in] path file to read
+     * @return true on success
+     */
+    bool open(const char *path);
+
+    /** Close the file */
+    void close();
+
+    /**
+     * Read the next record.
+     *
+     * @param[out] record filled in with the record; its buffer is reused
+     * @return false at the end of the records (or on a truncated record)
+     */
+    bool readRecord(Record &record);
+
+    /**
+     * Start reading from the first record again.
+     */
+    bool rewind();
+
+    /** @return number of keyframes listed in the index (0 if none) */
+    uint32_t getIndexEntries() const { return mIndexEntries; }
+
+private:
+
+    bool readBytes(void *data, size_t size);
+
+    FILE *mFile;
+    /** Offset of the first record */
+    uint64_t mRecordsStart;
+    /** Offset at which records end: the index, or the end of the file */
+    uint64_t mRecordsEnd;
+    /** Offset of the next record */
+    uint64_t mPosition;
+    uint32_t mIndexEntries;
+};
+
+#endif //_included_StreamReader_h
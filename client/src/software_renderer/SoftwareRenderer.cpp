@@ -0,0 +1,537 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "SoftwareRenderer.h"
+#include "YuvToBgra.h"
+
+#include "MUD/base/TimeVal.h"
+#include "MUD/threading/ScopeLock.h"
+#include "MUD/threading/ThreadUtil.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#undef LOG_TAG
+#define LOG_TAG "SoftwareRenderer"
+#include "log.h"
+
+namespace
+{
+
+/** Alignment of framebuffer rows and of the pixels in shared memory. */
+const uint32_t FRAMEBUFFER_ALIGNMENT = 64;
+
+inline void memoryBarrier()
+{
+#ifdef _WIN32
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+/**
+ * Build a nearest-neighbour map from destination to source positions.
+ */
+void buildMap(std::vector<uint32_t> &map, uint32_t dst, uint32_t src,
+              uint32_t divisor)
+{
+    map.resize(dst);
+    for (uint32_t i = 0; i < dst; i++)
+    {
+        uint32_t s = (uint32_t)(((2 * (uint64_t)i + 1) * src) / (2 * (uint64_t)dst));
+        if (s >= src)
+        {
+            s = src - 1;
+        }
+        map[i] = s / divisor;
+    }
+}
+
+} // namespace
+
+
+//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//
+//          Band worker
+//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//
+
+SoftwareRenderer::BandWorker::BandWorker(SoftwareRenderer &renderer,
+                                         uint32_t band) :
+    mRenderer(renderer),
+    mBand(band),
+    mThread("SoftwareRendererBand", *this)
+{
+}
+
+void SoftwareRenderer::BandWorker::kick()
+{
+    mStart.lock();
+    mStart.signal();
+    mStart.unlock();
+}
+
+void SoftwareRenderer::BandWorker::workLoop()
+{
+    for (;;)
+    {
+        mStart.waitForSignalAndLock();
+        mStart.unlock();
+
+        if (mRenderer.mStopWorkers)
+        {
+            return;
+        }
+        mRenderer.convertBand(mBand);
+        mRenderer.bandFinished();
+    }
+}
+
+
+//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//
+//          Software renderer
+//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//\\//
+
+/** Constructor */
+SoftwareRenderer::SoftwareRenderer() :
+    mThreadCount(1),
+    mStopWorkers(false),
+    mPendingBands(0),
+    mShmBase(NULL),
+    mShmSize(0),
+    mShmHeader(NULL),
+    mFramebuffer(NULL),
+    mFramebufferAllocation(NULL),
+    mFbWidth(0),
+    mFbHeight(0),
+    mFbStride(0),
+    mMapSourceWidth(0),
+    mMapSourceHeight(0),
+    mMapWidth(0),
+    mMapHeight(0),
+    mMapWidthOffset(0),
+    mMapHeightOffset(0),
+    mMapYuv444(false),
+    mChromaSampling(XSTX_CHROMA_SAMPLING_YUV420),
+    mFrameCount(0)
+{
+    const char *shmName = getenv("XSTX_SOFTWARE_RENDERER_SHM");
+    if (shmName != NULL)
+    {
+        mShmName = shmName;
+    }
+
+    mThreadCount = mud::ThreadUtil::getProcessorCount();
+    const char *threads = getenv("XSTX_SOFTWARE_RENDERER_THREADS");
+    if (threads != NULL && atoi(threads) > 0)
+    {
+        mThreadCount = (uint32_t)atoi(threads);
+    }
+    if (mThreadCount > MAX_THREADS)
+    {
+        mThreadCount = MAX_THREADS;
+    }
+}
+
+/** Destructor */
+SoftwareRenderer::~SoftwareRenderer()
+{
+    stop();
+
+    mStopWorkers = true;
+    for (size_t i = 0; i < mWorkers.size(); i++)
+    {
+        mWorkers[i]->kick();
+        mWorkers[i]->join();
+        delete mWorkers[i];
+    }
+    mWorkers.clear();
+
+    releaseFramebuffer();
+}
+
+bool SoftwareRenderer::init()
+{
+    if (!mWorkers.empty() || mThreadCount == 1)
+    {
+        return true;
+    }
+
+    // The render thread converts band 0 itself
+    for (uint32_t band = 1; band < mThreadCount; band++)
+    {
+        BandWorker *worker = new(std::nothrow) BandWorker(*this, band);
+        if (worker == NULL)
+        {
+            LOGE("Failed to create band worker");
+            break;
+        }
+        mWorkers.push_back(worker);
+        worker->start();
+    }
+    mThreadCount = (uint32_t)mWorkers.size() + 1;
+    mScratch.resize(mThreadCount);
+
+    LOGI("Software renderer: %s kernels, %u threads%s%s",
+         yuv::implementationName(), mThreadCount,
+         mShmName.empty() ? "" : ", shared memory ",
+         mShmName.c_str());
+    return true;
+}
+
+int SoftwareRenderer::draw()
+{
+    int nFrameRendered = checkQueue();
+    if (nFrameRendered == 0)
+    {
+        mud::ThreadUtil::sleep(1);
+    }
+    return nFrameRendered;
+}
+
+bool SoftwareRenderer::isChromaSamplingSupported(XStxChromaSampling chromaSampling)
+{
+    return chromaSampling == XSTX_CHROMA_SAMPLING_YUV420
+        || chromaSampling == XSTX_CHROMA_SAMPLING_YUV444;
+}
+
+bool SoftwareRenderer::receivedClientConfiguration(const XStxClientConfiguration* config)
+{
+    mChromaSampling = config->mChromaSampling;
+    if (mChromaSampling == XSTX_CHROMA_SAMPLING_YUV444)
+    {
+        mDecodeType = VideoDecoder::DECODE_PLANES444;
+    }
+    return isChromaSamplingSupported(mChromaSampling);
+}
+
+const uint8_t* SoftwareRenderer::lockFramebuffer(uint32_t &width,
+                                                 uint32_t &height,
+                                                 uint32_t &stride)
+{
+    mFramebufferLock.lock();
+    width = mFbWidth;
+    height = mFbHeight;
+    stride = mFbStride;
+    return mFrameCount ? mFramebuffer : NULL;
+}
+
+void SoftwareRenderer::unlockFramebuffer()
+{
+    mFramebufferLock.unlock();
+}
+
+void SoftwareRenderer::render()
+{
+    // Frames that weren't decoded (e.g. the simulated headless decoder)
+    // carry no pictures
+    if (mFrame == NULL || mFrame->mPlanes[0] == NULL)
+    {
+        return;
+    }
+
+    mud::TimeVal start = mud::TimeVal::mono();
+
+    mFramebufferLock.lock();
+
+    if (!updateGeometry())
+    {
+        mFramebufferLock.unlock();
+        return;
+    }
+
+    if (mShmHeader != NULL)
+    {
+        mShmHeader->mSequence++;
+        memoryBarrier();
+    }
+
+    if (!mWorkers.empty())
+    {
+        mBandsDone.lock();
+        mPendingBands = (uint32_t)mWorkers.size();
+        mBandsDone.unlock();
+
+        for (size_t i = 0; i < mWorkers.size(); i++)
+        {
+            mWorkers[i]->kick();
+        }
+    }
+
+    convertBand(0);
+
+    if (!mWorkers.empty())
+    {
+        bool done = false;
+        while (!done)
+        {
+            mBandsDone.waitForSignalAndLock();
+            done = (mPendingBands == 0);
+            mBandsDone.unlock();
+        }
+    }
+
+    mFrameCount++;
+    if (mShmHeader != NULL)
+    {
+        mShmHeader->mTimestampUs = mFrame->mTimestampUs;
+        mShmHeader->mFrameCount = mFrameCount;
+        memoryBarrier();
+        mShmHeader->mSequence++;
+    }
+
+    mFramebufferLock.unlock();
+
+    mRenderTimeUs.add((double)start.elapsedMono().toMicroSeconds());
+    if (mRenderTimeUs.count() >= STATS_INTERVAL_FRAMES)
+    {
+        LOGV("[software renderer]={ \"Kernels\":\"%s\", \"Threads\":%u, "
+             "\"Source\":\"%ux%u\", \"Output\":\"%ux%u\", "
+             "\"MeanMs\":%.3f, \"MaxMs\":%.3f }",
+             yuv::implementationName(), mThreadCount,
+             mMapSourceWidth, mMapSourceHeight, mMapWidth, mMapHeight,
+             mRenderTimeUs.mean() / 1000.0, mRenderTimeUs.maximum() / 1000.0);
+        mRenderTimeUs.reset();
+    }
+}
+
+void SoftwareRenderer::bandFinished()
+{
+    mBandsDone.lock();
+    if (--mPendingBands == 0)
+    {
+        mBandsDone.signal();
+    }
+    mBandsDone.unlock();
+}
+
+void SoftwareRenderer::convertBand(uint32_t band)
+{
+    const XStxRawVideoFrame *frame = mFrame;
+    if (frame == NULL || frame->mPlanes[0] == NULL ||
+        mMapWidth == 0 || mMapHeight == 0)
+    {
+        return;
+    }
+
+    uint32_t first = (uint32_t)(((uint64_t)mMapHeight * band) / mThreadCount);
+    uint32_t last = (uint32_t)(((uint64_t)mMapHeight * (band + 1)) / mThreadCount);
+
+    BandScratch &scratch = mScratch[band];
+    bool sameWidth = (mMapWidth == frame->mWidth);
+
+    for (uint32_t row = first; row < last; row++)
+    {
+        uint32_t srcRow = mSourceRow[row];
+        uint32_t chromaRow = mMapYuv444 ? srcRow : srcRow / 2;
+
+        const uint8_t *y = frame->mPlanes[0] + (size_t)srcRow * frame->mStrides[0];
+        const uint8_t *u = frame->mPlanes[1] + (size_t)chromaRow * frame->mStrides[1];
+        const uint8_t *v = frame->mPlanes[2] + (size_t)chromaRow * frame->mStrides[2];
+
+        if (!sameWidth)
+        {
+            yuv::gatherRow(y, &mLumaX[0], &scratch.mY[0], mMapWidth);
+            yuv::gatherRow(u, &mChromaX[0], &scratch.mU[0], mMapWidth);
+            yuv::gatherRow(v, &mChromaX[0], &scratch.mV[0], mMapWidth);
+            y = &scratch.mY[0];
+            u = &scratch.mU[0];
+            v = &scratch.mV[0];
+        }
+        else if (!mMapYuv444)
+        {
+            uint32_t chromaWidth = (mMapWidth + 1) / 2;
+            yuv::expandRow2x(u, &scratch.mU[0], chromaWidth);
+            yuv::expandRow2x(v, &scratch.mV[0], chromaWidth);
+            u = &scratch.mU[0];
+            v = &scratch.mV[0];
+        }
+
+        uint8_t *out = mFramebuffer +
+            (size_t)(row + mMapHeightOffset) * mFbStride +
+            (size_t)mMapWidthOffset * 4;
+        yuv::convertRow444(y, u, v, out, mMapWidth);
+    }
+}
+
+bool SoftwareRenderer::updateGeometry()
+{
+    uint32_t displayWidth = mDisplayWidth ? mDisplayWidth : mFrame->mWidth;
+    uint32_t displayHeight = mDisplayHeight ? mDisplayHeight : mFrame->mHeight;
+    uint32_t width = mWidth ? mWidth : displayWidth;
+    uint32_t height = mHeight ? mHeight : displayHeight;
+    uint32_t widthOffset = mWidth ? mWidthOffset : 0;
+    uint32_t heightOffset = mHeight ? mHeightOffset : 0;
+    bool yuv444 = (mDecodeType == VideoDecoder::DECODE_PLANES444);
+
+    if (width + widthOffset > displayWidth || height + heightOffset > displayHeight)
+    {
+        // Viewport from a previous display size; wait for the rescale
+        return false;
+    }
+
+    if (displayWidth != mFbWidth || displayHeight != mFbHeight)
+    {
+        if (!allocateFramebuffer(displayWidth, displayHeight))
+        {
+            return false;
+        }
+        mMapWidth = 0;
+    }
+
+    if (mMapSourceWidth == mFrame->mWidth && mMapSourceHeight == mFrame->mHeight &&
+        mMapWidth == width && mMapHeight == height &&
+        mMapWidthOffset == widthOffset && mMapHeightOffset == heightOffset &&
+        mMapYuv444 == yuv444)
+    {
+        return true;
+    }
+
+    mMapSourceWidth = mFrame->mWidth;
+    mMapSourceHeight = mFrame->mHeight;
+    mMapWidth = width;
+    mMapHeight = height;
+    mMapWidthOffset = widthOffset;
+    mMapHeightOffset = heightOffset;
+    mMapYuv444 = yuv444;
+
+    buildMap(mLumaX, width, mMapSourceWidth, 1);
+    buildMap(mChromaX, width, mMapSourceWidth, yuv444 ? 1 : 2);
+    buildMap(mSourceRow, height, mMapSourceHeight, 1);
+
+    // Scratch rows get a spare sample for odd widths in expandRow2x()
+    if (mScratch.size() < mThreadCount)
+    {
+        mScratch.resize(mThreadCount);
+    }
+    for (size_t i = 0; i < mScratch.size(); i++)
+    {
+        mScratch[i].mY.resize(width + 1);
+        mScratch[i].mU.resize(width + 1);
+        mScratch[i].mV.resize(width + 1);
+    }
+
+    // The letterbox bars are outside the video rectangle; paint them once
+    clearFramebuffer();
+
+    LOGI("Software renderer geometry: source %ux%u -> %ux%u at %u,%u in %ux%u",
+         mMapSourceWidth, mMapSourceHeight, width, height,
+         widthOffset, heightOffset, displayWidth, displayHeight);
+    return true;
+}
+
+bool SoftwareRenderer::allocateFramebuffer(uint32_t width, uint32_t height)
+{
+    releaseFramebuffer();
+
+    uint32_t stride = (width * 4 + FRAMEBUFFER_ALIGNMENT - 1) &
+        ~(FRAMEBUFFER_ALIGNMENT - 1);
+    size_t pixelBytes = (size_t)stride * height;
+
+#ifndef _WIN32
+    if (!mShmName.empty())
+    {
+        mShmSize = FRAMEBUFFER_ALIGNMENT + pixelBytes;
+        int fd = shm_open(mShmName.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            LOGE("shm_open(%s) failed", mShmName.c_str());
+            return false;
+        }
+        if (ftruncate(fd, (off_t)mShmSize) != 0)
+        {
+            LOGE("ftruncate(%s) failed", mShmName.c_str());
+            close(fd);
+            return false;
+        }
+        void *base = mmap(NULL, mShmSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED)
+        {
+            LOGE("mmap(%s) failed", mShmName.c_str());
+            return false;
+        }
+        mShmBase = (uint8_t *)base;
+        mShmHeader = (SharedFramebufferHeader *)mShmBase;
+        mShmHeader->mMagic = SHARED_FRAMEBUFFER_MAGIC;
+        mShmHeader->mHeaderSize = FRAMEBUFFER_ALIGNMENT;
+        mShmHeader->mWidth = width;
+        mShmHeader->mHeight = height;
+        mShmHeader->mStride = stride;
+        mShmHeader->mSequence = 0;
+        mShmHeader->mTimestampUs = 0;
+        mShmHeader->mFrameCount = 0;
+        mFramebuffer = mShmBase + FRAMEBUFFER_ALIGNMENT;
+    }
+    else
+#endif
+    {
+        mFramebufferAllocation = new(std::nothrow) uint8_t[pixelBytes + FRAMEBUFFER_ALIGNMENT];
+        if (mFramebufferAllocation == NULL)
+        {
+            LOGE("Failed to allocate %ux%u framebuffer", width, height);
+            return false;
+        }
+        mFramebuffer = (uint8_t *)(((uintptr_t)mFramebufferAllocation +
+            FRAMEBUFFER_ALIGNMENT - 1) & ~(uintptr_t)(FRAMEBUFFER_ALIGNMENT - 1));
+    }
+
+    mFbWidth = width;
+    mFbHeight = height;
+    mFbStride = stride;
+    return true;
+}
+
+void SoftwareRenderer::releaseFramebuffer()
+{
+#ifndef _WIN32
+    if (mShmBase != NULL)
+    {
+        munmap(mShmBase, mShmSize);
+        mShmBase = NULL;
+        mShmHeader = NULL;
+        mShmSize = 0;
+    }
+#endif
+    delete[] mFramebufferAllocation;
+    mFramebufferAllocation = NULL;
+    mFramebuffer = NULL;
+    mFbWidth = 0;
+    mFbHeight = 0;
+    mFbStride = 0;
+}
+
+void SoftwareRenderer::clearFramebuffer()
+{
+    for (uint32_t row = 0; row < mFbHeight; row++)
+    {
+        uint32_t *pixel = (uint32_t *)(mFramebuffer + (size_t)row * mFbStride);
+        for (uint32_t col = 0; col < mFbWidth; col++)
+        {
+            pixel[col] = 0xFF000000; // opaque black, little endian BGRA
+        }
+    }
+}
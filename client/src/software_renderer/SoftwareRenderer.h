@@ -0,0 +1,231 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_SoftwareRenderer_h
+#define _included_SoftwareRenderer_h
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "VideoRenderer.h"
+#include "RunningStats.h"
+#include "MUD/threading/Thread.h"
+#include "MUD/threading/WaitableLock.h"
+#include "MUD/threading/SimpleLock.h"
+
+/**
+ * Header at the start of the shared memory framebuffer. A viewer maps
+ * the region, waits for mSequence to change to an even value, copies
+ * the pixels and checks that mSequence didn't change meanwhile.
+ */
+struct SharedFramebufferHeader
+{
+    uint32_t mMagic;                ///< SHARED_FRAMEBUFFER_MAGIC
+    uint32_t mHeaderSize;           ///< Offset of the pixels from the header.
+    uint32_t mWidth;                ///< Framebuffer width in pixels.
+    uint32_t mHeight;               ///< Framebuffer height in pixels.
+    uint32_t mStride;               ///< Bytes per framebuffer row.
+    volatile uint32_t mSequence;    ///< Odd while a frame is being written.
+    uint64_t mTimestampUs;          ///< Stream timestamp of the last frame.
+    uint64_t mFrameCount;           ///< Frames written so far.
+};
+
+static const uint32_t SHARED_FRAMEBUFFER_MAGIC = 0x42475241; // 'BGRA'
+
+/**
+ * A renderer that needs no GPU: converts YUV 4:2:0 or 4:4:4 frames
+ * into a BGRA framebuffer on the CPU.
+ *
+ * The framebuffer has the display dimensions; the video is scaled
+ * (nearest neighbour) into the rectangle computed by setScaleAndOffset()
+ * in the same pass as the colour conversion, so no intermediate image
+ * is written. Rows are split into bands converted in parallel by a
+ * small pool of worker threads.
+ *
+ * The framebuffer lives either in process memory (see lockFramebuffer())
+ * or, when XSTX_SOFTWARE_RENDERER_SHM names a POSIX shared memory
+ * object, in shared memory for an external viewer. The number of
+ * threads defaults to the number of cores (at most MAX_THREADS) and can
+ * be set with XSTX_SOFTWARE_RENDERER_THREADS.
+ */
+class SoftwareRenderer : public VideoRenderer
+{
+public:
+    /**
+     * Constructor.
+     */
+    SoftwareRenderer();
+
+    /**
+     * Destructor.
+     */
+    virtual ~SoftwareRenderer();
+
+    /**
+     * Start the worker threads.
+     *
+     * @return True on success.
+     */
+    virtual bool init();
+
+    /**
+     * Render a pending frame, if any, into the framebuffer.
+     *
+     * @return 1 if a new frame was drawn; 0 if not.
+     */
+    virtual int draw();
+
+    virtual bool isChromaSamplingSupported(XStxChromaSampling chromaSampling);
+
+    virtual bool receivedClientConfiguration(const XStxClientConfiguration* config);
+
+    /**
+     * Lock the framebuffer for reading. Must be paired with
+     * unlockFramebuffer().
+     *
+     * @param[out] width framebuffer width in pixels
+     * @param[out] height framebuffer height in pixels
+     * @param[out] stride bytes per row
+     *
+     * @return The BGRA pixels, or NULL if nothing has been rendered yet.
+     */
+    const uint8_t* lockFramebuffer(uint32_t &width, uint32_t &height,
+                                   uint32_t &stride);
+
+    /**
+     * Release the lock taken by lockFramebuffer().
+     */
+    void unlockFramebuffer();
+
+    /**
+     * Convert the rows of one band of the current frame. Called by the
+     * worker threads.
+     *
+     * @param[in] band index of the band
+     */
+    void convertBand(uint32_t band);
+
+    /**
+     * Called by a worker when its band is done.
+     */
+    void bandFinished();
+
+protected:
+    /**
+     * Convert mFrame into the framebuffer.
+     */
+    virtual void render();
+
+private:
+    /** Upper limit on conversion threads, including the render thread. */
+    static const uint32_t MAX_THREADS = 8;
+
+    /** How often (in frames) the render cost is logged. */
+    static const uint32_t STATS_INTERVAL_FRAMES = 300;
+
+    /**
+     * A thread that converts one band of rows per frame.
+     */
+    class BandWorker
+    {
+    public:
+        BandWorker(SoftwareRenderer &renderer, uint32_t band);
+
+        void start() { mThread.start(); }
+        void join() { mThread.join(); }
+
+        /** Tell the worker to convert its band (or to exit). */
+        void kick();
+
+        void workLoop();
+
+    private:
+        DEFINE_METHOD_THREAD(WorkerThread, BandWorker, workLoop);
+
+        SoftwareRenderer &mRenderer;
+        uint32_t mBand;
+        mud::WaitableLock mStart;
+        WorkerThread mThread;
+    };
+    friend class BandWorker;
+
+    /**
+     * Per-band scratch rows for resampled samples.
+     */
+    struct BandScratch
+    {
+        std::vector<uint8_t> mY;
+        std::vector<uint8_t> mU;
+        std::vector<uint8_t> mV;
+    };
+
+    /**
+     * (Re)create the framebuffer and the scale maps if the display or
+     * source geometry changed.
+     *
+     * @return false if the framebuffer couldn't be allocated.
+     */
+    bool updateGeometry();
+
+    bool allocateFramebuffer(uint32_t width, uint32_t height);
+    void releaseFramebuffer();
+    void clearFramebuffer();
+
+    uint32_t mThreadCount;
+    std::vector<BandWorker*> mWorkers;
+    std::vector<BandScratch> mScratch;
+    volatile bool mStopWorkers;
+
+    /** Counts outstanding bands; signalled when it reaches zero. */
+    mud::WaitableLock mBandsDone;
+    uint32_t mPendingBands;
+
+    /** Guards the framebuffer against readers while a frame is written. */
+    mud::SimpleLock mFramebufferLock;
+
+    std::string mShmName;
+    uint8_t *mShmBase;
+    size_t mShmSize;
+    SharedFramebufferHeader *mShmHeader;
+
+    uint8_t *mFramebuffer;
+    uint8_t *mFramebufferAllocation;
+    uint32_t mFbWidth;
+    uint32_t mFbHeight;
+    uint32_t mFbStride;
+
+    /** Geometry the maps were built for. */
+    uint32_t mMapSourceWidth;
+    uint32_t mMapSourceHeight;
+    uint32_t mMapWidth;
+    uint32_t mMapHeight;
+    uint32_t mMapWidthOffset;
+    uint32_t mMapHeightOffset;
+    bool mMapYuv444;
+
+    std::vector<uint32_t> mLumaX;       ///< Source column for each output column.
+    std::vector<uint32_t> mChromaX;     ///< Same, in chroma samples.
+    std::vector<uint32_t> mSourceRow;   ///< Source row for each output row.
+
+    XStxChromaSampling mChromaSampling;
+
+    uint64_t mFrameCount;
+    RunningStats mRenderTimeUs;
+};
+
+#endif //_included_SoftwareRenderer_h
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include "YuvToBgra.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define YUV_USE_AVX2 1
+#define YUV_USE_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YUV_USE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_USE_NEON 1
+#endif
+
+/**
+ * Fixed point coefficients, 6 fractional bits:
+ *   R = 1.1643 (Y - 16) + 1.5958 (V - 128)
+ *   G = 1.1643 (Y - 16) - 0.39173 (U - 128) - 0.81290 (V - 128)
+ *   B = 1.1643 (Y - 16) + 2.017 (U - 128)
+ * The luma term is (Y - 16) * 149 / 2 so that it stays inside 16 bits
+ * unsigned; sums saturate at 16 bits signed, which only happens for
+ * results far above 255 anyway.
+ */
+#define YUV_KY      149
+#define YUV_KRV     102
+#define YUV_KGU     (-25)
+#define YUV_KGV     (-52)
+#define YUV_KBU     129
+#define YUV_ROUND   32
+#define YUV_SHIFT   6
+
+namespace
+{
+
+inline int32_t saturate16(int32_t x)
+{
+    return x < -32768 ? -32768 : (x > 32767 ? 32767 : x);
+}
+
+inline uint8_t clamp8(int32_t x)
+{
+    return (uint8_t)(x < 0 ? 0 : (x > 255 ? 255 : x));
+}
+
+#if YUV_USE_SSE2
+/**
+ * Interleave 16 B, G and R samples with opaque alpha and store them.
+ */
+inline void storeBgra16(__m128i b8, __m128i g8, __m128i r8, uint8_t *bgra)
+{
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    __m128i bgLo = _mm_unpacklo_epi8(b8, g8);
+    __m128i bgHi = _mm_unpackhi_epi8(b8, g8);
+    __m128i raLo = _mm_unpacklo_epi8(r8, alpha);
+    __m128i raHi = _mm_unpackhi_epi8(r8, alpha);
+    _mm_storeu_si128((__m128i *)(bgra),      _mm_unpacklo_epi16(bgLo, raLo));
+    _mm_storeu_si128((__m128i *)(bgra + 16), _mm_unpackhi_epi16(bgLo, raLo));
+    _mm_storeu_si128((__m128i *)(bgra + 32), _mm_unpacklo_epi16(bgHi, raHi));
+    _mm_storeu_si128((__m128i *)(bgra + 48), _mm_unpackhi_epi16(bgHi, raHi));
+}
+#endif
+
+#if YUV_USE_AVX2
+/**
+ * Convert 16 pixels held as 16-bit lanes; returns 8-bit B, G, R.
+ */
+inline void convert16Avx2(const uint8_t *y, const uint8_t *u,
+                          const uint8_t *v, uint8_t *bgra)
+{
+    const __m256i k16 = _mm256_set1_epi16(16);
+    const __m256i k128 = _mm256_set1_epi16(128);
+
+    __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)y));
+    __m256i u16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)u));
+    __m256i v16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)v));
+
+    y16 = _mm256_sub_epi16(_mm256_max_epi16(y16, k16), k16);
+    __m256i c = _mm256_add_epi16(
+        _mm256_srli_epi16(_mm256_mullo_epi16(y16, _mm256_set1_epi16(YUV_KY)), 1),
+        _mm256_set1_epi16(YUV_ROUND));
+    __m256i du = _mm256_sub_epi16(u16, k128);
+    __m256i dv = _mm256_sub_epi16(v16, k128);
+
+    __m256i r = _mm256_srai_epi16(_mm256_adds_epi16(c,
+        _mm256_mullo_epi16(dv, _mm256_set1_epi16(YUV_KRV))), YUV_SHIFT);
+    __m256i g = _mm256_srai_epi16(_mm256_adds_epi16(
+        _mm256_adds_epi16(c, _mm256_mullo_epi16(du, _mm256_set1_epi16(YUV_KGU))),
+        _mm256_mullo_epi16(dv, _mm256_set1_epi16(YUV_KGV))), YUV_SHIFT);
+    __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(c,
+        _mm256_mullo_epi16(du, _mm256_set1_epi16(YUV_KBU))), YUV_SHIFT);
+
+    // packus works per 128-bit lane; gather the two useful quadwords
+    __m128i b8 = _mm256_castsi256_si128(
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(b, b), 0x08));
+    __m128i g8 = _mm256_castsi256_si128(
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(g, g), 0x08));
+    __m128i r8 = _mm256_castsi256_si128(
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), 0x08));
+
+    storeBgra16(b8, g8, r8, bgra);
+}
+#elif YUV_USE_SSE2
+/**
+ * Convert 8 pixels held as 16-bit lanes to 16-bit B, G, R.
+ */
+inline void convert8Sse2(__m128i y16, __m128i u16, __m128i v16,
+                         __m128i &b, __m128i &g, __m128i &r)
+{
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i k128 = _mm_set1_epi16(128);
+
+    y16 = _mm_sub_epi16(_mm_max_epi16(y16, k16), k16);
+    __m128i c = _mm_add_epi16(
+        _mm_srli_epi16(_mm_mullo_epi16(y16, _mm_set1_epi16(YUV_KY)), 1),
+        _mm_set1_epi16(YUV_ROUND));
+    __m128i du = _mm_sub_epi16(u16, k128);
+    __m128i dv = _mm_sub_epi16(v16, k128);
+
+    r = _mm_srai_epi16(_mm_adds_epi16(c,
+        _mm_mullo_epi16(dv, _mm_set1_epi16(YUV_KRV))), YUV_SHIFT);
+    g = _mm_srai_epi16(_mm_adds_epi16(
+        _mm_adds_epi16(c, _mm_mullo_epi16(du, _mm_set1_epi16(YUV_KGU))),
+        _mm_mullo_epi16(dv, _mm_set1_epi16(YUV_KGV))), YUV_SHIFT);
+    b = _mm_srai_epi16(_mm_adds_epi16(c,
+        _mm_mullo_epi16(du, _mm_set1_epi16(YUV_KBU))), YUV_SHIFT);
+}
+#endif
+
+} // namespace
+
+namespace yuv
+{
+
+void convertRow444Reference(const uint8_t *y, const uint8_t *u,
+                            const uint8_t *v, uint8_t *bgra,
+                            uint32_t width)
+{
+    for (uint32_t i = 0; i < width; i++)
+    {
+        int32_t luma = y[i] < 16 ? 0 : y[i] - 16;
+        int32_t c = ((luma * YUV_KY) >> 1) + YUV_ROUND;
+        int32_t du = (int32_t)u[i] - 128;
+        int32_t dv = (int32_t)v[i] - 128;
+
+        int32_t r = saturate16(c + YUV_KRV * dv) >> YUV_SHIFT;
+        int32_t g = saturate16(saturate16(c + YUV_KGU * du) + YUV_KGV * dv) >> YUV_SHIFT;
+        int32_t b = saturate16(c + YUV_KBU * du) >> YUV_SHIFT;
+
+        bgra[4 * i + 0] = clamp8(b);
+        bgra[4 * i + 1] = clamp8(g);
+        bgra[4 * i + 2] = clamp8(r);
+        bgra[4 * i + 3] = 255;
+    }
+}
+
+void convertRow444(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                   uint8_t *bgra, uint32_t width)
+{
+    uint32_t i = 0;
+
+#if YUV_USE_AVX2
+    for (; i + 16 <= width; i += 16)
+    {
+        convert16Avx2(y + i, u + i, v + i, bgra + 4 * i);
+    }
+#elif YUV_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= width; i += 16)
+    {
+        __m128i y8 = _mm_loadu_si128((const __m128i *)(y + i));
+        __m128i u8 = _mm_loadu_si128((const __m128i *)(u + i));
+        __m128i v8 = _mm_loadu_si128((const __m128i *)(v + i));
+
+        __m128i bLo, gLo, rLo, bHi, gHi, rHi;
+        convert8Sse2(_mm_unpacklo_epi8(y8, zero), _mm_unpacklo_epi8(u8, zero),
+                     _mm_unpacklo_epi8(v8, zero), bLo, gLo, rLo);
+        convert8Sse2(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi8(u8, zero),
+                     _mm_unpackhi_epi8(v8, zero), bHi, gHi, rHi);
+
+        storeBgra16(_mm_packus_epi16(bLo, bHi), _mm_packus_epi16(gLo, gHi),
+                    _mm_packus_epi16(rLo, rHi), bgra + 4 * i);
+    }
+#elif YUV_USE_NEON
+    const int16x8_t k16 = vdupq_n_s16(16);
+    const int16x8_t k128 = vdupq_n_s16(128);
+    for (; i + 8 <= width; i += 8)
+    {
+        int16x8_t y16 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+        int16x8_t du = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(u + i))), k128);
+        int16x8_t dv = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(v + i))), k128);
+
+        y16 = vsubq_s16(vmaxq_s16(y16, k16), k16);
+        int16x8_t c = vaddq_s16(
+            vreinterpretq_s16_u16(vshrq_n_u16(vreinterpretq_u16_s16(
+                vmulq_n_s16(y16, YUV_KY)), 1)),
+            vdupq_n_s16(YUV_ROUND));
+
+        int16x8_t r = vshrq_n_s16(vqaddq_s16(c, vmulq_n_s16(dv, YUV_KRV)), YUV_SHIFT);
+        int16x8_t g = vshrq_n_s16(vqaddq_s16(vqaddq_s16(c, vmulq_n_s16(du, YUV_KGU)),
+                                             vmulq_n_s16(dv, YUV_KGV)), YUV_SHIFT);
+        int16x8_t b = vshrq_n_s16(vqaddq_s16(c, vmulq_n_s16(du, YUV_KBU)), YUV_SHIFT);
+
+        uint8x8x4_t out;
+        out.val[0] = vqmovun_s16(b);
+        out.val[1] = vqmovun_s16(g);
+        out.val[2] = vqmovun_s16(r);
+        out.val[3] = vdup_n_u8(255);
+        vst4_u8(bgra + 4 * i, out);
+    }
+#endif
+
+    convertRow444Reference(y + i, u + i, v + i, bgra + 4 * i, width - i);
+}
+
+void expandRow2x(const uint8_t *src, uint8_t *dst, uint32_t count)
+{
+    uint32_t i = 0;
+
+#if YUV_USE_SSE2
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(s, s));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(s, s));
+    }
+#elif YUV_USE_NEON
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8x8x2_t pair;
+        pair.val[0] = vld1_u8(src + i);
+        pair.val[1] = pair.val[0];
+        vst2_u8(dst + 2 * i, pair);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        dst[2 * i] = src[i];
+        dst[2 * i + 1] = src[i];
+    }
+}
+
+void gatherRow(const uint8_t *src, const uint32_t *map, uint8_t *dst,
+               uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        dst[i] = src[map[i]];
+    }
+}
+
+const char *implementationName()
+{
+#if YUV_USE_AVX2
+    return "avx2";
+#elif YUV_USE_SSE2
+    return "sse2";
+#elif YUV_USE_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace yuv
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _included_YuvToBgra_h
+#define _included_YuvToBgra_h
+
+#include <stdint.h>
+
+/**
+ * Row kernels for converting planar YUV (BT.601, limited range, the
+ * same matrix the OpenGL and DirectX shaders use) to 32-bit BGRA.
+ *
+ * The arithmetic is 16-bit fixed point with 6 fractional bits, so every
+ * implementation (SSE2, AVX2, NEON and the portable one) produces
+ * bit-identical output. The vector implementation is selected at
+ * compile time from the target's instruction set macros.
+ */
+namespace yuv
+{
+
+/**
+ * Convert one row of full-resolution (4:4:4) samples.
+ *
+ * @param[in] y     luma samples
+ * @param[in] u     Cb samples, one per pixel
+ * @param[in] v     Cr samples, one per pixel
+ * @param[out] bgra destination, 4 bytes per pixel, alpha set to 255
+ * @param[in] width number of pixels
+ */
+void convertRow444(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                   uint8_t *bgra, uint32_t width);
+
+/**
+ * Portable version of convertRow444; the vector versions must match it
+ * exactly.
+ */
+void convertRow444Reference(const uint8_t *y, const uint8_t *u,
+                            const uint8_t *v, uint8_t *bgra,
+                            uint32_t width);
+
+/**
+ * Duplicate every sample, turning half a row of 4:2:0 chroma into a
+ * full row.
+ *
+ * @param[in] src   source samples
+ * @param[out] dst  destination, 2 * count samples
+ * @param[in] count number of source samples
+ */
+void expandRow2x(const uint8_t *src, uint8_t *dst, uint32_t count);
+
+/**
+ * Nearest-neighbour resample of a row through a precomputed index map.
+ *
+ * @param[in] src   source samples
+ * @param[in] map   source index for each destination sample
+ * @param[out] dst  destination samples
+ * @param[in] count number of destination samples
+ */
+void gatherRow(const uint8_t *src, const uint32_t *map, uint8_t *dst,
+               uint32_t count);
+
+/**
+ * @return The name of the compiled-in vector implementation.
+ */
+const char *implementationName();
+
+} // namespace yuv
+
+#endif //_included_YuvToBgra_h
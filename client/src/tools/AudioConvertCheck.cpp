@@ -0,0 +1,526 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "AudioChannelMixer.h"
+#include "AudioFormatConverter.h"
+#include "AudioRenderer.h"
+#include "AudioRingFeeder.h"
+#include "RawAudioFrameAllocator.h"
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+
+#undef LOG_TAG
+#define LOG_TAG "AppStreamAudioConvertCheck"
+#include "log.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/** Rate the decoder produces; every conversion starts from it */
+static const uint32_t INPUT_RATE = AudioRingFeeder::SAMPLING_RATE;
+
+/** Samples per channel in a decoded frame */
+static const uint32_t FRAME_SAMPLES =
+    AudioRingFeeder::SAMPLING_RATE * AudioRingFeeder::NUM_MS_PER_FRAME / 1000;
+
+/** Peak of the test tones */
+static const double TONE_AMPLITUDE = 10000.0;
+
+/** Tone the test renderer plays */
+static const double TONE_HZ = 1000.0;
+
+/**
+ * Output samples skipped before measuring, so the filter's start-up
+ * transient doesn't count as noise
+ */
+static const uint32_t SETTLE_SAMPLES = 200;
+
+/** Largest passband gain error accepted, in dB */
+static const double MAX_GAIN_ERROR_DB = 0.25;
+
+/** Largest error accepted from the channel mixer */
+static const int MAX_MIX_ERROR = 1;
+
+/** Largest error accepted in the tone frequency heard through the feeder */
+static const double MAX_FREQUENCY_ERROR = 0.005;
+
+/** Frames queued in the ring before the device starts pulling */
+static const uint32_t PRIME_FRAMES = 3;
+
+/** Frames in the test renderer's pool */
+static const uint32_t POOL_FRAMES = 8;
+
+/** What each resampler quality has to reach */
+struct QualityLimits
+{
+    AudioResampler::EQuality mQuality;
+    const char *mName;
+    /** Lowest signal to noise ratio of a passband tone, in dB */
+    double mMinSnrDb;
+    /** Highest level of a tone above the output Nyquist, in dB */
+    double mMaxAliasDb;
+};
+
+static const QualityLimits QUALITY_LIMITS[] =
+{
+    { AudioResampler::QUALITY_LOW, "low", 60.0, -50.0 },
+    { AudioResampler::QUALITY_MEDIUM, "medium", 75.0, -80.0 },
+    { AudioResampler::QUALITY_HIGH, "high", 75.0, -80.0 },
+};
+
+/**
+ * Output rates and tones to resample. A tone below the output Nyquist
+ * has to come through at unity gain and clean; one above it has to be
+ * filtered out.
+ */
+struct ResamplerCase
+{
+    uint32_t mOutputRate;
+    double mToneHz;
+};
+
+static const ResamplerCase RESAMPLER_CASES[] =
+{
+    { 44100, 1000.0 },
+    { 44100, 15000.0 },
+    { 44100, 23000.0 },
+    { 16000, 1000.0 },
+    { 16000, 12000.0 },
+    { 96000, 1000.0 },
+};
+
+/** One frame through the channel mixer and the samples expected out */
+struct MixerCase
+{
+    uint32_t mInputChannels;
+    uint32_t mOutputChannels;
+    int16_t mInput[AudioChannelMixer::MAX_CHANNELS];
+    int16_t mExpected[AudioChannelMixer::MAX_CHANNELS];
+};
+
+static const MixerCase MIXER_CASES[] =
+{
+    // Mono goes to both fronts
+    { 1, 2, { 1000 }, { 1000, 1000 } },
+    // Down to mono averages
+    { 2, 1, { 1000, 3000 }, { 2000 } },
+    // The LFE is left out of a mono downmix
+    { 6, 1, { 1000, 2000, 3000, 30000, 4000, 5000 }, { 3000 } },
+    // Extra outputs are silent
+    { 2, 6, { 1000, 3000 }, { 1000, 3000, 0, 0, 0, 0 } },
+    // Centre and surrounds fold in at -3 dB, scaled back to unity gain
+    { 6, 2, { 1000, 2000, 3000, 30000, 4000, 5000 }, { 2465, 3172 } },
+};
+
+/** Device formats the feeder is run at */
+struct DeviceCase
+{
+    uint32_t mRate;
+    uint32_t mChannels;
+};
+
+static const DeviceCase DEVICE_CASES[] =
+{
+    { 48000, 2 },
+    { 44100, 2 },
+    { 44100, 1 },
+    { 16000, 2 },
+    { 96000, 6 },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * A renderer whose frames are a continuous stereo tone made up on the
+ * spot, so the feeder can be checked without a client library or a
+ * device. The feeder pulls frames from it and recycles them back into
+ * its pool like any other renderer's.
+ */
+class ToneAudioRenderer : public AudioRenderer
+{
+public:
+    explicit ToneAudioRenderer(mud::FixedSizePool<XStxRawAudioFrame> &framePool) :
+        AudioRenderer(framePool, NULL),
+        mPhase(0.0),
+        mTimestampUs(0)
+    {
+    }
+
+    virtual XStxRawAudioFrame* popFrame(int delay, int msBuffer)
+    {
+        // Frames are made up on demand, so there is never a wait
+        (void)delay;
+        (void)msBuffer;
+
+        XStxRawAudioFrame *frame = NULL;
+        if (mFramePool.getElement(frame) != SIMPLE_RESULT_OK || frame == NULL)
+        {
+            return NULL;
+        }
+
+        int16_t *samples = reinterpret_cast<int16_t*>(frame->mData);
+        for (uint32_t i = 0; i < FRAME_SAMPLES; i++)
+        {
+            int16_t value = (int16_t)(TONE_AMPLITUDE * sin(mPhase));
+            samples[2 * i] = value;
+            samples[2 * i + 1] = value;
+            mPhase += 2 * M_PI * TONE_HZ / INPUT_RATE;
+        }
+        mPhase = fmod(mPhase, 2 * M_PI);
+
+        frame->mDataSize = FRAME_SAMPLES * AudioRingFeeder::NUM_CHANNELS * sizeof(int16_t);
+        frame->mTimestampUs = mTimestampUs;
+        mTimestampUs += AudioRingFeeder::NUM_MS_PER_FRAME * 1000;
+        return frame;
+    }
+
+    virtual XStxResult start() { return XSTX_RESULT_OK; }
+    virtual void pause(bool pause) { (void)pause; }
+    virtual void stop() { }
+
+private:
+    double mPhase;
+    uint64_t mTimestampUs;
+};
+
+static double toDb(double powerRatio)
+{
+    return 10.0 * log10(powerRatio > 0.0 ? powerRatio : 1e-30);
+}
+
+/**
+ * Resample a second of a stereo tone from INPUT_RATE, a frame at a time,
+ * and check the gain and noise of the left channel, or how much of the
+ * tone is left if it is above the output Nyquist.
+ *
+ * @return true if the output is within the limits for the quality
+ */
+static bool checkResampler(const QualityLimits &limits,
+                           const ResamplerCase &test)
+{
+    AudioFormatConverter converter;
+    if (!converter.init(INPUT_RATE, 2, test.mOutputRate, 2, limits.mQuality))
+    {
+        LOGE("Converter init failed for %u Hz, %s", test.mOutputRate,
+             limits.mName);
+        return false;
+    }
+
+    std::vector<int16_t> in(INPUT_RATE * 2);
+    for (uint32_t i = 0; i < INPUT_RATE; i++)
+    {
+        int16_t value = (int16_t)(TONE_AMPLITUDE *
+                                  sin(2 * M_PI * test.mToneHz * i / INPUT_RATE));
+        in[2 * i] = value;
+        in[2 * i + 1] = value;
+    }
+
+    std::vector<int16_t> out(
+        converter.getMaxOutputSamples(FRAME_SAMPLES) * 2 *
+        (INPUT_RATE / FRAME_SAMPLES + 1));
+    uint32_t numOut = 0;
+    for (uint32_t i = 0; i < INPUT_RATE; i += FRAME_SAMPLES)
+    {
+        numOut += converter.process(&in[2 * i], FRAME_SAMPLES, &out[2 * numOut]);
+    }
+    if (numOut <= SETTLE_SAMPLES)
+    {
+        LOGE("Converter returned only %u samples", numOut);
+        return false;
+    }
+
+    uint32_t numMeasured = numOut - SETTLE_SAMPLES;
+    double inputPower = TONE_AMPLITUDE * TONE_AMPLITUDE / 2;
+    double power = 0.0;
+    for (uint32_t i = SETTLE_SAMPLES; i < numOut; i++)
+    {
+        power += (double)out[2 * i] * out[2 * i];
+    }
+    power /= numMeasured;
+
+    bool aliasCase = test.mToneHz >= test.mOutputRate / 2.0;
+    bool pass;
+    double gainDb = toDb(power / inputPower);
+    double snrDb = 0.0;
+    if (aliasCase)
+    {
+        pass = gainDb <= limits.mMaxAliasDb;
+    }
+    else
+    {
+        // Fit the tone by least squares and take what's left as noise
+        double w = 2 * M_PI * test.mToneHz / test.mOutputRate;
+        double a = 0.0;
+        double b = 0.0;
+        for (uint32_t i = SETTLE_SAMPLES; i < numOut; i++)
+        {
+            a += out[2 * i] * sin(w * i);
+            b += out[2 * i] * cos(w * i);
+        }
+        a *= 2.0 / numMeasured;
+        b *= 2.0 / numMeasured;
+
+        double noise = 0.0;
+        for (uint32_t i = SETTLE_SAMPLES; i < numOut; i++)
+        {
+            double error = out[2 * i] - a * sin(w * i) - b * cos(w * i);
+            noise += error * error;
+        }
+        noise /= numMeasured;
+
+        snrDb = toDb(power / noise);
+        pass = fabs(gainDb) <= MAX_GAIN_ERROR_DB && snrDb >= limits.mMinSnrDb;
+    }
+
+    LOGI("[audioconvertcheck]={ \"Check\":\"resampler\", \"Quality\":\"%s\", "
+         "\"OutputRate\":%u, \"ToneHz\":%.0f, \"Taps\":%u, \"Samples\":%u, "
+         "\"%s\":%.2f, \"SnrDb\":%.1f, \"Pass\":%d }",
+         limits.mName, test.mOutputRate, test.mToneHz,
+         converter.getResamplerTaps(), numOut,
+         aliasCase ? "AliasDb" : "GainDb", gainDb, snrDb, pass ? 1 : 0);
+    return pass;
+}
+
+/**
+ * Mix one frame and compare it to the expected samples.
+ *
+ * @return true if every channel is within MAX_MIX_ERROR
+ */
+static bool checkMixer(const MixerCase &test)
+{
+    AudioChannelMixer mixer;
+    if (!mixer.init(test.mInputChannels, test.mOutputChannels))
+    {
+        LOGE("Mixer init failed for %u to %u channels",
+             test.mInputChannels, test.mOutputChannels);
+        return false;
+    }
+
+    int16_t out[AudioChannelMixer::MAX_CHANNELS];
+    mixer.process(test.mInput, 1, out);
+
+    bool pass = true;
+    for (uint32_t c = 0; c < test.mOutputChannels; c++)
+    {
+        if (abs(out[c] - test.mExpected[c]) > MAX_MIX_ERROR)
+        {
+            LOGE("Mixer %u to %u: channel %u is %d, expected %d",
+                 test.mInputChannels, test.mOutputChannels, c, out[c],
+                 test.mExpected[c]);
+            pass = false;
+        }
+    }
+
+    LOGI("[audioconvertcheck]={ \"Check\":\"mixer\", \"InputChannels\":%u, "
+         "\"OutputChannels\":%u, \"Pass\":%d }",
+         test.mInputChannels, test.mOutputChannels, pass ? 1 : 0);
+    return pass;
+}
+
+/**
+ * Play the test renderer's tone through an AudioRingFeeder at a device
+ * format, the way PortAudioRenderer does: a frame is queued for every
+ * device period, and the device side pulls one period at a time. The tone
+ * has to come out at its own frequency and level on the front channels,
+ * with silence on the rest, and without underruns or dropped samples.
+ *
+ * @return true if it does
+ */
+static bool checkFeeder(mud::FixedSizePool<XStxRawAudioFrame> &framePool,
+                        const DeviceCase &device,
+                        AudioResampler::EQuality quality, uint32_t numFrames)
+{
+    ToneAudioRenderer renderer(framePool);
+    AudioRingFeeder feeder(renderer);
+    if (!feeder.init(device.mRate, device.mChannels, quality))
+    {
+        LOGE("Feeder init failed for %u Hz, %u channels", device.mRate,
+             device.mChannels);
+        return false;
+    }
+
+    uint32_t period = device.mRate * AudioRingFeeder::NUM_MS_PER_FRAME / 1000;
+    std::vector<int16_t> buffer(period * device.mChannels);
+
+    // The front channels carry the tone; a mono device gets both
+    uint32_t toneChannels = device.mChannels < 2 ? device.mChannels : 2;
+    std::vector<int> peak(device.mChannels, 0);
+    uint32_t crossings = 0;
+    uint32_t measured = 0;
+    bool negative = false;
+    uint32_t missingFrames = 0;
+
+    for (uint32_t f = 0; f < numFrames + PRIME_FRAMES; f++)
+    {
+        XStxRawAudioFrame *frame = renderer.popFrame(0, 0);
+        if (frame == NULL)
+        {
+            missingFrames++;
+            continue;
+        }
+        feeder.queueFrame(frame);
+
+        if (f < PRIME_FRAMES)
+        {
+            continue;
+        }
+        feeder.fill(&buffer[0], period);
+
+        // Skip the first periods, while the resampler fills its history
+        if (f < 2 * PRIME_FRAMES)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < period; i++)
+        {
+            const int16_t *sample = &buffer[i * device.mChannels];
+            for (uint32_t c = 0; c < device.mChannels; c++)
+            {
+                int level = abs((int)sample[c]);
+                peak[c] = level > peak[c] ? level : peak[c];
+            }
+            if (measured > 0 && (sample[0] < 0) != negative)
+            {
+                crossings++;
+            }
+            negative = sample[0] < 0;
+            measured++;
+        }
+    }
+
+    double seconds = (double)measured / device.mRate;
+    double frequency = seconds > 0.0 ? crossings / 2.0 / seconds : 0.0;
+    bool pass = missingFrames == 0 &&
+                feeder.getUnderruns() == 0 &&
+                feeder.getDroppedSamples() == 0 &&
+                fabs(frequency - TONE_HZ) <= TONE_HZ * MAX_FREQUENCY_ERROR;
+
+    double minToneDb = 0.0;
+    for (uint32_t c = 0; c < device.mChannels; c++)
+    {
+        if (c < toneChannels)
+        {
+            double levelDb = toDb((double)peak[c] * peak[c] /
+                                  (TONE_AMPLITUDE * TONE_AMPLITUDE));
+            minToneDb = c == 0 || levelDb < minToneDb ? levelDb : minToneDb;
+            pass = pass && fabs(levelDb) <= MAX_GAIN_ERROR_DB;
+        }
+        else
+        {
+            pass = pass && peak[c] == 0;
+        }
+    }
+
+    LOGI("[audioconvertcheck]={ \"Check\":\"feeder\", \"DeviceRate\":%u, "
+         "\"DeviceChannels\":%u, \"Seconds\":%.2f, \"FrequencyHz\":%.1f, "
+         "\"ToneLevelDb\":%.2f, \"Underruns\":%u, \"DroppedSamples\":%u, "
+         "\"MissingFrames\":%u, \"BufferedMs\":%.1f, \"Pass\":%d }",
+         device.mRate, device.mChannels, seconds, frequency, minToneDb,
+         feeder.getUnderruns(), feeder.getDroppedSamples(), missingFrames,
+         feeder.getBufferedUs() / 1000.0, pass ? 1 : 0);
+    return pass;
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Checks the audio format conversion: the resampler's gain, noise\n"
+           "and alias rejection at every quality, the channel mixer's\n"
+           "matrices, and a tone played through AudioRingFeeder at several\n"
+           "device formats.\n"
+           "\n"
+           "  -q <quality>  resampler quality for the feeder checks: low,\n"
+           "                medium or high (default medium)\n"
+           "  -t <seconds>  audio played per feeder check (default 3)\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    AudioResampler::EQuality quality = AudioResampler::QUALITY_MEDIUM;
+    uint32_t seconds = 3;
+
+    int count = 1;
+    while (count < argc)
+    {
+        const char *arg = argv[count++];
+        bool hasValue = count < argc;
+        if (strcmp(arg, "-q") == 0 && hasValue)
+        {
+            quality = AudioResampler::qualityFromString(argv[count++], quality);
+        }
+        else if (strcmp(arg, "-t") == 0 && hasValue)
+        {
+            seconds = (uint32_t)atoi(argv[count++]);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (seconds == 0)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    uint32_t checks = 0;
+    uint32_t failures = 0;
+
+    for (uint32_t q = 0; q < ARRAY_SIZE(QUALITY_LIMITS); q++)
+    {
+        for (uint32_t r = 0; r < ARRAY_SIZE(RESAMPLER_CASES); r++)
+        {
+            checks++;
+            failures += checkResampler(QUALITY_LIMITS[q], RESAMPLER_CASES[r]) ? 0 : 1;
+        }
+    }
+
+    for (uint32_t m = 0; m < ARRAY_SIZE(MIXER_CASES); m++)
+    {
+        checks++;
+        failures += checkMixer(MIXER_CASES[m]) ? 0 : 1;
+    }
+
+    uint32_t frameBytes = FRAME_SAMPLES * AudioRingFeeder::NUM_CHANNELS * sizeof(int16_t);
+    shared_ptr<RawAudioFrameAllocator> allocator(new RawAudioFrameAllocator(frameBytes));
+    mud::FixedSizePool<XStxRawAudioFrame> framePool;
+    if (framePool.allocate(allocator, POOL_FRAMES) != SIMPLE_RESULT_OK)
+    {
+        LOGE("Could not allocate the frame pool");
+        return 1;
+    }
+
+    uint32_t numFrames = seconds * 1000 / AudioRingFeeder::NUM_MS_PER_FRAME;
+    for (uint32_t d = 0; d < ARRAY_SIZE(DEVICE_CASES); d++)
+    {
+        checks++;
+        failures += checkFeeder(framePool, DEVICE_CASES[d], quality, numFrames) ? 0 : 1;
+    }
+
+    LOGI("[audioconvertcheck]={ \"Checks\":%u, \"Failures\":%u }",
+         checks, failures);
+    return failures == 0 ? 0 : 1;
+}
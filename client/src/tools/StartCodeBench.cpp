@@ -0,0 +1,253 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "NALUtils.h"
+
+#include "MUD/base/TimeVal.h"
+
+#undef LOG_TAG
+#define LOG_TAG "AppStreamStartCodeBench"
+#include "log.h"
+
+/** Sizes of the synthesized IDR frames, in MB */
+static const uint32_t FRAME_SIZES_MB[] = { 1, 2, 3, 4, 5 };
+
+static const uint8_t SPS_NAL[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78 };
+static const uint8_t PPS_NAL[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+
+static uint64_t nowUs()
+{
+    return mud::TimeVal::mono().toMicroSeconds();
+}
+
+/** xorshift32, so every run scans the same bytes */
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : mState(seed != 0 ? seed : 1) { }
+
+    uint32_t next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+private:
+    uint32_t mState;
+};
+
+static void appendNAL(std::vector<uint8_t> &frame, const uint8_t *nal, uint32_t size)
+{
+    static const uint8_t START_CODE[] = { 0, 0, 0, 1 };
+    frame.insert(frame.end(), START_CODE, START_CODE + sizeof(START_CODE));
+    frame.insert(frame.end(), nal, nal + size);
+}
+
+/**
+ * Build an Annex-B access unit that looks like an encoder's IDR frame:
+ * SPS, PPS, then equal sized IDR slices of random payload with emulation
+ * prevention applied, so the only start codes are the real ones.
+ *
+ * @param[in] zeroPercent share of payload bytes forced to zero; real
+ * slices are full of them and they are what slows the scalar scan
+ */
+static void buildIDRFrame(std::vector<uint8_t> &frame, uint32_t size,
+                          uint32_t slices, uint32_t zeroPercent, Random &random)
+{
+    frame.clear();
+    frame.reserve(size + size / 64);
+    appendNAL(frame, SPS_NAL, sizeof(SPS_NAL));
+    appendNAL(frame, PPS_NAL, sizeof(PPS_NAL));
+
+    uint32_t sliceSize = size / slices;
+    for (uint32_t s = 0; s < slices; s++)
+    {
+        static const uint8_t SLICE_HEADER[] = { 0x65, 0x88, 0x84 };
+        appendNAL(frame, SLICE_HEADER, sizeof(SLICE_HEADER));
+
+        uint32_t zeros = 0;
+        for (uint32_t i = 0; i < sliceSize; i++)
+        {
+            uint32_t r = random.next();
+            uint8_t byte = (r % 100) < zeroPercent ? 0 : (uint8_t)(r >> 8);
+            if (zeros >= 2 && byte <= 3)
+            {
+                frame.push_back(3);
+                zeros = 0;
+            }
+            frame.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        // rbsp_trailing_bits, so the slice never ends in a zero
+        frame.push_back(0x80);
+    }
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &frame)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        LOGE("Cannot open %s", path);
+        return false;
+    }
+    uint8_t chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        frame.insert(frame.end(), chunk, chunk + got);
+    }
+    fclose(file);
+    return !frame.empty();
+}
+
+typedef uint8_t *(*FindStartFn)(uint8_t *start, uint8_t *end,
+                                uint8_t &nalUnitHeaderLength);
+
+/**
+ * Walk every NAL unit in the frame reps times.
+ *
+ * @param[out] nals NAL units found in one pass
+ * @return throughput in MB/s
+ */
+static double scan(FindStartFn find, std::vector<uint8_t> &frame,
+                   uint32_t reps, uint32_t &nals)
+{
+    uint8_t *end = &frame[0] + frame.size();
+    uint64_t startUs = nowUs();
+    for (uint32_t rep = 0; rep < reps; rep++)
+    {
+        nals = 0;
+        uint8_t headerLength;
+        uint8_t *p = &frame[0];
+        while ((p = find(p, end, headerLength)) != NULL)
+        {
+            nals++;
+        }
+    }
+    uint64_t elapsedUs = nowUs() - startUs;
+    if (elapsedUs == 0)
+    {
+        elapsedUs = 1;
+    }
+    return (double)frame.size() * reps / elapsedUs;
+}
+
+/** @return false if the scanners found different numbers of NAL units */
+static bool bench(const char *name, std::vector<uint8_t> &frame, uint32_t reps)
+{
+    uint32_t vectorNals = 0;
+    uint32_t referenceNals = 0;
+    double vectorRate = scan(findNALUnitStart, frame, reps, vectorNals);
+    double referenceRate = scan(findNALUnitStartReference, frame, reps, referenceNals);
+
+    LOGI("[startcodebench]={ \"Frame\":\"%s\", \"Bytes\":%lu, \"NALs\":%u, "
+         "\"VectorMBps\":%.1f, \"ReferenceMBps\":%.1f, \"Speedup\":%.2f }",
+         name, (unsigned long)frame.size(), vectorNals, vectorRate,
+         referenceRate, referenceRate > 0 ? vectorRate / referenceRate : 0.0);
+
+    if (vectorNals != referenceNals)
+    {
+        LOGE("%s: findNALUnitStart found %u NAL units, the reference %u",
+             name, vectorNals, referenceNals);
+        return false;
+    }
+    return true;
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Times findNALUnitStart against findNALUnitStartReference on\n"
+           "synthesized 1 to 5 MB IDR frames, or on an Annex-B file.\n"
+           "\n"
+           "  -f <file>     scan this Annex-B file instead\n"
+           "  -r <reps>     passes over each frame (default 20)\n"
+           "  -n <slices>   slices per synthesized frame (default 8)\n"
+           "  -z <percent>  payload bytes forced to zero (default 12)\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL;
+    uint32_t reps = 20;
+    uint32_t slices = 8;
+    uint32_t zeroPercent = 12;
+
+    int count = 1;
+    while (count < argc)
+    {
+        const char *arg = argv[count++];
+        bool hasValue = count < argc;
+        if (strcmp(arg, "-f") == 0 && hasValue)
+        {
+            path = argv[count++];
+        }
+        else if (strcmp(arg, "-r") == 0 && hasValue)
+        {
+            reps = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-n") == 0 && hasValue)
+        {
+            slices = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-z") == 0 && hasValue)
+        {
+            zeroPercent = (uint32_t)atoi(argv[count++]);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (reps == 0 || slices == 0 || zeroPercent > 100)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> frame;
+    if (path != NULL)
+    {
+        if (!readFile(path, frame))
+        {
+            return 1;
+        }
+        return bench(path, frame, reps) ? 0 : 1;
+    }
+
+    Random random(1);
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(FRAME_SIZES_MB) / sizeof(FRAME_SIZES_MB[0]); i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "idr-%umb", FRAME_SIZES_MB[i]);
+        buildIDRFrame(frame, FRAME_SIZES_MB[i] << 20, slices, zeroPercent, random);
+        ok = bench(name, frame, reps) && ok;
+    }
+    return ok ? 0 : 1;
+}
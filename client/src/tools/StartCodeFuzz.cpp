@@ -0,0 +1,250 @@
+/*
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights
+ * Reserved.
+ *
+ * Licensed under the Amazon Software License (the "License"). You may
+ * not use this file except in compliance with the License. A copy of
+ * the License is located at
+ *
+ * http://aws.amazon.com/asl/
+ *
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES
+ * OR CONDITIONS OF ANY KIND, express or implied. See the License for
+ * the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "NALUtils.h"
+
+#undef LOG_TAG
+#define LOG_TAG "AppStreamStartCodeFuzz"
+#include "log.h"
+
+/** Extra bytes allocated so buffers can start at any alignment */
+static const uint32_t MAX_MISALIGNMENT = 64;
+
+/** Mismatches reported before giving up */
+static const uint32_t MAX_REPORTED_MISMATCHES = 10;
+
+/**
+ * xorshift32; the same seed gives the same inputs on every platform, so
+ * a failure can be reproduced with -s.
+ */
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : mState(seed != 0 ? seed : 1) { }
+
+    uint32_t next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+    /** @return a value in [0, range) */
+    uint32_t below(uint32_t range)
+    {
+        return range > 0 ? next() % range : 0;
+    }
+
+private:
+    uint32_t mState;
+};
+
+/** Kinds of buffer content, chosen to hit every branch of the scanners */
+enum EContent
+{
+    /** Uniformly random bytes; start codes are rare */
+    CONTENT_RANDOM,
+    /** Mostly 00 and 01 bytes, so partial start codes are everywhere */
+    CONTENT_ZERO_HEAVY,
+    /** Only 00, 01 and 03, as around emulation prevention */
+    CONTENT_SMALL_VALUES,
+    /** Random payload with 3 and 4 byte start codes dropped in */
+    CONTENT_START_CODES,
+    /** Long runs of zeros, some ending in 01 */
+    CONTENT_ZERO_RUNS,
+    CONTENT_COUNT
+};
+
+static void fill(Random &random, uint8_t *data, uint32_t size, EContent content)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        uint32_t r = random.below(100);
+        switch (content)
+        {
+        case CONTENT_ZERO_HEAVY:
+            data[i] = r < 40 ? 0 : (r < 60 ? 1 : (uint8_t)random.next());
+            break;
+        case CONTENT_SMALL_VALUES:
+            data[i] = r < 70 ? 0 : (r < 85 ? 1 : 3);
+            break;
+        case CONTENT_ZERO_RUNS:
+            data[i] = r < 95 ? 0 : (r < 98 ? 1 : (uint8_t)random.next());
+            break;
+        default:
+            data[i] = (uint8_t)random.next();
+            break;
+        }
+    }
+
+    if (content == CONTENT_START_CODES && size >= 4)
+    {
+        uint32_t codes = 1 + size / 64;
+        for (uint32_t i = 0; i < codes; i++)
+        {
+            uint32_t at = random.below(size - 3);
+            bool longCode = random.below(2) != 0 && at + 4 <= size;
+            data[at] = 0;
+            data[at + 1] = 0;
+            data[at + 2] = longCode ? 0 : 1;
+            if (longCode)
+            {
+                data[at + 3] = 1;
+            }
+        }
+    }
+}
+
+/**
+ * Compare the scanners on [start, end), both for one call and for
+ * walking every NAL unit to the end.
+ *
+ * @return false if they disagree
+ */
+static bool compare(uint8_t *base, uint8_t *start, uint8_t *end,
+                    uint64_t &checks)
+{
+    uint8_t *vector = start;
+    uint8_t *reference = start;
+    for (;;)
+    {
+        uint8_t vectorHeader = 0xff;
+        uint8_t referenceHeader = 0xff;
+        vector = findNALUnitStart(vector, end, vectorHeader);
+        reference = findNALUnitStartReference(reference, end, referenceHeader);
+        checks++;
+
+        if (vector != reference ||
+            (vector != NULL && vectorHeader != referenceHeader))
+        {
+            LOGE("Mismatch on [%ld, %ld): vector %ld/%u, reference %ld/%u",
+                 (long)(start - base), (long)(end - base),
+                 vector != NULL ? (long)(vector - base) : -1L, vectorHeader,
+                 reference != NULL ? (long)(reference - base) : -1L,
+                 referenceHeader);
+            return false;
+        }
+        if (vector == NULL)
+        {
+            return true;
+        }
+    }
+}
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "\n"
+           "Checks that the vectorized findNALUnitStart returns exactly what\n"
+           "findNALUnitStartReference does, on random buffers of every\n"
+           "alignment and on every window near their ends.\n"
+           "\n"
+           "  -n <count>  buffers to generate (default 20000)\n"
+           "  -s <seed>   random seed (default 1)\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t iterations = 20000;
+    uint32_t seed = 1;
+
+    int count = 1;
+    while (count < argc)
+    {
+        const char *arg = argv[count++];
+        bool hasValue = count < argc;
+        if (strcmp(arg, "-n") == 0 && hasValue)
+        {
+            iterations = (uint32_t)atoi(argv[count++]);
+        }
+        else if (strcmp(arg, "-s") == 0 && hasValue)
+        {
+            seed = (uint32_t)strtoul(argv[count++], NULL, 10);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    Random random(seed);
+    std::vector<uint8_t> buffer;
+    uint64_t checks = 0;
+    uint32_t mismatches = 0;
+
+    for (uint32_t i = 0; i < iterations && mismatches < MAX_REPORTED_MISMATCHES; i++)
+    {
+        // Mostly short buffers, where the boundary handling is; some long
+        // enough to run the vector loop for a while
+        uint32_t r = random.below(100);
+        uint32_t size = r < 70 ? random.below(200) :
+                        (r < 99 ? random.below(2048) : random.below(16384));
+        uint32_t offset = random.below(MAX_MISALIGNMENT);
+        EContent content = (EContent)random.below(CONTENT_COUNT);
+
+        buffer.assign(size + MAX_MISALIGNMENT + 1, 0xff);
+        uint8_t *base = &buffer[offset];
+        fill(random, base, size, content);
+
+        // Every start and end within 8 bytes of the edges of the buffer,
+        // where the vector loop hands over to the tail. Long buffers only
+        // get the windows that start or end at an edge, to keep the run
+        // short.
+        for (uint32_t s = 0; s <= size && s < 8; s++)
+        {
+            for (uint32_t e = size; e >= s && e + 8 > size; e--)
+            {
+                if (size >= 2048 && s != 0 && e != size)
+                {
+                    continue;
+                }
+                if (!compare(base, base + s, base + e, checks))
+                {
+                    mismatches++;
+                }
+                if (e == 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        // And a few windows anywhere
+        for (int w = 0; w < 4 && size > 0; w++)
+        {
+            uint32_t s = random.below(size);
+            uint32_t e = s + random.below(size - s + 1);
+            if (!compare(base, base + s, base + e, checks))
+            {
+                mismatches++;
+            }
+        }
+    }
+
+    LOGI("[startcodefuzz]={ \"Seed\":%u, \"Buffers\":%u, \"Checks\":%llu, "
+         "\"Mismatches\":%u }",
+         seed, iterations, (unsigned long long)checks, mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,447 @@
+/** 
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * 
+ * Licensed under the Amazon Software License (the "License"). You may not
+ * use this file except in compliance with the License. A copy of the License
+ *  is located at
+ * 
+ *       http://aws.amazon.com/asl/  
+ *        
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR 
+ * CONDITIONS OF ANY KIND, express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#ifndef _MUD_SLAB_ARENA_H_
+#define _MUD_SLAB_ARENA_H_
+
+/**
+ * One contiguous block of memory carved into equal, aligned slots, so that
+ * every element of a FixedSizePool lives in the same few pages instead of
+ * in separate heap allocations. The block can be touched up front so that
+ * the first use of a slot never page faults, locked so that it is never
+ * paged out, and backed by huge pages where the platform has them.
+ *
+ * A FixedSizePool::Allocator owns an arena, sizes it for the pool in its
+ * constructor and hands out slots from allocate(). Not thread safe:
+ * FixedSizePool only calls its allocator under its own lock.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../base/Uncopyable.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(MAP_ANONYMOUS)
+#define MUD_SLAB_MAP_ANONYMOUS MAP_ANONYMOUS
+#elif defined(MAP_ANON)
+#define MUD_SLAB_MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+namespace mud 
+{
+
+class SlabArena : private Uncopyable
+{
+public:
+
+    /**
+     * Options for init(). flagsFromEnvironment() reads them from
+     * XSTX_POOL_PREFAULT (default on), XSTX_POOL_MLOCK (default off) and
+     * XSTX_POOL_HUGE_PAGES (default on); set one to 0 or 1 to override.
+     */
+    enum EFlags
+    {
+        /** Touch every page so it is mapped before the first slot is used */
+        FLAG_PREFAULT = 1,
+        /** Lock the pages in memory; needs RLIMIT_MEMLOCK or a big enough
+            working set on Windows */
+        FLAG_LOCK = 2,
+        /** Back the block with huge pages, or advise the kernel to */
+        FLAG_HUGE_PAGES = 4
+    };
+
+    /** Default slot alignment; one cache line */
+    static const size_t DEFAULT_ALIGNMENT = 64;
+
+    SlabArena()
+        : mBlock(NULL)
+        , mBlockSize(0)
+        , mSlotSize(0)
+        , mSlotCount(0)
+        , mFreeList(NULL)
+        , mFreeSlots(0)
+        , mMapped(false)
+        , mLocked(false)
+        , mHugePages(false)
+    {
+    }
+
+    ~SlabArena()
+    {
+        release();
+    }
+
+    /**
+     * Reserve the block. Any previous block is released, so every slot
+     * must have been handed back first.
+     *
+     * @param[in] slotSize bytes in each slot; rounded up to alignment
+     * @param[in] slotCount number of slots
+     * @param[in] flags EFlags to apply
+     * @param[in] alignment power of two each slot is aligned to
+     * @return true on success. Failing to lock the pages or to get huge
+     *         pages is not an error; see isLocked() and usesHugePages().
+     */
+    bool init(size_t slotSize, uint32_t slotCount,
+              uint32_t flags = FLAG_PREFAULT | FLAG_HUGE_PAGES,
+              size_t alignment = DEFAULT_ALIGNMENT)
+    {
+        release();
+        if (slotSize == 0 || slotCount == 0 ||
+            alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+        {
+            return false;
+        }
+        size_t stride = (slotSize + alignment - 1) & ~(alignment - 1);
+        if (stride / alignment > ((size_t)-1 / alignment) / slotCount)
+        {
+            return false;
+        }
+        size_t size = stride * slotCount;
+
+        if (!reserve(size, flags, alignment))
+        {
+            return false;
+        }
+        if (flags & FLAG_PREFAULT)
+        {
+            prefault();
+        }
+        if (flags & FLAG_LOCK)
+        {
+            lockPages();
+        }
+
+        mSlotSize = stride;
+        mSlotCount = slotCount;
+        mFreeList = NULL;
+        // Thread the free list back to front so slots go out in address order
+        for (uint32_t i = slotCount; i > 0; --i)
+        {
+            void **slot = reinterpret_cast<void **>(
+                mBlock + (size_t)(i - 1) * stride);
+            *slot = mFreeList;
+            mFreeList = slot;
+        }
+        mFreeSlots = slotCount;
+        return true;
+    }
+
+    /**
+     * Unlock and free the block. Every slot must have been handed back.
+     */
+    void release()
+    {
+        if (mBlock == NULL)
+        {
+            return;
+        }
+#if defined(_WIN32)
+        if (mLocked)
+        {
+            VirtualUnlock(mBlock, mBlockSize);
+        }
+        if (mMapped)
+        {
+            VirtualFree(mBlock, 0, MEM_RELEASE);
+        }
+        else
+        {
+            _aligned_free(mBlock);
+        }
+#else
+        if (mLocked)
+        {
+            munlock(mBlock, mBlockSize);
+        }
+        if (mMapped)
+        {
+            munmap(mBlock, mBlockSize);
+        }
+        else
+        {
+            free(mBlock);
+        }
+#endif
+        mBlock = NULL;
+        mBlockSize = 0;
+        mSlotSize = 0;
+        mSlotCount = 0;
+        mFreeList = NULL;
+        mFreeSlots = 0;
+        mMapped = false;
+        mLocked = false;
+        mHugePages = false;
+    }
+
+    /**
+     * @return a free slot of getSlotSize() bytes, or NULL if every slot is
+     *         in use or the arena was never initialized. The contents are
+     *         undefined.
+     */
+    void *allocate()
+    {
+        if (mFreeList == NULL)
+        {
+            return NULL;
+        }
+        void **slot = static_cast<void **>(mFreeList);
+        mFreeList = *slot;
+        --mFreeSlots;
+        return slot;
+    }
+
+    /**
+     * Hand a slot back.
+     *
+     * @param[in] slot a slot from allocate()
+     * @return false, leaving the slot alone, if it did not come from this
+     *         arena; the caller allocated it some other way.
+     */
+    bool deallocate(void *slot)
+    {
+        if (!owns(slot))
+        {
+            return false;
+        }
+        *static_cast<void **>(slot) = mFreeList;
+        mFreeList = slot;
+        ++mFreeSlots;
+        return true;
+    }
+
+    /**
+     * @return true if the pointer lies inside the block
+     */
+    bool owns(const void *pointer) const
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(pointer);
+        return mBlock != NULL && p >= mBlock &&
+            p < mBlock + (size_t)mSlotCount * mSlotSize;
+    }
+
+    /** @return bytes in each slot, after alignment */
+    size_t getSlotSize() const { return mSlotSize; }
+
+    /** @return number of slots */
+    uint32_t getSlotCount() const { return mSlotCount; }
+
+    /** @return number of slots not handed out */
+    uint32_t getFreeSlots() const { return mFreeSlots; }
+
+    /** @return bytes reserved for the block, including rounding */
+    size_t getBlockSize() const { return mBlockSize; }
+
+    /** @return true if the pages are locked in memory */
+    bool isLocked() const { return mLocked; }
+
+    /** @return true if the block is on huge pages, or advised to be */
+    bool usesHugePages() const { return mHugePages; }
+
+    /**
+     * @return the EFlags selected by the XSTX_POOL_* environment variables
+     */
+    static uint32_t flagsFromEnvironment()
+    {
+        uint32_t flags = 0;
+        if (envFlag("XSTX_POOL_PREFAULT", true))
+        {
+            flags |= FLAG_PREFAULT;
+        }
+        if (envFlag("XSTX_POOL_MLOCK", false))
+        {
+            flags |= FLAG_LOCK;
+        }
+        if (envFlag("XSTX_POOL_HUGE_PAGES", true))
+        {
+            flags |= FLAG_HUGE_PAGES;
+        }
+        return flags;
+    }
+
+private:
+
+    /** Huge page size assumed where the platform can't be asked */
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    static bool envFlag(const char *name, bool defaultValue)
+    {
+        const char *value = getenv(name);
+        if (value == NULL || *value == '\0')
+        {
+            return defaultValue;
+        }
+        return atoi(value) != 0;
+    }
+
+    static size_t roundUp(size_t size, size_t granularity)
+    {
+        return (size + granularity - 1) / granularity * granularity;
+    }
+
+    static size_t pageSize()
+    {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        long size = sysconf(_SC_PAGESIZE);
+        return size > 0 ? (size_t)size : 4096;
+#endif
+    }
+
+    /**
+     * Get the block from the OS: explicit huge pages if asked for and
+     * available, else ordinary pages. Mapped pages are page aligned, which
+     * covers any slot alignment up to a page.
+     */
+    bool reserve(size_t size, uint32_t flags, size_t alignment)
+    {
+        size_t page = pageSize();
+#if defined(_WIN32)
+        if (flags & FLAG_HUGE_PAGES)
+        {
+            // Needs SeLockMemoryPrivilege; without it this simply fails
+            size_t largePage = GetLargePageMinimum();
+            if (largePage > 0)
+            {
+                size_t hugeSize = roundUp(size, largePage);
+                mBlock = static_cast<uint8_t *>(VirtualAlloc(NULL, hugeSize,
+                    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                    PAGE_READWRITE));
+                if (mBlock != NULL)
+                {
+                    mBlockSize = hugeSize;
+                    mMapped = true;
+                    mHugePages = true;
+                    return true;
+                }
+            }
+        }
+        if (alignment <= page)
+        {
+            size_t mappedSize = roundUp(size, page);
+            mBlock = static_cast<uint8_t *>(VirtualAlloc(NULL, mappedSize,
+                MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+            if (mBlock != NULL)
+            {
+                mBlockSize = mappedSize;
+                mMapped = true;
+                return true;
+            }
+        }
+        mBlock = static_cast<uint8_t *>(_aligned_malloc(size, alignment));
+#else
+#if defined(MUD_SLAB_MAP_ANONYMOUS)
+#if defined(MAP_HUGETLB)
+        if ((flags & FLAG_HUGE_PAGES) && size >= HUGE_PAGE_SIZE / 2)
+        {
+            // Only succeeds if the administrator reserved huge pages
+            size_t hugeSize = roundUp(size, HUGE_PAGE_SIZE);
+            void *block = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MUD_SLAB_MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (block != MAP_FAILED)
+            {
+                mBlock = static_cast<uint8_t *>(block);
+                mBlockSize = hugeSize;
+                mMapped = true;
+                mHugePages = true;
+                return true;
+            }
+        }
+#endif
+        if (alignment <= page)
+        {
+            size_t mappedSize = roundUp(size, page);
+            void *block = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MUD_SLAB_MAP_ANONYMOUS, -1, 0);
+            if (block != MAP_FAILED)
+            {
+                mBlock = static_cast<uint8_t *>(block);
+                mBlockSize = mappedSize;
+                mMapped = true;
+#if defined(MADV_HUGEPAGE)
+                // Transparent huge pages can only back whole aligned
+                // huge pages, so small blocks aren't worth the advice
+                if ((flags & FLAG_HUGE_PAGES) && mappedSize >= HUGE_PAGE_SIZE &&
+                    madvise(block, mappedSize, MADV_HUGEPAGE) == 0)
+                {
+                    mHugePages = true;
+                }
+#endif
+                return true;
+            }
+        }
+#endif
+        void *block = NULL;
+        if (posix_memalign(&block, alignment, size) != 0)
+        {
+            block = NULL;
+        }
+        mBlock = static_cast<uint8_t *>(block);
+#endif
+        if (mBlock == NULL)
+        {
+            return false;
+        }
+        mBlockSize = size;
+        mMapped = false;
+        return true;
+    }
+
+    /**
+     * Write to every page so that the OS maps it now rather than on the
+     * first access from a latency sensitive thread.
+     */
+    void prefault()
+    {
+        size_t page = mHugePages && mMapped ? HUGE_PAGE_SIZE : pageSize();
+        volatile uint8_t *p = mBlock;
+        for (size_t offset = 0; offset < mBlockSize; offset += page)
+        {
+            p[offset] = 0;
+        }
+        p[mBlockSize - 1] = 0;
+    }
+
+    void lockPages()
+    {
+#if defined(_WIN32)
+        mLocked = VirtualLock(mBlock, mBlockSize) != 0;
+#else
+        mLocked = mlock(mBlock, mBlockSize) == 0;
+#endif
+    }
+
+    uint8_t *mBlock;
+    size_t mBlockSize;
+    size_t mSlotSize;
+    uint32_t mSlotCount;
+    void *mFreeList;
+    uint32_t mFreeSlots;
+    bool mMapped;
+    bool mLocked;
+    bool mHugePages;
+};
+
+} // namespace mud
+
+#endif // _MUD_SLAB_ARENA_H_
@@ -0,0 +1,244 @@
+/** 
+ * Copyright 2013-2014 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * 
+ * Licensed under the Amazon Software License (the "License"). You may not
+ * use this file except in compliance with the License. A copy of the License
+ *  is located at
+ * 
+ *       http://aws.amazon.com/asl/  
+ *        
+ * This Software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR 
+ * CONDITIONS OF ANY KIND, express or implied. See the License for the specific
+ * language governing permissions and limitations under the License.
+ */
+
+#ifndef _MUD_SPSC_RING_BUFFER_H_
+#define _MUD_SPSC_RING_BUFFER_H_
+
+/**
+ * Wait-free ring buffer of plain values for exactly one producer thread and
+ * one consumer thread, such as a decoder thread feeding an audio callback.
+ * Neither side ever takes a lock, allocates or makes a system call, so the
+ * consumer may run in a real-time context.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../base/Uncopyable.h"
+#include "AmazonCompositeResult/SimpleResultCodes.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace mud 
+{
+
+template< class ElementType >
+class SpscRingBuffer : private Uncopyable
+{
+public:
+
+    SpscRingBuffer()
+        : mBuffer(NULL)
+        , mMask(0)
+        , mWriteIndex(0)
+        , mReadIndex(0)
+    {
+    }
+
+    ~SpscRingBuffer()
+    {
+        free(mBuffer);
+    }
+
+    /**
+     * Allocate the buffer. Not thread safe; call before either side starts.
+     *
+     * @param[in] capacity the number of elements the buffer can hold,
+     *            rounded up to a power of two.
+     * @return SIMPLE_RESULT_OK on success,
+     *         SIMPLE_RESULT_INVALID if capacity is 0 or too large,
+     *         SIMPLE_RESULT_NO_MEMORY otherwise.
+     */
+    int allocate(uint32_t capacity)
+    {
+        if (capacity == 0 || capacity > 0x80000000u)
+        {
+            return SIMPLE_RESULT_INVALID;
+        }
+        uint32_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        free(mBuffer);
+        mBuffer = static_cast<ElementType *>(malloc(size * sizeof(ElementType)));
+        mMask = 0;
+        mWriteIndex = 0;
+        mReadIndex = 0;
+        if (mBuffer == NULL)
+        {
+            return SIMPLE_RESULT_NO_MEMORY;
+        }
+        mMask = size - 1;
+        return SIMPLE_RESULT_OK;
+    }
+
+    /**
+     * Empty the buffer. Not thread safe; call while neither side is running.
+     */
+    void reset()
+    {
+        mWriteIndex = 0;
+        mReadIndex = 0;
+    }
+
+    /**
+     * @return the number of elements the buffer can hold
+     */
+    uint32_t capacity() const
+    {
+        return mBuffer == NULL ? 0 : mMask + 1;
+    }
+
+    /**
+     * @return the number of elements that can be read. Exact on the consumer
+     *         side; a lower bound anywhere else.
+     */
+    uint32_t readAvailable() const
+    {
+        return loadAcquire(&mWriteIndex) - loadAcquire(&mReadIndex);
+    }
+
+    /**
+     * @return the number of elements that can be written. Exact on the
+     *         producer side; a lower bound anywhere else.
+     */
+    uint32_t writeAvailable() const
+    {
+        return capacity() - readAvailable();
+    }
+
+    /**
+     * Copy elements into the buffer. Producer side only.
+     *
+     * @param[in] data the elements to copy
+     * @param[in] count the number of elements to copy
+     * @return the number of elements copied; less than count if the buffer
+     *         filled up.
+     */
+    uint32_t write(const ElementType *data, uint32_t count)
+    {
+        uint32_t writeIndex = mWriteIndex;
+        uint32_t space = capacity() - (writeIndex - loadAcquire(&mReadIndex));
+        if (count > space)
+        {
+            count = space;
+        }
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        uint32_t start = writeIndex & mMask;
+        uint32_t first = mMask + 1 - start;
+        if (first > count)
+        {
+            first = count;
+        }
+        memcpy(mBuffer + start, data, first * sizeof(ElementType));
+        memcpy(mBuffer, data + first, (count - first) * sizeof(ElementType));
+
+        // Publish the elements only once they are in place
+        storeRelease(&mWriteIndex, writeIndex + count);
+        return count;
+    }
+
+    /**
+     * Copy elements out of the buffer. Consumer side only.
+     *
+     * @param[out] data where to copy the elements
+     * @param[in] count the number of elements wanted
+     * @return the number of elements copied; less than count if the buffer
+     *         ran empty.
+     */
+    uint32_t read(ElementType *data, uint32_t count)
+    {
+        uint32_t readIndex = mReadIndex;
+        uint32_t available = loadAcquire(&mWriteIndex) - readIndex;
+        if (count > available)
+        {
+            count = available;
+        }
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        uint32_t start = readIndex & mMask;
+        uint32_t first = mMask + 1 - start;
+        if (first > count)
+        {
+            first = count;
+        }
+        memcpy(data, mBuffer + start, first * sizeof(ElementType));
+        memcpy(data + first, mBuffer, (count - first) * sizeof(ElementType));
+
+        // Hand the space back only once the elements are copied out
+        storeRelease(&mReadIndex, readIndex + count);
+        return count;
+    }
+
+private:
+
+    /** Bytes that keep the two indices on separate cache lines */
+    static const size_t CACHE_LINE_SIZE = 64;
+
+#if defined(_MSC_VER)
+    // On x86 and x64 plain loads and stores already have acquire and
+    // release semantics; only the compiler must be kept from reordering.
+    static uint32_t loadAcquire(const volatile uint32_t *index)
+    {
+        uint32_t value = *index;
+        _ReadWriteBarrier();
+        return value;
+    }
+
+    static void storeRelease(volatile uint32_t *index, uint32_t value)
+    {
+        _ReadWriteBarrier();
+        *index = value;
+    }
+#else
+    static uint32_t loadAcquire(const volatile uint32_t *index)
+    {
+        return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+    }
+
+    static void storeRelease(volatile uint32_t *index, uint32_t value)
+    {
+        __atomic_store_n(index, value, __ATOMIC_RELEASE);
+    }
+#endif
+
+    ElementType *mBuffer;
+    uint32_t mMask;
+
+    /**
+     * Free-running positions; they wrap at 2^32, which the power of two
+     * capacity divides. Only the producer writes mWriteIndex and only the
+     * consumer writes mReadIndex.
+     */
+    char mPad0[CACHE_LINE_SIZE];
+    volatile uint32_t mWriteIndex;
+    char mPad1[CACHE_LINE_SIZE];
+    volatile uint32_t mReadIndex;
+    char mPad2[CACHE_LINE_SIZE];
+};
+
+} // namespace mud
+
+#endif // _MUD_SPSC_RING_BUFFER_H_
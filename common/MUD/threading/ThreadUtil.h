@@ -48,11 +48,27 @@ public:
      */
     static void sleep( unsigned long milliseconds );
 
+    /**
+     * Sleeps until an absolute time on the TimeVal::mono() clock. Sleeping
+     * to absolute deadlines keeps a periodic loop from drifting by the
+     * amount it oversleeps each time. On Linux this is clock_nanosleep
+     * with TIMER_ABSTIME; elsewhere the remaining time is slept.
+     * @param monoDeadline the time to wake up at; returns at once if it
+     *     has passed.
+     */
+    static void sleepUntil( const TimeVal& monoDeadline );
+
     /**
      * Yields the CPU to other threads.
      */
     static void yield( );
 
+    /**
+     * Get the number of processors currently online.
+     * @return the processor count, at least 1.
+     */
+    static uint32_t getProcessorCount( );
+
     /**
      * Attempts to sleep with better accuracy then 'sleep'.
      * This is done by only yielding the CPU for sleep amounts 
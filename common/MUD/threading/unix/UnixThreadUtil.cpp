@@ -14,6 +14,8 @@
 
 #include <unistd.h>
 #include <sched.h>
+#include <errno.h>
+#include <time.h>
 
 #include "../ThreadUtil.h"
 
@@ -32,7 +34,40 @@ void ThreadUtil::sleep( unsigned long milliseconds )
     usleep( milliseconds * 1000 );
 }
 
+void ThreadUtil::sleepUntil( const TimeVal& monoDeadline )
+{
+#if defined(__linux__) && !defined(ANDROID)
+    // mono() reads CLOCK_MONOTONIC here
+    struct timespec deadline;
+    deadline.tv_sec = (time_t)monoDeadline.toSeconds();
+    deadline.tv_nsec = (long)(monoDeadline.toMicroSeconds() % 1000000ULL) * 1000L;
+    while (clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL )
+           == EINTR)
+    {
+    }
+#else
+    TimeVal now = TimeVal::mono();
+    if (now >= monoDeadline)
+    {
+        return;
+    }
+    uint64_t remaining = monoDeadline.toMicroSeconds() - now.toMicroSeconds();
+    struct timespec request;
+    request.tv_sec = (time_t)(remaining / 1000000ULL);
+    request.tv_nsec = (long)(remaining % 1000000ULL) * 1000L;
+    while (nanosleep( &request, &request ) == -1 && errno == EINTR)
+    {
+    }
+#endif
+}
+
 void ThreadUtil::yield( )
 {
     sched_yield( );
 }
+
+uint32_t ThreadUtil::getProcessorCount( )
+{
+    long count = sysconf( _SC_NPROCESSORS_ONLN );
+    return count > 0 ? (uint32_t)count : 1;
+}
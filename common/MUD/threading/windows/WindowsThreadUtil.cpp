@@ -33,6 +33,16 @@ void ThreadUtil::sleep( unsigned long milliseconds )
     ::Sleep( milliseconds );
 }
 
+void ThreadUtil::sleepUntil( const TimeVal& monoDeadline )
+{
+    TimeVal now = TimeVal::mono();
+    if (now < monoDeadline)
+    {
+        ::Sleep( (DWORD)((monoDeadline.toMicroSeconds() - now.toMicroSeconds())
+                         / 1000) );
+    }
+}
+
 void ThreadUtil::yield( )
 {
 
@@ -44,3 +54,10 @@ void ThreadUtil::yield( )
     SwitchToThread();  
 
 }
+
+uint32_t ThreadUtil::getProcessorCount( )
+{
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+}
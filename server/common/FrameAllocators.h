@@ -16,9 +16,11 @@
 #define FRAMEALLOCATORS_H_
 
 #include <string>
+#include <new>
 #include <assert.h>
 
 #include "MUD/memory/FixedSizePool.h"
+#include "MUD/memory/SlabArena.h"
 
 #include "XStx/common/XStxUtil.h"
 #include "XStx/common/XStxResultAPI.h"
@@ -27,6 +29,8 @@
 /**
  * Allocator for audio frame pool
  * - allocates audio frame buffer with fixed buffer size
+ * - when told how many frames the pool holds, carves each frame and its
+ *   buffer from one slot of a SlabArena instead of two heap allocations
  */
 class XStxRawAudioFrameAllocatorForPool :
     public mud::FixedSizePool< XStxRawAudioFrame >::Allocator {
@@ -36,14 +40,34 @@ public:
     /**
      * Constructor
      * @param[in] sizeInBytes size of audio frame buffer
+     * @param[in] numFrames number of frames the pool will hold; 0 to
+     *            allocate each frame on the heap
      */
-    XStxRawAudioFrameAllocatorForPool(const uint32_t sizeInBytes)
+    XStxRawAudioFrameAllocatorForPool(const uint32_t sizeInBytes,
+                                      const uint32_t numFrames = 0)
         : mSizeInBytes(sizeInBytes)
-    {}
+    {
+        if (numFrames > 0)
+        {
+            mArena.init(HEADER_SIZE + mSizeInBytes, numFrames,
+                        mud::SlabArena::flagsFromEnvironment());
+        }
+    }
 
     // allocate audio frame buffer
     XStxRawAudioFrame* allocate()
     {
+        uint8_t* slot = static_cast<uint8_t*>(mArena.allocate());
+        if (NULL != slot)
+        {
+            XStxRawAudioFrame* frame = new(slot) XStxRawAudioFrame;
+            frame->mData = slot + HEADER_SIZE;
+            frame->mBufferSize = mSizeInBytes;
+            frame->mSize = sizeof(XStxRawAudioFrame);
+            frame->mDataSize = 0;  // no data is filled yet
+            return frame;
+        }
+
         XStxRawAudioFrame* frame = new XStxRawAudioFrame;
         frame->mData = new uint8_t[mSizeInBytes];
         frame->mBufferSize = mSizeInBytes;
@@ -55,7 +79,12 @@ public:
     // free audio frame buffer
     void deallocate(XStxRawAudioFrame* frame)
     {
-        if (NULL != frame)
+        if (NULL != frame && mArena.owns(frame))
+        {
+            frame->~XStxRawAudioFrame();
+            mArena.deallocate(frame);
+        }
+        else if (NULL != frame)
         {
             delete [] frame->mData;
             delete frame;
@@ -63,8 +92,21 @@ public:
         }
     }
 
+    /**
+     * @return the arena the frames are carved from, for reporting
+     */
+    const mud::SlabArena& getArena() const
+    {
+        return mArena;
+    }
+
 private:
+    // frame header rounded up so the sample buffer stays aligned
+    static const uint32_t HEADER_SIZE =
+        (sizeof(XStxRawAudioFrame) + 15) & ~15u;
+
     uint32_t const mSizeInBytes;
+    mud::SlabArena mArena;
 };
 
 /**